@@ -9,73 +9,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fstream>	/* needed for Load/SaveBinaryFile */
+#include <chrono>
 
 #include "Atari6502.h"
 #include "RmtAtariBinaries.h"
 #include "General.h"
 #include "global.h"
-
-typedef void (* C6502_Initialise_PROC)(BYTE*);
-typedef int  (* C6502_JSR_PROC)(WORD* , BYTE* , BYTE* , BYTE* , int* );
-typedef void (* C6502_About_PROC)(char**, char**, char**);
-
-C6502_Initialise_PROC C6502_Initialise;
-C6502_JSR_PROC C6502_JSR;
-C6502_About_PROC C6502_About;
+#include "Cpu6502.h"
 
 void Atari6502_DeInit()
 {
 	g_is6502 = 0;
-
-	if (g_c6502_dll)
-	{
-		FreeLibrary(g_c6502_dll);
-		g_c6502_dll = NULL;
-	}
 	g_about6502 = "No Atari 6502 CPU emulation.";
 }
 
 int Atari6502_Init()
 {
-	if (g_c6502_dll) Atari6502_DeInit();	//just in case
-
-	g_c6502_dll=LoadLibrary("sa_c6502.dll");
-	if(!g_c6502_dll)
-	{
-		MessageBox(g_hwnd,"Warning:\n'sa_c6502.dll' library not found.\nTherefore, the Atari sound routines can't be performed.","LoadLibrary error",MB_ICONEXCLAMATION);
-		Atari6502_DeInit();
-		return 1;
-	}
-
-	CString wrn="";
-
-	C6502_Initialise = (C6502_Initialise_PROC) GetProcAddress(g_c6502_dll,"C6502_Initialise");
-	if(!C6502_Initialise) wrn +="C6502_Initialise\n";
-
-	C6502_JSR = (C6502_JSR_PROC) GetProcAddress(g_c6502_dll,"C6502_JSR");
-	if(!C6502_JSR) wrn +="C6502_JSR\n";
-
-	C6502_About = (C6502_About_PROC) GetProcAddress(g_c6502_dll,"C6502_About");
-	if(!C6502_About) wrn +="C6502_About\n";
-
-	if (wrn!="")
-	{
-		MessageBox(g_hwnd,"Error:\n'sa_c6502.dll' is not compatible.\nTherefore, the Atari sound routines can't be performed.\nIncompatibility with:" +wrn,"C6502 library error",MB_ICONEXCLAMATION);
-		Atari6502_DeInit();
-		return 1;
-	}
+	if (g_is6502) Atari6502_DeInit();	//just in case
 
 	//Text for About dialog
-	if (g_c6502_dll)
-	{
-		char *name, *author, *description;
-		C6502_About(&name,&author,&description);
-		g_about6502.Format("%s\n%s\n%s",name,author,description);
-	}
-
-	C6502_Initialise(g_atarimem);
+	char *name, *author, *description;
+	C6502_About(&name,&author,&description);
+	g_about6502.Format("%s\n%s\n%s",name,author,description);
 
-	memset(g_atarimem, 0, 65536);
+	g_atari.Reset();
 
 	g_is6502 = 1;
 
@@ -101,81 +58,315 @@ int Atari_LoadOBX(int obx, unsigned char* mem, WORD& minadr, WORD& maxadr)
 	return LoadDataAsBinaryFile(bin, size, mem, minadr, maxadr);
 }
 
+// Every driver binary which can play a module on its own, in the order the reports list them
+const TTrackerDriver g_trackerDrivers[TRACKER_DRIVER_VARIANTS] =
+{
+	{ TRACKER_DRIVER_UNPATCHED, "Unpatched" },
+	{ TRACKER_DRIVER_PATCH3_INSTRUMENTARIUM, "Patch3 Instrumentarium" },
+	{ TRACKER_DRIVER_PATCH6, "Patch6" },
+	{ TRACKER_DRIVER_PATCH8, "Patch8" },
+	{ TRACKER_DRIVER_PATCH16, "Patch16" },
+	{ TRACKER_DRIVER_PATCH_PRINCE_OF_PERSIA, "PoP" },
+};
+
+/// <summary>
+/// Name of a driver binary, as the reports show it.
+/// </summary>
+/// <returns>NULL if the driver is not one of g_trackerDrivers</returns>
+const char* GetTrackerDriverName(int driverVersion)
+{
+	for (const TTrackerDriver& driver : g_trackerDrivers)
+	{
+		if (driver.version == driverVersion)
+			return driver.name;
+	}
+
+	return NULL;
+}
+
+CAtariEmulation::CAtariEmulation(unsigned char* memory)
+{
+	m_isMemoryOwned = !memory;
+	m_memory = memory ? memory : new unsigned char[CPU6502_MEMORY_SIZE];
+	memset(m_memory, 0, CPU6502_MEMORY_SIZE);
+	m_cpu.Initialise(m_memory);
+	m_isRMTRoutine = false;
+	m_isNtsc = false;
+	m_p3Cycles = 0;
+	m_setPokeyCycles = 0;
+	m_moduleAddr = 0;
+	m_rowAddr = 0;
+}
+
+CAtariEmulation::~CAtariEmulation()
+{
+	if (m_isMemoryOwned)
+		delete[] m_memory;
+}
+
+/// <summary>
+/// Clear the memory image and reset the 6502, the driver has to be loaded again.
+/// </summary>
+void CAtariEmulation::Reset()
+{
+	memset(m_memory, 0, CPU6502_MEMORY_SIZE);
+	m_cpu.Initialise(m_memory);
+	m_isRMTRoutine = false;
+	m_moduleAddr = 0;
+}
+
+void CAtariEmulation::Call(WORD adr, BYTE& a, BYTE& x, BYTE& y, int& cycles)
+{
+	m_cpu.Jsr(adr, a, x, y, cycles);
+}
+
 // Load RMT routine to $3400, setnoteinstrvol to $3d00, and setvol to $3e00
 // TODO: Merge with Atari_InitRMTRoutine(), except not really...
-int Atari_LoadRMTRoutines()
+int CAtariEmulation::LoadRMTRoutines(int driverVersion)
 {
 	WORD min, max;
 	int size;
 	unsigned char* bin;
 
-	switch (g_trackerDriverVersion)
+	switch (driverVersion)
 	{
 	case TRACKER_DRIVER_UNPATCHED:
 	case TRACKER_DRIVER_UNPATCHED_WITH_TUNING: 
 		bin = tracker_Unpatched; size = sizeof tracker_Unpatched; 
+		m_rowAddr = 0x3615;
 		break;
 
 	case TRACKER_DRIVER_PATCH3_INSTRUMENTARIUM:
 		bin = tracker_Patch3_Instrumentarium; size = sizeof tracker_Patch3_Instrumentarium;
+		m_rowAddr = 0x361B;
 		break;
 
 	case TRACKER_DRIVER_PATCH6:
 		bin = tracker_Patch6; size = sizeof tracker_Patch6;
+		m_rowAddr = 0x3615;
 		break;
 
 	case TRACKER_DRIVER_PATCH8:
 		bin = tracker_Patch8; size = sizeof tracker_Patch8;
+		m_rowAddr = 0x3615;
 		break;
 
 	case TRACKER_DRIVER_NONE:
 	case TRACKER_DRIVER_PATCH16:
 		bin = tracker_Patch16; size = sizeof tracker_Patch16;
+		m_rowAddr = RMTPLAYR_V_ABEAT;		// tracker_obx.h is the listing of Patch16
 		break;
 
 	case TRACKER_DRIVER_PATCH_PRINCE_OF_PERSIA:
 		bin = tracker_PatchPoP; size = sizeof tracker_PatchPoP;
+		m_rowAddr = 0x3615;
 		break;
 
 	//case TRACKER_DRIVER_NONE:
 	default:
-		g_rmtroutine = 0;
+		m_isRMTRoutine = false;
 		return 0;
 	}
 
-	g_rmtroutine = 1;
-	return LoadDataAsBinaryFile(bin, size, g_atarimem, min, max);
+	m_isRMTRoutine = true;
+	int loaded = LoadDataAsBinaryFile(bin, size, m_memory, min, max);
+	m_cpu.InvalidateCode(min, max - min + 1);
+
+	return loaded;
 }
 
 // TODO: Repurpose this function for RMT(E) Module Variables initialisation without 6502 emulation
-int Atari_InitRMTRoutine()
+int CAtariEmulation::InitRMTRoutine()
 {
-	if (!g_is6502) return 0;
-
 	//g_Tuning.init_tuning();	//input the A-4 frequency for the tuning and generate all the lookup tables needed for the player routines
 
-	WORD adr=RMT_INIT;
 	BYTE a=0, x=0x00, y=0x3f;
-	int cycles = (g_ntsc) ? MAXSCREENCYCLES_NTSC : MAXSCREENCYCLES_PAL;
-	C6502_JSR(&adr,&a,&x,&y,&cycles);			//adr,A,X,Y
-	for(int i=0; i<SONGTRACKS; i++) { g_rmtinstr[i]=-1; }
+	int cycles = GetMaxCycles();
+	Call(RMT_INIT, a, x, y, cycles);			//adr,A,X,Y
 
 	return (int)a;
 }
 
 // TODO: Repurpose this function for RMT(E) Module Playback calls without 6502 emulation
+void CAtariEmulation::PlayRMT(bool isInstruments)
+{
+	//(without SetPokey) one run of RMT routine but from rmt_p3 (wrap processing)
+	BYTE a=0, x=0, y=0;
+	int cycles = GetMaxCycles();
+	m_p3Cycles = 0;
+	if (isInstruments)
+	{
+		Call(RMT_P3, a, x, y, cycles);			//adr,A,X,Y
+		m_p3Cycles = m_cpu.GetLastCycles();
+	}
+	a=x=y=0;
+	Call(RMT_SETPOKEY, a, x, y, cycles);		//adr,A,X,Y
+	m_setPokeyCycles = m_cpu.GetLastCycles();
+}
+
+// TODO: Repurpose this function for POKEY registers Read and Write without 6502 emulation
+void CAtariEmulation::SetPokey()
+{
+	BYTE a = 0, x = 0, y = 0;
+	int cycles = GetMaxCycles();
+	Call(RMT_SETPOKEY, a, x, y, cycles);
+	m_p3Cycles = 0;
+	m_setPokeyCycles = m_cpu.GetLastCycles();
+}
+
+/// <summary>
+/// Copy a legacy RMT module into the memory image, as made by MakeModule.
+/// The tracker drivers are all assembled for Stereo, with 8 tracks in every songline, so the songlines
+/// of a Mono module are widened in place, with the 4 tracks of the second POKEY left empty.
+/// </summary>
+/// <param name="memory">64K memory holding the module</param>
+/// <param name="fromAddr">First byte of the module, its "RMT4" or "RMT8" header</param>
+/// <param name="toAddr">Last byte of the module</param>
+void CAtariEmulation::LoadModule(const unsigned char* memory, WORD fromAddr, WORD toAddr)
+{
+	memcpy(m_memory + fromAddr, memory + fromAddr, toAddr - fromAddr + 1);
+	m_cpu.InvalidateCode(fromAddr, toAddr - fromAddr + 1);
+	m_moduleAddr = fromAddr;
+
+	unsigned char* module = m_memory + fromAddr;
+	if (module[3] != '4')
+		return;
+
+	// The song is the last part of the module, so it can grow past its end
+	int song = module[14] | (module[15] << 8);
+	int lines = (toAddr + 1 - song) / 4;
+	if (song + lines * RMTPLAYR_TRACKS > RMTPLAYR_TABLES)
+		return;
+
+	// From the last songline down, so none is overwritten before it was moved
+	for (int i = lines - 1; i >= 0; i--)
+	{
+		unsigned char* line = m_memory + song + i * 4;
+		unsigned char* wide = m_memory + song + i * RMTPLAYR_TRACKS;
+		unsigned char tracks[4];
+		memcpy(tracks, line, 4);
+
+		// Goto songline: $FE, $00, then the address of the songline to go to
+		if (tracks[0] == 0xfe)
+		{
+			int target = song + ((tracks[2] | (tracks[3] << 8)) - song) / 4 * RMTPLAYR_TRACKS;
+			tracks[2] = target & 0xff;
+			tracks[3] = target >> 8;
+		}
+
+		memcpy(wide, tracks, 4);
+		memset(wide + 4, 0xff, RMTPLAYR_TRACKS - 4);
+	}
+
+	m_cpu.InvalidateCode(song, lines * RMTPLAYR_TRACKS);
+
+	module[3] = '8';
+}
+
+/// <summary>
+/// Start the loaded module from a songline, with RMT_INIT.
+/// </summary>
+/// <returns>Value returned by RMT_INIT in the accumulator</returns>
+int CAtariEmulation::InitModule(int songline)
+{
+	BYTE a = songline, x = m_moduleAddr & 0xFF, y = m_moduleAddr >> 8;
+	int cycles = GetMaxCycles();
+	Call(RMT_INIT, a, x, y, cycles);
+
+	return (int)a;
+}
+
+/// <summary>
+/// Play 1 frame of the module with RMT_PLAY, the song, the instruments and the POKEY registers all at once.
+/// Every driver begins rmt_play with a JSR to SetPokey, so RMT_SETPOKEY is called first and rmt_play then goes on past that JSR,
+/// which plays the same frame with the cycles of both parts counted on their own.
+/// </summary>
+void CAtariEmulation::PlayModule()
+{
+	BYTE a = 0, x = 0, y = 0;
+	int cycles = GetMaxCycles();
+	WORD play = m_memory[RMT_PLAY + 1] | (m_memory[RMT_PLAY + 2] << 8);
+	WORD setPokey = m_memory[RMT_SETPOKEY + 1] | (m_memory[RMT_SETPOKEY + 2] << 8);
+
+	if (m_memory[play] != 0x20 || (m_memory[play + 1] | (m_memory[play + 2] << 8)) != setPokey)
+	{
+		Call(RMT_PLAY, a, x, y, cycles);
+		m_p3Cycles = m_cpu.GetLastCycles();
+		m_setPokeyCycles = 0;
+		return;
+	}
+
+	// The registers left by SetPokey are passed on, as the JSR would
+	Call(RMT_SETPOKEY, a, x, y, cycles);
+	m_setPokeyCycles = m_cpu.GetLastCycles();
+	cycles = GetMaxCycles();
+	Call(play + 3, a, x, y, cycles);
+	m_p3Cycles = m_cpu.GetLastCycles();
+}
+
+/// <summary>
+/// Songline and row played by the last PlayModule, read back from the driver variables.
+/// The song pointer and the row counter have both moved past them by then.
+/// </summary>
+void CAtariEmulation::GetModulePosition(int& songline, int& row)
+{
+	const unsigned char* module = m_memory + m_moduleAddr;
+	int song = module[14] | (module[15] << 8);
+	int songPointer = m_memory[RMTPLAYR_P_SONG] | (m_memory[RMTPLAYR_P_SONG + 1] << 8);
+
+	// Every songline has 8 tracks once loaded, see LoadModule
+	songline = (songPointer - song) / RMTPLAYR_TRACKS - 1;
+	row = m_memory[m_rowAddr] - 1;
+
+	// Nothing was played yet
+	if (songline < 0) songline = 0;
+	if (row < 0) row = 0;
+}
+
+/// <summary>
+/// Play the loaded module as fast as possible, with nothing else done between 2 frames, to time the 6502 emulation.
+/// The module goes on from where it was, InitModule starts it again.
+/// </summary>
+/// <param name="frames">Frames to play</param>
+/// <returns>Frames played per second</returns>
+double CAtariEmulation::MeasureModuleSpeed(int frames)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < frames; i++)
+		PlayModule();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return seconds > 0.0 ? frames / seconds : 0.0;
+}
+
+// The tracker plays in g_atari, following the region and the test modes of the GUI
+int Atari_LoadRMTRoutines()
+{
+	int size = g_atari.LoadRMTRoutines(g_trackerDriverVersion);
+	g_rmtroutine = g_atari.IsRMTRoutine();
+	return size;
+}
+
+int Atari_InitRMTRoutine()
+{
+	if (!g_is6502) return 0;
+
+	g_atari.SetNtsc(g_ntsc);
+	int a = g_atari.InitRMTRoutine();
+	for(int i=0; i<SONGTRACKS; i++) { g_rmtinstr[i]=-1; }
+
+	return a;
+}
+
 void Atari_PlayRMT()
 {
 	if (!g_is6502) return;
 
-	WORD adr=RMT_P3; //(without SetPokey) one run of RMT routine but from rmt_p3 (wrap processing)
-	BYTE a=0, x=0, y=0;
-	int cycles = (g_ntsc) ? MAXSCREENCYCLES_NTSC : MAXSCREENCYCLES_PAL;
-	if (g_prove < PROVE_EDIT_AND_JAM_MODES) // this is only good for tests, this trigger prevents the RMT driver running at all, leaving only SetPokey available
-		C6502_JSR(&adr,&a,&x,&y,&cycles);			//adr,A,X,Y
-	adr=RMT_SETPOKEY;
-	a=x=y=0;
-	C6502_JSR(&adr,&a,&x,&y,&cycles);			//adr,A,X,Y
+	// this is only good for tests, this trigger prevents the RMT driver running at all, leaving only SetPokey available
+	g_atari.SetNtsc(g_ntsc);
+	g_atari.PlayRMT(g_prove < PROVE_EDIT_AND_JAM_MODES);
 }
 
 /*
@@ -190,15 +381,12 @@ void Atari_PlayRMT_P3()
 }
 */
 
-// TODO: Repurpose this function for POKEY registers Read and Write without 6502 emulation
 void Atari_SetPokey()
 {
 	if (!g_is6502) return;
 
-	WORD adr = RMT_SETPOKEY;
-	BYTE a = 0, x = 0, y = 0;
-	int cycles = (g_ntsc) ? MAXSCREENCYCLES_NTSC : MAXSCREENCYCLES_PAL;
-	C6502_JSR(&adr, &a, &x, &y, &cycles);
+	g_atari.SetNtsc(g_ntsc);
+	g_atari.SetPokey();
 }
 
 /*
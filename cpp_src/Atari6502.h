@@ -9,12 +9,13 @@
 
 //#include "Tuning.h"
 #include "tracker_obx.h"				// The ASM generated C header file
+#include "Cpu6502.h"
 
 //bass16bit low byte, bass 0C, bass 0E, clean tones 0A and 0,2,4,8, bass16bit hi byte, this might require different addresses? What is this even used for anyway?
 #define RMT_FRQTABLES	RMTPLAYR_PAGE_DISTORTION_2				
 
 #define RMT_INIT		RMTPLAYR_RASTERMUSICTRACKER
-//#define RMT_PLAY		RMTPLAYR_RASTERMUSICTRACKER+3
+#define RMT_PLAY		RMTPLAYR_RASTERMUSICTRACKER+3
 #define RMT_P3			RMTPLAYR_RASTERMUSICTRACKER+6
 //#define RMT_SILENCE		RMTPLAYR_RASTERMUSICTRACKER+9
 #define RMT_SETPOKEY	RMTPLAYR_RASTERMUSICTRACKER+12
@@ -30,6 +31,71 @@
 #define MAXSCREENCYCLES_NTSC	114*262
 #define MAXSCREENCYCLES_PAL 	114*312
 
+#define TRACKER_DRIVER_VARIANTS	6		// Driver binaries in g_trackerDrivers, the Unpatched one with tuning is the same binary
+
+typedef struct
+{
+	int version;			// One of the TRACKER_DRIVER_* binaries
+	const char* name;		// Name shown in the reports
+} TTrackerDriver;
+
+/// <summary>
+/// One emulated Atari running an RMT driver: a 64K memory image, the 6502 and the player state.
+/// Contexts share nothing, so several songs can be emulated at the same time, one context per thread.
+/// g_atari is the context of the tracker itself, running in g_atarimem.
+/// </summary>
+class CAtariEmulation
+{
+public:
+	CAtariEmulation(unsigned char* memory = NULL);
+	~CAtariEmulation();
+
+	void Reset();
+	int LoadRMTRoutines(int driverVersion);
+	int InitRMTRoutine();
+	void PlayRMT(bool isInstruments = true);
+	void SetPokey();
+
+	// A whole legacy RMT module played by the driver itself, the way it runs on the Atari
+	void LoadModule(const unsigned char* memory, WORD fromAddr, WORD toAddr);
+	int InitModule(int songline);
+	void PlayModule();
+	void GetModulePosition(int& songline, int& row);
+	double MeasureModuleSpeed(int frames);
+
+	unsigned char* GetMemory() { return m_memory; };
+	CCpu6502* GetCpu() { return &m_cpu; };
+	bool IsRMTRoutine() { return m_isRMTRoutine; };
+	void SetNtsc(bool isNtsc) { m_isNtsc = isNtsc; };
+	bool IsNtsc() { return m_isNtsc; };
+
+	// Cycles used by the last play, RMT_P3 is 0 when only RMT_SETPOKEY was called, and holds the rest of RMT_PLAY for a module
+	int GetP3Cycles() { return m_p3Cycles; };
+	int GetSetPokeyCycles() { return m_setPokeyCycles; };
+
+private:
+	unsigned char* m_memory;
+	bool m_isMemoryOwned;		// The memory image was allocated by the context, and is freed with it
+	CCpu6502 m_cpu;
+	bool m_isRMTRoutine;		// A driver was loaded, the player routines can be called
+	bool m_isNtsc;				// Every call may run for up to a whole NTSC or PAL screen
+	int m_p3Cycles;
+	int m_setPokeyCycles;
+	WORD m_moduleAddr;			// Module loaded by LoadModule, 0 if none
+	WORD m_rowAddr;				// Row counter of the loaded driver, every patch has it at its own address
+
+	CAtariEmulation(const CAtariEmulation&) = delete;
+	CAtariEmulation& operator=(const CAtariEmulation&) = delete;
+
+	void Call(WORD adr, BYTE& a, BYTE& x, BYTE& y, int& cycles);
+	int GetMaxCycles() { return m_isNtsc ? MAXSCREENCYCLES_NTSC : MAXSCREENCYCLES_PAL; };
+};
+
+extern CAtariEmulation g_atari;
+
+extern const TTrackerDriver g_trackerDrivers[TRACKER_DRIVER_VARIANTS];
+extern const char* GetTrackerDriverName(int driverVersion);
+
 //extern void Memory_Clear();
 extern int LoadBinaryBlock(std::ifstream& in,unsigned char* memory,WORD& fromadr, WORD& toadr);
 extern int LoadBinaryFile(char *fname, unsigned char *memory,WORD& minadr,WORD& maxadr);
@@ -0,0 +1,92 @@
+//
+// AudioRingBuffer.cpp
+// Lock-free single producer, single consumer ring buffer of interleaved 16-bit samples
+//
+
+#include <cstring>
+
+#include "AudioRingBuffer.h"
+
+CAudioRingBuffer::CAudioRingBuffer()
+{
+	m_mask = -1;
+	m_writePos = 0;
+	m_readPos = 0;
+}
+
+/// <summary>
+/// Allocate the buffer, this must be done before either side starts using it.
+/// </summary>
+/// <param name="capacity">Number of samples, rounded up to a power of 2</param>
+void CAudioRingBuffer::Create(int capacity)
+{
+	int size = 1;
+
+	while (size < capacity)
+		size <<= 1;
+
+	m_buffer.assign(size, 0);
+	m_mask = size - 1;
+	Clear();
+}
+
+/// <summary>
+/// Drop all the samples in the buffer, this is only safe while neither side is using it.
+/// </summary>
+void CAudioRingBuffer::Clear()
+{
+	m_writePos.store(0, std::memory_order_release);
+	m_readPos.store(0, std::memory_order_release);
+}
+
+/// <summary>
+/// Producer side: copy as many samples as there is room for.
+/// </summary>
+/// <param name="data">Samples to write</param>
+/// <param name="count">Number of samples</param>
+/// <returns>Number of samples actually written</returns>
+int CAudioRingBuffer::Write(const int16_t* data, int count)
+{
+	uint32_t writePos = m_writePos.load(std::memory_order_relaxed);
+	uint32_t readPos = m_readPos.load(std::memory_order_acquire);
+	int space = GetCapacity() - (int)(writePos - readPos);
+
+	if (count > space)
+		count = space;
+
+	int offset = writePos & m_mask;
+	int first = (count < GetCapacity() - offset) ? count : GetCapacity() - offset;
+
+	memcpy(&m_buffer[offset], data, first * sizeof(int16_t));
+	memcpy(&m_buffer[0], data + first, (count - first) * sizeof(int16_t));
+
+	m_writePos.store(writePos + count, std::memory_order_release);
+
+	return count;
+}
+
+/// <summary>
+/// Consumer side: copy as many samples as are available.
+/// </summary>
+/// <param name="data">Destination of the samples</param>
+/// <param name="count">Maximum number of samples</param>
+/// <returns>Number of samples actually read</returns>
+int CAudioRingBuffer::Read(int16_t* data, int count)
+{
+	uint32_t readPos = m_readPos.load(std::memory_order_relaxed);
+	uint32_t writePos = m_writePos.load(std::memory_order_acquire);
+	int available = (int)(writePos - readPos);
+
+	if (count > available)
+		count = available;
+
+	int offset = readPos & m_mask;
+	int first = (count < GetCapacity() - offset) ? count : GetCapacity() - offset;
+
+	memcpy(data, &m_buffer[offset], first * sizeof(int16_t));
+	memcpy(data + first, &m_buffer[0], (count - first) * sizeof(int16_t));
+
+	m_readPos.store(readPos + count, std::memory_order_release);
+
+	return count;
+}
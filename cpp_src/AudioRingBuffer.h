@@ -0,0 +1,35 @@
+//
+// AudioRingBuffer.h header file
+// Lock-free single producer, single consumer ring buffer of interleaved 16-bit samples
+// The player thread writes rendered frames into it, and the audio sink reads them back on its own schedule
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class CAudioRingBuffer
+{
+public:
+	CAudioRingBuffer();
+
+	void Create(int capacity);
+	void Clear();
+
+	int Write(const int16_t* data, int count);
+	int Read(int16_t* data, int count);
+
+	int GetCapacity() { return m_mask + 1; };
+	int GetAvailable() { return (int)(m_writePos.load(std::memory_order_acquire) - m_readPos.load(std::memory_order_acquire)); };
+	int GetFreeSpace() { return GetCapacity() - GetAvailable(); };
+
+private:
+	std::vector<int16_t> m_buffer;
+	int m_mask;
+
+	// Free-running positions, only the producer moves m_writePos and only the consumer moves m_readPos
+	std::atomic<uint32_t> m_writePos;
+	std::atomic<uint32_t> m_readPos;
+};
@@ -0,0 +1,165 @@
+//
+// AudioSink.cpp
+// Audio outputs draining the CAudioRingBuffer filled by the POKEY renderer
+//
+
+#include <cstring>
+
+#include "AudioSink.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define PIPE_MODE "wb"
+#else
+#define PIPE_MODE "w"
+#endif
+
+int CNullSink::Consume(CAudioRingBuffer& ring)
+{
+	int16_t chunk[AUDIO_SINK_CHUNK];
+	int total = 0;
+
+	while (int count = ring.Read(chunk, AUDIO_SINK_CHUNK))
+		total += count;
+
+	return total;
+}
+
+// ----------------------------------------------------------------------------
+
+CWaveSink::CWaveSink()
+{
+	m_file = NULL;
+	m_dataSize = 0;
+}
+
+CWaveSink::~CWaveSink()
+{
+	Close();
+}
+
+/// <summary>
+/// Create the WAV file, with a placeholder header until the final size is known.
+/// </summary>
+bool CWaveSink::Open(const char* filename, int sampleRate, int channels)
+{
+	Close();
+
+	if (!(m_file = fopen(filename, "wb")))
+		return false;
+
+	m_sampleRate = sampleRate;
+	m_channels = channels;
+	m_dataSize = 0;
+	WriteHeader();
+
+	return true;
+}
+
+void CWaveSink::Close()
+{
+	if (!m_file)
+		return;
+
+	// Now the data size is known, the header can be written again for real
+	fseek(m_file, 0, SEEK_SET);
+	WriteHeader();
+	fclose(m_file);
+	m_file = NULL;
+}
+
+/// <summary>
+/// Canonical 44 bytes RIFF header, all fields are little-endian.
+/// </summary>
+void CWaveSink::WriteHeader()
+{
+	uint8_t header[44];
+	uint32_t blockAlign = m_channels * sizeof(int16_t);
+	uint32_t fields[] =
+	{
+		36 + m_dataSize,					// RIFF chunk size
+		16,									// fmt chunk size
+		1 | ((uint32_t)m_channels << 16),	// PCM, channels
+		(uint32_t)m_sampleRate,
+		m_sampleRate * blockAlign,			// Bytes per second
+		blockAlign | (16 << 16),			// Block align, bits per sample
+		m_dataSize
+	};
+	const int offsets[] = { 4, 16, 20, 24, 28, 32, 40 };
+
+	memcpy(header + 0, "RIFF", 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	memcpy(header + 36, "data", 4);
+
+	for (int i = 0; i < 7; i++)
+	{
+		for (int b = 0; b < 4; b++)
+			header[offsets[i] + b] = (uint8_t)(fields[i] >> (b * 8));
+	}
+
+	fwrite(header, 1, sizeof(header), m_file);
+}
+
+int CWaveSink::Consume(CAudioRingBuffer& ring)
+{
+	int16_t chunk[AUDIO_SINK_CHUNK];
+	int total = 0;
+
+	while (int count = ring.Read(chunk, AUDIO_SINK_CHUNK))
+	{
+		if (m_file)
+			m_dataSize += (uint32_t)fwrite(chunk, sizeof(int16_t), count, m_file) * sizeof(int16_t);
+		total += count;
+	}
+
+	return total;
+}
+
+// ----------------------------------------------------------------------------
+
+CPipeSink::CPipeSink()
+{
+	m_pipe = NULL;
+}
+
+CPipeSink::~CPipeSink()
+{
+	Close();
+}
+
+bool CPipeSink::Open(const char* command, int sampleRate, int channels)
+{
+	Close();
+
+	if (!(m_pipe = popen(command, PIPE_MODE)))
+		return false;
+
+	m_sampleRate = sampleRate;
+	m_channels = channels;
+
+	return true;
+}
+
+void CPipeSink::Close()
+{
+	if (m_pipe)
+		pclose(m_pipe);
+
+	m_pipe = NULL;
+}
+
+int CPipeSink::Consume(CAudioRingBuffer& ring)
+{
+	int16_t chunk[AUDIO_SINK_CHUNK];
+	int total = 0;
+
+	while (int count = ring.Read(chunk, AUDIO_SINK_CHUNK))
+	{
+		if (m_pipe)
+			fwrite(chunk, sizeof(int16_t), count, m_pipe);
+		total += count;
+	}
+
+	return total;
+}
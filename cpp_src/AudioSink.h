@@ -0,0 +1,89 @@
+//
+// AudioSink.h header file
+// Audio outputs draining the CAudioRingBuffer filled by the POKEY renderer
+// The sinks declared here do not depend on MFC or Windows, see DirectSoundSink.h for the live output
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include "AudioRingBuffer.h"
+
+#define AUDIO_SINK_CHUNK	4096		// Samples moved from the ring buffer in one go
+
+class CAudioSink
+{
+public:
+	CAudioSink() { m_sampleRate = 0; m_channels = 0; m_underrunCount = 0; };
+	virtual ~CAudioSink() { };
+
+	// Called from the consumer side only, take whatever is available from the ring buffer
+	virtual int Consume(CAudioRingBuffer& ring) = 0;
+	virtual void Close() { };
+
+	// Real time sinks are drained from their own thread, others are drained right after every rendered frame
+	virtual bool IsRealTime() { return false; };
+
+	// Amount of sound kept queued ahead of the playback position, in samples per channel, for real time sinks only
+	virtual void SetLatency(int /*latency*/) { };
+
+	int GetSampleRate() { return m_sampleRate; };
+	int GetChannels() { return m_channels; };
+	int GetUnderrunCount() { return m_underrunCount; };
+
+protected:
+	int m_sampleRate;
+	int m_channels;
+	std::atomic<int> m_underrunCount;		// Incremented by the consumer thread, read by the player thread
+};
+
+/// <summary>
+/// Discard everything, for headless rendering and benchmarking.
+/// </summary>
+class CNullSink : public CAudioSink
+{
+public:
+	CNullSink(int sampleRate, int channels) { m_sampleRate = sampleRate; m_channels = channels; };
+	int Consume(CAudioRingBuffer& ring);
+};
+
+/// <summary>
+/// Write a 16-bit PCM WAV file, the header sizes are patched when the file is closed.
+/// </summary>
+class CWaveSink : public CAudioSink
+{
+public:
+	CWaveSink();
+	~CWaveSink();
+
+	bool Open(const char* filename, int sampleRate, int channels);
+	void Close();
+	int Consume(CAudioRingBuffer& ring);
+
+private:
+	FILE* m_file;
+	uint32_t m_dataSize;
+
+	void WriteHeader();
+};
+
+/// <summary>
+/// Write raw 16-bit PCM to the standard input of another program,
+/// for example "aplay -q -f S16_LE -c 2 -r 44100" to play through ALSA on Linux.
+/// </summary>
+class CPipeSink : public CAudioSink
+{
+public:
+	CPipeSink();
+	~CPipeSink();
+
+	bool Open(const char* command, int sampleRate, int channels);
+	void Close();
+	int Consume(CAudioRingBuffer& ring);
+
+private:
+	FILE* m_pipe;
+};
@@ -0,0 +1,571 @@
+//
+// Cpu6502.cpp
+// Built-in 6502 CPU emulation, replacing the sa_c6502.dll plugin
+//
+// The dispatch is a single switch over the opcode, which every compiler turns into a jump table,
+// with the addressing modes expanded inline by the macros below.
+// Cycle counts follow the NMOS 6502, including the page crossing and taken branch penalties.
+//
+// The code cache, switched on with SetCodeCache, runs the same switch from pre-decoded instructions instead,
+// so the straight runs of player code skip the fetch of their operands. The RMT drivers patch their own operands
+// every frame (volumes, frequencies, jump vectors), so every store checks whether it hits a decoded instruction,
+// which is then decoded again the next time it runs. Writes made by the host between 2 calls are not seen,
+// CAtariEmulation invalidates what it loads, the tracker itself runs without the cache.
+//
+// The speed is timed by CAtariEmulation::MeasureModuleSpeed, and reported in the "speed" section of the cycle profile export,
+// with and without the code cache, along with whether both played the very same frames.
+//
+
+#include "Cpu6502.h"
+
+// Base cycles of every opcode, the undocumented ones are never executed
+static const uint8_t s_cycles[256] =
+{
+	7,6,2,8,3,3,5,5,3,2,2,2,4,4,6,6,	// 0x
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// 1x
+	6,6,2,8,3,3,5,5,4,2,2,2,4,4,6,6,	// 2x
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// 3x
+	6,6,2,8,3,3,5,5,3,2,2,2,3,4,6,6,	// 4x
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// 5x
+	6,6,2,8,3,3,5,5,4,2,2,2,5,4,6,6,	// 6x
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// 7x
+	2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,	// 8x
+	2,6,2,6,4,4,4,4,2,5,2,5,5,5,5,5,	// 9x
+	2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,	// Ax
+	2,5,2,5,4,4,4,4,2,4,2,4,4,4,4,4,	// Bx
+	2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,	// Cx
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// Dx
+	2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,	// Ex
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,	// Fx
+};
+
+// Bytes of every opcode with its operand, the undocumented ones only stop the subroutine
+static const uint8_t s_lengths[256] =
+{
+	1,2,1,1,1,2,2,1,1,2,1,1,1,3,3,1,	// 0x
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// 1x
+	3,2,1,1,2,2,2,1,1,2,1,1,3,3,3,1,	// 2x
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// 3x
+	1,2,1,1,1,2,2,1,1,2,1,1,3,3,3,1,	// 4x
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// 5x
+	1,2,1,1,1,2,2,1,1,2,1,1,3,3,3,1,	// 6x
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// 7x
+	1,2,1,1,2,2,2,1,1,1,1,1,3,3,3,1,	// 8x
+	2,2,1,1,2,2,2,1,1,3,1,1,1,3,1,1,	// 9x
+	2,2,2,1,2,2,2,1,1,2,1,1,3,3,3,1,	// Ax
+	2,2,1,1,2,2,2,1,1,3,1,1,3,3,3,1,	// Bx
+	2,2,1,1,2,2,2,1,1,2,1,1,3,3,3,1,	// Cx
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// Dx
+	2,2,1,1,2,2,2,1,1,2,1,1,3,3,3,1,	// Ex
+	2,2,1,1,1,2,2,1,1,3,1,1,1,3,3,1,	// Fx
+};
+
+// Operand of the instruction, read after the opcode, or already decoded with pc moved past the instruction
+#define OPERAND_BYTE	(isCached ? (uint8_t)operand : mem[pc++])
+#define OPERAND_WORD	(isCached ? operand : (pc += 2, ReadWord(pc - 2)))
+
+// Effective address of each addressing mode, the indexed reads add 1 cycle when they cross a page
+#define EA_ZP		OPERAND_BYTE
+#define EA_ZPX		((uint8_t)(OPERAND_BYTE + m_x))
+#define EA_ZPY		((uint8_t)(OPERAND_BYTE + m_y))
+#define EA_ABS		OPERAND_WORD
+#define EA_ABSX		(base = OPERAND_WORD, (uint16_t)(base + m_x))
+#define EA_ABSY		(base = OPERAND_WORD, (uint16_t)(base + m_y))
+#define EA_INDX		(ReadWordZp((uint8_t)(OPERAND_BYTE + m_x)))
+#define EA_INDY		(base = ReadWordZp(OPERAND_BYTE), (uint16_t)(base + m_y))
+
+// A store into a decoded instruction invalidates it, the stack page is never decoded so the pushes are not watched
+#define WATCH(ea)	if (isCached && codeUse[ea]) InvalidateAt(ea)
+#define STORE(ea, value)	{ uint16_t addr = ea; mem[addr] = value; WATCH(addr); }
+#define PAGE_CROSS(ea)	(cycles -= ((base ^ (ea)) >> 8) != 0)
+
+// Instructions reading their operand, with every addressing mode they support
+#define READ_OPS(opImm, opZp, opZpx, opAbs, opAbsx, opAbsy, opIndx, opIndy, OP) \
+	case opImm: { uint8_t value = OPERAND_BYTE; OP; break; } \
+	case opZp: { uint8_t value = mem[EA_ZP]; OP; break; } \
+	case opZpx: { uint8_t value = mem[EA_ZPX]; OP; break; } \
+	case opAbs: { uint8_t value = mem[EA_ABS]; OP; break; } \
+	case opAbsx: { uint16_t ea = EA_ABSX; PAGE_CROSS(ea); uint8_t value = mem[ea]; OP; break; } \
+	case opAbsy: { uint16_t ea = EA_ABSY; PAGE_CROSS(ea); uint8_t value = mem[ea]; OP; break; } \
+	case opIndx: { uint8_t value = mem[EA_INDX]; OP; break; } \
+	case opIndy: { uint16_t ea = EA_INDY; PAGE_CROSS(ea); uint8_t value = mem[ea]; OP; break; }
+
+// Read-Modify-Write instructions, on the accumulator and in memory
+#define RMW_OPS(opAcc, opZp, opZpx, opAbs, opAbsx, OP) \
+	case opAcc: { uint8_t value = m_a; OP; m_a = value; break; } \
+	case opZp: { uint16_t ea = EA_ZP; uint8_t value = mem[ea]; OP; STORE(ea, value); break; } \
+	case opZpx: { uint16_t ea = EA_ZPX; uint8_t value = mem[ea]; OP; STORE(ea, value); break; } \
+	case opAbs: { uint16_t ea = EA_ABS; uint8_t value = mem[ea]; OP; STORE(ea, value); break; } \
+	case opAbsx: { uint16_t ea = EA_ABSX; uint8_t value = mem[ea]; OP; STORE(ea, value); break; }
+
+#define BRANCH(op, condition) \
+	case op: \
+	{ \
+		int8_t offset = (int8_t)OPERAND_BYTE; \
+		if (condition) \
+		{ \
+			base = pc; \
+			pc = (uint16_t)(pc + offset); \
+			cycles -= 1 + (((base ^ pc) >> 8) != 0); \
+		} \
+		break; \
+	}
+
+CCpu6502::CCpu6502()
+{
+	m_memory = 0;
+	m_pc = 0;
+	m_a = m_x = m_y = 0;
+	m_s = 0xFF;
+	m_n = m_c = m_v = m_d = 0;
+	m_z = 1;
+	m_i = 1;
+	m_totalCycles = 0;
+	m_lastCycles = 0;
+	m_isHalted = false;
+}
+
+/// <summary>
+/// Attach the CPU to a 64K memory image, and reset the registers.
+/// </summary>
+/// <param name="memory">Memory image, CPU6502_MEMORY_SIZE bytes</param>
+void CCpu6502::Initialise(uint8_t* memory)
+{
+	m_memory = memory;
+	m_a = m_x = m_y = 0;
+	m_s = 0xFF;
+	m_n = m_c = m_v = m_d = 0;
+	m_z = 1;
+	m_i = 1;
+	m_totalCycles = 0;
+	m_lastCycles = 0;
+	m_isHalted = false;
+
+	// The new memory image holds other code
+	SetCodeCache(IsCodeCached());
+}
+
+/// <summary>
+/// Call a subroutine, the same way as the C6502_JSR export from sa_c6502.dll.
+/// The subroutine runs until its final RTS, or until the cycle budget is spent.
+/// </summary>
+/// <param name="adr">Subroutine address, returns the address the CPU stopped at</param>
+/// <param name="a">Accumulator, in and out</param>
+/// <param name="x">X register, in and out</param>
+/// <param name="y">Y register, in and out</param>
+/// <param name="cycles">Cycle budget, returns the cycles left unused</param>
+/// <returns>true if the subroutine returned within the budget</returns>
+bool CCpu6502::Jsr(uint16_t& adr, uint8_t& a, uint8_t& x, uint8_t& y, int& cycles)
+{
+	if (!m_memory)
+		return false;
+
+	m_a = a;
+	m_x = x;
+	m_y = y;
+
+	// Return address of a JSR that never happened, its RTS brings the stack back to this level
+	uint8_t returnStack = m_s;
+	Push(0xFF);
+	Push(0xFE);
+	m_pc = adr;
+	m_isHalted = false;
+
+	int left = IsCodeCached() ? Execute<true>(cycles, returnStack) : Execute<false>(cycles, returnStack);
+	bool isReturned = !m_isHalted && m_s == returnStack;
+
+	// The stack is always balanced again, even when the subroutine did not return
+	m_s = returnStack;
+	m_lastCycles = cycles - left;
+	m_totalCycles += m_lastCycles;
+
+	adr = m_pc;
+	a = m_a;
+	x = m_x;
+	y = m_y;
+	cycles = left;
+
+	return isReturned;
+}
+
+uint8_t CCpu6502::GetP()
+{
+	return (m_n & FLAG_N) | (m_v ? FLAG_V : 0) | FLAG_U | (m_d ? FLAG_D : 0) | (m_i ? FLAG_I : 0) | (m_z ? 0 : FLAG_Z) | (m_c ? FLAG_C : 0);
+}
+
+void CCpu6502::SetP(uint8_t p)
+{
+	m_n = p & FLAG_N;
+	m_v = p & FLAG_V;
+	m_d = p & FLAG_D;
+	m_i = p & FLAG_I;
+	m_z = !(p & FLAG_Z);
+	m_c = p & FLAG_C;
+}
+
+void CCpu6502::Adc(uint8_t value)
+{
+	if (m_d)
+	{
+		// Decimal mode, with the NMOS flags: Z comes from the binary sum, N and V from the intermediate result
+		int lo = (m_a & 0x0F) + (value & 0x0F) + (m_c ? 1 : 0);
+		int hi = (m_a & 0xF0) + (value & 0xF0);
+		m_z = (uint8_t)(m_a + value + (m_c ? 1 : 0));
+
+		if (lo > 0x09)
+		{
+			hi += 0x10;
+			lo += 0x06;
+		}
+
+		m_n = (uint8_t)hi;
+		m_v = ~(m_a ^ value) & (m_a ^ hi) & 0x80;
+
+		if (hi > 0x90)
+			hi += 0x60;
+
+		m_c = hi > 0xFF;
+		m_a = (uint8_t)((lo & 0x0F) | (hi & 0xF0));
+		return;
+	}
+
+	int sum = m_a + value + (m_c ? 1 : 0);
+	m_v = ~(m_a ^ value) & (m_a ^ sum) & 0x80;
+	m_c = sum > 0xFF;
+	m_a = m_n = m_z = (uint8_t)sum;
+}
+
+void CCpu6502::Sbc(uint8_t value)
+{
+	int borrow = m_c ? 0 : 1;
+	int diff = m_a - value - borrow;
+
+	if (m_d)
+	{
+		// Decimal mode, the NMOS flags all come from the binary subtraction
+		int lo = (m_a & 0x0F) - (value & 0x0F) - borrow;
+		int hi = (m_a & 0xF0) - (value & 0xF0);
+
+		if (lo < 0)
+		{
+			lo -= 0x06;
+			hi -= 0x10;
+		}
+
+		if (hi < 0)
+			hi -= 0x60;
+
+		m_v = (m_a ^ value) & (m_a ^ diff) & 0x80;
+		m_c = diff >= 0;
+		m_n = m_z = (uint8_t)diff;
+		m_a = (uint8_t)((lo & 0x0F) | (hi & 0xF0));
+		return;
+	}
+
+	m_v = (m_a ^ value) & (m_a ^ diff) & 0x80;
+	m_c = diff >= 0;
+	m_a = m_n = m_z = (uint8_t)diff;
+}
+
+void CCpu6502::Compare(uint8_t reg, uint8_t value)
+{
+	m_c = reg >= value;
+	m_n = m_z = (uint8_t)(reg - value);
+}
+
+/// <summary>
+/// Run instructions until the subroutine returns, or the cycle budget is spent.
+/// The registers are kept in locals where it matters, and written back on exit.
+/// With the code cache, every instruction is decoded the first time it runs, and taken from m_ops from then on.
+/// </summary>
+/// <param name="cycles">Cycle budget</param>
+/// <param name="returnStack">Stack pointer once the subroutine returned</param>
+/// <returns>Cycles left, negative if the last instruction went over the budget</returns>
+template <bool isCached>
+int CCpu6502::Execute(int cycles, uint8_t returnStack)
+{
+	uint8_t* mem = m_memory;
+	TCpu6502Op* ops = m_ops.data();
+	uint8_t* codeUse = m_codeUse.data();
+	uint16_t pc = m_pc;
+	uint16_t base = 0;
+
+	while (cycles > 0)
+	{
+		uint8_t opcode;
+		uint16_t operand = 0;
+
+		if (isCached)
+		{
+			TCpu6502Op op = ops[pc];
+
+			if (!op.length)
+				op = Decode(pc);
+
+			opcode = op.opcode;
+			operand = op.operand;
+			pc += op.length;
+		}
+		else
+		{
+			opcode = mem[pc++];
+		}
+
+		cycles -= s_cycles[opcode];
+
+		switch (opcode)
+		{
+		// Loads and stores
+		READ_OPS(0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1, m_a = m_n = m_z = value)
+		case 0xA2: m_x = m_n = m_z = OPERAND_BYTE; break;
+		case 0xA6: m_x = m_n = m_z = mem[EA_ZP]; break;
+		case 0xB6: m_x = m_n = m_z = mem[EA_ZPY]; break;
+		case 0xAE: m_x = m_n = m_z = mem[EA_ABS]; break;
+		case 0xBE: { uint16_t ea = EA_ABSY; PAGE_CROSS(ea); m_x = m_n = m_z = mem[ea]; break; }
+		case 0xA0: m_y = m_n = m_z = OPERAND_BYTE; break;
+		case 0xA4: m_y = m_n = m_z = mem[EA_ZP]; break;
+		case 0xB4: m_y = m_n = m_z = mem[EA_ZPX]; break;
+		case 0xAC: m_y = m_n = m_z = mem[EA_ABS]; break;
+		case 0xBC: { uint16_t ea = EA_ABSX; PAGE_CROSS(ea); m_y = m_n = m_z = mem[ea]; break; }
+		case 0x85: STORE(EA_ZP, m_a); break;
+		case 0x95: STORE(EA_ZPX, m_a); break;
+		case 0x8D: STORE(EA_ABS, m_a); break;
+		case 0x9D: STORE(EA_ABSX, m_a); break;
+		case 0x99: STORE(EA_ABSY, m_a); break;
+		case 0x81: STORE(EA_INDX, m_a); break;
+		case 0x91: STORE(EA_INDY, m_a); break;
+		case 0x86: STORE(EA_ZP, m_x); break;
+		case 0x96: STORE(EA_ZPY, m_x); break;
+		case 0x8E: STORE(EA_ABS, m_x); break;
+		case 0x84: STORE(EA_ZP, m_y); break;
+		case 0x94: STORE(EA_ZPX, m_y); break;
+		case 0x8C: STORE(EA_ABS, m_y); break;
+
+		// Register transfers
+		case 0xAA: m_x = m_n = m_z = m_a; break;
+		case 0xA8: m_y = m_n = m_z = m_a; break;
+		case 0x8A: m_a = m_n = m_z = m_x; break;
+		case 0x98: m_a = m_n = m_z = m_y; break;
+		case 0xBA: m_x = m_n = m_z = m_s; break;
+		case 0x9A: m_s = m_x; break;
+
+		// Stack
+		case 0x48: Push(m_a); break;
+		case 0x08: Push(GetP() | FLAG_B); break;
+		case 0x68: m_a = m_n = m_z = Pull(); break;
+		case 0x28: SetP(Pull()); break;
+
+		// Logical and arithmetic
+		READ_OPS(0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31, m_a &= value; m_n = m_z = m_a)
+		READ_OPS(0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11, m_a |= value; m_n = m_z = m_a)
+		READ_OPS(0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51, m_a ^= value; m_n = m_z = m_a)
+		READ_OPS(0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71, Adc(value))
+		READ_OPS(0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1, Sbc(value))
+		READ_OPS(0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1, Compare(m_a, value))
+		case 0xE0: Compare(m_x, OPERAND_BYTE); break;
+		case 0xE4: Compare(m_x, mem[EA_ZP]); break;
+		case 0xEC: Compare(m_x, mem[EA_ABS]); break;
+		case 0xC0: Compare(m_y, OPERAND_BYTE); break;
+		case 0xC4: Compare(m_y, mem[EA_ZP]); break;
+		case 0xCC: Compare(m_y, mem[EA_ABS]); break;
+		case 0x24: { uint8_t value = mem[EA_ZP]; m_n = value; m_v = value & FLAG_V; m_z = m_a & value; break; }
+		case 0x2C: { uint8_t value = mem[EA_ABS]; m_n = value; m_v = value & FLAG_V; m_z = m_a & value; break; }
+
+		// Increments and decrements
+		case 0xE6: { uint16_t ea = EA_ZP; m_n = m_z = ++mem[ea]; WATCH(ea); break; }
+		case 0xF6: { uint16_t ea = EA_ZPX; m_n = m_z = ++mem[ea]; WATCH(ea); break; }
+		case 0xEE: { uint16_t ea = EA_ABS; m_n = m_z = ++mem[ea]; WATCH(ea); break; }
+		case 0xFE: { uint16_t ea = EA_ABSX; m_n = m_z = ++mem[ea]; WATCH(ea); break; }
+		case 0xC6: { uint16_t ea = EA_ZP; m_n = m_z = --mem[ea]; WATCH(ea); break; }
+		case 0xD6: { uint16_t ea = EA_ZPX; m_n = m_z = --mem[ea]; WATCH(ea); break; }
+		case 0xCE: { uint16_t ea = EA_ABS; m_n = m_z = --mem[ea]; WATCH(ea); break; }
+		case 0xDE: { uint16_t ea = EA_ABSX; m_n = m_z = --mem[ea]; WATCH(ea); break; }
+		case 0xE8: m_n = m_z = ++m_x; break;
+		case 0xC8: m_n = m_z = ++m_y; break;
+		case 0xCA: m_n = m_z = --m_x; break;
+		case 0x88: m_n = m_z = --m_y; break;
+
+		// Shifts and rotates
+		RMW_OPS(0x0A, 0x06, 0x16, 0x0E, 0x1E, m_c = value & 0x80; value <<= 1; m_n = m_z = value)
+		RMW_OPS(0x4A, 0x46, 0x56, 0x4E, 0x5E, m_c = value & 0x01; value >>= 1; m_n = m_z = value)
+		RMW_OPS(0x2A, 0x26, 0x36, 0x2E, 0x3E, uint8_t carry = m_c ? 0x01 : 0; m_c = value & 0x80; value = (value << 1) | carry; m_n = m_z = value)
+		RMW_OPS(0x6A, 0x66, 0x76, 0x6E, 0x7E, uint8_t carry = m_c ? 0x80 : 0; m_c = value & 0x01; value = (value >> 1) | carry; m_n = m_z = value)
+
+		// Jumps and calls
+		case 0x4C: pc = OPERAND_WORD; break;
+		case 0x6C:
+		{
+			// The NMOS 6502 never carries into the high byte of the pointer
+			uint16_t ptr = OPERAND_WORD;
+			pc = mem[ptr] | (mem[(ptr & 0xFF00) | (uint8_t)(ptr + 1)] << 8);
+			break;
+		}
+		case 0x20:
+		{
+			// The return address pushed is the last byte of the JSR
+			uint16_t target = OPERAND_WORD;
+			pc--;
+			Push(pc >> 8);
+			Push(pc & 0xFF);
+			pc = target;
+			break;
+		}
+		case 0x60:
+			pc = Pull();
+			pc |= Pull() << 8;
+			pc++;
+
+			// The final RTS, back from the subroutine called by Jsr
+			if (m_s == returnStack)
+			{
+				m_pc = pc;
+				return cycles;
+			}
+			break;
+		case 0x40:
+			SetP(Pull());
+			pc = Pull();
+			pc |= Pull() << 8;
+			break;
+		case 0x00:
+			pc++;
+			Push(pc >> 8);
+			Push(pc & 0xFF);
+			Push(GetP() | FLAG_B);
+			m_i = 1;
+			pc = ReadWord(0xFFFE);
+			break;
+
+		// Branches
+		BRANCH(0x10, !(m_n & 0x80))
+		BRANCH(0x30, m_n & 0x80)
+		BRANCH(0x50, !m_v)
+		BRANCH(0x70, m_v)
+		BRANCH(0x90, !m_c)
+		BRANCH(0xB0, m_c)
+		BRANCH(0xD0, m_z)
+		BRANCH(0xF0, !m_z)
+
+		// Status flags
+		case 0x18: m_c = 0; break;
+		case 0x38: m_c = 1; break;
+		case 0x58: m_i = 0; break;
+		case 0x78: m_i = 1; break;
+		case 0xB8: m_v = 0; break;
+		case 0xD8: m_d = 0; break;
+		case 0xF8: m_d = 1; break;
+
+		case 0xEA: break;
+
+		default:
+			// Undocumented opcode, the subroutine can not go any further
+			m_isHalted = true;
+			m_pc = pc - 1;
+			return cycles;
+		}
+	}
+
+	m_pc = pc;
+	return cycles;
+}
+
+/// <summary>
+/// Decode the instruction at pc, and keep it in m_ops, unless it is in the stack page.
+/// </summary>
+TCpu6502Op CCpu6502::Decode(uint16_t pc)
+{
+	TCpu6502Op op;
+	op.opcode = m_memory[pc];
+	op.length = s_lengths[op.opcode];
+	op.operand = (op.length == 3) ? ReadWord(pc + 1) : (op.length == 2) ? m_memory[(uint16_t)(pc + 1)] : 0;
+
+	for (int i = 0; i < op.length; i++)
+	{
+		if ((uint16_t)(pc + i) >> 8 == CPU6502_STACK >> 8)
+			return op;
+	}
+
+	m_ops[pc] = op;
+
+	for (int i = 0; i < op.length; i++)
+		m_codeUse[(uint16_t)(pc + i)]++;
+
+	return op;
+}
+
+/// <summary>
+/// Forget every decoded instruction covering a byte, they are decoded again the next time they run.
+/// </summary>
+void CCpu6502::InvalidateAt(uint16_t addr)
+{
+	// An instruction is 3 bytes at most, only the ones starting up to 2 bytes before can cover addr
+	for (int back = 2; back >= 0; back--)
+	{
+		TCpu6502Op& op = m_ops[(uint16_t)(addr - back)];
+
+		if (op.length <= back)
+			continue;
+
+		for (int i = 0; i < op.length; i++)
+			m_codeUse[(uint16_t)(addr - back + i)]--;
+
+		op.length = 0;
+	}
+}
+
+/// <summary>
+/// Switch the code cache on or off, it starts empty either way.
+/// </summary>
+void CCpu6502::SetCodeCache(bool isEnabled)
+{
+	std::vector<TCpu6502Op>().swap(m_ops);
+	std::vector<uint8_t>().swap(m_codeUse);
+
+	if (isEnabled)
+	{
+		m_ops.resize(CPU6502_MEMORY_SIZE, TCpu6502Op());
+		m_codeUse.resize(CPU6502_MEMORY_SIZE, 0);
+	}
+}
+
+/// <summary>
+/// Tell the code cache that the host wrote into the memory image, the instructions there are decoded again.
+/// </summary>
+/// <param name="addr">First byte written</param>
+/// <param name="size">Bytes written</param>
+void CCpu6502::InvalidateCode(uint16_t addr, int size)
+{
+	if (!IsCodeCached())
+		return;
+
+	for (int i = 0; i < size && i < CPU6502_MEMORY_SIZE; i++)
+	{
+		uint16_t byte = (uint16_t)(addr + i);
+
+		if (m_codeUse[byte])
+			InvalidateAt(byte);
+	}
+}
+
+static CCpu6502 s_cpu;
+
+void C6502_Initialise(uint8_t* memory)
+{
+	s_cpu.Initialise(memory);
+}
+
+int C6502_JSR(uint16_t* adr, uint8_t* a, uint8_t* x, uint8_t* y, int* cycles)
+{
+	return s_cpu.Jsr(*adr, *a, *x, *y, *cycles);
+}
+
+void C6502_About(char** name, char** author, char** description)
+{
+	static char s_name[] = "Built-in 6502 CPU emulation";
+	static char s_author[] = "RASTER Music Tracker";
+	static char s_description[] = "NMOS 6502 documented instructions, cycle exact, with decimal mode";
+
+	*name = s_name;
+	*author = s_author;
+	*description = s_description;
+}
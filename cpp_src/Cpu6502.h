@@ -0,0 +1,99 @@
+//
+// Cpu6502.h header file
+// Built-in 6502 CPU emulation, replacing the sa_c6502.dll plugin
+// This code does not depend on MFC or Windows, so the RMT driver binaries could also be run headless
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define CPU6502_STACK		0x0100		// Hardware stack page
+#define CPU6502_MEMORY_SIZE	0x10000
+
+// Processor status flags
+#define FLAG_C		0x01
+#define FLAG_Z		0x02
+#define FLAG_I		0x04
+#define FLAG_D		0x08
+#define FLAG_B		0x10
+#define FLAG_U		0x20		// Always set when the status is pushed
+#define FLAG_V		0x40
+#define FLAG_N		0x80
+
+// An instruction decoded by the code cache, with its operand already read from memory
+typedef struct
+{
+	uint8_t opcode;
+	uint8_t length;			// 0 if the instruction at this address is not decoded
+	uint16_t operand;		// Immediate value, branch offset, zero page or absolute address
+} TCpu6502Op;
+
+/// <summary>
+/// NMOS 6502 core, running directly in a 64K memory image.
+/// Only the documented instructions are emulated, which is all the RMT drivers ever use.
+/// An undocumented opcode stops the subroutine, just like it would crash the real machine.
+/// Memory accesses have no side effects, the POKEY registers are simply read back from the memory image.
+/// The code cache keeps every instruction run decoded, stores into its bytes decode it again, and so must
+/// whoever writes code into the memory image between 2 calls, with InvalidateCode.
+/// </summary>
+class CCpu6502
+{
+public:
+	CCpu6502();
+
+	void Initialise(uint8_t* memory);
+	bool Jsr(uint16_t& adr, uint8_t& a, uint8_t& x, uint8_t& y, int& cycles);
+
+	uint64_t GetTotalCycles() { return m_totalCycles; };
+	int GetLastCycles() { return m_lastCycles; };
+	bool IsHalted() { return m_isHalted; };
+
+	void SetCodeCache(bool isEnabled);
+	bool IsCodeCached() { return !m_ops.empty(); };
+	void InvalidateCode(uint16_t addr, int size);
+
+private:
+	uint8_t* m_memory;
+
+	// Registers, N and Z are kept as the last value that set them, and only resolved when P is needed
+	uint16_t m_pc;
+	uint8_t m_a;
+	uint8_t m_x;
+	uint8_t m_y;
+	uint8_t m_s;
+	uint8_t m_n;
+	uint8_t m_z;
+	uint8_t m_c;
+	uint8_t m_v;
+	uint8_t m_d;
+	uint8_t m_i;
+
+	uint64_t m_totalCycles;
+	int m_lastCycles;		// Cycles used by the last Jsr
+	bool m_isHalted;		// An undocumented opcode was met during the last Jsr
+
+	std::vector<TCpu6502Op> m_ops;		// Decoded instruction at every address, empty if the code cache is off
+	std::vector<uint8_t> m_codeUse;		// Decoded instructions covering every byte, a store there invalidates them
+
+	template <bool isCached> int Execute(int cycles, uint8_t returnStack);
+	TCpu6502Op Decode(uint16_t pc);
+	void InvalidateAt(uint16_t addr);
+
+	uint8_t GetP();
+	void SetP(uint8_t p);
+	void Push(uint8_t value) { m_memory[CPU6502_STACK + m_s--] = value; };
+	uint8_t Pull() { return m_memory[CPU6502_STACK + ++m_s]; };
+	uint16_t ReadWord(uint16_t addr) { return m_memory[addr] | (m_memory[(uint16_t)(addr + 1)] << 8); };
+	uint16_t ReadWordZp(uint8_t addr) { return m_memory[addr] | (m_memory[(uint8_t)(addr + 1)] << 8); };
+
+	void Adc(uint8_t value);
+	void Sbc(uint8_t value);
+	void Compare(uint8_t reg, uint8_t value);
+};
+
+// Drop-in replacements for the sa_c6502.dll exports, running on a single shared core
+void C6502_Initialise(uint8_t* memory);
+int C6502_JSR(uint16_t* adr, uint8_t* a, uint8_t* x, uint8_t* y, int* cycles);
+void C6502_About(char** name, char** author, char** description);
@@ -0,0 +1,184 @@
+//
+// CycleProfiler.cpp
+// Statistics of the 6502 cycles used by the RMT driver on every frame, for each song and driver variant
+//
+
+#include "CycleProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char* const s_partNames[CYCLE_PART_COUNT] = { "P3", "SETPOKEY", "FRAME" };
+
+// Song names are free text, so they are always quoted, with any quote doubled
+static std::string CsvQuote(const std::string& text)
+{
+	std::string quoted = "\"";
+
+	for (char c : text)
+	{
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+
+	return quoted + "\"";
+}
+
+CCycleProfiler::CCycleProfiler()
+{
+	Clear();
+}
+
+void CCycleProfiler::Clear()
+{
+	m_profiles.clear();
+	m_frame = 0;
+	m_songline = 0;
+	m_row = 0;
+}
+
+/// <summary>
+/// Start a new profile, every frame added from now on goes into it.
+/// </summary>
+/// <param name="song">Name of the song, only used in the report</param>
+/// <param name="driver">Name of the driver variant, only used in the report</param>
+void CCycleProfiler::Begin(const char* song, const char* driver)
+{
+	TCycleProfile profile;
+	profile.song = song;
+	profile.driver = driver;
+	memset(profile.stats, 0, sizeof(profile.stats));
+	profile.framesPerSecond = 0.0;
+	profile.cachedFramesPerSecond = 0.0;
+	profile.isCacheIdentical = false;
+
+	for (int i = 0; i < CYCLE_PART_COUNT; i++)
+		profile.stats[i].min = INT32_MAX;
+
+	m_profiles.push_back(profile);
+	m_frame = 0;
+	m_songline = 0;
+	m_row = 0;
+}
+
+void CCycleProfiler::AddCycles(TCycleStats& stats, int cycles)
+{
+	stats.min = std::min(stats.min, cycles);
+	stats.max = std::max(stats.max, cycles);
+	stats.sum += cycles;
+	stats.count++;
+	stats.histogram[std::min(cycles / CYCLE_PROFILE_BIN_CYCLES, CYCLE_PROFILE_BINS - 1)]++;
+}
+
+/// <summary>
+/// Add the cycles of 1 frame, at the playback position last set.
+/// </summary>
+/// <param name="p3Cycles">Cycles used by RMT_P3, 0 if it was not called</param>
+/// <param name="setPokeyCycles">Cycles used by RMT_SETPOKEY</param>
+void CCycleProfiler::AddFrame(int p3Cycles, int setPokeyCycles)
+{
+	if (m_profiles.empty())
+		return;
+
+	TCycleProfile& profile = m_profiles.back();
+	TCycleFrame frame = { m_frame++, m_songline, m_row, { p3Cycles, setPokeyCycles, p3Cycles + setPokeyCycles } };
+
+	for (int i = 0; i < CYCLE_PART_COUNT; i++)
+		AddCycles(profile.stats[i], frame.cycles[i]);
+
+	// Keep the worst frames sorted, the first one found wins a tie
+	auto isWorse = [](const TCycleFrame& a, const TCycleFrame& b) { return a.cycles[CYCLE_PART_FRAME] > b.cycles[CYCLE_PART_FRAME]; };
+	std::vector<TCycleFrame>& worst = profile.worst;
+
+	if (worst.size() == CYCLE_PROFILE_WORST_FRAMES && !isWorse(frame, worst.back()))
+		return;
+
+	worst.insert(std::upper_bound(worst.begin(), worst.end(), frame, isWorse), frame);
+
+	if (worst.size() > CYCLE_PROFILE_WORST_FRAMES)
+		worst.pop_back();
+}
+
+/// <summary>
+/// Set how many frames per second the driver of the current profile was emulated at, timed without the profiler.
+/// </summary>
+/// <param name="framesPerSecond">Speed of the 6502 interpreter</param>
+/// <param name="cachedFramesPerSecond">Speed with the code cache of the 6502</param>
+/// <param name="isCacheIdentical">The code cache played the very same frames as the interpreter</param>
+void CCycleProfiler::SetSpeed(double framesPerSecond, double cachedFramesPerSecond, bool isCacheIdentical)
+{
+	if (m_profiles.empty())
+		return;
+
+	TCycleProfile& profile = m_profiles.back();
+	profile.framesPerSecond = framesPerSecond;
+	profile.cachedFramesPerSecond = cachedFramesPerSecond;
+	profile.isCacheIdentical = isCacheIdentical;
+}
+
+/// <summary>
+/// Write every profile as CSV, in 4 sections told apart by the first column:
+/// "summary" with min/avg/max, "histogram" with the frame count of each scanline bin, "worst" with the worst frames,
+/// and "speed" with the frames emulated per second, with and without the code cache of the 6502.
+/// </summary>
+/// <param name="out">Output stream</param>
+void CCycleProfiler::WriteCsv(std::ostream& out)
+{
+	out << "section,song,driver,part,frames,min,avg,max\n";
+
+	for (const TCycleProfile& profile : m_profiles)
+	{
+		for (int i = 0; i < CYCLE_PART_COUNT; i++)
+		{
+			const TCycleStats& stats = profile.stats[i];
+			int64_t avg = stats.count ? stats.sum / stats.count : 0;
+			out << "summary," << CsvQuote(profile.song) << "," << profile.driver << "," << s_partNames[i] << ","
+				<< stats.count << "," << (stats.count ? stats.min : 0) << "," << avg << "," << stats.max << "\n";
+		}
+	}
+
+	out << "\nsection,song,driver,part,from_cycles,to_cycles,frames\n";
+
+	for (const TCycleProfile& profile : m_profiles)
+	{
+		for (int i = 0; i < CYCLE_PART_COUNT; i++)
+		{
+			for (int bin = 0; bin < CYCLE_PROFILE_BINS; bin++)
+			{
+				// Only the bins that were used, the report would be mostly zeros otherwise
+				if (!profile.stats[i].histogram[bin])
+					continue;
+
+				out << "histogram," << CsvQuote(profile.song) << "," << profile.driver << "," << s_partNames[i] << ","
+					<< bin * CYCLE_PROFILE_BIN_CYCLES << ",";
+
+				if (bin < CYCLE_PROFILE_BINS - 1)
+					out << (bin + 1) * CYCLE_PROFILE_BIN_CYCLES - 1;
+
+				out << "," << profile.stats[i].histogram[bin] << "\n";
+			}
+		}
+	}
+
+	out << "\nsection,song,driver,rank,frame,songline,row,p3,setpokey,frame_cycles\n";
+
+	for (const TCycleProfile& profile : m_profiles)
+	{
+		for (int i = 0; i < (int)profile.worst.size(); i++)
+		{
+			const TCycleFrame& frame = profile.worst[i];
+			out << "worst," << CsvQuote(profile.song) << "," << profile.driver << "," << i + 1 << "," << frame.frame << ","
+				<< frame.songline << "," << frame.row << "," << frame.cycles[CYCLE_PART_P3] << ","
+				<< frame.cycles[CYCLE_PART_SETPOKEY] << "," << frame.cycles[CYCLE_PART_FRAME] << "\n";
+		}
+	}
+
+	out << "\nsection,song,driver,frames_per_second,cached_frames_per_second,cached_identical\n";
+
+	for (const TCycleProfile& profile : m_profiles)
+	{
+		out << "speed," << CsvQuote(profile.song) << "," << profile.driver << "," << (int64_t)profile.framesPerSecond << ","
+			<< (int64_t)profile.cachedFramesPerSecond << "," << (profile.isCacheIdentical ? "yes" : "no") << "\n";
+	}
+}
@@ -0,0 +1,80 @@
+//
+// CycleProfiler.h header file
+// Statistics of the 6502 cycles used by the RMT driver on every frame, for each song and driver variant
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define CYCLE_PROFILE_BIN_CYCLES	114			// Every histogram bin is 1 scanline of raster time
+#define CYCLE_PROFILE_BINS			64			// The last bin also holds every frame going over it
+#define CYCLE_PROFILE_WORST_FRAMES	16			// Worst frames kept for each profile
+#define CYCLE_PROFILE_SPEED_FRAMES	30000		// Frames timed at least for the speed, short songs are looped to get a steady figure
+
+// Which part of the driver the cycles were spent in
+#define CYCLE_PART_P3			0			// RMT_P3, instruments and effects
+#define CYCLE_PART_SETPOKEY		1			// RMT_SETPOKEY, the POKEY registers update
+#define CYCLE_PART_FRAME		2			// Both, the raster time of the whole VBI
+#define CYCLE_PART_COUNT		3
+
+typedef struct
+{
+	int min;
+	int max;
+	int64_t sum;
+	int count;
+	int histogram[CYCLE_PROFILE_BINS];
+} TCycleStats;
+
+typedef struct
+{
+	int frame;
+	int songline;
+	int row;
+	int cycles[CYCLE_PART_COUNT];
+} TCycleFrame;
+
+typedef struct
+{
+	std::string song;
+	std::string driver;
+	TCycleStats stats[CYCLE_PART_COUNT];
+	std::vector<TCycleFrame> worst;		// Highest whole frame cycles first
+	double framesPerSecond;				// Speed of the emulated driver, 0 if it was not measured
+	double cachedFramesPerSecond;		// Same, with the code cache of the 6502
+	bool isCacheIdentical;				// The code cache played the very same frames, memory and cycles
+} TCycleProfile;
+
+/// <summary>
+/// Collects the cycles of every played frame, into one profile per song and driver.
+/// Whoever plays the song sets the playback position, and adds the cycles measured on each frame.
+/// </summary>
+class CCycleProfiler
+{
+public:
+	CCycleProfiler();
+
+	void Clear();
+	void Begin(const char* song, const char* driver);
+	void SetPosition(int songline, int row) { m_songline = songline; m_row = row; };
+	void AddFrame(int p3Cycles, int setPokeyCycles);
+	void SetSpeed(double framesPerSecond, double cachedFramesPerSecond, bool isCacheIdentical);
+
+	int GetProfileCount() { return (int)m_profiles.size(); };
+	const TCycleProfile* GetProfile(int index) { return &m_profiles[index]; };
+
+	void WriteCsv(std::ostream& out);
+
+private:
+	std::vector<TCycleProfile> m_profiles;
+	int m_frame;
+	int m_songline;
+	int m_row;
+
+	static void AddCycles(TCycleStats& stats, int cycles);
+};
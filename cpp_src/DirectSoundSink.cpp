@@ -0,0 +1,225 @@
+//
+// DirectSoundSink.cpp
+// Live audio output through DirectSound, draining the CAudioRingBuffer from its own thread
+//
+
+#include "StdAfx.h"
+#include "DirectSoundSink.h"
+#include "global.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+
+CDirectSoundSink::CDirectSoundSink()
+{
+	m_lpds = NULL;
+	m_lpdsbPrimary = NULL;
+	m_SoundBuffer = NULL;
+	m_Chunk = NULL;
+	m_LoadPos = 0;
+	m_BufferSize = 0;
+	m_LatencySize = 0;
+	m_BlockAlign = 1;
+}
+
+CDirectSoundSink::~CDirectSoundSink()
+{
+	Close();
+}
+
+/// <summary>
+/// Create the DirectSound interface and a looping sound buffer, filled with silence.
+/// </summary>
+/// <param name="format">Sample format of the ring buffer contents</param>
+/// <param name="bufferSize">Size of the DirectSound buffer in bytes, must be a power of 2</param>
+/// <param name="latencySize">Bytes kept queued ahead of the write cursor</param>
+/// <returns>true if the sound output is ready</returns>
+bool CDirectSoundSink::Open(WAVEFORMATEX* format, int bufferSize, int latencySize)
+{
+	Close();
+
+	m_sampleRate = format->nSamplesPerSec;
+	m_channels = format->nChannels;
+	m_BlockAlign = format->nBlockAlign;
+	m_BufferSize = bufferSize;
+	m_LatencySize = latencySize;
+	m_underrunCount = 0;
+
+	if (DirectSoundCreate(NULL, &m_lpds, NULL) != DS_OK)
+	{
+		MessageBox(g_hwnd, "Error: DirectSoundCreate", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+		return false;
+	}
+
+	// Set cooperative level
+	if (m_lpds->SetCooperativeLevel(AfxGetApp()->GetMainWnd()->m_hWnd, DSSCL_PRIORITY) != DS_OK)
+	{
+		MessageBox(g_hwnd, "Error: SetCooperativeLevel", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+		return false;
+	}
+
+	// Create primary buffer.
+	ZeroMemory(&dsbdesc, sizeof(DSBUFFERDESC));
+	dsbdesc.dwSize = sizeof(DSBUFFERDESC);
+	dsbdesc.dwFlags = DSBCAPS_PRIMARYBUFFER;
+
+	if (m_lpds->CreateSoundBuffer(&dsbdesc, &m_lpdsbPrimary, NULL) != DS_OK)
+	{
+		MessageBox(g_hwnd, "Error: CreatePrimarySoundBuffer", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+		return false;
+	}
+
+	if (m_lpdsbPrimary->SetFormat(format) != DS_OK)
+	{
+		MessageBox(g_hwnd, "Error: SetFormat", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+		return false;
+	}
+
+	ZeroMemory(&dsbdesc, sizeof(DSBUFFERDESC));
+	dsbdesc.dwSize = sizeof(DSBUFFERDESC);
+	dsbdesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_LOCHARDWARE | DSBCAPS_GLOBALFOCUS | DSBCAPS_STICKYFOCUS;
+	dsbdesc.dwBufferBytes = m_BufferSize;
+	dsbdesc.lpwfxFormat = format;
+
+	if (g_nohwsoundbuffer ||
+		m_lpds->CreateSoundBuffer(&dsbdesc, &m_SoundBuffer, NULL) != DS_OK)
+	{
+		dsbdesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_LOCSOFTWARE | DSBCAPS_GLOBALFOCUS | DSBCAPS_STICKYFOCUS;
+		if (m_lpds->CreateSoundBuffer(&dsbdesc, &m_SoundBuffer, NULL) != DS_OK)
+		{
+			MessageBox(g_hwnd, "Error: CreateSoundBuffer", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+			return false;
+		}
+	}
+
+	LPVOID Data1, Data2;
+	DWORD dwSize1, dwSize2;
+
+	if (m_SoundBuffer->Lock(0, m_BufferSize, &Data1, &dwSize1, &Data2, &dwSize2, DSBLOCK_FROMWRITECURSOR) == DS_OK)
+	{
+		memset(Data1, 0, dwSize1);
+		if (Data2) memset(Data2, 0, dwSize2);
+		m_SoundBuffer->Unlock(Data1, dwSize1, Data2, dwSize2);
+	}
+
+	m_Chunk = new int16_t[m_BufferSize / sizeof(int16_t)];
+
+	DWORD playCursor, writeCursor;
+	m_SoundBuffer->Play(0, 0, DSBPLAY_LOOPING);
+	m_SoundBuffer->GetCurrentPosition(&playCursor, &writeCursor);
+	m_LoadPos = writeCursor;
+
+	return true;
+}
+
+void CDirectSoundSink::Close()
+{
+	if (m_SoundBuffer)
+	{
+		m_SoundBuffer->Stop();
+		m_SoundBuffer->Release();
+	}
+	m_SoundBuffer = NULL;
+
+	if (m_lpdsbPrimary) m_lpdsbPrimary->Release();
+	m_lpdsbPrimary = NULL;
+
+	if (m_lpds) m_lpds->Release();
+	m_lpds = NULL;
+
+	delete[] m_Chunk;
+	m_Chunk = NULL;
+}
+
+/// <summary>
+/// Copy data into the looping sound buffer, wrapping around its end if needed.
+/// When data is NULL, the area is cleared instead.
+/// </summary>
+void CDirectSoundSink::WriteBuffer(DWORD position, const void* data, DWORD size)
+{
+	LPVOID Data1, Data2;
+	DWORD dwSize1, dwSize2;
+
+	if (m_SoundBuffer->Lock(position, size, &Data1, &dwSize1, &Data2, &dwSize2, 0) != DS_OK)
+		return;
+
+	if (data)
+	{
+		memcpy(Data1, data, dwSize1);
+		if (Data2) memcpy(Data2, (const BYTE*)data + dwSize1, dwSize2);
+	}
+	else
+	{
+		memset(Data1, 0, dwSize1);
+		if (Data2) memset(Data2, 0, dwSize2);
+	}
+
+	m_SoundBuffer->Unlock(Data1, dwSize1, Data2, dwSize2);
+}
+
+/// <summary>
+/// Change the amount of sound kept queued ahead of the write cursor.
+/// A lower latency is reached by simply queueing less, the data already queued still plays out.
+/// </summary>
+/// <param name="latency">Latency in samples per channel, at most a quarter of the buffer</param>
+void CDirectSoundSink::SetLatency(int latency)
+{
+	int size = latency * m_BlockAlign;
+
+	if (size > m_BufferSize / 4)
+		size = m_BufferSize / 4;
+
+	m_LatencySize = size;
+}
+
+/// <summary>
+/// Keep the sound buffer filled up to the latency target from the ring buffer.
+/// If the write cursor caught up with the queued data, this is counted as an underrun.
+/// </summary>
+/// <param name="ring">Ring buffer filled by the POKEY renderer</param>
+/// <returns>Number of samples taken from the ring buffer</returns>
+int CDirectSoundSink::Consume(CAudioRingBuffer& ring)
+{
+	if (!m_SoundBuffer)
+		return 0;
+
+	DWORD playCursor, writeCursor;
+	m_SoundBuffer->GetCurrentPosition(&playCursor, &writeCursor);
+
+	//|||||||||||||||||||||||||||||||||||||||||
+	//           ^|-------queued------>^
+	//      writeCursor             m_LoadPos
+
+	int queued = (m_LoadPos - writeCursor) & (m_BufferSize - 1);
+
+	if (queued > m_BufferSize / 2)
+	{
+		// The write cursor went past everything that was queued, start again from where it is now
+		m_underrunCount++;
+		m_LoadPos = writeCursor;
+		queued = 0;
+	}
+
+	int latencySize = m_LatencySize;
+	int wanted = (latencySize - queued) & ~(m_BlockAlign - 1);
+
+	if (wanted <= 0)
+		return 0;
+
+	int count = ring.Read(m_Chunk, wanted / sizeof(int16_t));
+
+	if (count > 0)
+	{
+		DWORD size = count * sizeof(int16_t);
+		WriteBuffer(m_LoadPos, m_Chunk, size);
+		m_LoadPos = (m_LoadPos + size) & (m_BufferSize - 1);
+
+		// Clear what follows, so an underrun plays silence rather than the previous buffer contents
+		WriteBuffer(m_LoadPos, NULL, latencySize);
+	}
+
+	return count;
+}
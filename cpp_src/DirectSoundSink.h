@@ -0,0 +1,35 @@
+//
+// DirectSoundSink.h header file
+// Live audio output through DirectSound, draining the CAudioRingBuffer from its own thread
+//
+
+#pragma once
+
+#include "StdAfx.h"
+#include "AudioSink.h"
+
+class CDirectSoundSink : public CAudioSink
+{
+public:
+	CDirectSoundSink();
+	~CDirectSoundSink();
+
+	bool Open(WAVEFORMATEX* format, int bufferSize, int latencySize);
+	void Close();
+	int Consume(CAudioRingBuffer& ring);
+	bool IsRealTime() { return true; };
+	void SetLatency(int latency);
+
+private:
+	LPDIRECTSOUND			m_lpds;
+	LPDIRECTSOUNDBUFFER		m_lpdsbPrimary;
+	LPDIRECTSOUNDBUFFER		m_SoundBuffer;
+	DSBUFFERDESC			dsbdesc;
+	DWORD					m_LoadPos;
+	int						m_BufferSize;		// Must be a power of 2
+	std::atomic<int>		m_LatencySize;		// Bytes kept queued ahead of the write cursor, changed by the player thread
+	int						m_BlockAlign;
+	int16_t*				m_Chunk;			// Samples taken from the ring buffer, before they are copied into m_SoundBuffer
+
+	void WriteBuffer(DWORD position, const void* data, DWORD size);
+};
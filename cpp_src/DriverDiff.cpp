@@ -0,0 +1,171 @@
+//
+// DriverDiff.cpp
+// Differential tester of the RMT driver binaries, playing one module through several of them in lockstep
+//
+
+#include "stdafx.h"
+#include <stdio.h>
+
+#include "DriverDiff.h"
+
+static const char* const s_registerNames[9] = { "AUDF1", "AUDC1", "AUDF2", "AUDC2", "AUDF3", "AUDC3", "AUDF4", "AUDC4", "AUDCTL" };
+
+CDriverDiff::CDriverDiff()
+{
+	m_module = NULL;
+	m_moduleFrom = m_moduleTo = 0;
+	m_songline = 0;
+	m_registerCount = 9;
+	m_frames = 0;
+}
+
+void CDriverDiff::Clear()
+{
+	m_drivers.clear();
+	m_module = NULL;
+	m_frames = 0;
+}
+
+/// <summary>
+/// Add a driver variant to play the module with, the first one added is the reference the others are compared to.
+/// </summary>
+/// <param name="driverVersion">One of the TRACKER_DRIVER_* binaries</param>
+/// <param name="name">Name of the driver, only used in the report</param>
+void CDriverDiff::AddDriver(int driverVersion, const char* name)
+{
+	TDriver driver;
+	driver.version = driverVersion;
+	driver.name = name;
+	memset(&driver.divergence, 0, sizeof(driver.divergence));
+	m_drivers.push_back(std::move(driver));
+}
+
+/// <summary>
+/// Set the legacy RMT module to play, as made by MakeModule. The memory must stay valid until Run is done.
+/// </summary>
+/// <param name="memory">64K memory holding the module</param>
+/// <param name="fromAddr">First byte of the module</param>
+/// <param name="toAddr">Last byte of the module</param>
+/// <param name="songline">Songline the module starts from</param>
+void CDriverDiff::SetModule(const unsigned char* memory, WORD fromAddr, WORD toAddr, int songline)
+{
+	m_module = memory;
+	m_moduleFrom = fromAddr;
+	m_moduleTo = toAddr;
+	m_songline = songline;
+	m_registerCount = memory[fromAddr + 3] == '8' ? 18 : 9;
+}
+
+void CDriverDiff::ReadRegisters(CAtariEmulation* atari, BYTE* registers)
+{
+	const unsigned char* memory = atari->GetMemory();
+	memcpy(registers, memory + 0xd200, 9);
+	memcpy(registers + 9, memory + 0xd210, 9);
+}
+
+/// <summary>
+/// Play the module through every driver, 1 frame at a time, and compare the POKEY registers to the reference driver.
+/// The run stops early once every driver diverged, the number of different frames then only covers the frames played.
+/// </summary>
+/// <param name="maxFrames">Frames to play at most</param>
+/// <returns>Number of drivers that diverged from the reference</returns>
+int CDriverDiff::Run(int maxFrames)
+{
+	m_frames = 0;
+
+	if (!m_module || m_drivers.size() < 2)
+		return 0;
+
+	// Every driver gets its own Atari, the reference one included
+	for (TDriver& driver : m_drivers)
+	{
+		driver.atari.reset(new CAtariEmulation());
+		driver.atari->LoadRMTRoutines(driver.version);
+		driver.atari->LoadModule(m_module, m_moduleFrom, m_moduleTo);
+		driver.atari->InitModule(m_songline);
+		memset(&driver.divergence, 0, sizeof(driver.divergence));
+	}
+
+	int drivers = (int)m_drivers.size();
+	int divergedCount = 0;
+	BYTE expected[DRIVER_DIFF_REGISTERS];
+	BYTE registers[DRIVER_DIFF_REGISTERS];
+
+	for (; m_frames < maxFrames && divergedCount < drivers - 1; m_frames++)
+	{
+		CAtariEmulation* reference = m_drivers[0].atari.get();
+		reference->PlayModule();
+		ReadRegisters(reference, expected);
+
+		int songline, row;
+		reference->GetModulePosition(songline, row);
+
+		for (int i = 1; i < drivers; i++)
+		{
+			TDriver& driver = m_drivers[i];
+			driver.atari->PlayModule();
+			ReadRegisters(driver.atari.get(), registers);
+
+			if (!memcmp(registers, expected, m_registerCount))
+				continue;
+
+			TDriverDivergence& divergence = driver.divergence;
+			divergence.differentFrames++;
+
+			if (divergence.isDiverged)
+				continue;
+
+			int reg = 0;
+			while (registers[reg] == expected[reg]) reg++;
+
+			divergence.isDiverged = true;
+			divergence.frame = m_frames;
+			divergence.songline = songline;
+			divergence.row = row;
+			divergence.reg = reg;
+			divergence.expected = expected[reg];
+			divergence.value = registers[reg];
+			divergedCount++;
+		}
+	}
+
+	// The contexts are 64K each, only the results are kept
+	for (TDriver& driver : m_drivers)
+		driver.atari.reset();
+
+	return divergedCount;
+}
+
+/// <summary>
+/// Write the result of the last Run as plain text, 1 line per driver compared to the reference.
+/// </summary>
+/// <param name="out">Output stream</param>
+void CDriverDiff::WriteReport(std::ostream& out)
+{
+	if (m_drivers.empty())
+		return;
+
+	char line[256];
+	out << "Reference driver: " << m_drivers[0].name << "\n";
+	out << "Frames played: " << m_frames << ", " << (m_registerCount == 18 ? "Stereo" : "Mono") << "\n\n";
+
+	for (int i = 1; i < (int)m_drivers.size(); i++)
+	{
+		const TDriver& driver = m_drivers[i];
+		const TDriverDivergence& divergence = driver.divergence;
+
+		if (!divergence.isDiverged)
+		{
+			out << driver.name << ": identical\n";
+			continue;
+		}
+
+		// Songlines and rows are in hexadecimal, as the tracker shows them
+		int reg = divergence.reg;
+		snprintf(line, sizeof(line), "%s: first divergence at frame %d, songline %02X row %02X, %s ($%04X) is $%02X instead of $%02X, %d frames differ\n",
+			driver.name.c_str(), divergence.frame, divergence.songline, divergence.row,
+			s_registerNames[reg % 9], 0xd200 + (reg / 9) * 0x10 + reg % 9,
+			divergence.value, divergence.expected, divergence.differentFrames);
+		out << line;
+	}
+}
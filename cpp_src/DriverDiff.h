@@ -0,0 +1,68 @@
+//
+// DriverDiff.h header file
+// Differential tester of the RMT driver binaries, playing one module through several of them in lockstep
+// There is no GUI or sound involved, every driver runs in its own CAtariEmulation context
+//
+
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Atari6502.h"
+
+#define DRIVER_DIFF_MAX_FRAMES	(50 * 60 * 10)		// 10 minutes of PAL frames, looping songs never end by themselves
+#define DRIVER_DIFF_REGISTERS	18					// AUDF1-4, AUDC1-4 and AUDCTL, for up to 2 POKEY
+
+typedef struct
+{
+	bool isDiverged;
+	int frame;				// First frame with a different register
+	int songline;			// Played by the reference driver on that frame
+	int row;
+	int reg;				// First different register of that frame, 0-8 for $D200-$D208, 9-17 for $D210-$D218
+	BYTE expected;			// Value written by the reference driver
+	BYTE value;				// Value written by this driver
+	int differentFrames;	// Frames with at least one different register, over the whole run
+} TDriverDivergence;
+
+/// <summary>
+/// Plays a module through 2 or more driver variants, frame by frame, and diffs the POKEY registers
+/// written by each of them against the first driver added, the reference.
+/// </summary>
+class CDriverDiff
+{
+public:
+	CDriverDiff();
+
+	void Clear();
+	void AddDriver(int driverVersion, const char* name);
+	void SetModule(const unsigned char* memory, WORD fromAddr, WORD toAddr, int songline = 0);
+
+	int Run(int maxFrames = DRIVER_DIFF_MAX_FRAMES);
+
+	int GetDriverCount() { return (int)m_drivers.size(); };
+	const TDriverDivergence* GetDivergence(int driver) { return &m_drivers[driver].divergence; };
+	void WriteReport(std::ostream& out);
+
+private:
+	typedef struct
+	{
+		int version;
+		std::string name;
+		std::unique_ptr<CAtariEmulation> atari;
+		TDriverDivergence divergence;
+	} TDriver;
+
+	std::vector<TDriver> m_drivers;
+	const unsigned char* m_module;
+	WORD m_moduleFrom;
+	WORD m_moduleTo;
+	int m_songline;
+	int m_registerCount;		// 9 for a Mono module, 18 for a Stereo one
+	int m_frames;				// Frames played by the last Run
+
+	static void ReadRegisters(CAtariEmulation* atari, BYTE* registers);
+};
@@ -0,0 +1,230 @@
+//
+// EngineValidation.cpp
+// Validation and benchmark of the native RMTE engine against the 6502 RMT driver, playing the same module in lockstep
+//
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <chrono>
+
+#include "EngineValidation.h"
+
+static const char* const s_registerNames[9] = { "AUDF1", "AUDC1", "AUDF2", "AUDC2", "AUDF3", "AUDC3", "AUDF4", "AUDC4", "AUDCTL" };
+
+CEngineValidation::CEngineValidation()
+{
+	m_module = NULL;
+	m_moduleFrom = m_moduleTo = 0;
+	m_driverVersion = 0;
+	m_pModule = NULL;
+	m_subtune = MODULE_DEFAULT_SUBTUNE;
+	m_registerCount = 9;
+	m_frames = 0;
+	m_driverTime = m_engineTime = 0.0;
+	memset(&m_divergence, 0, sizeof(m_divergence));
+}
+
+/// <summary>
+/// Set the legacy RMT module played by the driver, as made by MakeModule. The memory must stay valid until Run is done.
+/// </summary>
+/// <param name="memory">64K memory holding the module</param>
+/// <param name="fromAddr">First byte of the module</param>
+/// <param name="toAddr">Last byte of the module</param>
+/// <param name="driverVersion">One of the TRACKER_DRIVER_* binaries</param>
+/// <param name="driverName">Name of the driver, only used in the report</param>
+void CEngineValidation::SetDriverModule(const unsigned char* memory, WORD fromAddr, WORD toAddr, int driverVersion, const char* driverName)
+{
+	m_module = memory;
+	m_moduleFrom = fromAddr;
+	m_moduleTo = toAddr;
+	m_driverVersion = driverVersion;
+	m_driverName = driverName;
+	m_registerCount = memory[fromAddr + 3] == '8' ? 18 : 9;
+}
+
+/// <summary>
+/// Set the RMTE module played by the engine, normally the same module imported with CModule::ImportLegacyRMT.
+/// </summary>
+void CEngineValidation::SetEngineModule(CModule* pModule, UINT subtune)
+{
+	m_pModule = pModule;
+	m_subtune = subtune;
+}
+
+void CEngineValidation::ReadRegisters(const TPokeyFrame* pFrame, BYTE* registers)
+{
+	for (int chip = 0; chip < 2; chip++)
+	{
+		const TPokeyRegisters* pPokey = &pFrame->pokey[chip];
+
+		for (int i = 0; i < POKEY_CHANNEL_COUNT; i++)
+		{
+			*registers++ = pPokey->audf[i];
+			*registers++ = pPokey->audc[i];
+		}
+
+		*registers++ = pPokey->audctl;
+	}
+}
+
+/// <summary>
+/// Play the module with the driver, then with the engine, and compare the POKEY registers of every frame.
+/// RMT_PLAY writes the registers of the previous frame before computing the next one,
+/// so frame n of the driver is read from POKEY once RMT_PLAY was called n + 2 times.
+/// </summary>
+/// <param name="maxFrames">Frames to play</param>
+/// <returns>Number of frames with at least one different register</returns>
+int CEngineValidation::Run(int maxFrames)
+{
+	m_frames = 0;
+	m_driverTime = m_engineTime = 0.0;
+	memset(&m_divergence, 0, sizeof(m_divergence));
+
+	if (!m_module || !m_pModule || maxFrames < 1)
+		return 0;
+
+	std::vector<BYTE> expected((size_t)maxFrames * ENGINE_VALIDATION_REGISTERS);
+	std::vector<int> positions((size_t)maxFrames * 2);
+
+	// The driver runs first, in its own Atari
+	{
+		CAtariEmulation atari;
+		atari.LoadRMTRoutines(m_driverVersion);
+		atari.LoadModule(m_module, m_moduleFrom, m_moduleTo);
+		atari.InitModule(0);
+
+		const unsigned char* memory = atari.GetMemory();
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i <= maxFrames; i++)
+		{
+			atari.PlayModule();
+
+			if (i < maxFrames)
+				atari.GetModulePosition(positions[i * 2], positions[i * 2 + 1]);
+
+			if (i > 0)
+			{
+				BYTE* registers = &expected[(size_t)(i - 1) * ENGINE_VALIDATION_REGISTERS];
+				memcpy(registers, memory + 0xd200, 9);
+				memcpy(registers + 9, memory + 0xd210, 9);
+			}
+		}
+
+		m_driverTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Then the engine, which gives every frame directly
+	std::vector<BYTE> played((size_t)maxFrames * ENGINE_VALIDATION_REGISTERS);
+	{
+		CRmteEngine engine(m_pModule);
+		TPokeyFrame frame;
+
+		engine.Start(m_subtune);
+
+		if (!engine.IsPlaying())
+			return 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < maxFrames; i++)
+		{
+			engine.PlayFrame(&frame);
+			ReadRegisters(&frame, &played[(size_t)i * ENGINE_VALIDATION_REGISTERS]);
+		}
+
+		m_engineTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	m_frames = maxFrames;
+
+	for (int i = 0; i < m_frames; i++)
+	{
+		const BYTE* registers = &played[(size_t)i * ENGINE_VALIDATION_REGISTERS];
+		const BYTE* reference = &expected[(size_t)i * ENGINE_VALIDATION_REGISTERS];
+
+		if (!memcmp(registers, reference, m_registerCount))
+			continue;
+
+		for (int reg = 0; reg < m_registerCount; reg++)
+		{
+			if (registers[reg] != reference[reg])
+				m_divergence.differentRegisters[reg]++;
+		}
+
+		m_divergence.differentFrames++;
+
+		if (m_divergence.isDiverged)
+			continue;
+
+		int reg = 0;
+		while (registers[reg] == reference[reg]) reg++;
+
+		m_divergence.isDiverged = true;
+		m_divergence.frame = i;
+		m_divergence.songline = positions[i * 2];
+		m_divergence.row = positions[i * 2 + 1];
+		m_divergence.reg = reg;
+		m_divergence.expected = reference[reg];
+		m_divergence.value = registers[reg];
+	}
+
+	return m_divergence.differentFrames;
+}
+
+/// <summary>
+/// Write the result of the last Run as plain text: the speed of both players, then how closely the engine matched the driver.
+/// </summary>
+/// <param name="out">Output stream</param>
+void CEngineValidation::WriteReport(std::ostream& out)
+{
+	char line[256];
+	double driverFps = GetDriverFps();
+	double engineFps = GetEngineFps();
+
+	out << "Reference driver: " << m_driverName << "\n";
+	out << "Frames played: " << m_frames << ", " << (m_registerCount == 18 ? "Stereo" : "Mono") << "\n\n";
+
+	if (!m_frames)
+	{
+		out << "Nothing was played, the module could not be loaded.\n";
+		return;
+	}
+
+	snprintf(line, sizeof(line), "6502 driver: %.3f ms, %.0f frames/s\n", m_driverTime * 1000.0, driverFps);
+	out << line;
+	snprintf(line, sizeof(line), "RMTE engine: %.3f ms, %.0f frames/s\n", m_engineTime * 1000.0, engineFps);
+	out << line;
+
+	if (driverFps > 0.0)
+	{
+		snprintf(line, sizeof(line), "The engine runs %.2f times as fast as the driver\n", engineFps / driverFps);
+		out << line;
+	}
+
+	out << "\n";
+
+	if (!m_divergence.isDiverged)
+	{
+		out << "Every frame is identical\n";
+		return;
+	}
+
+	// Songlines and rows are in hexadecimal, as the tracker shows them
+	int reg = m_divergence.reg;
+	snprintf(line, sizeof(line), "Identical frames: %d of %d\n", m_frames - m_divergence.differentFrames, m_frames);
+	out << line;
+	snprintf(line, sizeof(line), "First divergence at frame %d, songline %02X row %02X, %s ($%04X) is $%02X instead of $%02X\n\n",
+		m_divergence.frame, m_divergence.songline, m_divergence.row,
+		s_registerNames[reg % 9], 0xd200 + (reg / 9) * 0x10 + reg % 9,
+		m_divergence.value, m_divergence.expected);
+	out << line;
+
+	out << "Frames with a different register:\n";
+
+	for (int i = 0; i < m_registerCount; i++)
+	{
+		snprintf(line, sizeof(line), "%s ($%04X): %d\n", s_registerNames[i % 9], 0xd200 + (i / 9) * 0x10 + i % 9, m_divergence.differentRegisters[i]);
+		out << line;
+	}
+}
@@ -0,0 +1,68 @@
+//
+// EngineValidation.h header file
+// Validation and benchmark of the native RMTE engine against the 6502 RMT driver, playing the same module in lockstep
+// There is no GUI or sound involved, the driver runs in its own CAtariEmulation context
+//
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Atari6502.h"
+#include "RmteEngine.h"
+
+#define ENGINE_VALIDATION_MAX_FRAMES	(50 * 60 * 10)		// 10 minutes of PAL frames, looping songs never end by themselves
+#define ENGINE_VALIDATION_REGISTERS		18					// AUDF1-4, AUDC1-4 and AUDCTL, for up to 2 POKEY
+
+typedef struct
+{
+	bool isDiverged;
+	int frame;				// First frame with a different register
+	int songline;			// Played by the driver on that frame
+	int row;
+	int reg;				// First different register of that frame, 0-8 for $D200-$D208, 9-17 for $D210-$D218
+	BYTE expected;			// Value written by the driver
+	BYTE value;				// Value written by the engine
+	int differentFrames;	// Frames with at least one different register, over the whole run
+	int differentRegisters[ENGINE_VALIDATION_REGISTERS];
+} TEngineDivergence;
+
+/// <summary>
+/// Plays a legacy RMT module with a 6502 driver, and the same module imported as RMTE with CRmteEngine.
+/// Every frame of POKEY registers is compared, and both are timed, so the report gives the agreement and the speed of each.
+/// </summary>
+class CEngineValidation
+{
+public:
+	CEngineValidation();
+
+	void SetDriverModule(const unsigned char* memory, WORD fromAddr, WORD toAddr, int driverVersion, const char* driverName);
+	void SetEngineModule(CModule* pModule, UINT subtune = MODULE_DEFAULT_SUBTUNE);
+
+	int Run(int maxFrames = ENGINE_VALIDATION_MAX_FRAMES);
+
+	const TEngineDivergence* GetDivergence() { return &m_divergence; };
+	double GetDriverFps() { return m_driverTime > 0.0 ? m_frames / m_driverTime : 0.0; };
+	double GetEngineFps() { return m_engineTime > 0.0 ? m_frames / m_engineTime : 0.0; };
+	void WriteReport(std::ostream& out);
+
+private:
+	const unsigned char* m_module;
+	WORD m_moduleFrom;
+	WORD m_moduleTo;
+	int m_driverVersion;
+	std::string m_driverName;
+
+	CModule* m_pModule;
+	UINT m_subtune;
+
+	int m_registerCount;		// 9 for a Mono module, 18 for a Stereo one
+	int m_frames;				// Frames played by the last Run
+	double m_driverTime;		// Seconds spent in the driver by the last Run
+	double m_engineTime;		// Seconds spent in the engine by the last Run
+	TEngineDivergence m_divergence;
+
+	static void ReadRegisters(const TPokeyFrame* pFrame, BYTE* registers);
+};
@@ -217,6 +217,12 @@ typedef unsigned long long UINT64;
 #define IOTYPE_LZSS_XEX		13
 
 #define IOTYPE_WAV			20
+#define IOTYPE_WAV_STEMS	21		// WAV mix, plus 1 mono WAV file per channel
+
+#define IOTYPE_CYCLES_CSV	30		// 6502 cycles used by every RMT driver variant, as CSV
+#define IOTYPE_DRIVER_DIFF	31		// POKEY registers of every RMT driver variant compared to the current one, as text
+#define IOTYPE_ENGINE_CHECK	32		// POKEY registers and speed of the RMTE engine compared to the current RMT driver, as text
+#define IOTYPE_LZSS_CHECK	33		// SAP-R LZSS compression of every module in the folder of the song compared to the reference compressor, as CSV
 
 #define IOTYPE_RMTE			100
 
@@ -377,6 +383,11 @@ typedef unsigned long long UINT64;
 		"XEX Atari executable + LZSS driver (*.xex)|*.xex|" \
 		"Relocatable ASM for RMTPlayer (*.asm)|*.asm|" \
 		"WAV audio file (*.wav)|*.wav|" \
+		"WAV audio file + channel stems (*.wav)|*.wav|" \
+		"6502 cycle profile of the RMT drivers (*.csv)|*.csv|" \
+		"RMT driver differences report (*.txt)|*.txt|" \
+		"RMTE engine validation report (*.txt)|*.txt|" \
+		"SAP-R LZSS compression check of the song folder (*.csv)|*.csv|" \
 		"|"
 #define FILE_EXPORT_FILTER_IDX_STRIPPED_RMT 1
 #define FILE_EXPORT_FILTER_IDX_SIMPLE_ASM 2
@@ -386,10 +397,15 @@ typedef unsigned long long UINT64;
 #define FILE_EXPORT_FILTER_IDX_XEX 6
 #define FILE_EXPORT_FILTER_IDX_RELOC_ASM 7
 #define FILE_EXPORT_FILTER_IDX_WAV 8
+#define FILE_EXPORT_FILTER_IDX_WAV_STEMS 9
+#define FILE_EXPORT_FILTER_IDX_CYCLES_CSV 10
+#define FILE_EXPORT_FILTER_IDX_DRIVER_DIFF 11
+#define FILE_EXPORT_FILTER_IDX_ENGINE_CHECK 12
+#define FILE_EXPORT_FILTER_IDX_LZSS_CHECK 13
 #define FILE_EXPORT_FILTER_IDX_MIN FILE_EXPORT_FILTER_IDX_STRIPPED_RMT
-#define FILE_EXPORT_FILTER_IDX_MAX FILE_EXPORT_FILTER_IDX_WAV
-#define FILE_EXPORT_EXTENSIONS_ARRAY { ".rmt",".asm",".sapr",".lzss",".sap",".xex",".asm",".wav" };
-#define FILE_EXPORT_EXTENSIONS_LENGTH_ARRAY { 4, 4, 5, 5, 4, 4, 4, 4}
+#define FILE_EXPORT_FILTER_IDX_MAX FILE_EXPORT_FILTER_IDX_LZSS_CHECK
+#define FILE_EXPORT_EXTENSIONS_ARRAY { ".rmt",".asm",".sapr",".lzss",".sap",".xex",".asm",".wav",".wav",".csv",".txt",".txt",".csv" };
+#define FILE_EXPORT_EXTENSIONS_LENGTH_ARRAY { 4, 4, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 4}
 
 // ----------------------------------------------------------------------------
 // SAP-R optimisations pattern, for optimal data compression to LZSS 
@@ -408,6 +424,7 @@ typedef unsigned long long UINT64;
 #define SAPR_OPTIMISATIONS_AUDCTL_AUDF		6
 #define SAPR_OPTIMISATIONS_ALL				7
 #define SAPR_OPTIMISATIONS_COUNT			8
+#define SAPR_OPTIMISATIONS_PER_STREAM		8		// Not a pattern: each stream uses the optimisation giving it the fewest bits, see CCompressLzss::GetStreamOptimisations
 
 // ----------------------------------------------------------------------------
 // RMT tracker driver binaries versions
@@ -14,12 +14,11 @@
 CString g_aboutpokey;
 CString g_about6502;
 
-HINSTANCE g_c6502_dll = NULL;
-
 BOOL volatile g_is6502 = 0;
 BOOL volatile g_rmtroutine;
 
 unsigned char g_atarimem[65536];
+CAtariEmulation g_atari(g_atarimem);		// The tracker emulation context, running in g_atarimem
 
 int g_channelon[SONGTRACKS];	// TODO: Move elsewhere or delete
 int g_rmtinstr[SONGTRACKS];		// TODO: Move elsewhere or delete
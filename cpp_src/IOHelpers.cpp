@@ -114,3 +114,15 @@ UINT CRC32(BYTE* data, UINT64 size)
 	// Invert all bits and return the Checksum
 	return crc ^ INVALID;
 }
+
+// 64-bit FNV-1a hash, much quicker than CRC32, used for detecting changes or repeats in large amounts of data
+// The hash of a previous call may be passed, to continue hashing over several blocks of data
+UINT64 FNV1a(const void* data, UINT64 size, UINT64 hash)
+{
+	const BYTE* bytes = (const BYTE*)data;
+
+	for (UINT64 i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * FNV1A_PRIME;
+
+	return hash;
+}
@@ -12,4 +12,9 @@ extern char CharL4(unsigned char b);
 extern void Trimstr(char* txt);
 extern int Hexstr(char* txt, int len);
 
-extern UINT CRC32(BYTE* data, UINT64 size);
\ No newline at end of file
+extern UINT CRC32(BYTE* data, UINT64 size);
+
+#define FNV1A_OFFSET_BASIS	0xCBF29CE484222325ULL
+#define FNV1A_PRIME			0x00000100000001B3ULL
+
+extern UINT64 FNV1a(const void* data, UINT64 size, UINT64 hash = FNV1A_OFFSET_BASIS);
\ No newline at end of file
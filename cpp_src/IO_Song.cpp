@@ -13,6 +13,9 @@
 #include "MainFrm.h"
 
 #include "Atari6502.h"
+#include "CycleProfiler.h"
+#include "DriverDiff.h"
+#include "EngineValidation.h"
 #include "XPokey.h"
 #include "PokeyStream.h"
 #include "IOHelpers.h"
@@ -789,6 +792,11 @@ void CSong::FileExportAs()
 	if (m_lastExportType == IOTYPE_LZSS_XEX) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_XEX;
 	if (m_lastExportType == IOTYPE_ASM_RMTPLAYER) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_RELOC_ASM;
 	if (m_lastExportType == IOTYPE_WAV) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_WAV;
+	if (m_lastExportType == IOTYPE_WAV_STEMS) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_WAV_STEMS;
+	if (m_lastExportType == IOTYPE_CYCLES_CSV) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_CYCLES_CSV;
+	if (m_lastExportType == IOTYPE_DRIVER_DIFF) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_DRIVER_DIFF;
+	if (m_lastExportType == IOTYPE_ENGINE_CHECK) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_ENGINE_CHECK;
+	if (m_lastExportType == IOTYPE_LZSS_CHECK) dlg.m_ofn.nFilterIndex = FILE_EXPORT_FILTER_IDX_LZSS_CHECK;
 
 	// If not ok, nothing will be saved
 	if (dlg.DoModal() == IDOK)
@@ -854,6 +862,26 @@ void CSong::FileExportAs()
 				m_lastExportType = IOTYPE_WAV;
 				break;
 
+			case FILE_EXPORT_FILTER_IDX_WAV_STEMS:
+				m_lastExportType = IOTYPE_WAV_STEMS;
+				break;
+
+			case FILE_EXPORT_FILTER_IDX_CYCLES_CSV:
+				m_lastExportType = IOTYPE_CYCLES_CSV;
+				break;
+
+			case FILE_EXPORT_FILTER_IDX_DRIVER_DIFF:
+				m_lastExportType = IOTYPE_DRIVER_DIFF;
+				break;
+
+			case FILE_EXPORT_FILTER_IDX_ENGINE_CHECK:
+				m_lastExportType = IOTYPE_ENGINE_CHECK;
+				break;
+
+			case FILE_EXPORT_FILTER_IDX_LZSS_CHECK:
+				m_lastExportType = IOTYPE_LZSS_CHECK;
+				break;
+
 		}
 
 		// Save the file using the set parameters 
@@ -1561,11 +1589,16 @@ bool CSong::ExportV2(std::ofstream& ou, int iotype, LPCTSTR filename)
 		case IOTYPE_RMTSTRIPPED: return ExportAsStrippedRMT(ou, &exportDesc, filename);
 		case IOTYPE_ASM: return ExportAsAsm(ou, &exportDesc);
 		case IOTYPE_ASM_RMTPLAYER: return ExportAsRelocatableAsmForRmtPlayer(ou, &exportDesc);
-		case IOTYPE_SAPR: return ExportSAP_R(ou);
+		case IOTYPE_SAPR: return ExportSAP_R(ou, filename);
 		case IOTYPE_LZSS: return ExportLZSS(ou, filename);
 		case IOTYPE_LZSS_SAP: return ExportLZSS_SAP(ou);
 		case IOTYPE_LZSS_XEX: return ExportLZSS_XEX(ou);
 		case IOTYPE_WAV: return ExportWav(ou, filename);
+		case IOTYPE_WAV_STEMS: return ExportWav(ou, filename, true);
+		case IOTYPE_CYCLES_CSV: return ExportCycleProfile(ou, &exportDesc);
+		case IOTYPE_DRIVER_DIFF: return ExportDriverDiff(ou, &exportDesc);
+		case IOTYPE_ENGINE_CHECK: return ExportEngineValidation(ou, &exportDesc);
+		case IOTYPE_LZSS_CHECK: return ExportLzssValidation(ou);
 	}
 
 	return false;	// Failed
@@ -1841,12 +1874,15 @@ bool CSong::WriteToXEX(struct TExportMetadata* metadata)
 	return true;
 }
 
-bool CSong::ExportWav(std::ofstream& ou, LPCTSTR filename)
+bool CSong::ExportWav(std::ofstream& ou, LPCTSTR filename, bool isStems)
 {
 	CWaveFile wavefile{};
+	CWaveFile stemfile[POKEY_CHIP_COUNT * POKEY_CHANNELS]{};
+	int stems = isStems ? g_tracks4_8 : 0;	// 1 mono stem per channel, rendered in the same pass as the mix
 
 	BYTE* buffer = NULL;
-	BYTE* streambuffer = NULL;
+	const BYTE* streambuffer = NULL;
+	TStreamCursor cursor;
 	WAVEFORMATEX* wfm = NULL;
 	int length = 0, frames = 0, offset = 0;
 	int frameSize = (g_tracks4_8 == 8) ? 18 : 9;	// SAP-R bytes to copy, Stereo doubles the number
@@ -1865,23 +1901,47 @@ bool CSong::ExportWav(std::ofstream& ou, LPCTSTR filename)
 		return false;
 	}
 
-	// Dump the POKEY registers from full song playback
-	DumpSongToPokeyBuffer();
+	// The stems are named after the mix, "song.wav" gives "song_ch1.wav", "song_ch2.wav", etc
+	for (int i = 0; i < stems; i++)
+	{
+		CString stemname = filename;
+		stemname.Format("%s_ch%d.wav", (LPCTSTR)stemname.Left(stemname.GetLength() - 4), i + 1);
+
+		if (!stemfile[i].OpenFile((LPTSTR)(LPCTSTR)stemname, wfm->nSamplesPerSec, wfm->wBitsPerSample, 1))
+		{
+			MessageBox(g_hwnd, "Wav file could not be created: " + stemname, "ExportWav", MB_ICONWARNING);
+			for (int j = 0; j < i; j++) stemfile[j].CloseFile();
+			wavefile.CloseFile();
+			return false;
+		}
+	}
+
+	// Dump the POKEY registers from full song playback, nothing is rendered from an incomplete recording
+	if (!DumpSongToPokeyBuffer())
+	{
+		g_PokeyStream.FinishedRecording();
+		for (int i = 0; i < stems; i++) stemfile[i].CloseFile();
+		wavefile.CloseFile();
+		return false;
+	}
 
 	// Busy writing! TODO: Fix the timing overlap causing conflicts
 	g_PokeyStream.SetState(CPokeyStream::WRITE);
 
 	Atari_InitRMTRoutine();	// Reset the Atari memory 
 	SetChannelOnOff(-1, 1);	// Unmute all channels
+	g_Pokey.SetStems(isStems);
 
 	// Create the sound buffer to copy from and to
 	buffer = new BYTE[BUFFER_SIZE];
-	memset(buffer, 0x80, BUFFER_SIZE);
+	memset(buffer, 0, BUFFER_SIZE);
 
-	while (frames < g_PokeyStream.GetFirstCountPoint())
+	// The frames are decoded one after the other, from the first one
+	g_PokeyStream.SeekFrame(&cursor, 0);
+
+	while (frames < g_PokeyStream.GetFirstCountPoint() && (streambuffer = g_PokeyStream.ReadFrame(&cursor)))
 	{
 		// Copy the SAP-R bytes to g_atarimem for this frame
-		streambuffer = g_PokeyStream.GetStreamBuffer() + frames * frameSize;
 
 		//for (int i = 0; i < frameSize; i++)
 		//{
@@ -1904,6 +1964,10 @@ bool CSong::ExportWav(std::ofstream& ou, LPCTSTR filename)
 		// Write the buffer to WAV file
 		wavefile.WriteWave(buffer, length);
 
+		// Each stem has as many samples as the mix, in Mono
+		for (int i = 0; i < stems; i++)
+			stemfile[i].WriteWave((BYTE*)g_Pokey.GetStemBuffer(i), length / BLOCK_ALIGN * sizeof(int16_t));
+
 		// Update the PokeyStream offset for the next frame
 		frames++;
 	}
@@ -1912,14 +1976,193 @@ bool CSong::ExportWav(std::ofstream& ou, LPCTSTR filename)
 	g_PokeyStream.FinishedRecording();
 
 	// Finished doing WAV things...
+	g_Pokey.SetStems(false);
 	wavefile.CloseFile();
 
+	for (int i = 0; i < stems; i++)
+		stemfile[i].CloseFile();
+
 	// Also make sure to delete the buffer once it's no longer needed
 	delete buffer;
 
 	return true;
 }
 
+/// <summary>
+/// Play the song once, up to its loop point, through every RMT driver variant, and write the 6502 cycles used on each frame as CSV.
+/// The report has min/avg/max and a histogram of RMT_P3, RMT_SETPOKEY and the whole frame, for each driver,
+/// followed by the worst frames with their songline and row, and the frames per second each driver is emulated at.
+/// Every driver is also played by a 6502 with the code cache, in lockstep, which must play the very same frames,
+/// and is timed the same way.
+/// Only the legacy RMT modules can be played by the drivers on their own.
+/// </summary>
+/// <param name="ou">Output stream</param>
+/// <param name="exportDesc">Module made by ExportV2</param>
+/// <returns>true = saved ok</returns>
+bool CSong::ExportCycleProfile(std::ofstream& ou, tExportDescription* exportDesc)
+{
+	if (g_isRMTE)
+	{
+		MessageBox(g_hwnd, "The RMT drivers can only play legacy RMT modules.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	// The dump finds the loop point, every driver then plays as many frames
+	if (!DumpSongToPokeyBuffer())
+	{
+		g_PokeyStream.FinishedRecording();
+		return false;
+	}
+
+	int frames = g_PokeyStream.GetFirstCountPoint();
+	g_PokeyStream.FinishedRecording();
+
+	CCycleProfiler profiler;
+	CString songname = m_songname;
+	songname.TrimRight();
+
+	for (const TTrackerDriver& driver : g_trackerDrivers)
+	{
+		// Every driver gets its own Atari, the tracker playback is left alone
+		CAtariEmulation atari;
+		CAtariEmulation cached;
+		cached.GetCpu()->SetCodeCache(true);
+
+		for (CAtariEmulation* pAtari : { &atari, &cached })
+		{
+			pAtari->LoadRMTRoutines(driver.version);
+			pAtari->LoadModule(exportDesc->mem, exportDesc->targetAddrOfModule, exportDesc->firstByteAfterModule - 1);
+			pAtari->InitModule(0);
+		}
+
+		profiler.Begin(songname, driver.name);
+		bool isCacheIdentical = true;
+
+		for (int i = 0; i < frames; i++)
+		{
+			int songline, row;
+			atari.PlayModule();
+			atari.GetModulePosition(songline, row);
+			profiler.SetPosition(songline, row);
+			profiler.AddFrame(atari.GetP3Cycles(), atari.GetSetPokeyCycles());
+
+			cached.PlayModule();
+			isCacheIdentical = isCacheIdentical && !memcmp(atari.GetMemory(), cached.GetMemory(), CPU6502_MEMORY_SIZE)
+				&& atari.GetP3Cycles() == cached.GetP3Cycles() && atari.GetSetPokeyCycles() == cached.GetSetPokeyCycles();
+		}
+
+		// The song is played again from the start, only timed, for the speed of the 6502 emulation
+		int speedFrames = max(frames, CYCLE_PROFILE_SPEED_FRAMES);
+		atari.InitModule(0);
+		cached.InitModule(0);
+		double framesPerSecond = atari.MeasureModuleSpeed(speedFrames);
+		profiler.SetSpeed(framesPerSecond, cached.MeasureModuleSpeed(speedFrames), isCacheIdentical);
+	}
+
+	profiler.WriteCsv(ou);
+
+	return true;
+}
+
+/// <summary>
+/// Play the module through every RMT driver variant in lockstep, and report where each one first writes
+/// different POKEY registers than the driver the tracker is using.
+/// Only the legacy RMT modules can be played by the drivers on their own.
+/// </summary>
+/// <param name="ou">Output stream</param>
+/// <param name="exportDesc">Module made by ExportV2</param>
+/// <returns>true = saved ok</returns>
+bool CSong::ExportDriverDiff(std::ofstream& ou, tExportDescription* exportDesc)
+{
+	if (g_isRMTE)
+	{
+		MessageBox(g_hwnd, "The RMT drivers can only play legacy RMT modules.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	CDriverDiff diff;
+
+	// The driver used by the tracker is the reference
+	for (const TTrackerDriver& driver : g_trackerDrivers)
+	{
+		if (driver.version == g_trackerDriverVersion)
+			diff.AddDriver(driver.version, driver.name);
+	}
+
+	for (const TTrackerDriver& driver : g_trackerDrivers)
+	{
+		if (driver.version != g_trackerDriverVersion)
+			diff.AddDriver(driver.version, driver.name);
+	}
+
+	diff.SetModule(exportDesc->mem, exportDesc->targetAddrOfModule, exportDesc->firstByteAfterModule - 1);
+	diff.Run();
+	diff.WriteReport(ou);
+
+	return true;
+}
+
+/// <summary>
+/// Play the module with the RMT driver the tracker is using, and with the native RMTE engine after importing it,
+/// then report how fast each of them is, and where the engine first writes different POKEY registers than the driver.
+/// The module goes through a temporary .rmt file, since the legacy import reads from a file.
+/// </summary>
+/// <param name="ou">Output stream</param>
+/// <param name="exportDesc">Module made by ExportV2</param>
+/// <returns>true = saved ok</returns>
+bool CSong::ExportEngineValidation(std::ofstream& ou, tExportDescription* exportDesc)
+{
+	if (g_isRMTE)
+	{
+		MessageBox(g_hwnd, "The RMT drivers can only play legacy RMT modules.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	const char* driverName = GetTrackerDriverName(g_trackerDriverVersion);
+
+	if (!driverName)
+		driverName = "Tracker driver";
+
+	char tempPath[MAX_PATH], tempFile[MAX_PATH];
+
+	if (!GetTempPath(MAX_PATH, tempPath) || !GetTempFileName(tempPath, "rmt", 0, tempFile))
+	{
+		MessageBox(g_hwnd, "The temporary RMT module could not be created.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	// Only the module block is needed by the import, the names are left out
+	std::ofstream rmt(tempFile, std::ios::binary);
+	SaveBinaryBlock(rmt, exportDesc->mem, exportDesc->targetAddrOfModule, exportDesc->firstByteAfterModule - 1, TRUE);
+	rmt.close();
+
+	// The import sets the global number of channels, which is the same for this song anyway
+	int tracks4_8 = g_tracks4_8;
+	CModule* pModule = new CModule();
+	std::ifstream in(tempFile, std::ios::binary);
+	bool isImported = pModule->ImportLegacyRMT(in, false);
+	in.close();
+	DeleteFile(tempFile);
+	g_tracks4_8 = tracks4_8;
+
+	if (!isImported)
+	{
+		delete pModule;
+		MessageBox(g_hwnd, "The RMT module could not be imported as RMTE.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	CEngineValidation validation;
+	validation.SetDriverModule(exportDesc->mem, exportDesc->targetAddrOfModule, exportDesc->firstByteAfterModule - 1, g_trackerDriverVersion, driverName);
+	validation.SetEngineModule(pModule);
+	validation.Run();
+	validation.WriteReport(ou);
+
+	delete pModule;
+
+	return true;
+}
+
 // Create a RMTE Module file
 bool CSong::SaveRMTE(std::ofstream& ou)
 {
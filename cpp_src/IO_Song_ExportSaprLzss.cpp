@@ -1,6 +1,8 @@
 #include "StdAfx.h"
 #include <fstream>
+#include <filesystem>
 #include <memory.h>
+#include <psapi.h>
 
 #include "GuiHelpers.h"
 #include "Song.h"
@@ -11,6 +13,7 @@
 #include "Atari6502.h"
 #include "XPokey.h"
 #include "PokeyStream.h"
+#include "SaprDumper.h"
 
 #include "global.h"
 
@@ -18,6 +21,8 @@
 
 #include "lzssp.h"
 #include "lzss_sap.h"
+#include "LzssValidation.h"
+#include "IOHelpers.h"
 
 extern CInstruments	g_Instruments;
 extern CPokeyStream g_PokeyStream;
@@ -42,15 +47,18 @@ extern CModule g_Module;
 
 #define VU_PLAYER_SOUNGTIMER	LZSSP_SONGTIMERCOUNT
 
+#define SAPR_FRAMES_FIELD_WIDTH	20						// Room left in the SAP-R header for the number of frames, and the closing bracket after it
+
 /// <summary>
 /// Export the Pokey registers to the SAP Type R format (data stream)
+/// The frames are written into the file while the song is played, so the memory used does not depend on its length.
+/// The header is written first, with room left for the number of frames, which is only known once the loop point is found.
 /// </summary>
 /// <param name="ou">Output stream</param>
+/// <param name="filename">Filename of the output, the file is cut if more frames were written than needed</param>
 /// <returns>true if the file was written</returns>
-bool CSong::ExportSAP_R(std::ofstream& ou)
+bool CSong::ExportSAP_R(std::ofstream& ou, LPCTSTR filename)
 {
-	DumpSongToPokeyBuffer();
-
 	CString s;
 	CExpSAPDlg dlg;
 	s = m_songname;
@@ -64,11 +72,7 @@ bool CSong::ExportSAP_R(std::ofstream& ou)
 	dlg.m_date = time.Format("%d/%m/%Y");
 
 	if (dlg.DoModal() != IDOK)
-	{
-		// Clear the Pokey dumper memory and reset RMT routines
-		g_PokeyStream.FinishedRecording();
 		return false;
-	}
 
 	ou << "SAP" << EOL;
 
@@ -82,7 +86,10 @@ bool CSong::ExportSAP_R(std::ofstream& ou)
 	s.TrimRight();
 	s.Replace('"', '\'');
 
-	ou << "NAME \"" << s << " (" << g_PokeyStream.GetFirstCountPoint() << " frames)" << "\"" << EOL;	//display the total frames recorded
+	// The total frames recorded are displayed in the name, the field is written again once the dump is done
+	ou << "NAME \"" << s << " (";
+	std::streampos framesPosition = ou.tellp();
+	ou << CString(' ', SAPR_FRAMES_FIELD_WIDTH) << "\"" << EOL;
 
 	s = dlg.m_date;
 	s.TrimRight();
@@ -130,13 +137,32 @@ bool CSong::ExportSAP_R(std::ofstream& ou)
 	// A double EOL is necessary for making the SAP-R export functional
 	ou << EOL;
 
-	// Write the SAP-R stream to the output file defined in the path dialog with the data specified above
-	g_PokeyStream.WriteToFile(ou, g_PokeyStream.GetFirstCountPoint(), 0);
+	// Write the SAP-R stream to the output file defined in the path dialog with the data specified above, as it is recorded
+	std::streampos streamPosition = ou.tellp();
+	g_PokeyStream.SetOutput(&ou);
+	bool isDumped = DumpSongToPokeyBuffer();
+
+	int frames = g_PokeyStream.GetFirstCountPoint();
+	bool isWritten = isDumped && frames > 0 && g_PokeyStream.GetWrittenFrames() >= frames && ou.good();
+
+	// The spaces left over stay inside the quotation marks, where they are not visible
+	s.Format("%i frames)", frames);
+	ou.seekp(framesPosition);
+	ou << s << CString(' ', SAPR_FRAMES_FIELD_WIDTH - s.GetLength());
+	ou.close();
+
+	// The frames recorded past the loop point, while it was not found yet, are cut off the end of the file
+	if (isWritten && g_PokeyStream.GetWrittenFrames() > frames)
+	{
+		std::error_code error;
+		std::filesystem::resize_file(filename, (UINT64)streamPosition + (UINT64)frames * g_PokeyStream.GetFrameSize(), error);
+		isWritten = !error;
+	}
 
 	// Clear the memory and reset the dumper to its initial setup for the next time it will be called
 	g_PokeyStream.FinishedRecording();
 
-	return true;
+	return isWritten;
 }
 
 /// <summary>
@@ -147,14 +173,16 @@ bool CSong::ExportSAP_R(std::ofstream& ou)
 /// <returns></returns>
 bool CSong::ExportLZSS(std::ofstream& ou, LPCTSTR filename)
 {
-	DumpSongToPokeyBuffer();
+	if (!DumpSongToPokeyBuffer())
+	{
+		g_PokeyStream.FinishedRecording();
+		return false;
+	}
 
 	SetStatusBarText("Compressing data ...");
 
-	int frameSize = (g_tracks4_8 == 8) ? 18 : 9;	//SAP-R bytes to copy, Stereo doubles the number
-
-	// Now, create LZSS files using the SAP-R dump created earlier
-	unsigned char compressedData[65536];
+	// Now, create LZSS files using the SAP-R dump created earlier, the buffer grows with the compressed data
+	std::vector<unsigned char> compressedData;
 
 	CCompressLzss lzssData;
 
@@ -165,29 +193,31 @@ bool CSong::ExportLZSS(std::ofstream& ou, LPCTSTR filename)
 	fn = fn.Left(fn.GetLength() - 5);	// In order to keep the filename without the extention 
 
 	// Full tune playback up to its loop point
-	int full = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer(), g_PokeyStream.GetFirstCountPoint() * frameSize, compressedData);
+	int full = lzssData.LZSS_SAP(&g_PokeyStream, 0, g_PokeyStream.GetFirstCountPoint(), compressedData);
 	if (full > 16)
 	{
 		//ou.open(fn + "_FULL.lzss", ios::binary);	// Create a new file for the Full section
-		ou.write((char*)compressedData, full);	// Write the buffer contents to the export file
+		ou.write((char*)compressedData.data(), full);	// Write the buffer contents to the export file
 	}
 	ou.close();	// Close the file, if successful, it should not be empty 
 
 	// Intro section playback, up to the start of the detected loop point
-	int intro = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer(), g_PokeyStream.GetThirdCountPoint() * frameSize, compressedData);
+	compressedData.clear();
+	int intro = lzssData.LZSS_SAP(&g_PokeyStream, 0, g_PokeyStream.GetThirdCountPoint(), compressedData);
 	if (intro > 16)
 	{
 		ou.open(fn + "_INTRO.lzss", std::ios::binary);	// Create a new file for the Intro section
-		ou.write((char*)compressedData, intro);		// Write the buffer contents to the export file
+		ou.write((char*)compressedData.data(), intro);		// Write the buffer contents to the export file
 	}
 	ou.close();	// Close the file, if successful, it should not be empty 
 
 	// Looped section playback, this part is virtually seamless to itself
-	int loop = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer() + (g_PokeyStream.GetFirstCountPoint() * frameSize), g_PokeyStream.GetSecondCountPoint() * frameSize, compressedData);
+	compressedData.clear();
+	int loop = lzssData.LZSS_SAP(&g_PokeyStream, g_PokeyStream.GetThirdCountPoint(), g_PokeyStream.GetSecondCountPoint(), compressedData);
 	if (loop > 16)
 	{
 		ou.open(fn + "_LOOP.lzss", std::ios::binary);	// Create a new file for the Loop section
-		ou.write((char*)compressedData, loop);		// Write the buffer contents to the export file
+		ou.write((char*)compressedData.data(), loop);		// Write the buffer contents to the export file
 	}
 	ou.close();	// Close the file, if successful, it should not be empty 
 
@@ -210,7 +240,11 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 {
 	// TODO: everything related to exporting the stream buffer into small files and compress them to LZSS
 
-	DumpSongToPokeyBuffer();
+	if (!DumpSongToPokeyBuffer())
+	{
+		g_PokeyStream.FinishedRecording();
+		return false;
+	}
 
 	SetStatusBarText("Compressing data ...");
 
@@ -223,8 +257,8 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 	int listOfMatches[256];
 	memset(listOfMatches, -1, sizeof(listOfMatches));
 
-	// Now, create LZSS files using the SAP-R dump created earlier
-	unsigned char compressedData[65536];
+	// Now, create LZSS files using the SAP-R dump created earlier, the buffer grows with the compressed data
+	std::vector<unsigned char> compressedData;
 
 	CCompressLzss lzssData;
 
@@ -233,13 +267,17 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 	fn = fn.Left(fn.GetLength() - 5);	// In order to keep the filename without the extention 
 	ou.close();
 
+	// The songlines are decoded from the stream to be compared
+	std::vector<unsigned char> buff1, buff2;
+
 	// For all songlines to index, process with comparisons and find duplicates 
 	while (indexToSongline < songlineCount)
 	{
 		int bytesCount = g_PokeyStream.GetFramesPerSongline(indexToSongline) * frameSize;
 
 		int index1 = g_PokeyStream.GetOffsetPerSongline(indexToSongline);
-		unsigned char* buff1 = g_PokeyStream.GetStreamBuffer() + (index1 * frameSize);
+		buff1.resize(bytesCount);
+		g_PokeyStream.ReadFrames(index1, g_PokeyStream.GetFramesPerSongline(indexToSongline), buff1.data());
 
 		// If there is no index already, assume the Index1 to be the first occurence 
 		if (listOfMatches[indexToSongline] == -1)
@@ -253,10 +291,11 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 				continue;
 
 			int index2 = g_PokeyStream.GetOffsetPerSongline(i);
-			unsigned char* buff2 = g_PokeyStream.GetStreamBuffer() + (index2 * frameSize);
+			buff2.resize(bytesCount);
+			g_PokeyStream.ReadFrames(index2, g_PokeyStream.GetFramesPerSongline(i), buff2.data());
 
 			// If there is a match, the second index will adopt the offset of the first index
-			if (!memcmp(buff1, buff2, bytesCount))
+			if (buff1 == buff2)
 				listOfMatches[i] = index1;
 		}
 
@@ -293,11 +332,12 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 
 	for (int i = 0; i < songlineCount; i++)
 	{
+		compressedData.clear();
 		ou << "Index: " << PADHEX(2, i);
 		ou << ",\t Offset (real): " << PADHEX(4, g_PokeyStream.GetOffsetPerSongline(i));
 		ou << ",\t Offset (dupe): " << PADHEX(4, listOfMatches[i]);
 		ou << ",\t Bytes (uncompressed): " << PADDEC(1, g_PokeyStream.GetFramesPerSongline(i) * frameSize);
-		ou << ",\t Bytes (LZ16 compressed): " << PADDEC(1, lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer() + (g_PokeyStream.GetOffsetPerSongline(i) * frameSize), g_PokeyStream.GetFramesPerSongline(i) * frameSize, compressedData));
+		ou << ",\t Bytes (LZ16 compressed): " << PADDEC(1, lzssData.LZSS_SAP(&g_PokeyStream, g_PokeyStream.GetOffsetPerSongline(i), g_PokeyStream.GetFramesPerSongline(i), compressedData));
 		ou << std::endl;
 	}
 
@@ -317,22 +357,24 @@ bool CSong::ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename)
 /// <returns>true if the file was written</returns>
 bool CSong::ExportLZSS_SAP(std::ofstream& ou)
 {
-	DumpSongToPokeyBuffer();
+	if (!DumpSongToPokeyBuffer())
+	{
+		g_PokeyStream.FinishedRecording();
+		return false;
+	}
 
 	SetStatusBarText("Compressing data ...");
 
-	int frameSize = (g_tracks4_8 == 8) ? 18 : 9;	//SAP-R bytes to copy, Stereo doubles the number
-
-	unsigned char buff1[65536];			// LZSS buffers for each ones of the tune parts being reconstructed
-	unsigned char buff2[65536];			// they are used for parts labeled: full, intro, and loop 
-	unsigned char buff3[65536];			// a LZSS export will typically make use of intro and loop only, unless specified otherwise
+	std::vector<unsigned char> buff1;	// LZSS buffers for each ones of the tune parts being reconstructed
+	std::vector<unsigned char> buff2;	// they are used for parts labeled: full, intro, and loop 
+	std::vector<unsigned char> buff3;	// a LZSS export will typically make use of intro and loop only, unless specified otherwise
 
 	CCompressLzss lzssData;
 
 	// Now, create LZSS files using the SAP-R dump created earlier
-	int full = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer(), g_PokeyStream.GetFirstCountPoint() * frameSize, buff1);
-	int intro = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer(), g_PokeyStream.GetThirdCountPoint() * frameSize, buff2);
-	int loop = lzssData.LZSS_SAP(g_PokeyStream.GetStreamBuffer() + (g_PokeyStream.GetFirstCountPoint() * frameSize), g_PokeyStream.GetSecondCountPoint() * frameSize, buff3);
+	int full = lzssData.LZSS_SAP(&g_PokeyStream, 0, g_PokeyStream.GetFirstCountPoint(), buff1);
+	int intro = lzssData.LZSS_SAP(&g_PokeyStream, 0, g_PokeyStream.GetThirdCountPoint(), buff2);
+	int loop = lzssData.LZSS_SAP(&g_PokeyStream, g_PokeyStream.GetThirdCountPoint(), g_PokeyStream.GetSecondCountPoint(), buff3);
 
 	g_PokeyStream.FinishedRecording();	// Clear the SAP-R dumper memory and reset RMT routines
 
@@ -514,13 +556,13 @@ bool CSong::ExportLZSS_SAP(std::ofstream& ou)
 
 	if (intro > 16)
 	{
-		memcpy(mem + targetAddrOfModule, buff2, intro);
-		memcpy(mem + lzss_offset, buff3, loop);
+		memcpy(mem + targetAddrOfModule, buff2.data(), intro);
+		memcpy(mem + lzss_offset, buff3.data(), loop);
 	}
 	else
 	{
-		//memcpy(mem + targetAddrOfModule, buff1, full);
-		memcpy(mem + lzss_offset, buff3, loop);
+		//memcpy(mem + targetAddrOfModule, buff1.data(), full);
+		memcpy(mem + lzss_offset, buff3.data(), loop);
 	}
 
 	// Overwrite the LZSS data region with both the pointers for subtunes index, and the actual LZSS streams until the end of file
@@ -539,7 +581,6 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 	CString s, t;
 
 	WORD addressFrom, addressTo;
-	BYTE* buff2, * buff3;
 
 	//int subsongs = GetSubsongParts(t);
 	int subsongs = g_Module.GetSubtuneCount();
@@ -552,7 +593,6 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 	int lzss_total = 0;	// Final offset for LZSS bytes to export
 	int framescount = 0;
 
-	int frameSize = (g_tracks4_8 == 8) ? 18 : 9;	// SAP-R bytes to copy, Stereo doubles the number
 	int section = VU_PLAYER_SECTION;
 	int sequence = VU_PLAYER_SEQUENCE;
 
@@ -577,27 +617,39 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 	if (!CreateExportMetadata(IOTYPE_LZSS_XEX, &metadata))
 		return false;
 
-	// LZSS buffers for each ones of the tune parts being reconstructed
-	buff2 = new BYTE[0xFFFFF];
-	buff3 = new BYTE[0xFFFFF];
+	// LZSS buffers for each ones of the tune parts being reconstructed, they grow with the compressed data
+	// Each part is compressed in chunks, with the offset of every chunk, a section of its own for VUPlayer
+	std::vector<unsigned char> buff2, buff3;
+	std::vector<int> chunks2, chunks3;
 
 	while (count < subsongs)
 	{
 		// a LZSS export will typically make use of intro and loop only, unless specified otherwise
 		int intro = 0, loop = 0;
+		buff2.clear();
+		buff3.clear();
+		chunks2.clear();
+		chunks3.clear();
 
 		//DumpSongToPokeyBuffer(MPLAY_FROM, subtune[count], 0);
-		DumpSongToPokeyBuffer(MPLAY_START, count);
+		if (!DumpSongToPokeyBuffer(MPLAY_START, count))
+		{
+			g_PokeyStream.FinishedRecording();
+			return false;
+		}
 
 		//SetStatusBarText("Compressing data ...");
 
+		// Room left for the subtune below $C000, a song too long for it is only compressed until the chunks overflow it, see the check below
+		int room = 0xC000 - (VU_PLAYER_SONGDATA + lzss_chunk);
+
 		// There is an Intro section 
 		if (g_PokeyStream.GetThirdCountPoint())
-			intro = BruteforceOptimalLZSS(g_PokeyStream.GetStreamBuffer(), g_PokeyStream.GetThirdCountPoint() * frameSize, buff2);
+			intro = BruteforceOptimalLZSS(0, g_PokeyStream.GetThirdCountPoint(), buff2, chunks2, room);
 
 		// There is a Loop section
 		if (g_PokeyStream.GetFirstCountPoint())
-			loop = BruteforceOptimalLZSS(g_PokeyStream.GetStreamBuffer() + (g_PokeyStream.GetFirstCountPoint() * frameSize), g_PokeyStream.GetSecondCountPoint() * frameSize, buff3);
+			loop = BruteforceOptimalLZSS(g_PokeyStream.GetThirdCountPoint(), g_PokeyStream.GetSecondCountPoint(), buff3, chunks3, room - intro);
 
 		// Add the number of frames recorded to the total count
 		framescount += g_PokeyStream.GetFirstCountPoint();	
@@ -628,6 +680,7 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 		int subtunetimetotal = 0xFFFFFF / g_PokeyStream.GetFirstCountPoint();
 		int subtunelooppoint = subtunetimetotal * g_PokeyStream.GetThirdCountPoint();
 		int chunk = 0;
+		int loopChunk = 0;
 
 		mem[index + 0] = section & 0xFF;
 		mem[index + 1] = section >> 8;
@@ -638,37 +691,44 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 		mem[timerindex + 2] = subtunetimetotal & 0xFF;
 		mem[timerindex + 3] = subtunelooppoint >> 16;
 
-		// If there is an Intro section...
+		// If there is an Intro section, each of its chunks is played in sequence
 		if (intro)
 		{
-			memcpy(mem + targetAddrOfModule, buff2, intro);
+			memcpy(mem + targetAddrOfModule, buff2.data(), intro);
 			lzss_chunk += intro;
-			mem[section + 0] = targetAddrOfModule & 0xFF;
-			mem[section + 1] = targetAddrOfModule >> 8;
-			mem[sequence] = chunk;
-			section += 2;
-			sequence += 1;
-			chunk += 1;
+			for (int restartPoint : chunks2)
+			{
+				mem[section + 0] = (targetAddrOfModule + restartPoint) & 0xFF;
+				mem[section + 1] = (targetAddrOfModule + restartPoint) >> 8;
+				mem[sequence] = chunk;
+				section += 2;
+				sequence += 1;
+				chunk += 1;
+			}
 		}
 
-		// If there is a Loop section...
+		// If there is a Loop section, the sequence goes back to its first chunk once the last one was played
 		if (loop)
 		{
-			memcpy(mem + lzss_offset, buff3, loop);
+			memcpy(mem + lzss_offset, buff3.data(), loop);
 			lzss_chunk += loop;
-			mem[section + 0] = lzss_offset & 0xFF;
-			mem[section + 1] = lzss_offset >> 8;
-			mem[sequence] = chunk;
-			section += 2;
-			sequence += 1;
-			chunk += 1;
+			loopChunk = chunk;
+			for (int restartPoint : chunks3)
+			{
+				mem[section + 0] = (lzss_offset + restartPoint) & 0xFF;
+				mem[section + 1] = (lzss_offset + restartPoint) >> 8;
+				mem[sequence] = chunk;
+				section += 2;
+				sequence += 1;
+				chunk += 1;
+			}
 		}
 
 		// End of data, will be overwritten if there is more data to export
 		mem[section + 0] = lzss_end & 0xFF;
 		mem[section + 1] = lzss_end >> 8;
 		section += 2;
-		mem[sequence] = (chunk | 0x80) - 1;
+		mem[sequence] = loop ? (loopChunk | 0x80) : (chunk | 0x80) - 1;
 		sequence += 1;
 
 		// Update the subtune offsets to export the next one
@@ -723,104 +783,104 @@ bool CSong::ExportLZSS_XEX(std::ofstream& ou)
 	// Overwrite the LZSS data region with both the pointers for subtunes index, and the actual LZSS streams until the end of file
 	SaveBinaryBlock(ou, mem, LZSS_POINTER, lzss_total, 0);
 
-	// Delete buffers
-	delete buff2;
-	delete buff3;
-
 	return true;
 }
 
 /// <summary>
-/// Get the Pokey registers to be dumped to a stream buffer.
-/// GUI is disabled but MFC messages are being pumped, so the screen is updated
+/// Status bar progress of DumpSongToPokeyBuffer, called a few times per second at most.
 /// </summary>
-/// <returns></returns>
-void CSong::DumpSongToPokeyBuffer(int playmode, int songline, int trackline)
+static void ShowDumpProgress(int frames, void* pContext)
 {
 	CString statusBarLog;
-	TSubtune* pSubtune = g_Module.GetSubtune(songline);
+	statusBarLog.Format("Generating Pokey stream, playing song in quick mode... %i frames recorded", frames);
+	SetStatusBarText(statusBarLog);
+}
 
-	if (!pSubtune)
-		return;
+/// <summary>
+/// Get the Pokey registers to be dumped to a stream buffer, using CSaprDumper.
+/// The tracker playback is stopped, and the GUI disabled until the dump is done.
+/// </summary>
+/// <param name="playmode">MPLAY_START, or MPLAY_FROM for the cursor position, or MPLAY_PATTERN for looping the active Pattern</param>
+/// <param name="songline">Subtune to dump</param>
+/// <param name="trackline">Unused</param>
+/// <returns>False if nothing was recorded, or if the recording is incomplete, the export must then be aborted</returns>
+bool CSong::DumpSongToPokeyBuffer(int playmode, int songline, int trackline)
+{
+	CString statusBarLog;
+	CSaprDumper dumper(&g_Module);
 
 	Stop();					// Make sure RMT is stopped
-	//Atari_InitRMTRoutine();	// Reset the RMT routines
 	SetChannelOnOff(-1, 0);	// Switch all channels off 
 
-	g_PokeyStream.StartRecording();
-
-	// Play song using the chosen playback parameters
-	// If no argument was passed, Play from start will be assumed
-	//m_activeSongline = songline;
-	//m_activeRow = trackline;
-	m_activeSubtune = songline;
-
-	Play(playmode, m_isFollowPlay);
-
-	// Wait in a tight loop pumping messages until the playback stops
 	EnableWindow(g_hwnd, FALSE);
 
-	// The SAP-R dumper is running during that time...
-	while (m_playMode != MPLAY_STOP)
-	{
-		// 1 VBI of module playback
-		//PlayPattern(pSubtune);
-		//PlayContinue(pSubtune);
-
-		// Increment the timer shown during playback (not actually needed here?)
-		//UpdatePlayTime();
+	dumper.SetProgress(ShowDumpProgress);
 
-		// Multiple RMT routine calls will be processed if needed
-		for (int i = 0; i < m_instrumentSpeed; i++)
+	if (!dumper.Dump(&g_PokeyStream, songline, playmode, m_activeSongline, m_activeRow))
+	{
+		if (g_PokeyStream.IsFailed())
 		{
-			// 1 VBI of RMT routine (for instruments)
-			//if (g_rmtroutine)
-			//	Atari_PlayRMT();
-
-			Atari_SetPokey();
-
-			// Transfer from g_atarimem to POKEY buffer
-			g_PokeyStream.Record();
+			statusBarLog.Format("Failed... the Pokey stream could not keep frame %i, out of memory or disk space", g_PokeyStream.GetCurrentFrame());
+			SetStatusBarText(statusBarLog);
 		}
 
-		// Update the screen only once every few frames
-		// Displaying everything in real time slows things down considerably!
-		//if (!RefreshScreen(1))
-		//	continue;
-
-		// Display the number of frames dumped so far
-		statusBarLog.Format("Generating Pokey stream, playing song in quick mode... %i frames recorded", g_PokeyStream.GetCurrentFrame());
-		SetStatusBarText(statusBarLog);
+		EnableWindow(g_hwnd, TRUE);
+		return false;
 	}
 
-	// End playback now, the SAP-R data should have been dumped successfully!
-	//Stop();
+	// Report how long it took, and how much memory was needed for it
+	const TSaprDumpResult* pResult = dumper.GetResult();
+	PROCESS_MEMORY_COUNTERS memoryCounters = { sizeof(memoryCounters) };
+	SIZE_T peakMemory = GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters)) ? memoryCounters.PeakWorkingSetSize : 0;
 
-	statusBarLog.Format("Done... %i frames recorded in total, Loop point found at frame %i", g_PokeyStream.GetCurrentFrame(), g_PokeyStream.GetFirstCountPoint());
+	statusBarLog.Format("Done... %i frames recorded in total, Loop point found at frame %i, in %.0f ms, stream buffer %i KB%s, peak memory %i MB",
+		pResult->frames, pResult->loopPoint, pResult->time * 1000.0,
+		(int)(g_PokeyStream.GetDataSize() / 1024), g_PokeyStream.IsBufferMapped() ? " (mapped file)" : "", (int)(peakMemory / (1024 * 1024)));
 	SetStatusBarText(statusBarLog);
 
 	EnableWindow(g_hwnd, TRUE);
+	return true;
 }
 
-// A dumb SAP-R LZSS optimisations bruteforcer, returns the optimal value and buffer
-int CSong::BruteforceOptimalLZSS(unsigned char* src, int srclen, unsigned char* dst)
+// Room left in the Atari memory for a part of a song, the chunks are no longer compressed once they overflow it
+typedef struct
+{
+	const std::vector<unsigned char>* pCompressed;	// The chunks of the part are appended to it
+	size_t start;									// Size before the first chunk
+	int room;										// Bytes the part may use
+} TLzssRoom;
+
+/// <summary>
+/// Bruteforce the SAP-R LZSS optimisation pattern of a chunk, called by LZSS_SAP_Chunks before each chunk is compressed.
+/// Every distinct stream of every pattern is parsed once, at the same time, the patterns then only need to be encoded.
+/// The compression is stopped once the chunks already compressed no longer fit in the room given as context, a long song is then rejected
+/// without compressing the rest of it.
+/// </summary>
+static int BruteforceChunkPattern(CCompressLzss* pLzss, CPokeyStream* pStream, int firstFrame, int frameCount, void* pContext)
 {
+	const TLzssRoom* pRoom = (const TLzssRoom*)pContext;
+
+	if (pRoom && (int)(pRoom->pCompressed->size() - pRoom->start) > pRoom->room)
+		return -1;
+
 	CString statusBarLog;
-	CCompressLzss lzssData;
+	std::vector<unsigned char> bruteforced;
+	int srclen = frameCount * pStream->GetFrameSize();
 
 	// Start from a high value to force the first pattern to be the best one
 	int bestScore = 0xFFFFFF;
 	int optimal = 0;
 
-	EnableWindow(g_hwnd, FALSE);
+	pLzss->ParseOptimisations(pStream, firstFrame, frameCount);
 
 	for (int i = 0; i < SAPR_OPTIMISATIONS_COUNT; i++)
 	{
-		int bruteforced = lzssData.LZSS_SAP(src, srclen, dst, i);
+		bruteforced.clear();
+		int score = pLzss->LZSS_SAP(pStream, firstFrame, frameCount, bruteforced, i);
 
-		if (bruteforced < bestScore)
+		if (score < bestScore)
 		{
-			bestScore = bruteforced;
+			bestScore = score;
 			optimal = i;
 		}
 
@@ -831,11 +891,112 @@ int CSong::BruteforceOptimalLZSS(unsigned char* src, int srclen, unsigned char*
 		SetStatusBarText(statusBarLog);
 	}
 
-	// Bruteforcing was completed, display some stats
-	statusBarLog.Format("Done... %i bytes were shrunk to %i bytes using the optimisation pattern %i", srclen, bestScore, optimal);
+	// Each stream may also use the pattern which suits it best, regardless of the other streams, the streams are already parsed
+	bruteforced.clear();
+	int perStream = pLzss->LZSS_SAP(pStream, firstFrame, frameCount, bruteforced, SAPR_OPTIMISATIONS_PER_STREAM);
+
+	if (perStream < bestScore)
+	{
+		bestScore = perStream;
+		optimal = SAPR_OPTIMISATIONS_PER_STREAM;
+	}
+
+	// Bruteforcing was completed, display some stats, with the pattern used by each stream, from AUDF1 to AUDCTL
+	CString patterns;
+	const int* streamOptimisations = pLzss->GetStreamOptimisations();
+
+	for (int i = 0; i < 9; i++)
+		patterns.AppendFormat("%i", (optimal == SAPR_OPTIMISATIONS_PER_STREAM) ? streamOptimisations[i] : optimal);
+
+	statusBarLog.Format("Done... %i bytes were shrunk to %i bytes using the optimisation pattern %i (per stream: %s)", srclen, bestScore, optimal, (LPCTSTR)patterns);
 	SetStatusBarText(statusBarLog);
 
+	return optimal;
+}
+
+// A dumb SAP-R LZSS optimisations bruteforcer, appends the optimal buffer to dst and returns its size
+// The frames are compressed straight from the recorded stream, in chunks of LZSS_CHUNK_FRAMES bruteforced on their own, so any length fits in memory
+// The offset of every chunk in dst is added to restartPoints, each chunk being a complete LZSS stream, which VUPlayer plays as a section of its own
+// Once the chunks compressed are larger than room, the next ones are left out, the size returned is then larger than room, and the part is incomplete
+int CSong::BruteforceOptimalLZSS(int firstFrame, int frameCount, std::vector<unsigned char>& dst, std::vector<int>& restartPoints, int room)
+{
+	CCompressLzss lzssData;
+	TLzssRoom partRoom = { &dst, dst.size(), room };
+
+	EnableWindow(g_hwnd, FALSE);
+
+	lzssData.SetParseCache(true);
+	int total = lzssData.LZSS_SAP_Chunks(&g_PokeyStream, firstFrame, frameCount, dst, restartPoints, SAPR_OPTIMISATIONS_AUDC, BruteforceChunkPattern, &partRoom);
+
 	EnableWindow(g_hwnd, TRUE);
 
-	return lzssData.LZSS_SAP(src, srclen, dst, optimal);
+	return total;
+}
+
+/// <summary>
+/// Compress every legacy RMT module in the folder of the song, such as one of the RMT/songs folders, with the SAP-R LZSS compressor
+/// as the exports do, and with its reference, see CLzssValidation. The report tells if the bytes were identical for all of them.
+/// Each module is recorded by its own CSaprDumper into its own stream, the song being edited is left as it is.
+/// </summary>
+/// <param name="ou">Output stream</param>
+/// <returns>true = saved ok</returns>
+bool CSong::ExportLzssValidation(std::ofstream& ou)
+{
+	if (m_fileName.IsEmpty())
+	{
+		MessageBox(g_hwnd, "The song must be saved first, every RMT module in its folder is checked.", "Export aborted", MB_ICONERROR);
+		return false;
+	}
+
+	std::vector<std::filesystem::path> modules;
+	std::error_code error;
+
+	for (const auto& entry : std::filesystem::directory_iterator((LPCTSTR)GetFilePath(m_fileName), error))
+	{
+		CString extension = entry.path().extension().string().c_str();
+
+		if (entry.is_regular_file() && !extension.CompareNoCase(".rmt"))
+			modules.push_back(entry.path());
+	}
+
+	std::sort(modules.begin(), modules.end());
+
+	CString statusBarLog;
+	CLzssValidation validation;
+	int tracks4_8 = g_tracks4_8;
+
+	Stop();
+	EnableWindow(g_hwnd, FALSE);
+
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		std::string name = modules[i].filename().string();
+		statusBarLog.Format("Checking the LZSS compression of %s, module %i of %i...", name.c_str(), (int)i + 1, (int)modules.size());
+		SetStatusBarText(statusBarLog);
+
+		// The import sets the global number of channels, it is restored for the song being edited
+		CModule* pModule = new CModule();
+		std::ifstream in(modules[i], std::ios::binary);
+		bool isImported = pModule->ImportLegacyRMT(in, false);
+		in.close();
+		g_tracks4_8 = tracks4_8;
+
+		// A module which could not be imported or played is left out of the report
+		CPokeyStream stream;
+		CSaprDumper dumper(pModule);
+
+		if (isImported && dumper.Dump(&stream, MODULE_DEFAULT_SUBTUNE))
+			validation.Run(&stream, name.c_str());
+
+		delete pModule;
+	}
+
+	EnableWindow(g_hwnd, TRUE);
+
+	validation.WriteCsv(ou);
+
+	statusBarLog.Format("Done... %i LZSS checks over %i modules, %i with different bytes", validation.GetCheckCount(), (int)modules.size(), validation.GetDifferenceCount());
+	SetStatusBarText(statusBarLog);
+
+	return true;
 }
@@ -0,0 +1,79 @@
+//
+// LatencyController.cpp
+// Adaptive output latency, settling on the lowest amount of queued sound the machine can sustain
+//
+
+#include "LatencyController.h"
+
+CLatencyController::CLatencyController()
+{
+	SetLimits(44100, 441, 44100 / 4);
+	Reset(44100 * 3 / 50);
+}
+
+/// <summary>
+/// Set the range the latency may move in.
+/// </summary>
+/// <param name="sampleRate">Output samples per second, the step sizes follow from it</param>
+/// <param name="minLatency">Lowest latency ever used, in samples</param>
+/// <param name="maxLatency">Highest latency ever used, in samples</param>
+void CLatencyController::SetLimits(int sampleRate, int minLatency, int maxLatency)
+{
+	m_minLatency = minLatency;
+	m_maxLatency = maxLatency;
+	m_growStep = sampleRate / LATENCY_GROW_DIVISOR;
+	m_shrinkStep = sampleRate / LATENCY_SHRINK_DIVISOR;
+
+	if (m_shrinkStep < 1)
+		m_shrinkStep = 1;
+}
+
+/// <summary>
+/// Start over from the given latency, for a new audio output with its underrun counter cleared.
+/// </summary>
+/// <param name="latency">Initial latency, in samples</param>
+void CLatencyController::Reset(int latency)
+{
+	m_latency = latency < m_minLatency ? m_minLatency : latency > m_maxLatency ? m_maxLatency : latency;
+	m_lastUnderrunCount = 0;
+	m_stableFrames = 0;
+	m_stableNeeded = LATENCY_STABLE_FRAMES;
+}
+
+/// <summary>
+/// Call this once per rendered frame, with the underrun counter of the audio output.
+/// </summary>
+/// <param name="underrunCount">Total number of underruns reported by the audio output so far</param>
+void CLatencyController::Update(int underrunCount)
+{
+	int underruns = underrunCount - m_lastUnderrunCount;
+	m_lastUnderrunCount = underrunCount;
+
+	if (underruns > 0)
+	{
+		m_latency += m_growStep * underruns;
+
+		if (m_latency > m_maxLatency)
+			m_latency = m_maxLatency;
+
+		m_stableFrames = 0;
+
+		if (m_stableNeeded < LATENCY_STABLE_MAX)
+			m_stableNeeded *= 2;
+
+		return;
+	}
+
+	if (++m_stableFrames < m_stableNeeded)
+		return;
+
+	m_stableFrames = 0;
+	m_latency -= m_shrinkStep;
+
+	if (m_latency < m_minLatency)
+		m_latency = m_minLatency;
+
+	// The run needed comes back down after every stable run, a past bad stretch does not slow the next ones down for good
+	if (m_stableNeeded > LATENCY_STABLE_FRAMES)
+		m_stableNeeded /= 2;
+}
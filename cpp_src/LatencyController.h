@@ -0,0 +1,46 @@
+//
+// LatencyController.h header file
+// Adaptive output latency, settling on the lowest amount of queued sound the machine can sustain
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <cstdint>
+
+#define LATENCY_STABLE_FRAMES	100			// Frames without an underrun before the latency is lowered, 2 seconds on PAL
+#define LATENCY_STABLE_MAX		3200		// Longest wait before lowering again, after repeated underruns
+#define LATENCY_GROW_DIVISOR	100			// An underrun adds 1/100 second of latency
+#define LATENCY_SHRINK_DIVISOR	1000		// A stable run removes 1/1000 second of latency
+
+/// <summary>
+/// The latency goes up by a large step as soon as an underrun is reported, and comes down by
+/// small steps after runs of stable frames. Every underrun also doubles the length of the run
+/// needed before lowering again, so the latency does not keep bouncing on the same limit,
+/// and every stable run halves it again, down to LATENCY_STABLE_FRAMES.
+/// All values are counted in sample frames, 1 sample for each of the output channels.
+/// </summary>
+class CLatencyController
+{
+public:
+	CLatencyController();
+
+	void SetLimits(int sampleRate, int minLatency, int maxLatency);
+	void Reset(int latency);
+	void Update(int underrunCount);
+
+	int GetLatency() { return m_latency; };
+	int GetMinLatency() { return m_minLatency; };
+	int GetMaxLatency() { return m_maxLatency; };
+
+private:
+	int m_latency;
+	int m_minLatency;
+	int m_maxLatency;
+	int m_growStep;
+	int m_shrinkStep;
+
+	int m_lastUnderrunCount;
+	int m_stableFrames;
+	int m_stableNeeded;
+};
@@ -0,0 +1,149 @@
+//
+// LzssValidation.cpp
+// Check of the SAP-R LZSS compressor against its reference, compressing the very same frames the way the original compressor did
+//
+
+#include "stdafx.h"
+#include <chrono>
+
+#include "LzssValidation.h"
+#include "lzss_sap.h"
+
+CLzssValidation::CLzssValidation()
+{
+	Clear();
+}
+
+void CLzssValidation::Clear()
+{
+	m_checks.clear();
+	m_speeds.clear();
+	m_differences = 0;
+}
+
+/// <summary>
+/// Check the intro and the loop of a recorded song, as CSong::ExportLZSS_XEX splits them, with every optimisation pattern.
+/// </summary>
+/// <param name="pStream">Stream holding the frames of the song, up to its loop point</param>
+/// <param name="song">Name of the song, only used in the report</param>
+/// <param name="chunkFrames">Frames per chunk for the LZSS_SAP_Chunks check</param>
+/// <returns>Number of checks with any byte different</returns>
+int CLzssValidation::Run(CPokeyStream* pStream, const char* song, int chunkFrames)
+{
+	int differences = 0;
+	int intro = pStream->GetThirdCountPoint();
+	int loop = pStream->GetSecondCountPoint();
+
+	if (intro > 0)
+		differences += CheckPart(pStream, song, "intro", 0, intro, chunkFrames);
+
+	if (loop > 0)
+		differences += CheckPart(pStream, song, "loop", intro, loop, chunkFrames);
+
+	m_differences += differences;
+	return differences;
+}
+
+/// <summary>
+/// Compress the frames with every optimisation pattern, from the stream as the exports do, then with the reference.
+/// The stream is parsed for every pattern at once, like BruteforceChunkPattern does, so the patterns only use the parse cache.
+/// Every chunk of LZSS_SAP_Chunks must also be what the reference makes of the same frames, at the same offset.
+/// </summary>
+int CLzssValidation::CheckPart(CPokeyStream* pStream, const char* song, const char* part, int firstFrame, int frameCount, int chunkFrames)
+{
+	int differences = 0;
+	int frameSize = pStream->GetFrameSize();
+	std::vector<unsigned char> frames((size_t)frameCount * frameSize);
+	frameCount = pStream->ReadFrames(firstFrame, frameCount, frames.data());
+
+	TLzssSpeed speed = { song, part, 0.0, 0.0 };
+	CCompressLzss compressor;
+	compressor.SetParseCache(true);
+
+	auto start = std::chrono::steady_clock::now();
+	compressor.ParseOptimisations(pStream, firstFrame, frameCount);
+	speed.time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (int opt = 0; opt < SAPR_OPTIMISATIONS_COUNT; opt++)
+	{
+		TLzssCheck check = { song, part, opt, frameCount, 0, 0, false, 0, false };
+		std::vector<unsigned char> compressed, reference;
+
+		start = std::chrono::steady_clock::now();
+		check.bytes = compressor.LZSS_SAP(pStream, firstFrame, frameCount, compressed, opt);
+		speed.time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// A new reference for every pattern, nothing is kept from one compression to the next
+		{
+			CCompressLzss referenceCompressor;
+			referenceCompressor.SetReference(true);
+
+			start = std::chrono::steady_clock::now();
+			check.referenceBytes = referenceCompressor.LZSS_SAP(frames.data(), frameCount * frameSize, reference, opt);
+			speed.referenceTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		check.isIdentical = compressed == reference && check.bytes == check.referenceBytes;
+
+		// The chunks are compressed by a compressor of their own, which only caches the chunk being compressed
+		CCompressLzss chunkCompressor;
+		std::vector<unsigned char> chunked, chunkReference;
+		std::vector<int> restartPoints;
+		chunkCompressor.SetParseCache(true);
+
+		int chunkBytes = chunkCompressor.LZSS_SAP_Chunks(pStream, firstFrame, frameCount, chunked, restartPoints, opt, NULL, NULL, chunkFrames);
+		check.chunks = (int)restartPoints.size();
+		check.isChunkIdentical = chunkBytes == (int)chunked.size();
+
+		for (int i = 0, frame = 0; frame < frameCount; i++, frame += chunkFrames)
+		{
+			CCompressLzss referenceCompressor;
+			referenceCompressor.SetReference(true);
+
+			if (i >= check.chunks || restartPoints[i] != (int)chunkReference.size())
+				check.isChunkIdentical = false;
+
+			int count = min(chunkFrames, frameCount - frame);
+			referenceCompressor.LZSS_SAP(&frames[(size_t)frame * frameSize], count * frameSize, chunkReference, opt);
+		}
+
+		check.isChunkIdentical = check.isChunkIdentical && check.chunks == (frameCount + chunkFrames - 1) / chunkFrames && chunked == chunkReference;
+
+		if (!check.isIdentical || !check.isChunkIdentical)
+			differences++;
+
+		m_checks.push_back(check);
+	}
+
+	m_speeds.push_back(speed);
+	return differences;
+}
+
+/// <summary>
+/// Write every check as CSV, in 3 sections told apart by the first column:
+/// "check" with the bytes of each pattern, "speed" with the time spent on each part, and "total" with the checks identical.
+/// </summary>
+/// <param name="out">Output stream</param>
+void CLzssValidation::WriteCsv(std::ostream& out)
+{
+	// The songs are file names, which cannot hold a quote, but may hold a comma
+	out << "section,song,part,pattern,frames,reference_bytes,bytes,identical,chunks,chunks_identical\n";
+
+	for (const TLzssCheck& check : m_checks)
+	{
+		out << "check,\"" << check.song << "\"," << check.part << "," << check.optimisations << "," << check.frames << ","
+			<< check.referenceBytes << "," << check.bytes << "," << (check.isIdentical ? "yes" : "no") << ","
+			<< check.chunks << "," << (check.isChunkIdentical ? "yes" : "no") << "\n";
+	}
+
+	out << "\nsection,song,part,reference_ms,ms\n";
+
+	for (const TLzssSpeed& speed : m_speeds)
+	{
+		out << "speed,\"" << speed.song << "\"," << speed.part << "," << (int)(speed.referenceTime * 1000.0) << ","
+			<< (int)(speed.time * 1000.0) << "\n";
+	}
+
+	out << "\nsection,checks,identical\n";
+	out << "total," << GetCheckCount() << "," << GetCheckCount() - m_differences << "\n";
+}
@@ -0,0 +1,62 @@
+//
+// LzssValidation.h header file
+// Check of the SAP-R LZSS compressor against its reference, compressing the very same frames the way the original compressor did
+// Every optimisation pattern of the intro and the loop of a song is compressed both ways, the bytes must be identical
+//
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "PokeyStream.h"
+
+#define LZSS_VALIDATION_CHUNK_FRAMES	0x400		// Frames per chunk for the LZSS_SAP_Chunks check, small enough for most songs to have several
+
+typedef struct
+{
+	std::string song;
+	const char* part;		// "intro" or "loop"
+	int optimisations;		// One of the SAPR_OPTIMISATIONS_* patterns
+	int frames;
+	int referenceBytes;		// Compressed by the reference, from the frames decoded into a SAP-R buffer
+	int bytes;				// Compressed from the stream, with the parse cache and the workers
+	bool isIdentical;
+	int chunks;				// Chunks made by LZSS_SAP_Chunks
+	bool isChunkIdentical;	// Every chunk, and its restart point, identical to the reference compressing the same frames
+} TLzssCheck;
+
+typedef struct
+{
+	std::string song;
+	const char* part;
+	double referenceTime;	// Seconds spent by the reference on every pattern
+	double time;			// Same, from the stream, including the parsing of every pattern at once
+} TLzssSpeed;
+
+/// <summary>
+/// Compresses the recorded frames of a song with every optimisation pattern, as the exports do, and with the reference.
+/// The reference reads the frames from a contiguous SAP-R buffer, compares every position of the window to find the matches,
+/// parses the streams one after the other and caches nothing, see CCompressLzss::SetReference.
+/// The results of every song checked are kept, so a single report covers a whole folder of songs.
+/// </summary>
+class CLzssValidation
+{
+public:
+	CLzssValidation();
+
+	void Clear();
+	int Run(CPokeyStream* pStream, const char* song, int chunkFrames = LZSS_VALIDATION_CHUNK_FRAMES);
+
+	int GetCheckCount() { return (int)m_checks.size(); };
+	int GetDifferenceCount() { return m_differences; };
+	void WriteCsv(std::ostream& out);
+
+private:
+	std::vector<TLzssCheck> m_checks;
+	std::vector<TLzssSpeed> m_speeds;
+	int m_differences;			// Checks with any byte different, over every song
+
+	int CheckPart(CPokeyStream* pStream, const char* song, const char* part, int firstFrame, int frameCount, int chunkFrames);
+};
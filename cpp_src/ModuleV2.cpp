@@ -417,7 +417,7 @@ bool CModule::InitialiseEnvelope(TEnvelope* pEnvelope, UINT type)
 
 //--
 
-bool CModule::ImportLegacyRMT(std::ifstream& in)
+bool CModule::ImportLegacyRMT(std::ifstream& in, bool isLogShown)
 {
 	CString importLog;
 	importLog.Format("");
@@ -605,7 +605,8 @@ bool CModule::ImportLegacyRMT(std::ifstream& in)
 	delete importSubtune;
 
 	// Spawn a messagebox with the statistics collected during the Legacy RMT Module import procedure
-	MessageBox(g_hwnd, importLog, "Import Legacy RMT", MB_ICONINFORMATION);
+	if (isLogShown)
+		MessageBox(g_hwnd, importLog, "Import Legacy RMT", MB_ICONINFORMATION);
 
 	return true;
 }
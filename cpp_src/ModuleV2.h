@@ -6,7 +6,7 @@
 // TODO: Create an enum for the majority of the things defined below, it might make future revisions a lot easier...
 
 #pragma once
-#pragma pack(1)
+#pragma pack(push, 1)	// Only the Module structs are packed, the packing must not leak into the headers included after this one
 
 #include "General.h"
 #include "global.h"
@@ -588,7 +588,7 @@ public:
 
 	//-- Legacy RMT Module Import Functions --//
 
-	bool ImportLegacyRMT(std::ifstream& in);
+	bool ImportLegacyRMT(std::ifstream& in, bool isLogShown = true);
 	bool DecodeLegacyRMT(std::ifstream& in, TSubtune* pSubtune, CString& log);
 	bool ImportLegacyPatterns(TSubtune* pSubtune, BYTE* sourceMemory, WORD sourceAddress);
 	bool ImportLegacySonglines(TSubtune* pSubtune, BYTE* sourceMemory, WORD sourceAddress, WORD endAddress);
@@ -861,3 +861,5 @@ private:
 	TInstrumentIndex* m_instrumentIndex;
 	TEnvelopeIndex* m_envelopeIndex;
 };
+
+#pragma pack(pop)
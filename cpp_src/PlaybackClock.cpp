@@ -0,0 +1,56 @@
+//
+// PlaybackClock.cpp
+// Playback scheduler driven by the audio output instead of a system timer
+//
+
+#include <chrono>
+
+#include "PlaybackClock.h"
+
+CPlaybackClock::CPlaybackClock()
+{
+	m_tick = NULL;
+	m_isRunning = false;
+	m_tickCount = 0;
+}
+
+CPlaybackClock::~CPlaybackClock()
+{
+	Stop();
+}
+
+/// <summary>
+/// Start calling the tick procedure from the playback thread.
+/// With a real time audio output, the ticks follow the sound card clock exactly.
+/// With an offline output (WAV file, null sink...), the ticks run as fast as the CPU allows.
+/// </summary>
+/// <param name="tick">Procedure playing 1 frame</param>
+void CPlaybackClock::Start(PLAYBACK_TICK_PROC tick)
+{
+	Stop();
+
+	m_tick = tick;
+	m_tickCount = 0;
+	m_isRunning = true;
+	m_thread = std::thread(&CPlaybackClock::Loop, this);
+}
+
+void CPlaybackClock::Stop()
+{
+	if (m_isRunning)
+	{
+		m_isRunning = false;
+		m_thread.join();
+	}
+}
+
+void CPlaybackClock::Loop()
+{
+	while (m_isRunning)
+	{
+		if (m_tick())
+			m_tickCount++;
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
@@ -0,0 +1,61 @@
+//
+// PlaybackClock.h header file
+// Playback scheduler driven by the audio output instead of a system timer
+// Each tick plays exactly 1 frame, and a tick only happens once the audio output has room for that frame
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Play 1 frame if the audio output needs one, return false when it is full and there is nothing to do yet
+typedef bool (*PLAYBACK_TICK_PROC)();
+
+class CPlaybackClock
+{
+public:
+	CPlaybackClock();
+	~CPlaybackClock();
+
+	void Start(PLAYBACK_TICK_PROC tick);
+	void Stop();
+
+	bool IsRunning() { return m_isRunning; };
+	uint64_t GetTickCount() { return m_tickCount; };
+
+private:
+	PLAYBACK_TICK_PROC m_tick;
+	std::thread m_thread;
+	std::atomic<bool> m_isRunning;
+	std::atomic<uint64_t> m_tickCount;
+
+	void Loop();
+};
+
+/// <summary>
+/// Split a frame rate that does not divide the machine clock into whole frames of CPU cycles.
+/// The remainder is carried over from frame to frame, so there is no drift at all over time.
+/// </summary>
+class CFrameCycles
+{
+public:
+	CFrameCycles() { SetTiming(1773447, 50); };
+
+	void SetTiming(uint32_t cpuClock, uint32_t frameRate) { m_cpuClock = cpuClock; m_frameRate = frameRate; m_remainder = 0; };
+
+	int Next()
+	{
+		m_remainder += m_cpuClock;
+		int cycles = m_remainder / m_frameRate;
+		m_remainder %= m_frameRate;
+		return cycles;
+	};
+
+private:
+	uint32_t m_cpuClock;
+	uint32_t m_frameRate;
+	uint32_t m_remainder;
+};
@@ -0,0 +1,456 @@
+//
+// PokeyEmu.cpp
+// Built-in POKEY sound emulation, replacing the sa_pokey.dll and apokeysnd.dll plugins
+//
+// The emulation is event driven: instead of stepping every single 1.79MHz cycle,
+// the renderer jumps straight to the next timer underflow, and passes every change
+// of output level to the band-limited resampler (see PokeyResampler.cpp).
+// The polynomial counters are derived from the absolute cycle count, so they never
+// need to be clocked between the events either.
+//
+
+#include <cstring>
+
+#include "PokeyEmu.h"
+
+#define POLY4_SIZE		0x0000F
+#define POLY5_SIZE		0x0001F
+#define POLY9_SIZE		0x001FF
+#define POLY17_SIZE		0x1FFFF
+
+/// <summary>
+/// Lookup tables for the output bit of each polynomial counter, shared by all the POKEY instances.
+/// The counters are Fibonacci LFSRs using the polynomials x^4+x^3+1, x^5+x^3+1, x^9+x^4+1 and x^17+x^14+1.
+/// </summary>
+static struct TPolyTables
+{
+	uint8_t poly4[POLY4_SIZE];
+	uint8_t poly5[POLY5_SIZE];
+	uint8_t poly9[POLY9_SIZE];
+	uint8_t poly17[POLY17_SIZE];
+
+	TPolyTables()
+	{
+		Generate(poly4, 4, 1, POLY4_SIZE);
+		Generate(poly5, 5, 2, POLY5_SIZE);
+		Generate(poly9, 9, 5, POLY9_SIZE);
+		Generate(poly17, 17, 3, POLY17_SIZE);
+	}
+
+	static void Generate(uint8_t* table, int bits, int tap, int length)
+	{
+		uint32_t reg = (1 << bits) - 1;
+
+		for (int i = 0; i < length; i++)
+		{
+			table[i] = reg & 1;
+			uint32_t feedback = (reg ^ (reg >> tap)) & 1;
+			reg = (reg >> 1) | (feedback << (bits - 1));
+		}
+	}
+} s_poly;
+
+CPokeyEmu::CPokeyEmu()
+{
+	m_cpuClock = 1773447;
+	m_sampleRate = 44100;
+	m_isStems = false;
+	Reset();
+}
+
+/// <summary>
+/// Return the POKEY to its power-on state, with the polynomial counters running.
+/// The sample clock set with SetClock is kept.
+/// </summary>
+void CPokeyEmu::Reset()
+{
+	memset(m_register, 0, sizeof(m_register));
+	memset(m_output, 0, sizeof(m_output));
+	memset(m_highPass, 0, sizeof(m_highPass));
+	memset(m_timerActive, 0, sizeof(m_timerActive));
+	memset(m_channelLevel, 0, sizeof(m_channelLevel));
+
+	// Normal operation, this is what the Atari OS sets during its initialisation
+	m_register[POKEY_SKCTL] = SKCTL_INIT_MASK;
+	memcpy(m_queuedRegister, m_register, sizeof(m_queuedRegister));
+	m_writeQueue.clear();
+	m_writeQueue.reserve(POKEY_REGISTER_COUNT * 16);
+
+	m_cycle = 0;
+	m_polyResetCycle = 0;
+	m_level = 0;
+
+	UpdatePeriods();
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+		m_counter[i] = m_period[i];
+
+	SetClock(m_cpuClock, m_sampleRate);
+}
+
+/// <summary>
+/// Set the POKEY input clock and the rate of the rendered samples.
+/// The resampler keeps the ratio as an exact fraction, so no precision is lost between the 2 clocks.
+/// </summary>
+/// <param name="cpuClock">FREQ_17_PAL or FREQ_17_NTSC</param>
+/// <param name="sampleRate">Output samples per second</param>
+void CPokeyEmu::SetClock(uint32_t cpuClock, uint32_t sampleRate)
+{
+	m_cpuClock = cpuClock;
+	m_sampleRate = sampleRate;
+	m_outputLevel = 0;
+	m_resampler.SetRates(cpuClock, sampleRate);
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+	{
+		m_stemOutputLevel[i] = 0;
+		m_stemResampler[i].SetRates(cpuClock, sampleRate);
+	}
+}
+
+/// <summary>
+/// Enable or disable the rendering of every channel on its own, next to the mix.
+/// This only costs 1 more resampler step for each change of a channel output,
+/// the timers and polynomial counters are shared, so the stems always match the mix exactly.
+/// The stems start from the current channel levels, they should be enabled before anything is rendered.
+/// </summary>
+void CPokeyEmu::SetStems(bool isStems)
+{
+	m_isStems = isStems;
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+	{
+		m_stemResampler[i].Clear();
+		m_stemOutputLevel[i] = 0;
+	}
+}
+
+/// <summary>
+/// Write a value to one of the POKEY registers.
+/// The change takes effect from the current cycle, the timers keep counting down until their next underflow.
+/// </summary>
+/// <param name="addr">Register offset, $00-$0F</param>
+/// <param name="value">Byte to write</param>
+void CPokeyEmu::PutByte(int addr, uint8_t value)
+{
+	addr &= POKEY_REGISTER_COUNT - 1;
+	m_queuedRegister[addr] = value;
+	ApplyWrite(addr, value);
+}
+
+/// <summary>
+/// Schedule a register write at an exact cycle of the next Run, the writes must be queued in cycle order.
+/// Writing the value a sound register already holds has no effect at all, so these writes are not queued.
+/// Writes past the end of the next Run are kept for the one after, with their cycle moved accordingly.
+/// </summary>
+/// <param name="cycle">Cycle offset from the start of the next Run</param>
+/// <param name="addr">Register offset, $00-$0F</param>
+/// <param name="value">Byte to write</param>
+void CPokeyEmu::QueueWrite(int cycle, int addr, uint8_t value)
+{
+	addr &= POKEY_REGISTER_COUNT - 1;
+
+	// STIMER and SKCTL act on every write, even with the same value
+	if (addr < POKEY_STIMER && m_queuedRegister[addr] == value)
+		return;
+
+	m_queuedRegister[addr] = value;
+	m_writeQueue.push_back({ (uint32_t)cycle, (uint8_t)addr, value });
+}
+
+/// <summary>
+/// Update a register and everything that depends on it, at the current cycle.
+/// </summary>
+void CPokeyEmu::ApplyWrite(int addr, uint8_t value)
+{
+	m_register[addr] = value;
+
+	switch (addr)
+	{
+	case POKEY_AUDF1:
+	case POKEY_AUDF2:
+	case POKEY_AUDF3:
+	case POKEY_AUDF4:
+	case POKEY_AUDCTL:
+		UpdatePeriods();
+		break;
+
+	case POKEY_STIMER:
+		// Any write to STIMER reloads all the timers at once
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+			m_counter[i] = m_period[i];
+		break;
+
+	case POKEY_SKCTL:
+		// The polynomial counters restart from their initial state once the reset bits are released
+		if (!(value & SKCTL_INIT_MASK))
+			m_polyResetCycle = m_cycle;
+		break;
+	}
+
+	UpdateLevel();
+}
+
+/// <summary>
+/// Calculate the number of CPU cycles between 2 underflows of each channel timer.
+/// This follows the AUDCTL clock and 16-bit settings, including the extra cycles needed for reloading at 1.79MHz.
+/// </summary>
+void CPokeyEmu::UpdatePeriods()
+{
+	uint8_t audctl = m_register[POKEY_AUDCTL];
+	int base = (audctl & AUDCTL_15KHZ) ? POKEY_CYCLES_15KHZ : POKEY_CYCLES_64KHZ;
+
+	// Channels 1+2, then channels 3+4
+	for (int pair = 0; pair < 2; pair++)
+	{
+		int lo = pair * 2;
+		int hi = lo + 1;
+		bool is179 = audctl & (pair ? AUDCTL_CH3_179 : AUDCTL_CH1_179);
+		bool isJoined = audctl & (pair ? AUDCTL_JOIN_34 : AUDCTL_JOIN_12);
+		int audfLo = m_register[POKEY_AUDF1 + lo * 2];
+		int audfHi = m_register[POKEY_AUDF1 + hi * 2];
+
+		if (isJoined)
+		{
+			// The low channel only drives the high channel, it has no timer output of its own
+			int audf = audfHi * 256 + audfLo;
+			m_period[lo] = 0;
+			m_period[hi] = is179 ? audf + 7 : (audf + 1) * base;
+		}
+		else
+		{
+			m_period[lo] = is179 ? audfLo + 4 : (audfLo + 1) * base;
+			m_period[hi] = (audfHi + 1) * base;
+		}
+	}
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+	{
+		bool wasActive = m_timerActive[i];
+		m_timerActive[i] = m_period[i] > 0;
+
+		// A timer that was just enabled starts a full period, and no timer waits longer than its new period
+		if (m_timerActive[i] && (!wasActive || m_counter[i] > m_period[i]))
+			m_counter[i] = m_period[i];
+	}
+}
+
+/// <summary>
+/// Sum the output of all the channels, including the High Pass Filters and Volume Only mode.
+/// </summary>
+void CPokeyEmu::UpdateLevel()
+{
+	uint8_t audctl = m_register[POKEY_AUDCTL];
+	int level = 0;
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+	{
+		m_channelLevel[i] = 0;
+
+		uint8_t audc = m_register[POKEY_AUDC1 + i * 2];
+		int volume = audc & AUDC_VOLUME_MASK;
+
+		// Volume Only is output as it is, even when the channel has no timer, like the low channel of a 16-bit pair
+		if (audc & AUDC_VOLUME_ONLY)
+		{
+			m_channelLevel[i] = volume;
+			level += volume;
+			continue;
+		}
+
+		if (!m_timerActive[i])
+			continue;
+
+		uint8_t bit = m_output[i];
+
+		if ((i == 0 && (audctl & AUDCTL_HPF_13)) || (i == 1 && (audctl & AUDCTL_HPF_24)))
+			bit ^= m_highPass[i];
+
+		if (bit)
+		{
+			m_channelLevel[i] = volume;
+			level += volume;
+		}
+	}
+
+	m_level = level;
+}
+
+/// <summary>
+/// Process the underflow of a channel timer at the current cycle.
+/// The timer is reloaded, and the output flip-flop is updated from the selected distortion.
+/// </summary>
+/// <param name="channel">Channel 0-3</param>
+void CPokeyEmu::Underflow(int channel)
+{
+	uint8_t audctl = m_register[POKEY_AUDCTL];
+	uint8_t audc = m_register[POKEY_AUDC1 + channel * 2];
+
+	m_counter[channel] = m_period[channel];
+
+	uint64_t poly = (m_register[POKEY_SKCTL] & SKCTL_INIT_MASK) ? m_cycle - m_polyResetCycle : 0;
+
+	if ((audc & AUDC_NO_POLY5) || s_poly.poly5[poly % POLY5_SIZE])
+	{
+		if (audc & AUDC_PURE)
+			m_output[channel] ^= 1;
+		else if (audc & AUDC_POLY4)
+			m_output[channel] = s_poly.poly4[poly % POLY4_SIZE];
+		else if (audctl & AUDCTL_POLY9)
+			m_output[channel] = s_poly.poly9[poly % POLY9_SIZE];
+		else
+			m_output[channel] = s_poly.poly17[poly % POLY17_SIZE];
+	}
+
+	switch (channel)
+	{
+	case 1:
+		// Two-Tone mode, channel 2 resets the channel 1 timer
+		if (m_register[POKEY_SKCTL] & SKCTL_TWO_TONE)
+			m_counter[0] = m_period[0];
+		break;
+
+	case 2:
+		// Channel 3 clocks the High Pass Filter of channel 1
+		if (audctl & AUDCTL_HPF_13)
+			m_highPass[0] = m_output[0];
+		break;
+
+	case 3:
+		// Channel 4 clocks the High Pass Filter of channel 2
+		if (audctl & AUDCTL_HPF_24)
+			m_highPass[1] = m_output[1];
+		break;
+	}
+}
+
+/// <summary>
+/// Send the output level to the resampler, if it changed since the last time.
+/// </summary>
+/// <param name="cycle">Cycle offset in the current resampler frame</param>
+void CPokeyEmu::FlushLevel(int cycle)
+{
+	if (m_level != m_outputLevel)
+	{
+		m_resampler.AddDelta(cycle, m_level - m_outputLevel);
+		m_outputLevel = m_level;
+	}
+
+	if (!m_isStems)
+		return;
+
+	for (int i = 0; i < POKEY_CHANNELS; i++)
+	{
+		if (m_channelLevel[i] != m_stemOutputLevel[i])
+		{
+			m_stemResampler[i].AddDelta(cycle, m_channelLevel[i] - m_stemOutputLevel[i]);
+			m_stemOutputLevel[i] = m_channelLevel[i];
+		}
+	}
+}
+
+/// <summary>
+/// Run the POKEY for a number of cycles, feeding every change of output level to the resampler.
+/// The emulation only stops at timer underflows and queued register writes,
+/// so low pitched or silent channels cost almost nothing.
+/// </summary>
+/// <param name="cycles">Number of cycles to run</param>
+void CPokeyEmu::Run(int cycles)
+{
+	m_resampler.BeginFrame(cycles);
+
+	if (m_isStems)
+	{
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+			m_stemResampler[i].BeginFrame(cycles);
+	}
+
+	size_t write = 0;
+	size_t writeCount = m_writeQueue.size();
+	int done = 0;
+
+	while (true)
+	{
+		// Queued writes take effect at their exact cycle, registers written with PutByte at the very start
+		while (write < writeCount && (int)m_writeQueue[write].cycle <= done)
+		{
+			ApplyWrite(m_writeQueue[write].addr, m_writeQueue[write].value);
+			write++;
+		}
+
+		FlushLevel(done);
+
+		if (done >= cycles)
+			break;
+
+		int span = cycles - done;
+
+		if (write < writeCount && (int)m_writeQueue[write].cycle - done < span)
+			span = m_writeQueue[write].cycle - done;
+
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+		{
+			if (m_timerActive[i] && m_counter[i] < span)
+				span = m_counter[i];
+		}
+
+		done += span;
+		m_cycle += span;
+
+		bool isUnderflow = false;
+
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+		{
+			if (!m_timerActive[i])
+				continue;
+
+			m_counter[i] -= span;
+
+			if (m_counter[i] <= 0)
+			{
+				Underflow(i);
+				isUnderflow = true;
+			}
+		}
+
+		if (isUnderflow)
+			UpdateLevel();
+	}
+
+	// Keep the writes meant for the next blocks
+	m_writeQueue.erase(m_writeQueue.begin(), m_writeQueue.begin() + write);
+
+	for (size_t i = 0; i < m_writeQueue.size(); i++)
+		m_writeQueue[i].cycle -= cycles;
+
+	m_resampler.EndFrame(cycles);
+
+	if (m_isStems)
+	{
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+			m_stemResampler[i].EndFrame(cycles);
+	}
+}
+
+/// <summary>
+/// Render a block of mono samples from the current POKEY state, as 16-bit signed integers.
+/// </summary>
+/// <param name="buffer">Output buffer, at least samples long</param>
+/// <param name="samples">Number of samples to render</param>
+void CPokeyEmu::Render(int16_t* buffer, int samples)
+{
+	Run(m_resampler.GetCyclesNeeded(samples));
+	m_resampler.ReadSamples(buffer, samples, POKEY_VOLUME_SCALE);
+}
+
+/// <summary>
+/// Render a block of mono samples from the current POKEY state, as floating point numbers.
+/// 4 channels at volume 15 peak at 1.0.
+/// </summary>
+/// <param name="buffer">Output buffer, at least samples long</param>
+/// <param name="samples">Number of samples to render</param>
+void CPokeyEmu::Render(float* buffer, int samples)
+{
+	Run(m_resampler.GetCyclesNeeded(samples));
+	m_resampler.ReadSamples(buffer, samples, 1.0f / (POKEY_CHANNELS * AUDC_VOLUME_MASK));
+}
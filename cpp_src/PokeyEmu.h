@@ -0,0 +1,127 @@
+//
+// PokeyEmu.h header file
+// Built-in POKEY sound emulation, replacing the sa_pokey.dll and apokeysnd.dll plugins
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "PokeyResampler.h"
+
+#define POKEY_CHANNELS			4			// Audio channels per POKEY soundchip
+#define POKEY_REGISTER_COUNT	0x10		// Write registers, $D200-$D20F
+#define POKEY_VOLUME_SCALE		512			// Sample amplitude for 1 step of volume, 4 channels at volume 15 peak at 30720
+#define POKEY_CYCLES_64KHZ		28			// 64kHz base clock divisor
+#define POKEY_CYCLES_15KHZ		114			// 15kHz base clock divisor
+
+// POKEY write registers, as offsets from the soundchip base address
+#define POKEY_AUDF1		0x00
+#define POKEY_AUDC1		0x01
+#define POKEY_AUDF2		0x02
+#define POKEY_AUDC2		0x03
+#define POKEY_AUDF3		0x04
+#define POKEY_AUDC3		0x05
+#define POKEY_AUDF4		0x06
+#define POKEY_AUDC4		0x07
+#define POKEY_AUDCTL	0x08
+#define POKEY_STIMER	0x09
+#define POKEY_SKCTL		0x0F
+
+// AUDCTL bits
+#define AUDCTL_POLY9		0x80		// Use the 9-bit polynomial counter instead of the 17-bit one
+#define AUDCTL_CH1_179		0x40		// Channel 1 is clocked at 1.79MHz
+#define AUDCTL_CH3_179		0x20		// Channel 3 is clocked at 1.79MHz
+#define AUDCTL_JOIN_12		0x10		// Channels 1+2 are joined into a 16-bit channel
+#define AUDCTL_JOIN_34		0x08		// Channels 3+4 are joined into a 16-bit channel
+#define AUDCTL_HPF_13		0x04		// High Pass Filter in channel 1, clocked by channel 3
+#define AUDCTL_HPF_24		0x02		// High Pass Filter in channel 2, clocked by channel 4
+#define AUDCTL_15KHZ		0x01		// Base clock is 15kHz instead of 64kHz
+
+// AUDC bits
+#define AUDC_NO_POLY5		0x80		// Do not gate the output through the 5-bit polynomial counter
+#define AUDC_POLY4			0x40		// Use the 4-bit polynomial counter, unless AUDC_PURE is set
+#define AUDC_PURE			0x20		// Pure tone, the output toggles on every timer underflow
+#define AUDC_VOLUME_ONLY	0x10		// Volume Only mode, the output is forced high
+#define AUDC_VOLUME_MASK	0x0F
+
+// SKCTL bits
+#define SKCTL_TWO_TONE		0x08		// Two-Tone mode, channel 2 timer resets channel 1
+#define SKCTL_INIT_MASK		0x03		// Both bits cleared hold the polynomial counters in reset
+
+// Register write scheduled at an exact cycle of the next Run
+struct TPokeyWrite
+{
+	uint32_t cycle;		// Cycle offset from the start of the next Run
+	uint8_t addr;
+	uint8_t value;
+};
+
+class CPokeyEmu
+{
+public:
+	CPokeyEmu();
+
+	void Reset();
+	void SetClock(uint32_t cpuClock, uint32_t sampleRate);
+
+	void PutByte(int addr, uint8_t value);
+	void QueueWrite(int cycle, int addr, uint8_t value);
+	uint8_t GetByte(int addr) { return m_register[addr & (POKEY_REGISTER_COUNT - 1)]; };
+
+	void Render(int16_t* buffer, int samples);
+	void Render(float* buffer, int samples);
+
+	// Run for an exact number of cycles, then read back however many samples that produced
+	void Run(int cycles);
+	int GetSamplesAvailable() { return m_resampler.GetSamplesAvailable(); };
+	void ReadSamples(int16_t* buffer, int samples) { m_resampler.ReadSamples(buffer, samples, POKEY_VOLUME_SCALE); };
+
+	// Render each channel on its own as well, from the very same emulation, the stems add up to the mix
+	void SetStems(bool isStems);
+	bool IsStems() { return m_isStems; };
+	void ReadStemSamples(int channel, int16_t* buffer, int samples) { m_stemResampler[channel].ReadSamples(buffer, samples, POKEY_VOLUME_SCALE); };
+
+	uint32_t GetSampleRate() { return m_sampleRate; };
+	uint64_t GetCycleCount() { return m_cycle; };
+
+private:
+	uint8_t m_register[POKEY_REGISTER_COUNT];
+
+	// Channel timers, counted in CPU cycles left until the next underflow
+	int m_counter[POKEY_CHANNELS];
+	int m_period[POKEY_CHANNELS];
+	uint8_t m_output[POKEY_CHANNELS];		// Output flip-flops
+	uint8_t m_highPass[POKEY_CHANNELS];	// High Pass Filter flip-flops, only used by channels 1 and 2
+	bool m_timerActive[POKEY_CHANNELS];	// The low channel of a 16-bit pair drives no underflow of its own
+
+	// Writes waiting for their cycle, in cycle order, and the register values once they are all applied
+	std::vector<TPokeyWrite> m_writeQueue;
+	uint8_t m_queuedRegister[POKEY_REGISTER_COUNT];
+
+	// Absolute cycle count, the polynomial counters are derived from it
+	uint64_t m_cycle;
+	uint64_t m_polyResetCycle;
+
+	// Sum of all channels output at the current cycle, and the last level sent to the resampler
+	int m_level;
+	int m_outputLevel;
+
+	// The same for every channel, when the stems are rendered
+	bool m_isStems;
+	int m_channelLevel[POKEY_CHANNELS];
+	int m_stemOutputLevel[POKEY_CHANNELS];
+	CPokeyResampler m_stemResampler[POKEY_CHANNELS];
+
+	uint32_t m_cpuClock;
+	uint32_t m_sampleRate;
+	CPokeyResampler m_resampler;
+
+	void ApplyWrite(int addr, uint8_t value);
+	void UpdatePeriods();
+	void UpdateLevel();
+	void Underflow(int channel);
+	void FlushLevel(int cycle);
+};
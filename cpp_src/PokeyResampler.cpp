@@ -0,0 +1,208 @@
+//
+// PokeyResampler.cpp
+// Band-limited resampling of the POKEY output, from the 1.79MHz machine clock to any output sample rate
+//
+// The kernel is a Blackman windowed sinc, stored as impulses rather than steps,
+// so the output is simply integrated when the samples are read back.
+//
+
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2
+#endif
+
+#include "PokeyResampler.h"
+
+static const double PI = 3.14159265358979323846;
+
+/// <summary>
+/// Kernel table, shared by all the resampler instances.
+/// Each coefficient is stored as a 32-bit value holding a signed 16-bit number,
+/// so the SSE2 path can multiply 4 of them at once with _mm_madd_epi16.
+/// </summary>
+static struct TResamplerKernel
+{
+	int32_t phase[RESAMPLER_PHASES][RESAMPLER_TAPS];
+
+	TResamplerKernel()
+	{
+		for (int p = 0; p < RESAMPLER_PHASES; p++)
+		{
+			double kernel[RESAMPLER_TAPS];
+			double sum = 0;
+
+			for (int k = 0; k < RESAMPLER_TAPS; k++)
+			{
+				// Distance from the impulse centre, in output samples
+				double x = k - (RESAMPLER_TAPS / 2 - 1) - (double)p / RESAMPLER_PHASES;
+				double w = (x + RESAMPLER_TAPS / 2) / RESAMPLER_TAPS;
+				double sinc = (x == 0) ? 1.0 : sin(2 * PI * RESAMPLER_CUTOFF * x) / (2 * PI * RESAMPLER_CUTOFF * x);
+				double window = (w <= 0 || w >= 1) ? 0 : 0.42 - 0.5 * cos(2 * PI * w) + 0.08 * cos(4 * PI * w);
+				kernel[k] = sinc * window;
+				sum += kernel[k];
+			}
+
+			// Normalise every phase to exactly the same DC gain, so the integrated output never drifts
+			int total = 0;
+			for (int k = 0; k < RESAMPLER_TAPS; k++)
+			{
+				phase[p][k] = (int32_t)floor(kernel[k] / sum * (1 << RESAMPLER_KERNEL_BITS) + 0.5);
+				total += phase[p][k];
+			}
+			phase[p][RESAMPLER_TAPS / 2 - 1] += (1 << RESAMPLER_KERNEL_BITS) - total;
+		}
+	}
+} s_kernel;
+
+CPokeyResampler::CPokeyResampler()
+{
+	SetRates(1773447, 44100);
+}
+
+/// <summary>
+/// Set the input clock and the output sample rate, this also clears the buffer.
+/// </summary>
+/// <param name="clockRate">POKEY input clock, FREQ_17_PAL or FREQ_17_NTSC</param>
+/// <param name="sampleRate">Output samples per second, such as 44100, 48000 or 96000</param>
+void CPokeyResampler::SetRates(uint32_t clockRate, uint32_t sampleRate)
+{
+	m_clockRate = clockRate;
+	m_sampleRate = sampleRate;
+	Clear();
+}
+
+void CPokeyResampler::Clear()
+{
+	m_timeOffset = 0;
+	m_integrator = 0;
+	m_buffer.assign(m_buffer.size(), 0);
+}
+
+/// <summary>
+/// Make sure the buffer can hold the given number of samples, plus the tail of the kernel.
+/// </summary>
+void CPokeyResampler::Reserve(int samples)
+{
+	size_t size = samples + RESAMPLER_TAPS + 1;
+
+	if (m_buffer.size() < size)
+		m_buffer.resize(size, 0);
+}
+
+/// <summary>
+/// Get the number of clock cycles that must be run, so at least the given number of samples are available.
+/// </summary>
+int CPokeyResampler::GetCyclesNeeded(int samples)
+{
+	uint64_t needed = (uint64_t)samples * m_clockRate;
+
+	if (needed <= m_timeOffset)
+		return 0;
+
+	return (int)((needed - m_timeOffset + m_sampleRate - 1) / m_sampleRate);
+}
+
+/// <summary>
+/// Open a new frame, making room for all the samples it could produce.
+/// </summary>
+/// <param name="cycles">Length of the frame, in clock cycles</param>
+void CPokeyResampler::BeginFrame(int cycles)
+{
+	Reserve((int)((m_timeOffset + (uint64_t)cycles * m_sampleRate) / m_clockRate));
+}
+
+/// <summary>
+/// Add a change of output level at the given cycle of the current frame.
+/// </summary>
+/// <param name="cycle">Cycle offset from the start of the frame, within the cycles given to BeginFrame</param>
+/// <param name="delta">Change of output level</param>
+void CPokeyResampler::AddDelta(int cycle, int delta)
+{
+	uint64_t time = m_timeOffset + (uint64_t)cycle * m_sampleRate;
+	uint32_t position = (uint32_t)(time / m_clockRate);
+	uint32_t phase = (uint32_t)((time % m_clockRate) * RESAMPLER_PHASES / m_clockRate);
+
+	const int32_t* kernel = s_kernel.phase[phase];
+	int32_t* out = &m_buffer[position];
+
+#ifdef RESAMPLER_SSE2
+	// The delta sits in the low half of each 32-bit lane, so madd multiplies it with the 16-bit coefficient only
+	__m128i d = _mm_set1_epi32(delta & 0xFFFF);
+
+	for (int k = 0; k < RESAMPLER_TAPS; k += 4)
+	{
+		__m128i product = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(kernel + k)), d);
+		__m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(out + k)), product);
+		_mm_storeu_si128((__m128i*)(out + k), sum);
+	}
+#else
+	for (int k = 0; k < RESAMPLER_TAPS; k++)
+		out[k] += kernel[k] * delta;
+#endif
+}
+
+/// <summary>
+/// Close the current frame, the samples up to its end can then be read.
+/// </summary>
+/// <param name="cycles">Length of the frame, in clock cycles</param>
+void CPokeyResampler::EndFrame(int cycles)
+{
+	m_timeOffset += (uint64_t)cycles * m_sampleRate;
+}
+
+/// <summary>
+/// Remove the samples that were read from the start of the buffer, keeping the kernel tail of the next ones.
+/// </summary>
+void CPokeyResampler::Discard(int samples)
+{
+	size_t tail = m_buffer.size() - samples;
+
+	memmove(&m_buffer[0], &m_buffer[samples], tail * sizeof(int32_t));
+	memset(&m_buffer[tail], 0, samples * sizeof(int32_t));
+	m_timeOffset -= (uint64_t)samples * m_clockRate;
+}
+
+/// <summary>
+/// Read back output samples as 16-bit signed integers, clipped to the 16-bit range.
+/// </summary>
+/// <param name="buffer">Output buffer</param>
+/// <param name="samples">Number of samples to read, at most GetSamplesAvailable()</param>
+/// <param name="scale">Output amplitude for 1 step of input level</param>
+void CPokeyResampler::ReadSamples(int16_t* buffer, int samples, int scale)
+{
+	int32_t integrator = m_integrator;
+
+	for (int i = 0; i < samples; i++)
+	{
+		integrator += m_buffer[i];
+		int32_t sample = (int32_t)(((int64_t)integrator * scale) >> RESAMPLER_KERNEL_BITS);
+		buffer[i] = (int16_t)(sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+	}
+
+	m_integrator = integrator;
+	Discard(samples);
+}
+
+/// <summary>
+/// Read back output samples as floating point numbers.
+/// </summary>
+/// <param name="buffer">Output buffer</param>
+/// <param name="samples">Number of samples to read, at most GetSamplesAvailable()</param>
+/// <param name="scale">Output amplitude for 1 step of input level</param>
+void CPokeyResampler::ReadSamples(float* buffer, int samples, float scale)
+{
+	int32_t integrator = m_integrator;
+	scale /= (1 << RESAMPLER_KERNEL_BITS);
+
+	for (int i = 0; i < samples; i++)
+	{
+		integrator += m_buffer[i];
+		buffer[i] = integrator * scale;
+	}
+
+	m_integrator = integrator;
+	Discard(samples);
+}
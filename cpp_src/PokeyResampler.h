@@ -0,0 +1,55 @@
+//
+// PokeyResampler.h header file
+// Band-limited resampling of the POKEY output, from the 1.79MHz machine clock to any output sample rate
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define RESAMPLER_TAPS			16			// Length of the band-limited step kernel, in output samples
+#define RESAMPLER_PHASES		64			// Sub-sample positions of the kernel
+#define RESAMPLER_KERNEL_BITS	15			// Fixed point precision of the kernel, each phase sums to exactly 1 << RESAMPLER_KERNEL_BITS
+#define RESAMPLER_CUTOFF		0.45		// Cutoff frequency, relative to the output sample rate
+
+/// <summary>
+/// Polyphase band-limited step synthesis (BLEP).
+/// The POKEY only ever changes its output level at precise cycles, so every level change is
+/// added to the buffer as a band-limited impulse at its exact sub-sample position, and the
+/// output samples are the running sum of these impulses.
+/// The clock ratio is kept as an exact fraction, output never drifts away from the machine clock.
+/// </summary>
+class CPokeyResampler
+{
+public:
+	CPokeyResampler();
+
+	void SetRates(uint32_t clockRate, uint32_t sampleRate);
+	void Clear();
+
+	int GetCyclesNeeded(int samples);
+	void BeginFrame(int cycles);
+	void AddDelta(int cycle, int delta);
+	void EndFrame(int cycles);
+
+	int GetSamplesAvailable() { return (int)(m_timeOffset / m_clockRate); };
+	void ReadSamples(int16_t* buffer, int samples, int scale);
+	void ReadSamples(float* buffer, int samples, float scale);
+
+private:
+	uint32_t m_clockRate;
+	uint32_t m_sampleRate;
+
+	// Start of the current frame, relative to the first sample in the buffer, in 1/m_clockRate sample units
+	uint64_t m_timeOffset;
+
+	// Running sum of the impulses read so far, this is the current output level
+	int32_t m_integrator;
+
+	std::vector<int32_t> m_buffer;
+
+	void Reserve(int samples);
+	void Discard(int samples);
+};
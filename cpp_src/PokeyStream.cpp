@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include <fstream>
+#include <algorithm>
 #include "PokeyStream.h"
+#include "IOHelpers.h"
 
 #include "Atari6502.h"
 #include "ChannelControl.h"
@@ -12,79 +14,247 @@
 CPokeyStream::CPokeyStream()
 {
 	m_recordState = STREAM_STATE::STOP;
+	m_isFailed = false;
 	m_StreamBuffer = NULL;
 	m_BufferSize = 0;
+	m_FrameSize = 9;
+	m_FrameCapacity = 0;
+	m_DataSize = 0;
+	m_MappedFile = INVALID_HANDLE_VALUE;
+	m_FileMapping = NULL;
+	m_Output = NULL;
 	m_FrameCounter = 0;
 	m_SonglineCounter = 0;
 	memset(m_PlayCount, 0, sizeof(m_PlayCount));
 	memset(m_FramesPerSongline, 0, sizeof(m_FramesPerSongline));
 	memset(m_OffsetPerSongline, 0, sizeof(m_OffsetPerSongline));
+	memset(m_LastPassOffset, 0, sizeof(m_LastPassOffset));
+	memset(m_PreviousPassOffset, 0, sizeof(m_PreviousPassOffset));
+	m_StateOffset.clear();
+	m_Segments.clear();
+	m_SegmentOffset = 0;
+	m_SegmentHash = FNV1A_OFFSET_BASIS;
+	m_BufferFrame = 0;
+	m_WrittenFrames = 0;
 	m_SongLoopedCounter = 0;
 }
 
 CPokeyStream::~CPokeyStream()
 {
-	if (m_StreamBuffer)
-	{
-		free(m_StreamBuffer);
-		m_StreamBuffer = NULL;
-	}
+	ReleaseBuffer();
 }
 
 void CPokeyStream::Clear()
 {
-	if (m_StreamBuffer)
-	{
-		free(m_StreamBuffer);
-		m_StreamBuffer = NULL;
-	}
-	m_BufferSize = 0;
+	ReleaseBuffer();
 	m_FrameCounter = 0;
 	m_SonglineCounter = 0;
 	memset(m_PlayCount, 0, sizeof(m_PlayCount));
 	memset(m_FramesPerSongline, 0, sizeof(m_FramesPerSongline));
 	memset(m_OffsetPerSongline, 0, sizeof(m_OffsetPerSongline));
+	memset(m_LastPassOffset, 0, sizeof(m_LastPassOffset));
+	memset(m_PreviousPassOffset, 0, sizeof(m_PreviousPassOffset));
+	m_StateOffset.clear();
+	m_Segments.clear();
+	m_SegmentOffset = 0;
+	m_SegmentHash = FNV1A_OFFSET_BASIS;
+	m_BufferFrame = 0;
+	m_WrittenFrames = 0;
 	m_SongLoopedCounter = 0;
 }
 
-void CPokeyStream::StartRecording()
+/// <summary>
+/// Prepare the buffer for a new recording, large enough for the expected number of frames, so it is normally never grown.
+/// When an output is set, the buffer only holds a batch of frames, whatever the length of the recording is.
+/// </summary>
+/// <param name="expectedFrames">Frames the recording is predicted to need, the default buffer size is used if unknown</param>
+/// <param name="channelCount">Channels of the song, 4 for Mono and 8 for Stereo, the tracker setting is used if 0</param>
+void CPokeyStream::StartRecording(int expectedFrames, int channelCount)
 {
-	if (m_StreamBuffer)
-	{
-		free(m_StreamBuffer);
-		m_StreamBuffer = NULL;
-	}
+	ReleaseBuffer();
+
+	if (!channelCount)
+		channelCount = g_tracks4_8;
 
 	m_recordState = STREAM_STATE::START;
-	m_BufferSize = 0xFFFFF;
-	m_StreamBuffer = (unsigned char*)calloc(m_BufferSize, 1);
+	m_isFailed = false;
+	m_FrameSize = (channelCount > 4) ? 18 : 9;	// Stereo support doubles the dumped data
+
+	m_DataSize = 0;
+	m_FrameIndex.clear();
+
 	m_FrameCounter = 0;
 	m_SonglineCounter = 0;
 	memset(m_PlayCount, 0, sizeof(m_PlayCount));
 	memset(m_FramesPerSongline, 0, sizeof(m_FramesPerSongline));
 	memset(m_OffsetPerSongline, 0, sizeof(m_OffsetPerSongline));
+	memset(m_LastPassOffset, 0, sizeof(m_LastPassOffset));
+	memset(m_PreviousPassOffset, 0, sizeof(m_PreviousPassOffset));
+	m_StateOffset.clear();
+	m_Segments.clear();
+	m_SegmentOffset = 0;
+	m_SegmentHash = FNV1A_OFFSET_BASIS;
+	m_BufferFrame = 0;
+	m_WrittenFrames = 0;
 	m_SongLoopedCounter = 0;
 
 	m_FirstCountPoint = 0;
 	m_SecondCountPoint = 0;
 	m_ThirdCountPoint = 0;
+
+	// Without a buffer, nothing could be recorded, the recording is failed right away
+	bool isAllocated;
+	if (m_Output)
+		isAllocated = AllocateBuffer((size_t)POKEYSTREAM_OUTPUT_FRAMES * m_FrameSize);
+	else
+		isAllocated = AllocateBuffer((expectedFrames > 0) ? (size_t)expectedFrames * m_FrameSize / POKEYSTREAM_DELTA_RATIO : POKEYSTREAM_BUFFER_DEFAULT);
+
+	if (!isAllocated)
+		AbortRecording();
 }
 
-int CPokeyStream::SwitchIntoRecording()
+/// <summary>
+/// Stop the recording once a frame could not be buffered or written, it is then incomplete.
+/// The playback ends at the next frame, and IsFailed() tells the caller not to use what was recorded.
+/// </summary>
+void CPokeyStream::AbortRecording()
 {
-	m_recordState = STREAM_STATE::RECORD;
-	m_FirstCountPoint = m_FrameCounter; 
-	return m_FirstCountPoint;
+	m_recordState = STREAM_STATE::STOP;
+	m_isFailed = true;
 }
 
-int CPokeyStream::SwitchIntoStop()
+/// <summary>
+/// Allocate an empty buffer, on the heap, or in a temporary file for the very long recordings.
+/// </summary>
+bool CPokeyStream::AllocateBuffer(size_t size)
 {
-	m_recordState = STREAM_STATE::STOP;
-	m_SecondCountPoint = m_FrameCounter - m_FirstCountPoint;
-	if (m_SecondCountPoint < 0) m_SecondCountPoint = 0;
-	m_ThirdCountPoint = m_FirstCountPoint - m_SecondCountPoint;
-	if (m_ThirdCountPoint < 0) m_ThirdCountPoint = 0;
-	return m_SecondCountPoint;
+	if (size >= POKEYSTREAM_MAPPED_SIZE)
+		return MapBuffer(size);
+
+	m_StreamBuffer = (unsigned char*)calloc(size, 1);
+	if (!m_StreamBuffer)
+		return false;
+
+	m_BufferSize = size;
+	m_FrameCapacity = (int)(m_BufferSize / m_FrameSize);
+	return true;
+}
+
+/// <summary>
+/// Double the size of the buffer, once it is full because the recording is longer than expected.
+/// A heap buffer moves into a temporary file once it becomes too large, a mapped file is simply extended.
+/// </summary>
+bool CPokeyStream::GrowBuffer()
+{
+	size_t size = m_BufferSize * 2;
+
+	if (!m_StreamBuffer)
+		return false;
+
+	if (size >= POKEYSTREAM_MAPPED_SIZE)
+	{
+		if (IsBufferMapped())
+			return MapBuffer(size);
+
+		unsigned char* heapBuffer = m_StreamBuffer;
+		size_t heapSize = m_BufferSize;
+
+		// The heap buffer is kept as it is if the file could not be mapped
+		if (!MapBuffer(size))
+			return false;
+
+		memcpy(m_StreamBuffer, heapBuffer, heapSize);
+		free(heapBuffer);
+		return true;
+	}
+
+	unsigned char* buffer = (unsigned char*)realloc(m_StreamBuffer, size);
+	if (!buffer)
+		return false;
+
+	m_StreamBuffer = buffer;
+	m_BufferSize = size;
+	m_FrameCapacity = (int)(m_BufferSize / m_FrameSize);
+	return true;
+}
+
+/// <summary>
+/// Map the buffer from a temporary file, deleted once it is closed, only the frames recorded so far need to be paged in.
+/// The file is created by the first call, the next calls extend it, keeping everything recorded.
+/// If the mapping fails, only what this call created is closed, the buffer and everything recorded are left as they were.
+/// </summary>
+bool CPokeyStream::MapBuffer(size_t size)
+{
+	bool isCreated = m_MappedFile == INVALID_HANDLE_VALUE;
+
+	if (isCreated)
+	{
+		char tempPath[MAX_PATH];
+		char tempFile[MAX_PATH];
+
+		if (!GetTempPath(MAX_PATH, tempPath) || !GetTempFileName(tempPath, "rmt", 0, tempFile))
+			return false;
+
+		m_MappedFile = CreateFile(tempFile, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+		if (m_MappedFile == INVALID_HANDLE_VALUE)
+			return false;
+	}
+
+	// A new mapping and view are made with the new size, the file grows along with them, the old ones are closed once they succeeded
+	HANDLE fileMapping = CreateFileMapping(m_MappedFile, NULL, PAGE_READWRITE, (DWORD)((UINT64)size >> 32), (DWORD)size, NULL);
+	unsigned char* view = fileMapping ? (unsigned char*)MapViewOfFile(fileMapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+
+	if (!view)
+	{
+		if (fileMapping)
+			CloseHandle(fileMapping);
+
+		if (isCreated)
+		{
+			CloseHandle(m_MappedFile);
+			m_MappedFile = INVALID_HANDLE_VALUE;
+		}
+
+		return false;
+	}
+
+	if (!isCreated)
+	{
+		UnmapViewOfFile(m_StreamBuffer);
+		CloseHandle(m_FileMapping);
+	}
+
+	m_FileMapping = fileMapping;
+	m_StreamBuffer = view;
+
+	m_BufferSize = size;
+	m_FrameCapacity = (int)(m_BufferSize / m_FrameSize);
+	return true;
+}
+
+void CPokeyStream::ReleaseBuffer()
+{
+	if (IsBufferMapped())
+	{
+		if (m_StreamBuffer)
+			UnmapViewOfFile(m_StreamBuffer);
+		if (m_FileMapping)
+			CloseHandle(m_FileMapping);
+
+		CloseHandle(m_MappedFile);
+		m_MappedFile = INVALID_HANDLE_VALUE;
+		m_FileMapping = NULL;
+	}
+	else if (m_StreamBuffer)
+	{
+		free(m_StreamBuffer);
+	}
+
+	m_StreamBuffer = NULL;
+	m_BufferSize = 0;
+	m_FrameCapacity = 0;
+	m_DataSize = 0;
+	m_FrameIndex.clear();
 }
 
 void CPokeyStream::CallFromPlay(int playerState, int trackLine, int songLine)
@@ -95,47 +265,133 @@ void CPokeyStream::CallFromPlay(int playerState, int trackLine, int songLine)
 		memset(m_PlayCount, 0, sizeof(m_PlayCount));	// Reset lines play counter first
 		if (playerState == MPLAY_BLOCK)
 			m_PlayCount[trackLine] += 1;				// Increment the track line play count early, so it will be detected as the selection block loop
-		else
-			m_PlayCount[songLine] += 1;					// Increment the line play count early, to ensure that same line will be detected again as the loop point
 		m_recordState = STREAM_STATE::RECORD;			// Set the SAPR dumper with the "is currently recording data" flag 
 	}
 }
 
-bool CPokeyStream::TrackSongLine(int trackedInstance)
+/// <summary>
+/// Track the player state at the beginning of every songline, starting with the first frame recorded.
+/// The loop is found once a state is reached a second time: everything played from there is what was played from the first time,
+/// so the recording is the shortest intro and loop possible, even with jumps in the middle of Patterns.
+/// </summary>
+/// <param name="songLine">Songline played</param>
+/// <param name="stateHash">Hash of the complete player state, and of the POKEY registers of the frames just played</param>
+/// <returns>True once the loop was found, the recording is then stopped</returns>
+bool CPokeyStream::TrackSongLine(int songLine, UINT64 stateHash)
 {
-	if (m_recordState == STREAM_STATE::RECORD)			// The SAPR dumper is running with the "is currently recording data" flag 
+	if (m_recordState != STREAM_STATE::RECORD)
+		return false;
+
+	// The frames recorded since the last songline are kept as a hash, passes can then be compared without the frames themselves
+	if (m_FrameCounter > m_SegmentOffset)
+		m_Segments.push_back({ m_SegmentOffset, m_SegmentHash });
+
+	m_SegmentOffset = m_FrameCounter;
+	m_SegmentHash = FNV1A_OFFSET_BASIS;
+
+	int count = ++m_PlayCount[songLine];
+
+	// Songlines are indexed by the frame they begin at, until one of them is played again
+	if (count > 1 && m_SongLoopedCounter < 1)
+		m_SongLoopedCounter = 1;
+
+	if (m_SongLoopedCounter < 1 && m_FrameCounter > 0)
 	{
-		m_PlayCount[trackedInstance] += 1;				// Increment the position counter by 1
+		m_SonglineCounter++;
+		m_OffsetPerSongline[m_SonglineCounter] = m_FrameCounter;
+	}
 
-		// If the Songline is played for the first time, the current frames count will be used for its index
-		if (m_SongLoopedCounter < 1)
-		{
-			// At least 1 Songline will be played, increment the count early
-			m_SonglineCounter++;
-			m_OffsetPerSongline[m_SonglineCounter] = m_FrameCounter;
-		}
+	int loopStart;
+	int loopEnd = m_FrameCounter;
+	auto match = m_StateOffset.find(stateHash);
 
-		int count = m_PlayCount[trackedInstance];		// Fetch that line play count for the next step
-		if (count > 1)
-		{
-			// A value above 1 means a full playback loop has been completed, the line play count incremented twice
-			m_SongLoopedCounter++;						// Increment the dumper iteration count by 1
-			m_recordState = STREAM_STATE::WRITE;		// Set the "write SAP-R data to file" flag
-			if (m_SongLoopedCounter == 1)
-			{
-				memset(m_PlayCount, 0, sizeof(m_PlayCount));	// Reset the lines play count before the next step 
-				m_PlayCount[trackedInstance] += 1;				// Increment the line play count early, to ensure that same line will be detected again as the loop point for the next dumper iteration 
+	if (match != m_StateOffset.end())
+	{
+		loopStart = match->second;
+	}
+	else if (count > 2 && IsPassRepeated(songLine))
+	{
+		// Some variables may keep changing without ever being heard, such as counters running across the loop
+		// 2 identical passes in a row are then as good as it gets, the second one was recorded for nothing
+		loopStart = m_PreviousPassOffset[songLine];
+		loopEnd = m_LastPassOffset[songLine];
+	}
+	else if (count > POKEYSTREAM_PASSES_MAX)
+	{
+		// The song never settles, the last pass is used for the loop
+		loopStart = m_LastPassOffset[songLine];
+	}
+	else
+	{
+		m_StateOffset[stateHash] = m_FrameCounter;
+		m_PreviousPassOffset[songLine] = m_LastPassOffset[songLine];
+		m_LastPassOffset[songLine] = m_FrameCounter;
+		return false;
+	}
 
-				SwitchIntoRecording();
-			}
-			if (m_SongLoopedCounter == 2)
-			{
-				SwitchIntoStop();
-				return true;
-			}
-		}
+	m_FirstCountPoint = loopEnd;
+	m_SecondCountPoint = loopEnd - loopStart;
+	m_ThirdCountPoint = loopStart;
+	m_SongLoopedCounter = 2;
+	m_recordState = STREAM_STATE::STOP;
+
+	// Only the frames up to the loop point are written, the caller cuts any frame written past it
+	if (m_Output && !WriteOutput(m_FirstCountPoint))
+		AbortRecording();
+
+	return true;
+}
+
+/// <summary>
+/// Compare the last 2 passes of a songline, up to the current frame, to tell if the POKEY registers recorded were identical.
+/// Every songline played in both passes must have the same length and the same hash, the frames may no longer be in memory.
+/// </summary>
+bool CPokeyStream::IsPassRepeated(int songLine)
+{
+	int previous = m_PreviousPassOffset[songLine];
+	int last = m_LastPassOffset[songLine];
+	int length = last - previous;
+
+	if (length <= 0 || m_FrameCounter - last != length)
+		return false;
+
+	auto compare = [](const TStreamSegment& segment, int offset) { return segment.offset < offset; };
+	size_t first = std::lower_bound(m_Segments.begin(), m_Segments.end(), previous, compare) - m_Segments.begin();
+	size_t second = std::lower_bound(m_Segments.begin(), m_Segments.end(), last, compare) - m_Segments.begin();
+
+	if (second - first != m_Segments.size() - second)
+		return false;
+
+	for (size_t i = 0; first + i < second; i++)
+	{
+		const TStreamSegment& a = m_Segments[first + i];
+		const TStreamSegment& b = m_Segments[second + i];
+
+		if (a.offset - previous != b.offset - last || a.hash != b.hash)
+			return false;
 	}
-	return false;
+
+	return true;
+}
+
+/// <summary>
+/// Write the frames held in the buffer to the output, up to the given frame, the buffer is then empty.
+/// </summary>
+bool CPokeyStream::WriteOutput(int lastFrame)
+{
+	if (!m_Output || !m_StreamBuffer)
+		return false;
+
+	int frames = min(lastFrame, m_FrameCounter) - m_BufferFrame;
+
+	if (frames > 0)
+	{
+		m_Output->write((char*)m_StreamBuffer, (std::streamsize)frames * m_FrameSize);
+		m_WrittenFrames = m_BufferFrame + frames;
+	}
+
+	m_BufferFrame = m_FrameCounter;
+	return m_Output->good();
 }
 
 bool CPokeyStream::CallFromPlayBeat(int trackedInstance)
@@ -165,49 +421,57 @@ bool CPokeyStream::CallFromPlayBeat(int trackedInstance)
 	return false;
 }
 
-void CPokeyStream::Record()
+void CPokeyStream::Record(const unsigned char* memory)
+{
+	RecordRegisters(memory + 0xd200);
+}
+
+/// <summary>
+/// Record 1 frame of POKEY registers, laid out as they are in memory from $D200, with the second POKEY $10 bytes after the first.
+/// </summary>
+void CPokeyStream::RecordRegisters(const unsigned char* registers)
 {
 	if (m_recordState == STREAM_STATE::STOP) return;
 	if (m_recordState == STREAM_STATE::START) return;		// Too soon, must first be initialised to get a constant rate every time, this prevents writing garbage in memory for the first few frames
 
-	int frameSize = (g_tracks4_8 == 8) ? 18 : 9;			// Stereo support doubles the dumped data
-	int offsetIntoSAPRBuffer = m_FrameCounter * frameSize;	// 4 AUDC, 4 AUDF, 1 AUDCTL + Second POKEY if used
+	// If the end was reached, do nothing, simply ignore the last frame
+	if (m_SongLoopedCounter == 2) return;
+
+	// Dump Pokey sound registers to position defined by the frames counter, 4 AUDC, 4 AUDF, 1 AUDCTL + Second POKEY if used
+	// AUDF1, AUDC1, AUDF2, AUDC2, AUDF3, AUDC3, AUDF4, AUDC4, AUDCTL
+	// If Two-Tone is expected by SKCTL, the Volume Only bit is set in AUDC1
+	unsigned char frame[POKEYSTREAM_FRAME_MAX];
+	unsigned char* pokey = frame;
 
-	if (offsetIntoSAPRBuffer > m_BufferSize - frameSize + 1)
+	// In Stereo, the 2nd POKEY comes first, memory can then be aligned as it is expected
+	if (m_FrameSize == 18)
 	{
-		// Buffer is too small, grow it
-		m_BufferSize *= 2;
-		m_StreamBuffer = (unsigned char*)realloc(m_StreamBuffer, m_BufferSize);
+		memcpy(pokey, registers + 0x10, 9);
+		pokey[1] |= (registers[0x1F] == 0x8B) ? 0x10 : 0x00;
+		pokey += 9;
 	}
 
-	// Dump Pokey sound registers to position defined by the frames counter
-	// AUDF1, AUDC1, AUDF2, AUDC2, AUDF3, AUDC3, AUDF4, AUDC4, AUDCTL
-	for (int i = 0; i < 9; i++)
-	{
-		int j = (frameSize == 18) ? 9 : 0;		// Slight offset for i count, memory can then be aligned as it is expected
+	memcpy(pokey, registers, 9);
+	pokey[1] |= (registers[0x0F] == 0x8B) ? 0x10 : 0x00;
 
-		// Copy data from the 1st Pokey
-		// 0 offset in mono
-		// 9 offset in stereo
-		m_StreamBuffer[offsetIntoSAPRBuffer + i + j] = g_atarimem[0xd200 + i];
-		if (i == 1)	// AUDC1
-		{	// Test SKCTL ($D20F), if Two-Tone is expected, set the Volume Only bit in the current AUDC1 offset
-			m_StreamBuffer[offsetIntoSAPRBuffer + i + j] |= (g_atarimem[0xd20F] == 0x8B) ? 0x10 : 0x00;
+	if (m_Output)
+	{
+		// The frames are kept as they are, and written once the buffer is full, it is then used again from the start
+		if (m_FrameCounter - m_BufferFrame >= m_FrameCapacity && !WriteOutput(m_FrameCounter))
+		{
+			AbortRecording();
+			return;
 		}
 
-		if (frameSize == 9)
-			continue;	// No second POKEY 
-
-		// Copy data from the 2nd Pokey
-		m_StreamBuffer[offsetIntoSAPRBuffer + i] = g_atarimem[0xd210 + i];
-		if (i == 1)	//AUDC1
-		{	//test SKCTL, if Two-Tone is expected, set the Volume Only bit in the current AUDC1 offset
-			m_StreamBuffer[offsetIntoSAPRBuffer + i] |= (g_atarimem[0xd21F] == 0x8B) ? 0x10 : 0x00;
-		}
+		memcpy(m_StreamBuffer + (size_t)(m_FrameCounter - m_BufferFrame) * m_FrameSize, frame, m_FrameSize);
+	}
+	else if (!EncodeFrame(frame))
+	{
+		AbortRecording();
+		return;
 	}
 
-	// If the end was reached, do nothing, simply ignore the last frame
-	if (m_SongLoopedCounter == 2) return;
+	m_SegmentHash = FNV1a(frame, m_FrameSize, m_SegmentHash);
 
 	// Count the frames played in each Songline, until the first loop point is found
 	if (m_SongLoopedCounter < 1)
@@ -220,14 +484,139 @@ void CPokeyStream::Record()
 	m_FrameCounter++;
 }
 
+/// <summary>
+/// Delta encode a frame at the end of the buffer, from the previous frame, or completely every POKEYSTREAM_INDEX_INTERVAL frames.
+/// The buffer is normally large enough for the whole recording, and is only grown if the prediction was too short.
+/// </summary>
+bool CPokeyStream::EncodeFrame(const unsigned char* frame)
+{
+	if (m_DataSize + POKEYSTREAM_DELTA_MAX > m_BufferSize && !GrowBuffer())
+		return false;
+
+	bool isComplete = !(m_FrameCounter % POKEYSTREAM_INDEX_INTERVAL);
+	bool isChanged[POKEYSTREAM_FRAME_MAX];
+	int lastChanged = -1;
+
+	if (isComplete)
+		m_FrameIndex.push_back(m_DataSize);
+
+	for (int i = 0; i < m_FrameSize; i++)
+	{
+		isChanged[i] = isComplete || frame[i] != m_LastFrame[i];
+
+		if (isChanged[i])
+			lastChanged = i;
+	}
+
+	// The mask bytes stop after the last register changed, at least 1 is always written
+	unsigned char* data = m_StreamBuffer + m_DataSize;
+	int maskCount = lastChanged / 7 + 1;
+
+	for (int i = 0; i < maskCount; i++)
+	{
+		unsigned char mask = (i < maskCount - 1) ? 0x80 : 0x00;
+
+		for (int bit = 0; bit < 7 && i * 7 + bit < m_FrameSize; bit++)
+			mask |= isChanged[i * 7 + bit] << bit;
+
+		*data++ = mask;
+	}
+
+	for (int i = 0; i <= lastChanged; i++)
+	{
+		if (isChanged[i])
+			*data++ = frame[i];
+	}
+
+	m_DataSize = data - m_StreamBuffer;
+	memcpy(m_LastFrame, frame, m_FrameSize);
+	return true;
+}
+
+/// <summary>
+/// Position a cursor for reading the recorded frames from the given frame, starting from the complete frame indexed before it.
+/// </summary>
+void CPokeyStream::SeekFrame(TStreamCursor* pCursor, int frame)
+{
+	memset(pCursor, 0, sizeof(TStreamCursor));
+
+	if (m_FrameIndex.empty())
+		return;
+
+	int index = min(max(frame, 0), m_FrameCounter - 1) / POKEYSTREAM_INDEX_INTERVAL;
+	pCursor->frame = index * POKEYSTREAM_INDEX_INTERVAL;
+	pCursor->offset = m_FrameIndex[index];
+
+	while (pCursor->frame < frame && ReadFrame(pCursor));
+}
+
+/// <summary>
+/// Read the next frame from a cursor, the registers are laid out as they are in the SAP-R format.
+/// </summary>
+/// <returns>The registers of the frame, held by the cursor, or NULL past the last frame recorded</returns>
+const unsigned char* CPokeyStream::ReadFrame(TStreamCursor* pCursor)
+{
+	// The frames written to an output as they were recorded are no longer in the buffer
+	if (m_Output || pCursor->frame >= m_FrameCounter)
+		return NULL;
+
+	const unsigned char* mask = m_StreamBuffer + pCursor->offset;
+	int maskCount = 1;
+
+	while (mask[maskCount - 1] & 0x80)
+		maskCount++;
+
+	// The changed registers follow the mask bytes, in order
+	const unsigned char* data = mask + maskCount;
+
+	for (int i = 0; i < maskCount; i++)
+	{
+		for (int bit = 0; bit < 7; bit++)
+		{
+			if (mask[i] & (1 << bit))
+				pCursor->registers[i * 7 + bit] = *data++;
+		}
+	}
+
+	pCursor->offset = data - m_StreamBuffer;
+	pCursor->frame++;
+	return pCursor->registers;
+}
+
+/// <summary>
+/// Decode recorded frames, as they are in the SAP-R format, for anything needing them in a contiguous buffer.
+/// </summary>
+/// <returns>Frames decoded, fewer than asked for if the recording ends before</returns>
+int CPokeyStream::ReadFrames(int frame, int frameCount, unsigned char* frames)
+{
+	TStreamCursor cursor;
+	const unsigned char* registers;
+	int count = 0;
+
+	SeekFrame(&cursor, frame);
+
+	for (; count < frameCount && (registers = ReadFrame(&cursor)); count++)
+		memcpy(frames + (size_t)count * m_FrameSize, registers, m_FrameSize);
+
+	return count;
+}
+
 void CPokeyStream::WriteToFile(std::ofstream& ou, int frames, int offset)
 {
-	if (m_StreamBuffer == NULL) return;
+	std::vector<unsigned char> buffer((size_t)POKEYSTREAM_OUTPUT_FRAMES * m_FrameSize);
+
+	// The frames are decoded in batches, there is never a complete copy of them
+	while (frames > 0)
+	{
+		int count = ReadFrames(offset, min(frames, POKEYSTREAM_OUTPUT_FRAMES), buffer.data());
 
-	int bytenum = (g_tracks4_8 == 8) ? 18 : 9;
-	int len = frames * bytenum;
-	int off = offset * bytenum;
-	ou.write((char*)m_StreamBuffer + off, len);
+		if (!count)
+			break;
+
+		ou.write((char*)buffer.data(), (std::streamsize)count * m_FrameSize);
+		offset += count;
+		frames -= count;
+	}
 }
 
 void CPokeyStream::FinishedRecording()
@@ -235,13 +624,10 @@ void CPokeyStream::FinishedRecording()
 	m_recordState = STREAM_STATE::STOP;		// Reset the SAPR dump flag now it is done
 	m_FrameCounter = 0;						// Also reset the framecount once finished
 	m_SongLoopedCounter = 0;				// Reset the playback counter
+	m_Output = NULL;						// The next recording is kept in memory again, unless an output is set for it
 
-	// Clear the allocated memory for the SAP-R dumper, TODO: manage memory dynamically instead
-	if (m_StreamBuffer)
-	{
-		free(m_StreamBuffer);
-		m_StreamBuffer = NULL;
-	}
+	// Clear the allocated memory for the SAP-R dumper
+	ReleaseBuffer();
 
 	Atari_InitRMTRoutine();	//reset the Atari memory 
 	SetChannelOnOff(-1, 1);	//switch all channels back on, since they were purposefully turned off during the recording
@@ -1,10 +1,42 @@
 #pragma once
 
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#define POKEYSTREAM_BUFFER_DEFAULT	0xFFFFF		// Buffer size when the length of the stream is not known in advance
+#define POKEYSTREAM_MAPPED_SIZE		0x4000000	// Buffers from that size are kept in a memory mapped temporary file instead of the heap
+#define POKEYSTREAM_PASSES_MAX		16			// Songline passes before the loop detection gives up on finding an exact state repeat
+#define POKEYSTREAM_OUTPUT_FRAMES	0x1000		// Frames buffered before they are written, when the stream is recorded straight into a file
+#define POKEYSTREAM_FRAME_MAX		18			// Registers in a frame, 9 for Mono and 18 for Stereo
+#define POKEYSTREAM_DELTA_MAX		(3 + POKEYSTREAM_FRAME_MAX)	// Bytes of the largest delta encoded frame, with every register changed
+#define POKEYSTREAM_INDEX_INTERVAL	256			// Frames between 2 complete frames, any frame is decoded from the last one of them
+#define POKEYSTREAM_DELTA_RATIO		2			// Delta encoded frames are expected to be at most half their size, the buffer is grown otherwise
+
+// Frames recorded from the beginning of a songline until the next one, as tracked by TrackSongLine
+typedef struct
+{
+	int offset;						// First frame
+	UINT64 hash;					// Hash of the POKEY registers of every frame
+} TStreamSegment;
+
+// Position in the recorded frames, for reading them in order from any frame
+typedef struct
+{
+	int frame;						// Next frame to read
+	size_t offset;					// Where it begins in the delta encoded data
+	unsigned char registers[POKEYSTREAM_FRAME_MAX];	// Registers of the last frame read
+} TStreamCursor;
+
 /// <summary>
 /// Helper class to record the 9 (mono) or 18 (stereo) Pokey registers
 /// into a large memory buffer.
 /// This happens during quick-play.
 /// These values can then be exported by various paths: SAP-R, with LZSS etc
+/// With an output set, the frames are written into a file in small batches instead, and nothing is kept in memory for long.
+/// In memory, the frames are delta encoded: a mask of the registers changed since the previous frame, then only the changed registers.
+/// The mask is 7 registers per byte, bit 7 is set when another mask byte follows, so a frame without changes is only 1 byte.
+/// Every POKEYSTREAM_INDEX_INTERVAL frames, a complete frame is indexed, from which reading may start, see SeekFrame and ReadFrame.
 /// </summary>
 class CPokeyStream
 {
@@ -22,9 +54,9 @@ public:
 
 	void Clear();
 
-	void StartRecording();
+	void StartRecording(int expectedFrames = 0, int channelCount = 0);
+	void SetOutput(std::ofstream* pOutput) { m_Output = pOutput; }
 
-	inline unsigned char* GetStreamBuffer(void) { return m_StreamBuffer; }
 	inline int GetCurrentFrame(void) { return m_FrameCounter; }
 	inline int GetFirstCountPoint(void) { return m_FirstCountPoint; }
 	inline int GetSecondCountPoint(void) { return m_SecondCountPoint; }
@@ -32,42 +64,80 @@ public:
 
 	inline bool IsRecording() { return m_recordState != STREAM_STATE::STOP; }
 	inline bool IsWriting() { return m_recordState == STREAM_STATE::WRITE; }
+	inline bool IsFailed() { return m_isFailed; }
 	inline void SetState(STREAM_STATE newState) { m_recordState = newState; }
 	inline int LoopCount() { return m_SongLoopedCounter; }
+	inline int GetFrameSize() { return m_FrameSize; }
+	inline size_t GetBufferSize() { return m_BufferSize; }
+	inline size_t GetDataSize() { return m_DataSize; }
+	inline bool IsBufferMapped() { return m_MappedFile != INVALID_HANDLE_VALUE; }
+	inline int GetWrittenFrames() { return m_WrittenFrames; }
 
 	inline int GetSonglineCount() { return m_SonglineCounter; }
 	inline int GetFramesPerSongline(int songLine) { return m_FramesPerSongline[songLine]; }
 	inline int GetOffsetPerSongline(int songLine) { return m_OffsetPerSongline[songLine]; }
 
-	int SwitchIntoRecording();
-	int SwitchIntoStop();
 	void CallFromPlay(int playerState, int trackLine, int songLine);
-	bool TrackSongLine(int songLine);
+	bool TrackSongLine(int songLine, UINT64 stateHash);
 	bool CallFromPlayBeat(int trackLine);
 
-	void Record();
+	void Record(const unsigned char* memory);
+	void RecordRegisters(const unsigned char* registers);
 	void WriteToFile(std::ofstream& ou, int frames, int offset);
+
+	void SeekFrame(TStreamCursor* pCursor, int frame);
+	const unsigned char* ReadFrame(TStreamCursor* pCursor);
+	int ReadFrames(int frame, int frameCount, unsigned char* frames);
 	void FinishedRecording();
 
 private:
 	STREAM_STATE m_recordState;		// What state is the recorder in?
+	bool m_isFailed;				// A frame could not be buffered or written, the recording was stopped and is incomplete
 
-	unsigned char* m_StreamBuffer;	// Ptr to the buffer to hold the Pokey values
+	unsigned char* m_StreamBuffer;	// Ptr to the buffer to hold the Pokey values, delta encoded, or as they are when written to an output
+	size_t m_DataSize;				// Bytes of delta encoded frames in m_StreamBuffer
+	std::vector<size_t> m_FrameIndex;	// Offset of every complete frame in m_StreamBuffer, 1 every POKEYSTREAM_INDEX_INTERVAL frames
+	unsigned char m_LastFrame[POKEYSTREAM_FRAME_MAX];	// Registers of the last frame recorded, the next one is encoded from them
 
 	int m_FrameCounter;				// How many Pokey frames have been recorded?
 
-	int m_SongLoopedCounter;		// How may times has the song been looped?
+	int m_SongLoopedCounter;		// 0 until a songline is played twice, 1 until the loop is found, then 2
 
 	int m_SonglineCounter;			// How many songlines were played?
 
 	int m_PlayCount[256];			// Keeping track of loop points
 	int m_FramesPerSongline[256];	// Keeping track of frames per songline
 	int m_OffsetPerSongline[256];	// Keeping track of index offset per songline
-
-	int m_FirstCountPoint;			// How many frames until we hit the first loop point
-	int m_SecondCountPoint;			// How many frames until we hit the second loop point
-	int m_ThirdCountPoint;			// How many frames between the first and second loop point
-
-	int m_BufferSize;				// What size if the m_StreamBuffer currently
+	int m_LastPassOffset[256];		// Frame where each songline was played the last time
+	int m_PreviousPassOffset[256];	// Frame where each songline was played the time before
+
+	std::unordered_map<UINT64, int> m_StateOffset;	// Frame where each player state was first reached, at the beginning of songlines
+	std::vector<TStreamSegment> m_Segments;			// Every songline played, for comparing passes once the frames are no longer in memory
+	int m_SegmentOffset;			// First frame of the songline being recorded
+	UINT64 m_SegmentHash;			// Hash of the frames recorded since then
+
+	int m_FirstCountPoint;			// How many frames for the intro and the loop together
+	int m_SecondCountPoint;			// How many frames in the loop
+	int m_ThirdCountPoint;			// How many frames in the intro, which is also where the loop begins
+
+	int m_FrameSize;				// Bytes per frame, 9 for Mono and 18 for Stereo, set when the recording starts
+	int m_FrameCapacity;			// How many frames fit in m_StreamBuffer, when they are written to an output
+	size_t m_BufferSize;			// What size if the m_StreamBuffer currently
+
+	HANDLE m_MappedFile;			// Temporary file holding m_StreamBuffer once it is too large for the heap
+	HANDLE m_FileMapping;
+
+	std::ofstream* m_Output;		// File the frames are written to as they are recorded, or NULL to keep all of them in m_StreamBuffer
+	int m_BufferFrame;				// First frame held in m_StreamBuffer, the ones before it were written already
+	int m_WrittenFrames;			// How many frames were written to m_Output
+
+	bool IsPassRepeated(int songLine);
+	void AbortRecording();
+	bool WriteOutput(int lastFrame);
+	bool EncodeFrame(const unsigned char* frame);
+	bool AllocateBuffer(size_t size);
+	bool GrowBuffer();
+	bool MapBuffer(size_t size);
+	void ReleaseBuffer();
 };
 
@@ -926,7 +926,7 @@ void CRmtView::OnInitialUpdate()
 	g_Midi.MidiOn();
 
 	//Pal or NTSC
-	g_Song.ChangeTimer(16);
+	g_Song.StartTimer();
 	g_Song.ClearSong(g_tracks4_8);
 
 	//If the tracker was started with an argument, it attempts to load the file, and will return an error if the extention isn't .rmt. 
@@ -0,0 +1,916 @@
+//
+// RmteEngine.cpp
+// Native C++ playback of the RMTE Module format, turning the Subtune, Instrument and Envelope data into POKEY registers
+//
+
+#include "stdafx.h"
+#include <math.h>
+
+#include "RmteEngine.h"
+#include "IOHelpers.h"
+#include "Tuning.h"
+
+extern CTuning g_Tuning;
+
+CRmteEngine::CRmteEngine(CModule* pModule)
+{
+	m_module = pModule;
+	m_pSubtune = NULL;
+	m_subtune = 0;
+	m_songline = m_row = 0;
+	m_speed = m_speedTimer = 1;
+	m_channelCount = 0;
+	Stop();
+}
+
+/// <summary>
+/// Start playing a Subtune, the first PlayFrame plays the Row at the given position.
+/// Invalid positions are reset to the beginning of the Subtune.
+/// </summary>
+/// <param name="subtune">Subtune to play, nothing is played if it does not exist</param>
+/// <param name="songline">Songline to start from</param>
+/// <param name="row">Row to start from</param>
+/// <param name="isPatternLooped">Stay in the same Songline, the Goto Songline Commands only restart the Pattern</param>
+void CRmteEngine::Start(UINT subtune, UINT songline, UINT row, bool isPatternLooped)
+{
+	Stop();
+
+	if (!m_module || !(m_pSubtune = m_module->GetSubtune(subtune)))
+		return;
+
+	m_subtune = subtune;
+	m_channelCount = m_module->GetChannelCount(m_pSubtune);
+	m_isPatternLooped = isPatternLooped;
+
+	m_songline = songline < m_module->GetSongLength(m_pSubtune) ? songline : 0;
+	m_row = row < m_module->GetPatternLength(m_pSubtune) ? row : 0;
+	m_nextSongline = m_songline;
+	m_nextRow = m_row;
+
+	m_speed = m_module->GetSongSpeed(m_pSubtune);
+	m_speedTimer = 1;
+	m_isPlaying = true;
+}
+
+void CRmteEngine::Stop()
+{
+	m_isPlaying = false;
+	m_isPatternLooped = false;
+	m_isNewSongline = false;
+	m_isRowPlayed = false;
+	m_nextSongline = m_nextRow = INVALID;
+
+	memset(&m_variables, 0, sizeof(m_variables));
+
+	for (int i = 0; i < CHANNEL_COUNT; i++)
+		ResetChannelVariables(&m_variables.channel[i]);
+}
+
+/// <summary>
+/// Tell if the next PlayFrame is going to play the first Row of a Songline, so the state may be saved just before it.
+/// A Goto Command processed by a Row delayed with Gxx is only known once that frame is played.
+/// </summary>
+bool CRmteEngine::IsNewSonglineNext()
+{
+	if (!m_isPlaying || m_speedTimer != 1)
+		return false;
+
+	if (m_nextSongline != INVALID || m_nextRow != INVALID)
+		return m_isRowPlayed;
+
+	return m_row + 1 >= m_module->GetPatternLength(m_pSubtune);
+}
+
+/// <summary>
+/// Copy the playback state, it must be taken while playing.
+/// </summary>
+void CRmteEngine::GetState(TRmteEngineState* pState)
+{
+	pState->variables = m_variables;
+	pState->isPatternLooped = m_isPatternLooped;
+	pState->isRowPlayed = m_isRowPlayed;
+	pState->subtune = m_subtune;
+	pState->songline = m_songline;
+	pState->row = m_row;
+	pState->speed = m_speed;
+	pState->speedTimer = m_speedTimer;
+	pState->nextSongline = m_nextSongline;
+	pState->nextRow = m_nextRow;
+}
+
+/// <summary>
+/// Resume playback from a state taken by GetState, the next PlayFrame continues exactly where that state was taken.
+/// </summary>
+/// <returns>False if the Subtune of the state does not exist, playback is then stopped</returns>
+bool CRmteEngine::SetState(const TRmteEngineState* pState)
+{
+	Stop();
+
+	if (!m_module || !(m_pSubtune = m_module->GetSubtune(pState->subtune)))
+		return false;
+
+	m_variables = pState->variables;
+	m_isPatternLooped = pState->isPatternLooped;
+	m_isRowPlayed = pState->isRowPlayed;
+	m_subtune = pState->subtune;
+	m_channelCount = m_module->GetChannelCount(m_pSubtune);
+	m_songline = pState->songline;
+	m_row = pState->row;
+	m_speed = pState->speed;
+	m_speedTimer = pState->speedTimer;
+	m_nextSongline = pState->nextSongline;
+	m_nextRow = pState->nextRow;
+	m_isPlaying = true;
+
+	return true;
+}
+
+/// <summary>
+/// Hash of the playback state, and of the frames played from it, 2 identical hashes mean everything played after them is identical too.
+/// </summary>
+/// <param name="pFrames">POKEY registers of the frames just played</param>
+/// <param name="frameCount">Number of frames, normally the Instrument Speed</param>
+UINT64 CRmteEngine::GetStateHash(const TPokeyFrame* pFrames, UINT frameCount)
+{
+	UINT position[] = { m_songline, m_row, m_speed, m_speedTimer, (UINT)m_nextSongline, (UINT)m_nextRow, m_isPlaying };
+
+	UINT64 hash = FNV1a(&m_variables, sizeof(m_variables));
+	hash = FNV1a(position, sizeof(position), hash);
+	return FNV1a(pFrames, sizeof(TPokeyFrame) * frameCount, hash);
+}
+
+void CRmteEngine::ResetChannelVariables(TChannelVariables* pVariables)
+{
+	memset(pVariables, 0, sizeof(TChannelVariables));
+	pVariables->note = NOTE_EMPTY;
+	pVariables->instrument = INSTRUMENT_EMPTY;
+	pVariables->volume = VOLUME_COUNT - 1;
+}
+
+/// <summary>
+/// Play 1 frame, the Row when the Speed Timer is expired, then the Instruments, like RMT_PLAY does.
+/// </summary>
+/// <param name="pFrame">POKEY registers of the frame, all the POKEY soundchips are written</param>
+void CRmteEngine::PlayFrame(TPokeyFrame* pFrame)
+{
+	m_isNewSongline = false;
+
+	if (m_isPlaying)
+	{
+		// Rows delayed by the Gxx Command are processed before the next Row may begin
+		for (UINT i = 0; i < m_channelCount; i++)
+		{
+			TChannelVariables* pVariables = &m_variables.channel[i];
+
+			if (pVariables->delayedRow && --pVariables->delayOffset == 0)
+			{
+				TRow* pRow = pVariables->delayedRow;
+				pVariables->delayedRow = NULL;
+				ProcessRow(i, pRow, true);
+			}
+		}
+
+		// Decrement the Speed Timer, and process the next Row when it is ready
+		if (--m_speedTimer == 0)
+			PlayRow();
+	}
+
+	PlayInstruments(pFrame);
+}
+
+/// <summary>
+/// Play the Instruments and Effect Commands only, like RMT_P3 does for every additional call set by the Instrument Speed.
+/// </summary>
+/// <param name="pFrame">POKEY registers of the frame, all the POKEY soundchips are written</param>
+void CRmteEngine::PlayInstruments(TPokeyFrame* pFrame)
+{
+	memset(pFrame, 0x00, sizeof(TPokeyFrame));
+
+	for (int i = 0; i < POKEY_SOUNDCHIP_COUNT; i++)
+		pFrame->pokey[i].skctl = RMTE_SKCTL_DEFAULT;
+
+	if (!m_isPlaying)
+		return;
+
+	for (UINT loop = 0; loop < m_channelCount; loop += POKEY_CHANNEL_COUNT)
+	{
+		TPokeyRegisters* pPokey = &pFrame->pokey[loop / POKEY_CHANNEL_COUNT];
+		UINT last = loop + POKEY_CHANNEL_COUNT < m_channelCount ? loop + POKEY_CHANNEL_COUNT : m_channelCount;
+
+		// AUDC and AUDCTL first, the Freq of every Channel depends on the AUDCTL bits set by all of them
+		for (UINT i = loop; i < last; i++)
+			PlayInstrument(i, pPokey);
+
+		// Going in the reverse order actually helps for setting data "after" when it is expected "before"
+		for (UINT i = last; i-- > loop;)
+			PlayFreq(i, pPokey);
+	}
+}
+
+/// <summary>
+/// Write the POKEY registers of a frame into the Atari memory, at $D200 for the first POKEY, $D210 for the second, etc.
+/// </summary>
+void CRmteEngine::WriteToMemory(const TPokeyFrame* pFrame, BYTE* memory)
+{
+	WriteToRegisters(pFrame, &memory[0xD200]);
+}
+
+/// <summary>
+/// Write the POKEY registers of a frame as they are laid out in memory, $10 bytes for every POKEY, without the rest of the Atari memory.
+/// </summary>
+void CRmteEngine::WriteToRegisters(const TPokeyFrame* pFrame, BYTE* registers)
+{
+	for (int chip = 0; chip < POKEY_SOUNDCHIP_COUNT; chip++)
+	{
+		const TPokeyRegisters* pPokey = &pFrame->pokey[chip];
+		BYTE* pRegisters = &registers[chip * 0x10];
+
+		for (int i = 0; i < POKEY_CHANNEL_COUNT; i++)
+		{
+			pRegisters[i * 2] = pPokey->audf[i];
+			pRegisters[i * 2 + 1] = pPokey->audc[i];
+		}
+
+		pRegisters[0x08] = pPokey->audctl;
+		pRegisters[0x0F] = pPokey->skctl;
+	}
+}
+
+void CRmteEngine::PlayRow()
+{
+	UINT songLength = m_module->GetSongLength(m_pSubtune);
+	UINT patternLength = m_module->GetPatternLength(m_pSubtune);
+
+	// If the playback positions were set prior to this point, the values will be used accordingly
+	if (m_nextSongline != INVALID || m_nextRow != INVALID)
+	{
+		// If a Goto Songline (Bxx) command was used, set the new Songline position, unless the Pattern is looped
+		if (m_nextSongline != INVALID && !m_isPatternLooped)
+			m_songline = m_nextSongline;
+
+		// If a End Pattern (Dxx) command was used, set the new Row position
+		if (m_nextRow != INVALID)
+			m_row = m_nextRow;
+
+		// Invalidate subsequent movements once they're used
+		m_nextSongline = m_nextRow = INVALID;
+		m_isNewSongline = m_isRowPlayed;
+	}
+
+	// Else, continue playback by incrementing the Row and Songline positions like usual
+	else if (++m_row >= patternLength)
+	{
+		m_row = 0;
+
+		if (!m_isPatternLooped)
+			m_songline++;
+
+		m_isNewSongline = true;
+	}
+
+	// Check the song boundaries, to prevent invalid movements
+	if (m_songline >= songLength)
+		m_songline = 0;
+
+	if (m_row >= patternLength)
+		m_row = 0;
+
+	// Process all channels
+	for (UINT i = 0; i < m_channelCount; i++)
+	{
+		TRow* pRow = m_module->GetRow(m_module->GetIndexedPattern(m_pSubtune, i, m_songline), m_row);
+
+		if (pRow)
+			ProcessRow(i, pRow, false);
+	}
+
+	// Set the Speed Timer to the current Play Speed parameter, the last Fxx Command used will take priority
+	m_speedTimer = m_speed;
+	m_isRowPlayed = true;
+}
+
+void CRmteEngine::ProcessRow(UINT channel, TRow* pRow, bool isDelayed)
+{
+	TChannelVariables* pVariables = &m_variables.channel[channel];
+	UINT effectCount = m_module->GetEffectCommandCount(m_module->GetChannel(m_pSubtune, channel));
+
+	// A Gxx Command delays the whole Row by xx frames, as long as it is still within the Row duration
+	if (!isDelayed)
+	{
+		pVariables->delayedRow = NULL;
+
+		for (UINT i = 0; i < effectCount; i++)
+		{
+			BYTE delay = pRow->effect[i].parameter;
+
+			if (pRow->effect[i].command == PE_SET_DELAY && delay && delay < m_speed)
+			{
+				pVariables->delayOffset = delay;
+				pVariables->delayedRow = pRow;
+				return;
+			}
+		}
+	}
+
+	ProcessNote(pRow->note, pVariables);
+	ProcessInstrument(pRow->instrument, pVariables);
+	ProcessVolume(pRow->volume, pVariables);
+
+	for (UINT i = 0; i < effectCount; i++)
+		ProcessEffect(&pRow->effect[i], pVariables);
+}
+
+void CRmteEngine::ProcessNote(BYTE note, TChannelVariables* pVariables)
+{
+	switch (note)
+	{
+	case NOTE_EMPTY:
+		break;
+
+	case NOTE_OFF:
+		ResetChannelVariables(pVariables);
+		break;
+
+	case NOTE_RELEASE:
+		if (pVariables->isNoteActive)
+			pVariables->isNoteRelease = true;
+		break;
+
+	case NOTE_RETRIGGER:
+		if (pVariables->isNoteActive)
+			pVariables->isNoteTrigger = true;
+		break;
+
+	default:
+		if (note < NOTE_COUNT)
+		{
+			pVariables->note = note;
+			pVariables->isNoteActive = true;
+			pVariables->isNoteTrigger = true;
+			pVariables->isNoteReset = true;
+			pVariables->frameCount = 0x00;
+			pVariables->pitchSlide = 0;
+		}
+	}
+}
+
+void CRmteEngine::ProcessInstrument(BYTE instrument, TChannelVariables* pVariables)
+{
+	switch (instrument)
+	{
+	case INSTRUMENT_EMPTY:
+		// A Note without Instrument is played legato, the Instrument keeps going from where it was
+		if (pVariables->isNoteActive && pVariables->isNoteReset && pVariables->instrument != INSTRUMENT_EMPTY)
+			pVariables->isNoteTrigger = false;
+		break;
+
+	default:
+		if (instrument < INSTRUMENT_COUNT)
+			pVariables->instrument = instrument;
+	}
+}
+
+void CRmteEngine::ProcessVolume(BYTE volume, TChannelVariables* pVariables)
+{
+	switch (volume)
+	{
+	case VOLUME_EMPTY:
+		break;
+
+	default:
+		if (volume < VOLUME_COUNT)
+		{
+			pVariables->volume = volume;
+			pVariables->volumeSlide = 0x00;
+		}
+	}
+}
+
+void CRmteEngine::ProcessEffect(TEffect* pEffect, TChannelVariables* pVariables)
+{
+	BYTE parameter = pEffect->parameter;
+
+	switch (pEffect->command)
+	{
+	case PE_ARPEGGIO:
+		pVariables->arpeggioScheme = parameter;
+		break;
+
+	case PE_PITCH_UP:
+	case PE_PITCH_DOWN:
+		pVariables->pitchSlideSpeed = parameter;
+		pVariables->isPitchSlideUp = pEffect->command == PE_PITCH_UP;
+		break;
+
+	case PE_PORTAMENTO:
+		pVariables->portamento.speed = parameter & 0x0F;
+		pVariables->portamento.depth = parameter >> 4;
+		pVariables->portamento.isActive = pVariables->portamento.speed;
+		break;
+
+	case PE_VIBRATO:
+		if (pVariables->isNoteActive && pVariables->isNoteReset)
+			pVariables->vibrato.phase = 0x00;
+		pVariables->vibrato.speed = parameter & 0x0F;
+		pVariables->vibrato.depth = parameter >> 4;
+		pVariables->vibrato.isActive = pVariables->vibrato.speed;
+		break;
+
+	case PE_VOLUME_FADE:
+		pVariables->volumeFade = parameter;
+		break;
+
+	case PE_GOTO_SONGLINE:
+		if (m_nextRow == INVALID)
+			m_nextRow = 0;
+		m_nextSongline = parameter;
+		break;
+
+	case PE_END_PATTERN:
+		if (m_nextSongline == INVALID)
+			m_nextSongline = m_songline + 1;
+		m_nextRow = parameter;
+		break;
+
+	case PE_SET_SPEED:
+		if (parameter)
+			m_speed = parameter;
+		break;
+
+	case PE_SET_FINETUNE:
+		pVariables->finetuneOffset = parameter;
+		break;
+	}
+}
+
+TEnvelope* CRmteEngine::GetEnvelope(TInstrumentV2* pInstrument, TEnvelopeType type)
+{
+	if (!pInstrument->envelope[type].isEnabled)
+		return NULL;
+
+	return m_module->GetEnvelope(pInstrument->envelope[type].index, type);
+}
+
+/// <summary>
+/// Move an Envelope by 1 Instrument frame, from its beginning on a new Note, or from its Release point on a released Note.
+/// </summary>
+/// <returns>True if the Envelope moved to a different step, its value must be read again</returns>
+bool CRmteEngine::AdvanceEnvelope(TActive* pActive, TEnvelope* pEnvelope, bool trigger, bool release)
+{
+	TEnvelopeParameter* pParameter = &pEnvelope->parameter;
+	UINT length = m_module->GetEnvelopeLength(pEnvelope);
+	BYTE speed = pParameter->speed ? pParameter->speed : INSTRUMENT_SPEED_MAX;
+
+	// In order to prevent false Release, the matching Flag must be set as well
+	if (trigger || (release && pParameter->isReleased))
+	{
+		pActive->offset = trigger ? 0x00 : (pParameter->release < length ? pParameter->release : length - 1);
+		pActive->timer = speed;
+		return true;
+	}
+
+	// If the Timer is 0, the Envelope will advance by 1 step
+	if (--pActive->timer == 0)
+	{
+		UINT offset = pActive->offset + 1;
+
+		// If the End Point is reached, check if the Envelope is Looped
+		if (offset >= length)
+			offset = pParameter->isLooped && pParameter->loop < length ? pParameter->loop : length - 1;
+
+		pActive->offset = offset;
+		pActive->timer = speed;
+		return true;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Advance the Instrument of a Channel by 1 frame, then set its AUDC, and the AUDCTL and SKCTL bits it needs.
+/// </summary>
+void CRmteEngine::PlayInstrument(UINT channel, TPokeyRegisters* pPokey)
+{
+	TChannelVariables* pChannelVariables = &m_variables.channel[channel];
+	TInstrumentVariables* pInstrumentVariables = &m_variables.instrument[channel];
+	TInstrumentV2* pInstrument = m_module->GetInstrument(pChannelVariables->instrument);
+	UINT i = channel % POKEY_CHANNEL_COUNT;
+
+	bool trigger = pChannelVariables->isNoteTrigger;
+	bool release = pChannelVariables->isNoteRelease;
+
+	// These Flags are no longer needed after this point
+	pChannelVariables->isNoteTrigger = pChannelVariables->isNoteRelease = false;
+	pChannelVariables->isNoteReset = false;
+
+	if (!pChannelVariables->isNoteActive || !pInstrument)
+		return;
+
+	TEnvelopeVariables* pEnvelope = &pInstrumentVariables->envelope;
+	TEnvelope* pEnvelopeData;
+
+	if (trigger)
+	{
+		TInstrumentParameter* pParameter = &pInstrument->parameter;
+
+		// Envelopes that are not enabled leave the Channel Volume, Note and Freq unchanged
+		(BYTE&)pInstrumentVariables->volume = 0xFF;
+		(BYTE&)pInstrumentVariables->timbre = TIMBRE_PURE;
+		(BYTE&)pInstrumentVariables->audctl = 0x00;
+		memset(&pInstrumentVariables->effect, 0x00, sizeof(TEffectEnvelope));
+		pInstrumentVariables->note = 0x00;
+		pInstrumentVariables->freq = 0x0000;
+
+		pInstrumentVariables->volumeFade = pParameter->volumeFade;
+		pInstrumentVariables->volumeSlide = RMTE_VOLUME_SLIDE_INIT;
+		pInstrumentVariables->volumeTimer = pParameter->volumeDelay;
+		pInstrumentVariables->vibratoTimer = pParameter->vibratoDelay;
+		pInstrumentVariables->freqShiftTimer = pParameter->freqShiftDelay;
+		pInstrumentVariables->freqShift = pParameter->freqShift;
+		pInstrumentVariables->finetuneOffset = 0x00;
+		pInstrumentVariables->vibrato.speed = pParameter->vibrato & 0x0F;
+		pInstrumentVariables->vibrato.depth = pParameter->vibrato >> 4;
+		pInstrumentVariables->vibrato.phase = 0x00;
+		pInstrumentVariables->vibrato.isActive = pInstrumentVariables->vibrato.speed;
+	}
+
+	if ((pEnvelope->volume.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_VOLUME)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->volume, pEnvelopeData, trigger, release))
+			pInstrumentVariables->volume = pEnvelopeData->volume[pEnvelope->volume.offset];
+	}
+
+	if ((pEnvelope->timbre.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_TIMBRE)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->timbre, pEnvelopeData, trigger, release))
+			pInstrumentVariables->timbre = pEnvelopeData->timbre[pEnvelope->timbre.offset];
+	}
+
+	if ((pEnvelope->audctl.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_AUDCTL)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->audctl, pEnvelopeData, trigger, release))
+			pInstrumentVariables->audctl = pEnvelopeData->audctl[pEnvelope->audctl.offset];
+	}
+
+	if ((pEnvelope->effect.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_EFFECT)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->effect, pEnvelopeData, trigger, release))
+			pInstrumentVariables->effect = pEnvelopeData->effect[pEnvelope->effect.offset];
+	}
+
+	if ((pEnvelope->note.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_NOTE_TABLE)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->note, pEnvelopeData, trigger, release))
+		{
+			BYTE note = pEnvelopeData->note[pEnvelope->note.offset].noteAbsolute;
+
+			if (!trigger && pEnvelopeData->parameter.isAdditive)
+				pInstrumentVariables->note += note;
+			else
+				pInstrumentVariables->note = note;
+		}
+	}
+
+	if ((pEnvelope->freq.isActive = (pEnvelopeData = GetEnvelope(pInstrument, ET_FREQ_TABLE)) != NULL))
+	{
+		if (AdvanceEnvelope(&pEnvelope->freq, pEnvelopeData, trigger, release))
+		{
+			WORD freq = pEnvelopeData->freq[pEnvelope->freq.offset].freqAbsolute;
+
+			if (!trigger && pEnvelopeData->parameter.isAdditive)
+				pInstrumentVariables->freq += freq;
+			else
+				pInstrumentVariables->freq = freq;
+		}
+	}
+
+	// Instrument Effect Commands changing the Instrument and Channel variables, the ones changing the Freq of this frame only are processed later
+	TEffectEnvelope* pEffect = &pInstrumentVariables->effect;
+	BYTE command[2] = { pEffect->command_1, pEffect->command_2 };
+	BYTE parameter[2] = { pEffect->parameter_1, pEffect->parameter_2 };
+
+	for (int j = 0; j < 2; j++)
+	{
+		switch (command[j])
+		{
+		case IE_PITCH_UP:
+			pInstrumentVariables->freqShift = -parameter[j];
+			break;
+
+		case IE_PITCH_DOWN:
+			pInstrumentVariables->freqShift = parameter[j];
+			break;
+
+		case IE_PORTAMENTO:
+			if (pChannelVariables->portamento.isActive)
+			{
+				pChannelVariables->portamento.speed = parameter[j] & 0x0F;
+				pChannelVariables->portamento.depth = parameter[j] >> 4;
+			}
+			break;
+
+		case IE_VIBRATO:
+			pInstrumentVariables->vibrato.speed = parameter[j] & 0x0F;
+			pInstrumentVariables->vibrato.depth = parameter[j] >> 4;
+			pInstrumentVariables->vibrato.isActive = pInstrumentVariables->vibrato.speed;
+			break;
+
+		case IE_VOLUME_FADE:
+			pInstrumentVariables->volumeFade = parameter[j];
+			break;
+
+		case IE_FREQ_SHIFT:
+			pInstrumentVariables->finetuneOffset += parameter[j];
+			break;
+
+		case IE_NOTE_SHIFT:
+			pChannelVariables->note = (pChannelVariables->note + parameter[j]) % NOTE_COUNT;
+			break;
+		}
+	}
+
+	// Volume Fade, once the delay timer is expired, the Channel Volume goes down to the Volume Sustain
+	if (pInstrumentVariables->volumeTimer)
+		pInstrumentVariables->volumeTimer--;
+
+	else if (pInstrumentVariables->volumeFade && pChannelVariables->volume > pInstrument->parameter.volumeSustain)
+	{
+		BYTE volumeSlide = pInstrumentVariables->volumeSlide;
+		pInstrumentVariables->volumeSlide += pInstrumentVariables->volumeFade;
+
+		if (pInstrumentVariables->volumeSlide < volumeSlide)
+			pChannelVariables->volume--;
+	}
+
+	// Volume Fade set by the Axy Command, in 1/16 of a Volume level for every frame
+	if (pChannelVariables->volumeFade)
+	{
+		int level = (pChannelVariables->volume << 4) | pChannelVariables->volumeSlide;
+		level += (pChannelVariables->volumeFade >> 4) - (pChannelVariables->volumeFade & 0x0F);
+
+		if (level < 0x00)
+			level = 0x00;
+
+		if (level > 0xFF)
+			level = 0xFF;
+
+		pChannelVariables->volume = level >> 4;
+		pChannelVariables->volumeSlide = level & 0x0F;
+	}
+
+	// Freq Shift, which is additive to itself, processed as soon as the delay timer is expired
+	if (pInstrumentVariables->freqShiftTimer)
+		pInstrumentVariables->freqShiftTimer--;
+	else
+		pInstrumentVariables->finetuneOffset += pInstrumentVariables->freqShift;
+
+	// Pitch Slide set by the 1xx and 2xx Commands, a lower Freq is a higher Pitch
+	if (pChannelVariables->pitchSlideSpeed)
+	{
+		pChannelVariables->pitchSlide += pChannelVariables->isPitchSlideUp ? -pChannelVariables->pitchSlideSpeed : pChannelVariables->pitchSlideSpeed;
+
+		if (pChannelVariables->pitchSlide < -0xFFFF)
+			pChannelVariables->pitchSlide = -0xFFFF;
+
+		if (pChannelVariables->pitchSlide > 0xFFFF)
+			pChannelVariables->pitchSlide = 0xFFFF;
+	}
+
+	// The Left POKEY Volume is used by default, the Right POKEY Volume is only used by the Stereo Channels of Legacy RMT Instruments
+	BYTE envelopeVolume = channel >= POKEY_CHANNEL_COUNT && channel < 2 * POKEY_CHANNEL_COUNT ? pInstrumentVariables->volume.volumeRight : pInstrumentVariables->volume.volumeLeft;
+	BYTE volume = (envelopeVolume * pChannelVariables->volume + 7) / 15;
+	BYTE timbre = (BYTE&)pInstrumentVariables->timbre;
+
+	// Volume Only Mode ignores the Distortion, all the bits are set like the Legacy RMT driver does
+	pPokey->audc[i] = pInstrumentVariables->timbre.isVolumeOnly ? 0xF0 | volume : (timbre & 0xE0) | volume;
+	pPokey->audctl |= (BYTE&)pInstrumentVariables->audctl;
+
+	// Process the Instrument Triggers for functionalities that are automatically handled based on specific criteria
+	if (volume)
+	{
+		// High Pass Filter, triggered in Channel 1 and 2, from which the Freq is derived and written into the Channel modulating it
+		if (pEffect->autoFilter && (CH1(i) || CH2(i)))
+			pPokey->audctl |= CH1(i) ? 0x04 : 0x02;
+
+		// 16-Bit Mode, triggered in Channel 2 and 4, allowing 16-bit pitch accuracy, the Channel above will also be muted automatically
+		if (pEffect->auto16Bit && (CH2(i) || CH4(i)))
+		{
+			pPokey->audctl |= CH2(i) ? 0x50 : 0x28;
+			pPokey->audc[i - 1] = 0x00;
+		}
+
+		// 1.79Mhz Mode, triggered in Channel 1 and 3
+		if (pEffect->auto179Mhz && (CH1(i) || CH3(i)))
+			pPokey->audctl |= CH1(i) ? 0x40 : 0x20;
+
+		// 15Khz Mode and Poly9 Noise, triggered from any Channel
+		if (pEffect->auto15Khz)
+			pPokey->audctl |= 0x01;
+
+		if (pEffect->autoPoly9)
+			pPokey->audctl |= 0x80;
+	}
+
+	// Two-Tone Filter, triggered in Channel 1, modulated by the Freq of Channel 2, it does not depend on the Volume of Channel 1
+	if (pEffect->autoTwoTone && CH1(i))
+		pPokey->skctl = RMTE_SKCTL_TWO_TONE;
+}
+
+/// <summary>
+/// Set the AUDF of a Channel, once the AUDCTL bits of all the Channels of its POKEY are known.
+/// </summary>
+void CRmteEngine::PlayFreq(UINT channel, TPokeyRegisters* pPokey)
+{
+	TChannelVariables* pChannelVariables = &m_variables.channel[channel];
+	TInstrumentVariables* pInstrumentVariables = &m_variables.instrument[channel];
+	TInstrumentV2* pInstrument = m_module->GetInstrument(pChannelVariables->instrument);
+	UINT i = channel % POKEY_CHANNEL_COUNT;
+
+	if (!pChannelVariables->isNoteActive || !pInstrument)
+		return;
+
+	// The Freq of a Channel joined in 16-bit mode is set by the Channel above it
+	if ((CH1(i) && (pPokey->audctl & 0x50) == 0x50) || (CH3(i) && (pPokey->audctl & 0x28) == 0x28))
+		return;
+
+	bool is16BitMode = (CH2(i) && (pPokey->audctl & 0x50) == 0x50) || (CH4(i) && (pPokey->audctl & 0x28) == 0x28);
+	BYTE timbre = (BYTE&)pInstrumentVariables->timbre & 0xEF;
+	TEffectEnvelope* pEffect = &pInstrumentVariables->effect;
+
+	int note = pChannelVariables->note;
+	int freq = INVALID;
+	int offsetFreq = (char)pInstrumentVariables->finetuneOffset + (char)pChannelVariables->finetuneOffset + pChannelVariables->pitchSlide;
+	BYTE autoFilterOffset = pInstrument->parameter.autoFilter;
+
+	// Arpeggio Scheme, cycling between the Channel Note, X, then Y semitones above it
+	if (pChannelVariables->arpeggioScheme)
+	{
+		switch (pChannelVariables->frameCount % 3)
+		{
+		case 1:
+			note += pChannelVariables->arpeggioScheme >> 4;
+			break;
+
+		case 2:
+			note += pChannelVariables->arpeggioScheme & 0x0F;
+			break;
+		}
+	}
+
+	// Note and Freq Tables, either Absolute, or Relative to the Channel Note and Freq
+	if (pInstrumentVariables->envelope.note.isActive)
+	{
+		TEnvelope* pEnvelope = GetEnvelope(pInstrument, ET_NOTE_TABLE);
+		note = pEnvelope->parameter.isAbsolute ? pInstrumentVariables->note : note + (char)pInstrumentVariables->note;
+	}
+
+	if (pInstrumentVariables->envelope.freq.isActive)
+	{
+		TEnvelope* pEnvelope = GetEnvelope(pInstrument, ET_FREQ_TABLE);
+
+		if (pEnvelope->parameter.isAbsolute)
+			freq = pInstrumentVariables->freq;
+		else
+			offsetFreq += (SWORD)pInstrumentVariables->freq;
+	}
+
+	// Instrument Effect Commands, only changing the Freq of this frame
+	BYTE command[2] = { pEffect->command_1, pEffect->command_2 };
+	BYTE parameter[2] = { pEffect->parameter_1, pEffect->parameter_2 };
+
+	for (int j = 0; j < 2; j++)
+	{
+		switch (command[j])
+		{
+		case IE_TRANSPOSE:
+			note += (char)parameter[j];
+			break;
+
+		case IE_FINETUNE:
+			offsetFreq += (char)parameter[j];
+			break;
+
+		case IE_AUTOFILTER:
+			autoFilterOffset = pInstrument->parameter.autoFilterMode ? autoFilterOffset + parameter[j] : parameter[j];
+			break;
+
+		case IE_SET_FREQ_LSB:
+			freq = (freq == INVALID ? 0x0000 : freq & 0xFF00) | parameter[j];
+			break;
+
+		case IE_SET_FREQ_MSB:
+			if (is16BitMode)
+				freq = (freq == INVALID ? 0x0000 : freq & 0x00FF) | (parameter[j] << 8);
+			break;
+		}
+	}
+
+	// Instrument Vibrato, processed as soon as the delay timer is expired
+	bool isVibrato = pInstrumentVariables->vibrato.isActive && pInstrumentVariables->vibratoTimer == 0;
+
+	if (pInstrumentVariables->vibratoTimer)
+		pInstrumentVariables->vibratoTimer--;
+
+	// An Absolute Freq is used directly, otherwise it is generated from the Note and Tuning parameters
+	if (freq == INVALID)
+	{
+		if (note < 0)
+			note = 0;
+
+		if (note > NOTE_COUNT - 1)
+			note = NOTE_COUNT - 1;
+
+		double pitch = g_Tuning.GetTruePitch(note, g_baseNote + 12 * (g_baseOctave - 4), g_baseTuning);
+		double vibrato = 0.0;
+
+		// Channel Portamento, sliding from the last Pitch played to the Pitch of the current Note
+		if (pChannelVariables->portamento.isActive)
+		{
+			TPortamento* pPortamento = &pChannelVariables->portamento;
+			pPortamento->targetPitch = pitch;
+
+			if (pPortamento->lastPitch == 0.0)
+				pPortamento->lastPitch = pitch;
+
+			pitch = pPortamento->lastPitch;
+			pitch += GetPortamento(pPortamento, pitch);
+
+			if (pPortamento->targetPitch > pPortamento->lastPitch)
+			{
+				if (pitch > pPortamento->targetPitch)
+					pitch = pPortamento->targetPitch;
+			}
+			else
+			{
+				if (pitch < pPortamento->targetPitch)
+					pitch = pPortamento->targetPitch;
+			}
+
+			pPortamento->lastPitch = pitch;
+		}
+
+		// If the Instrument Vibrato is active, it will be processed in priority, else the Channel Vibrato is used instead
+		if (isVibrato)
+			vibrato = GetVibrato(&pInstrumentVariables->vibrato, pitch);
+		else if (pChannelVariables->vibrato.isActive)
+			vibrato = GetVibrato(&pChannelVariables->vibrato, pitch);
+
+		// Generate the actual POKEY Freq using all the necessary parameters
+		freq = g_Tuning.GeneratePokeyFreq(pitch + vibrato, i, timbre, pPokey->audctl);
+		freq += offsetFreq;
+	}
+
+	// The Freq should never be allowed to go below 0!
+	if (freq < 0x00)
+		freq = 0x00;
+
+	// Update the AUDF registers once the Freq is ready to be used
+	if (is16BitMode)
+		pPokey->audf16[CH2(i) ? 0 : 1] = freq > 0xFFFF ? 0xFFFF : freq;
+	else
+		pPokey->audf[i] = freq > 0xFF ? 0xFF : freq;
+
+	// Autofilter is processed after everything, and used to derive the Freq used in the modulation channel
+	if ((pPokey->audc[i] & 0x0F) && pEffect->autoFilter && (CH1(i) || CH2(i)))
+	{
+		if (is16BitMode)
+		{
+			freq = pPokey->audf16[0] + (char)autoFilterOffset;
+			pPokey->audf16[1] = freq < 0x0000 ? 0x0000 : freq > 0xFFFF ? 0xFFFF : freq;
+		}
+		else
+			pPokey->audf[i + 2] = pPokey->audf[i] + autoFilterOffset;
+	}
+
+	// Update the Channel Timer for the next frame once everything was processed using it
+	pChannelVariables->frameCount++;
+}
+
+double CRmteEngine::GetVibrato(TPeriodic* pVibrato, double pitch)
+{
+	// Create the modulation variables from the vibrato parameters
+	double depth = pVibrato->depth ? pVibrato->depth : 0.5;
+	double phase = pVibrato->phase;
+	double amplitude = log2(1.0 + (depth / 64.0));
+	double velocity = phase / 64.0;
+
+	// Update the Vibrato Phase with the Speed parameter for the next frame
+	pVibrato->phase += pVibrato->speed;
+
+	// Return the finetuned offset from the reference Pitch on the current Vibrato Phase
+	return ((pitch / sqrt(depth)) * amplitude) * sin(velocity * 2.0 * 3.14159265359);
+}
+
+double CRmteEngine::GetPortamento(TPortamento* pPortamento, double pitch)
+{
+	// Create the modulation variables from the portamento parameters
+	double depth = pPortamento->depth ? pPortamento->depth : 0.5;
+	double speed = pPortamento->speed;
+	double phase = pPortamento->targetPitch > pPortamento->lastPitch ? 1.0 : -0.5;
+
+	double amplitude = log2(1.0 + (depth / 16.0));
+	double velocity = phase * (speed / 64.0);
+
+	// Return the finetuned offset from the reference Pitch
+	return ((pitch / sqrt(depth)) * amplitude) * sin(velocity * 2.0 * 3.14159265359);
+}
@@ -0,0 +1,214 @@
+//
+// RmteEngine.h header file
+// Native C++ playback of the RMTE Module format, turning the Subtune, Instrument and Envelope data into POKEY registers
+// There is no 6502 involved, every frame is computed directly from the CModule data
+//
+
+#pragma once
+
+#include "General.h"
+#include "global.h"
+#include "ModuleV2.h"
+
+#define RMTE_SKCTL_DEFAULT		0x03		// SKCTL initialised state, necessary for actually generating POKEY sound
+#define RMTE_SKCTL_TWO_TONE		0x8B		// SKCTL with the Two-Tone Filter enabled
+#define RMTE_VOLUME_SLIDE_INIT	0x80		// Volume Fade accumulator on every new Note, like the Legacy RMT driver
+
+// POKEY registers typically make use of 8-bit values, but there are cases where 2 Channels may also be joined together in 16-bit mode
+// It is effectively possible to use the same data for either 2 contiguous AUDF Bytes, or a single 16-bit Word, depending on the AUDCTL state
+struct TPokeyRegisters
+{
+	union
+	{
+		BYTE audf[4];
+		WORD audf16[2];
+	};
+	BYTE audc[4];
+	BYTE audctl;
+	BYTE skctl;
+};
+
+// POKEY registers buffer Frame, used for every call of Instrument and/or Effect routines
+struct TPokeyFrame
+{
+	TPokeyRegisters pokey[POKEY_SOUNDCHIP_COUNT];
+};
+
+// POKEY registers buffer Heap, used for rendering sound for a set number of Millisecond Chunks
+struct TPokeyBuffer
+{
+	TPokeyFrame frame[256];
+};
+
+// Active Instrument Envelope Variables
+struct TActive
+{
+	bool isActive;					// Instrument Envelope is Active
+	BYTE offset;					// Instrument Envelope Offset
+	BYTE timer;						// Instrument Envelope Timer
+};
+
+// Periodic Effect Variables, such as Vibrato and Tremolo
+struct TPeriodic
+{
+	bool isActive;
+	BYTE depth;
+	BYTE speed;
+	BYTE phase;
+};
+
+// Portamento Effect Variables
+struct TPortamento
+{
+	bool isActive;
+	BYTE depth;
+	BYTE speed;
+	double lastPitch;
+	double targetPitch;
+};
+
+struct TEnvelopeVariables
+{
+	TActive volume;
+	TActive timbre;
+	TActive audctl;
+	TActive effect;
+	TActive note;
+	TActive freq;
+};
+
+// Instrument variables used by the RMTE Module playback routines
+struct TInstrumentVariables
+{
+	TEnvelopeVariables envelope;	// Instrument Envelope variables to keep track of during playback
+	TVolumeEnvelope volume;			// AUDC, bits 0-3, Volume levels for the Left and Right POKEY
+	TTimbreEnvelope timbre;			// AUDC, bits 4-7, unique tones and noises generated by the POKEY Soundchip
+	TAudctlEnvelope audctl;			// AUDCTL, bits from all 4 POKEY Channels combined during playback
+	TEffectEnvelope effect;			// Instrument Effect Commands and Automatic Triggers used during playback
+	BYTE note;						// Instrument Note, which may be used as an offset to the Channel Note
+	WORD freq;						// Instrument Freq, which may be used as an offset to the Channel Freq
+	BYTE volumeFade;				// Volume Fade parameter, the IE_VOLUME_FADE Command may override it
+	BYTE volumeSlide;				// Volume Fade accumulator, the Channel Volume is decremented every time it overflows
+	BYTE volumeTimer;				// Delay before the Volume Fade is processed, in Instrument frames
+	BYTE vibratoTimer;				// Delay before the Vibrato is processed, in Instrument frames
+	BYTE freqShiftTimer;			// Delay before the Freq Shift is processed, in Instrument frames
+	BYTE freqShift;					// Freq Shift parameter, the IE_PITCH_UP and IE_PITCH_DOWN Commands may override it
+	BYTE finetuneOffset;			// Freq offset accumulated by the Freq Shift and the IE_FREQ_SHIFT Command, wrapping around like the Legacy RMT driver
+	TPeriodic vibrato;				// Instrument Vibrato, taking priority over Channel Vibrato
+};
+
+// Channel variables used by the RMTE Module playback routines
+// Loosely inspired by FamiTracker for most of them
+struct TChannelVariables
+{
+	bool isNoteTrigger;				// Note Trigger, for new Note initialisation, the Command ~~~ will retrigger the last Note played
+	bool isNoteRelease;				// Note Release, the Command === will release the last Note played
+	bool isNoteActive;				// Note Playing, the Command OFF will stop the last Note played, and reset the Channel variables
+	bool isNoteReset;				// Note Reset, implying it is played for the first time when this flag is set
+	BYTE note;						// Maximum set by NOTE_COUNT, currently set to 120
+	BYTE instrument;				// Maximum set by INSTRUMENT_COUNT, currently set to 64
+	BYTE volume;					// AUDC, bits 0-3, Volume level could be 0-15 inclusive
+	BYTE volumeSlide;				// Volume Fade accumulator, set using the Axy Command
+	BYTE volumeFade;				// Volume Fade parameter, set using the Axy Command, X fades up and Y fades down
+	BYTE frameCount;				// Counter used for timing Effect Commands, including the Arpeggio Cycle, and possibly more things
+	BYTE delayOffset;				// Number of frames used to delay a Row during playback
+	TRow* delayedRow;				// Pointer to the delayed Row Index
+	BYTE arpeggioScheme;			// Arpeggio Scheme, set using the 0xy Command, cycling between channelNote, x, y, then repeat
+	int pitchSlide;					// Freq offset accumulated by the 1xx and 2xx Commands, reset on every new Note
+	BYTE pitchSlideSpeed;			// Freq units per frame, set using the 1xx and 2xx Commands
+	bool isPitchSlideUp;			// Direction of the Pitch Slide, up for 1xx, down for 2xx
+	TPortamento portamento;			// Channel Portamento, set using Effect Commands such as 3xy
+	TPeriodic vibrato;				// Channel Vibrato, set using Effect Commands such as 4xy
+	BYTE finetuneOffset;			// Finetune offset, set using the Pxx Command, signed values are expected, thus $01 will add 1, and $FF will subtract 1, etc
+};
+
+struct TSongVariables
+{
+	TChannelVariables channel[CHANNEL_COUNT];
+	TInstrumentVariables instrument[CHANNEL_COUNT];
+};
+
+// Complete playback state of CRmteEngine, every frame rewrites all the POKEY registers, so nothing else is needed for resuming playback
+// The delayed Rows point into the Subtune, a state is only valid for the Module it was taken from, as long as it is not edited
+struct TRmteEngineState
+{
+	TSongVariables variables;
+	bool isPatternLooped;
+	bool isRowPlayed;
+	UINT subtune;
+	UINT songline;
+	UINT row;
+	UINT speed;
+	UINT speedTimer;
+	int nextSongline;
+	int nextRow;
+};
+
+/// <summary>
+/// Plays a Subtune of a CModule, 1 frame at the time, into TPokeyFrame registers.
+/// PlayFrame is the equivalent of RMT_PLAY, and PlayInstruments the equivalent of RMT_P3, for the additional Instrument Speed calls.
+/// </summary>
+class CRmteEngine
+{
+public:
+	CRmteEngine(CModule* pModule = NULL);
+
+	void SetModule(CModule* pModule) { m_module = pModule; };
+
+	void Start(UINT subtune, UINT songline = 0, UINT row = 0, bool isPatternLooped = false);
+	void Stop();
+	bool IsPlaying() { return m_isPlaying; };
+
+	void PlayFrame(TPokeyFrame* pFrame);
+	void PlayInstruments(TPokeyFrame* pFrame);
+	static void WriteToMemory(const TPokeyFrame* pFrame, BYTE* memory);
+	static void WriteToRegisters(const TPokeyFrame* pFrame, BYTE* registers);
+
+	UINT GetSubtune() { return m_subtune; };
+	UINT GetSongline() { return m_songline; };
+	UINT GetRow() { return m_row; };
+	UINT GetSpeed() { return m_speed; };
+	UINT GetInstrumentSpeed() { return m_module->GetInstrumentSpeed(m_pSubtune); };
+	UINT GetChannelCount() { return m_channelCount; };
+	bool IsNewSongline() { return m_isNewSongline; };
+	bool IsNewSonglineNext();
+
+	void GetState(TRmteEngineState* pState);
+	bool SetState(const TRmteEngineState* pState);
+	UINT64 GetStateHash(const TPokeyFrame* pFrames, UINT frameCount);
+
+private:
+	CModule* m_module;
+	TSubtune* m_pSubtune;
+	TSongVariables m_variables;
+
+	bool m_isPlaying;
+	bool m_isPatternLooped;			// The Songline never changes, used for playing a single Pattern
+	bool m_isNewSongline;			// The last PlayFrame played the first Row of a Songline
+	bool m_isRowPlayed;				// A Row was played since Start, the starting position is not a new Songline
+	UINT m_subtune;
+	UINT m_songline;
+	UINT m_row;
+	UINT m_speed;
+	UINT m_speedTimer;
+	UINT m_channelCount;
+	int m_nextSongline;
+	int m_nextRow;
+
+	void PlayRow();
+	void ProcessRow(UINT channel, TRow* pRow, bool isDelayed);
+	void ProcessNote(BYTE note, TChannelVariables* pVariables);
+	void ProcessInstrument(BYTE instrument, TChannelVariables* pVariables);
+	void ProcessVolume(BYTE volume, TChannelVariables* pVariables);
+	void ProcessEffect(TEffect* pEffect, TChannelVariables* pVariables);
+
+	void PlayInstrument(UINT channel, TPokeyRegisters* pPokey);
+	void PlayFreq(UINT channel, TPokeyRegisters* pPokey);
+
+	TEnvelope* GetEnvelope(TInstrumentV2* pInstrument, TEnvelopeType type);
+	bool AdvanceEnvelope(TActive* pActive, TEnvelope* pEnvelope, bool trigger, bool release);
+	void ResetChannelVariables(TChannelVariables* pVariables);
+
+	static double GetVibrato(TPeriodic* pVibrato, double pitch);
+	static double GetPortamento(TPortamento* pPortamento, double pitch);
+};
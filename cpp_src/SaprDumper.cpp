@@ -0,0 +1,135 @@
+//
+// SaprDumper.cpp
+// Batch recording of the POKEY registers of a Subtune into a CPokeyStream, up to its loop point, for the SAP-R and LZSS exports
+//
+
+#include "stdafx.h"
+#include <chrono>
+
+#include "SaprDumper.h"
+
+CSaprDumper::CSaprDumper(CModule* pModule)
+{
+	m_module = pModule;
+	m_progress = NULL;
+	m_progressContext = NULL;
+	m_progressInterval = SAPR_DUMP_PROGRESS_INTERVAL;
+	memset(&m_result, 0, sizeof(m_result));
+}
+
+/// <summary>
+/// Set the function called with the number of frames recorded, while the dump is running, and once it is done.
+/// </summary>
+/// <param name="progress">Function to call, NULL for no progress report</param>
+/// <param name="pContext">Passed to the function as it is</param>
+/// <param name="interval">Minimum time between 2 calls, in milliseconds</param>
+void CSaprDumper::SetProgress(TSaprDumpProgress progress, void* pContext, int interval)
+{
+	m_progress = progress;
+	m_progressContext = pContext;
+	m_progressInterval = interval;
+}
+
+/// <summary>
+/// Record a Subtune, from the given position, until the player state at the beginning of a Songline was already recorded.
+/// The loop then starts where that state was first reached, see CPokeyStream::TrackSongLine.
+/// </summary>
+/// <param name="pStream">Stream recording the POKEY registers, it is started again, and stopped once the loop point is found</param>
+/// <param name="subtune">Subtune to play</param>
+/// <param name="playMode">MPLAY_START plays from the beginning, MPLAY_PATTERN and MPLAY_BLOCK loop the Pattern, anything else plays from the position</param>
+/// <returns>False if there was nothing to play, or if the stream could not record every frame, see CPokeyStream::IsFailed</returns>
+bool CSaprDumper::Dump(CPokeyStream* pStream, UINT subtune, int playMode, UINT songline, UINT row)
+{
+	memset(&m_result, 0, sizeof(m_result));
+
+	TSubtune* pSubtune = m_module ? m_module->GetSubtune(subtune) : NULL;
+
+	if (!pSubtune)
+		return false;
+
+	// Block playback is not supported by the engine yet, the whole Pattern is looped instead, like CSong::Play does
+	if (playMode == MPLAY_BLOCK)
+		playMode = MPLAY_PATTERN;
+
+	if (playMode == MPLAY_START)
+		songline = row = 0;
+
+	if (playMode == MPLAY_PATTERN)
+		row = 0;
+
+	// The dump plays the song until its loop point, then the loop once more, the buffer is sized for twice the nominal length
+	// Speed Commands and shortened Patterns make the actual length differ, the buffer is only grown if it was too short
+	UINT songFrames = m_module->GetSongLength(pSubtune) * m_module->GetPatternLength(pSubtune) * m_module->GetSongSpeed(pSubtune) * m_module->GetInstrumentSpeed(pSubtune);
+	auto dumpStart = std::chrono::steady_clock::now();
+	auto progressTime = dumpStart;
+
+	pStream->StartRecording(songFrames * 2, m_module->GetChannelCount(pSubtune));
+
+	m_engine.SetModule(m_module);
+	m_snapshots.Start(&m_engine, m_module, subtune, songline, row, playMode == MPLAY_PATTERN);
+
+	if (!m_engine.IsPlaying())
+	{
+		pStream->SetState(CPokeyStream::STOP);
+		return false;
+	}
+
+	pStream->CallFromPlay(playMode, m_engine.GetRow(), m_engine.GetSongline());
+
+	TPokeyBuffer* pBuffer = new TPokeyBuffer;
+	BYTE registers[POKEY_SOUNDCHIP_COUNT * 0x10] = {};
+	UINT instrumentSpeed = m_engine.GetInstrumentSpeed();
+	int progressFrame = SAPR_DUMP_PROGRESS_FRAMES;
+
+	// The player state is tracked from the very first frame, the song may loop back to it
+	bool isFirstFrame = true;
+
+	// The engine always loops, the stream stops recording once the loop point is found
+	while (pStream->IsRecording())
+	{
+		// 1 VBI of Subtune playback, the first frame also plays the Row, the others only play the Instruments
+		m_snapshots.PlayFrame(&m_engine, &pBuffer->frame[0]);
+
+		for (UINT i = 1; i < instrumentSpeed; i++)
+			m_engine.PlayInstruments(&pBuffer->frame[i]);
+
+		// The dump ends once the player state at the beginning of a Songline was already recorded, that VBI is not recorded
+		if ((m_engine.IsNewSongline() || isFirstFrame) && pStream->TrackSongLine(m_engine.GetSongline(), m_engine.GetStateHash(pBuffer->frame, instrumentSpeed)))
+			break;
+
+		isFirstFrame = false;
+
+		for (UINT i = 0; i < instrumentSpeed; i++)
+		{
+			CRmteEngine::WriteToRegisters(&pBuffer->frame[i], registers);
+			pStream->RecordRegisters(registers);
+		}
+
+		if (!m_progress || pStream->GetCurrentFrame() < progressFrame)
+			continue;
+
+		progressFrame += SAPR_DUMP_PROGRESS_FRAMES;
+		auto now = std::chrono::steady_clock::now();
+
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - progressTime).count() >= m_progressInterval)
+		{
+			progressTime = now;
+			m_progress(pStream->GetCurrentFrame(), m_progressContext);
+		}
+	}
+
+	delete pBuffer;
+	m_engine.Stop();
+
+	m_result.frames = pStream->GetCurrentFrame();
+	m_result.loopPoint = pStream->GetFirstCountPoint();
+	m_result.introFrames = pStream->GetThirdCountPoint();
+	m_result.loopFrames = pStream->GetSecondCountPoint();
+	m_result.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - dumpStart).count();
+
+	if (m_progress)
+		m_progress(m_result.frames, m_progressContext);
+
+	// The stream stopped itself when a frame could not be kept, what was recorded is incomplete
+	return !pStream->IsFailed();
+}
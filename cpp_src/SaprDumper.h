@@ -0,0 +1,54 @@
+//
+// SaprDumper.h header file
+// Batch recording of the POKEY registers of a Subtune into a CPokeyStream, up to its loop point, for the SAP-R and LZSS exports
+// There is no GUI involved, the progress is only reported through a callback, at most a few times per second
+//
+
+#pragma once
+
+#include "PokeyStream.h"
+#include "RmteEngine.h"
+#include "SonglineSnapshots.h"
+
+#define SAPR_DUMP_PROGRESS_FRAMES		256		// Frames recorded between 2 looks at the clock, reading it every frame would cost more than the frame itself
+#define SAPR_DUMP_PROGRESS_INTERVAL		100		// Milliseconds between 2 progress reports
+
+// Progress of a dump, with the frames recorded so far
+typedef void (*TSaprDumpProgress)(int frames, void* pContext);
+
+typedef struct
+{
+	int frames;				// Frames recorded in total
+	int loopPoint;			// Frames of the intro and the loop together, the loop point is reached after them
+	int introFrames;		// Frames before the loop begins
+	int loopFrames;			// Frames in the loop
+	double time;			// Seconds spent recording
+} TSaprDumpResult;
+
+/// <summary>
+/// Plays a Subtune with an engine of its own, as fast as possible, and records every frame into a CPokeyStream until the loop point is found.
+/// The tracker playback is left untouched, and no window is needed, so a command line tool can use it as well as the export dialogs.
+/// </summary>
+class CSaprDumper
+{
+public:
+	CSaprDumper(CModule* pModule = NULL);
+
+	void SetModule(CModule* pModule) { m_module = pModule; };
+	void SetProgress(TSaprDumpProgress progress, void* pContext = NULL, int interval = SAPR_DUMP_PROGRESS_INTERVAL);
+
+	bool Dump(CPokeyStream* pStream, UINT subtune, int playMode = MPLAY_START, UINT songline = 0, UINT row = 0);
+
+	const TSaprDumpResult* GetResult() { return &m_result; };
+
+private:
+	CModule* m_module;
+	CRmteEngine m_engine;
+	CSonglineSnapshots m_snapshots;
+
+	TSaprDumpProgress m_progress;
+	void* m_progressContext;
+	int m_progressInterval;
+
+	TSaprDumpResult m_result;
+};
@@ -34,47 +34,43 @@ extern CTuning g_Tuning;
 
 // ----------------------------------------------------------------------------
 
-std::chrono::steady_clock::time_point m_deltaTimerRoutine;
-static bool volatile m_timerRoutineSwitch;
-
-void CALLBACK G_TimerRoutine(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR)
+bool G_TimerRoutine()
 {
 	// If the POKEY Stream is being recorded, the Timer Routine is bypassed entirely to run as fast as possible
 	if (g_PokeyStream.IsRecording())
-		return;
+		return false;
+
+	// The audio output sets the pace, a frame is only played once there is room for it
+	if (!g_Pokey.IsFrameNeeded())
+		return false;
 
-	std::this_thread::sleep_until(m_deltaTimerRoutine);
-	m_deltaTimerRoutine = std::chrono::steady_clock::now() + std::chrono::milliseconds(g_ntsc ? 16 + (m_timerRoutineSwitch ^= 1) : 20);
 	g_Song.TimerRoutine();
+	return true;
 }
 
 // ----------------------------------------------------------------------------
 
 CSong::CSong()
 {
-	m_timerRoutine = NULL;
-	//m_songVariables = NULL;
 	m_pokeyBuffer = NULL;
-	//CreateSongVariables();
+	m_engine.SetModule(&g_Module);
 	CreatePokeyBuffer();
 }
 
 CSong::~CSong()
 {
 	KillTimer();
-	//DeleteSongVariables();
 	DeletePokeyBuffer();
 }
 
 /// <summary>
-/// Change the timing of how often the CSong::TimerRoutine is being called.
-/// Depends on PAL or NTSC timing.
+/// Start calling CSong::TimerRoutine from the playback thread.
+/// There is no fixed period, every call plays 1 frame of exactly FREQ_17 / FRAMERATE cycles,
+/// and the calls follow the audio output, so PAL or NTSC timing never drifts.
 /// </summary>
-/// <param name="ms">ms between calls (17=NTSC, 20=PAL)</param>
-void CSong::ChangeTimer(int ms)
+void CSong::StartTimer()
 {
-	KillTimer();
-	m_timerRoutine = timeSetEvent(ms, 0, G_TimerRoutine, (ULONG)(NULL), TIME_PERIODIC);
+	m_playbackClock.Start(G_TimerRoutine);
 }
 
 /// <summary>
@@ -82,10 +78,7 @@ void CSong::ChangeTimer(int ms)
 /// </summary>
 void CSong::KillTimer()
 {
-	if (m_timerRoutine) 
-		timeKillEvent(m_timerRoutine);
-
-	m_timerRoutine = NULL;
+	m_playbackClock.Stop();
 }
 
 /// <summary>
@@ -175,51 +168,14 @@ void CSong::ClearSong(int numOfTracks)
 	//g_Module.ClearModule();
 	g_Module.InitialiseModule();
 
-	// Clear Song variables
-	//ClearSongVariables();
+	// Stop the RMTE engine, it may still be playing from the Module that was just cleared
+	m_engine.Stop();
+	m_snapshots.Invalidate();
 
 	// Clear POKEY registers buffer
 	ClearPokeyBuffer();
 }
 
-/*
-void CSong::ResetChannelVariables(TChannelVariables* pVariables)
-{
-	if (!pVariables)
-		return;
-
-	// Clear all variables in the Channel
-	memset(pVariables, 0x00, sizeof(TChannelVariables));
-
-	// Set default values
-	pVariables->note = INVALID;
-	pVariables->instrument = INVALID;
-	pVariables->timbre = TIMBRE_PURE;
-}
-
-void CSong::ClearSongVariables()
-{
-	for (int i = 0; i < CHANNEL_COUNT; i++)
-		ResetChannelVariables(&m_songVariables->channel[i]);
-}
-
-void CSong::DeleteSongVariables()
-{
-	if (m_songVariables)
-		delete m_songVariables;
-
-	m_songVariables = NULL;
-}
-
-void CSong::CreateSongVariables()
-{
-	if (!m_songVariables)
-		m_songVariables = new TSongVariables;
-
-	ClearSongVariables();
-}
-*/
-
 void CSong::ClearPokeyBuffer()
 {
 	memset(m_pokeyBuffer, 0x00, sizeof(TPokeyBuffer));
@@ -3604,23 +3560,17 @@ BOOL CSong::PlayVBI()
 */
 
 /// <summary>
-/// Call this X times per second to handle the playing of the song
+/// Call this once per frame to handle the playing of the song
 /// </summary>
 void CSong::TimerRoutine()
 {
-/*
-	// Get the pointer to the Active Subtune
-	TSubtune* pSubtune = GetSubtune();
-
-	// Things that are solved 1x for vbi
-	PlayFrame(pSubtune);
+	// Play 1 VBI of the RMTE Module, the engine returns silent frames while it is stopped
+	UINT frameCount = PlayEngineFrame(m_pokeyBuffer->frame);
 
-	// Post Play stuff, such as Instruments and Effects
-	PlayContinue(pSubtune);
-
-	// Write to POKEY (FIXME: AAAAAAAAAAAAAAA)
-	g_Pokey.RenderSound_No6502(m_instrumentSpeed);
+	// Write to POKEY, this renders exactly 1 frame into the audio output
+	g_Pokey.RenderSound_No6502(frameCount, m_pokeyBuffer->frame);
 
+/*
 	// If the Song is currently playing, increment the timer
 	UpdatePlayTime();
 */
@@ -4657,6 +4607,19 @@ void CSong::DrawDebugInfos()
 		case 11: s.Format("OL = %02d", g_tracklines / 2); break;
 		case 12: s.Format("VK = %02X", g_lastKeyPressed); break;
 		case 13: s.Format("SC = %02X", g_lastScanPressed); break;
+		case 14: s.Format("RS = %1.0Fx", g_Pokey.GetRenderSpeed()); break;
+		case 15: s.Format("RT = %1.2Fms", g_Pokey.GetRenderTime()); break;
+		case 16: s.Format("LT = %02dms", g_Pokey.GetLatency() * 1000 / OUTPUTFREQ); break;
+		case 17: s.Format("UR = %02d", g_Pokey.GetUnderrunCount()); break;
+		case 18: s.Format("OR = %02d", g_Pokey.GetOverrunCount()); break;
+		case 19:
+		case 20:
+		case 21:
+		case 22:
+			// Render time of each POKEY in use, for the last block
+			if (i - 19 >= g_Pokey.GetSoundchipCount()) continue;
+			s.Format("P%d = %1.2Fms", i - 18, g_Pokey.GetSoundchipRenderTime(i - 19));
+			break;
 		default: continue;
 		}
 
@@ -4664,31 +4627,22 @@ void CSong::DrawDebugInfos()
 	}
 }
 
-// Prototype C++ RMTE Module Driver functions
-// TODO: Move to a different file later
+// RMTE Module playback, the frames are computed by CRmteEngine, without running any 6502 code
 
 void CSong::Stop()
 {
-/*
-	m_playMode = MPLAY_STOP;
-	ResetPlayTime();
-	ClearSongVariables();
-	ClearPokeyBuffer();
-	Atari_InitRMTRoutine();
-	Sleep(20);	// To ensure the Timer Routine is executed at least once here
-*/
+	std::lock_guard<std::mutex> lock(m_engineMutex);
+	m_engine.Stop();
 	m_playMode = MPLAY_STOP;
 }
 
 void CSong::Play(int mode, BOOL follow, int special)
 {
-/*
 	switch (mode)
 	{
 	case MPLAY_START:
-		m_nextSongline = m_playSongline = 0;
-		m_nextRow = m_playRow = 0;
-		m_playSpeed = GetSongSpeed();
+		m_playSongline = 0;
+		m_playRow = 0;
 		break;
 
 	case MPLAY_FROM:
@@ -4698,13 +4652,43 @@ void CSong::Play(int mode, BOOL follow, int special)
 			m_playMode = mode;
 			return;
 		}
-		m_nextSongline = m_playSongline = m_activeSongline;
-		m_nextRow = m_playRow = m_activeRow;
+		m_playSongline = m_activeSongline;
+		m_playRow = m_activeRow;
 		break;
 
 	case MPLAY_PATTERN:
-		m_nextSongline = m_playSongline = m_activeSongline;
-		m_nextRow = m_playRow = (special) ? m_activeRow : 0;
+		m_playSongline = m_activeSongline;
+		m_playRow = (special) ? m_activeRow : 0;
+		break;
+
+	case MPLAY_BOOKMARK:
+		if (m_bookmark.songline < 0 || m_bookmark.trackline < 0)
+			return;
+		m_playSongline = m_bookmark.songline;
+		m_playRow = m_bookmark.trackline;
+		break;
+
+	case MPLAY_SEEK_NEXT:
+		if (++m_activeSongline > SONGLINE_COUNT - 1)
+			m_activeSongline = SONGLINE_COUNT - 1;
+		m_playSongline = m_activeSongline;
+		m_playRow = m_activeRow = 0;
+		mode = MPLAY_FROM;
+		break;
+
+	case MPLAY_SEEK_PREV:
+		if (--m_activeSongline < 0)
+			m_activeSongline = 0;
+		m_playSongline = m_activeSongline;
+		m_playRow = m_activeRow = 0;
+		mode = MPLAY_FROM;
+		break;
+
+	default:
+		// Block playback is not supported by the engine yet, the whole Pattern is looped instead
+		m_playSongline = m_activeSongline;
+		m_playRow = 0;
+		mode = MPLAY_PATTERN;
 		break;
 	}
 
@@ -4712,9 +4696,17 @@ void CSong::Play(int mode, BOOL follow, int special)
 	if (m_playMode != MPLAY_STOP)
 		Stop();
 
-	// Begin playback from here
+	// Begin playback from here, the engine corrects any position that is out of bounds
+	// Anywhere past the beginning of the Subtune, the state reached by playing from the beginning is restored from its snapshot
+	std::unique_lock<std::mutex> lock(m_engineMutex);
+	// A restored engine is positioned just before the Row, which is then already the right position
+	if (!m_snapshots.Start(&m_engine, &g_Module, m_activeSubtune, m_playSongline, m_playRow, mode == MPLAY_PATTERN))
+	{
+		m_playSongline = m_engine.GetSongline();
+		m_playRow = m_engine.GetRow();
+	}
 	m_playMode = mode;
-	m_speedTimer = 1;
+	lock.unlock();
 
 	// Cursor following the player
 	if (m_isFollowPlay = follow)
@@ -4722,774 +4714,44 @@ void CSong::Play(int mode, BOOL follow, int special)
 		m_activeRow = m_playRow;
 		m_activeSongline = m_playSongline;
 	}
-	
-	//g_PokeyStream.CallFromPlay(m_playMode, m_playRow, m_playSongline);
-*/
-}
-
-/*
-// Play Module without the 6502 RMT routines limitation, designed specifically for the new RMTE Module format
-// Ultimatey, this will become the default payback method, unless specified otherwise (eg: Legacy RMT compatibility)
-void CSong::PlayFrame(TSubtune* pSubtune)
-{
-	if (!pSubtune)
-		return;
-	
-	// If RMT is not playing, there is nothing to do here
-	if (m_playMode == MPLAY_STOP)
-		return;
-
-	// Decrement the Speed Timer, and process the next Row when it is ready
-	if (--m_speedTimer == 0)
-	{
-		// Play 1 Row, and update the playback position accordingly
-		PlayRow(pSubtune);
-	}
-
-	// If FollowPlay is enabled, update the Active Row and Active Songline values accordingly
-	if (m_isFollowPlay)
-	{
-		m_activeRow = m_playRow;
-		m_activeSongline = m_playSongline;
-	}
-
-}
-*/
-
-/*
-// Procedure taking care of playing Instruments, executing Effect Commands, and setting up the POKEY registers during playback
-void CSong::PlayContinue(TSubtune* pSubtune)
-{
-	if (!pSubtune)
-		return;
-
-	// If RMT is not playing, there is nothing to do here
-	if (m_playMode == MPLAY_STOP)
-		return;
-
-	// Process everything at once using the variables that were loaded ahead of time
-	for (int loop = 0; loop < pSubtune->channelCount; loop += 4)
-	{
-		TPokeyRegisters* pPokey = &m_pokeyBuffer->frame[0x00].pokey[loop / 4];
-		memset(pPokey, 0x00, sizeof(TPokeyRegisters));
-
-		// SKCTL initialised state is necessary for actually generating POKEY sound
-		pPokey->skctl = 0x03;
-
-		// In order to properly access individual POKEY Channels
-		for (int i = 0; i < POKEY_CHANNEL_COUNT; i++)
-		{
-			TChannelVariables* pChannelVariables = &m_songVariables->channel[loop + i];
-			TInstrumentVariables* pInstrumentVariables = &m_songVariables->instrument[loop + i];
-			TInstrumentV2* pInstrument = GetInstrument(pChannelVariables->instrument);
-
-			// TODO: Move all of the code in this loop to Play Instrument instead...
-			PlayInstrument(pInstrument, pChannelVariables, pInstrumentVariables);
-
-			if (!pChannelVariables->isNoteActive)
-				continue;
-
-			TAutomatic* pTrigger = pInstrumentVariables->envelope.trigger.isActive ? &pInstrumentVariables->trigger : NULL;
-
-			BYTE volume = pInstrumentVariables->envelope.volume.isActive ? (BYTE)round((double)(pChannelVariables->volume * pInstrumentVariables->volume) / 0x0F) : pChannelVariables->volume;
-			BYTE timbre = pInstrumentVariables->envelope.timbre.isActive ? pInstrumentVariables->timbre : pChannelVariables->timbre;
-			BYTE audctl = pInstrumentVariables->envelope.audctl.isActive ? pInstrumentVariables->audctl : pChannelVariables->audctl;
-
-			pPokey->audc[i] = (timbre & 0xF0) | volume;
-			pPokey->audctl |= audctl;
-
-			if (pInstrument)
-			{
-				// Process the Instrument Triggers for functionalities that are automatically handled based on specific criteria
-				if (pTrigger && pPokey->audc[i] & 0x0F)
-				{
-					// High Pass Filter, triggered in Channel 1 and 2, from which the Freq is derived and written into the Channel modulating it
-					if (pTrigger->autoFilter && (_CH1(i) || _CH2(i)))
-					{
-						pPokey->audctl |= _CH1(i) ? 0x04 : 0x02;
-					}
-
-					// 16-Bit Mode, triggered in Channel 2 and 4, allowing 16-bit pitch accuracy, the Channel above will also be muted automatically
-					if (pTrigger->auto16Bit && (_CH2(i) || _CH4(i)))
-					{
-						pPokey->audctl |= _CH2(i) ? 0x50 : 0x28;
-						pPokey->audc[i - 1] = 0x00;
-					}
-
-					// Two-Tone Filter, triggered in Channel 1, modulated by the Freq of Channel 2, similar to the High Pass Filter
-					if (pTrigger->autoTwoTone && _CH1(i))
-					{
-						pPokey->skctl = 0x8B;
-					}
-				}
-
-				// Apply the Instrument Volume Fade if the Volume Envelope had looped at least once
-				if (pInstrumentVariables->envelope.volume.isActive && pInstrumentVariables->isEnvelopeLooped && pChannelVariables->volume > pInstrument->volumeSustain)
-				{
-					WORD volumeFade = (pChannelVariables->volume << 8) | pInstrumentVariables->volumeSlide;
-					volumeFade -= pInstrument->volumeFade;
-					pChannelVariables->volume = volumeFade >> 8;
-					pInstrumentVariables->volumeSlide = volumeFade & 0xFF;
-				}
-
-				// FreqShift and Vibrato effect, processed as soon as the delay timer is expired
-				if (pInstrumentVariables->delayTimer == 0x00)
-				{
-					// FreqShift effect, which is additive to itself, there is no boundary check in place for now
-					if (pInstrument->freqShift)
-					{
-						int instrumentfinetune = (char)pInstrumentVariables->finetuneOffset;
-						instrumentfinetune += (char)pInstrument->freqShift;
-
-						if (instrumentfinetune < 0x00)
-							instrumentfinetune = 0x00;
-
-						if (instrumentfinetune > 0xFF)
-							instrumentfinetune = 0xFF;
-
-						pInstrumentVariables->finetuneOffset = instrumentfinetune;
-					}
-				}
-				else
-					pInstrumentVariables->delayTimer--;
-			}
-
-		}
-
-		// Going in the reverse order actually helps for setting data "after" when it is expected "before"
-		for (int i = POKEY_CHANNEL_COUNT - 1; i >= 0; --i)
-		{
-			TChannelVariables* pChannelVariables = &m_songVariables->channel[loop + i];
-			TInstrumentVariables* pInstrumentVariables = &m_songVariables->instrument[loop + i];
-
-			if (!pChannelVariables->isNoteActive)
-				continue;
-
-			TAutomatic* pTrigger = &pInstrumentVariables->trigger;
-			TEffect* pEffect = &pInstrumentVariables->effect;
-			BYTE timbre = pInstrumentVariables->timbre;
-
-			bool is16BitMode = (_CH2(i) && (pPokey->audctl & 0x50) == 0x50) || (_CH4(i) && (pPokey->audctl & 0x28) == 0x28);
-			bool autoFilter = (pPokey->audc[i] & 0x0F) && (pTrigger->autoFilter && (_CH1(i) || _CH2(i)));
-			bool autoPortamento = pInstrumentVariables->portamento.isActive && pTrigger->autoPortamento;
-
-			int note = pChannelVariables->note;
-			int offsetNote = (char)pInstrumentVariables->note;
-
-			int freq = 0x00;
-			int offsetFreq = (char)pInstrumentVariables->freq;
-			int instrumentfinetune = (char)pInstrumentVariables->finetuneOffset;
-
-			double pitch = 0.0, vibrato = 0.0;
-
-			// Instrument Effect Commands, unfinished implementation
-			switch (pEffect->command)
-			{
-			case 0x00:
-				// Note offset, for XY semitones
-				offsetNote += (char)pEffect->parameter;
-				break;
-
-			case 0x01:
-				// Absolute Freq, it will always take priority
-				freq = pEffect->parameter;
-				note = INVALID;
-				break;
-
-			case 0x02:
-				// Detune, relative to the current Freq value
-				offsetFreq += (char)pEffect->parameter;
-				break;
-
-			case 0x03:
-				// Note offset, additive
-				note += (char)pEffect->parameter;
-
-				if (note < 0x00)
-					note = 0x00;
-
-				if (note > NOTE_COUNT)
-					note = NOTE_COUNT;
-
-				pChannelVariables->note = note;
-				break;
-
-			case 0x04:
-				// Finetune offset, additive
-				instrumentfinetune += (char)pEffect->parameter;
-
-				if (instrumentfinetune < 0x00)
-					instrumentfinetune = 0x00;
-
-				if (instrumentfinetune > 0xFF)
-					instrumentfinetune = 0xFF;
-
-				pInstrumentVariables->finetuneOffset = instrumentfinetune;
-				break;
-
-			case 0x05:
-				// Instrument Portamento
-				if (autoPortamento)
-				{
-					pInstrumentVariables->portamento.speed = pEffect->parameter & 0x0F;
-					pInstrumentVariables->portamento.depth = pEffect->parameter >> 4;
-				}
-				break;
-			}
-
-			// Originally known as ShiftFreq, basically a direct additive offset to Freq
-			offsetFreq += instrumentfinetune;
-
-			// If the Note is Invalid, the Freq to be used is most likely Absolute, and would be used directly instead
-			if (note != INVALID)
-			{
-				note += offsetNote;
-
-				if (note < 0x00)
-					note = 0x00;
-
-				// This is overkill, but this isn't really a problem for now...
-				if (note > 0xFF)
-					note = 0xFF;
-
-				// Generate the reference Pitch, using the current Note and Tuning parameters
-				pitch = g_Tuning.GetTruePitch(note, g_baseNote + 12 * (g_baseOctave - 4), g_baseTuning);
-
-				// Legacy RMT Instrument Portamento hack: initialise the Last Pitch when the CMD5 is used alone
-				if (!autoPortamento && pEffect->command == 0x05)
-					pInstrumentVariables->portamento.lastPitch = pitch;
-
-				// If the Instrument Portamento is active, proceed with it in priority
-				if (pInstrumentVariables->portamento.isActive)
-				{
-					if (autoPortamento)
-					{
-						TPortamento* pPortamento = &pInstrumentVariables->portamento;
-
-						if (pEffect->command == 0x05)
-							pPortamento->targetPitch = pitch;
-
-						if (pPortamento->lastPitch == 0.0)
-							pPortamento->lastPitch = pitch;
-
-						pitch = pPortamento->lastPitch;
-						pitch += GetPortamento(pPortamento, pitch);
-
-						if (pPortamento->targetPitch > pPortamento->lastPitch)
-						{
-							if (pitch > pPortamento->targetPitch)
-								pitch = pPortamento->targetPitch;
-						}
-						else
-						{
-							if (pitch < pPortamento->targetPitch)
-								pitch = pPortamento->targetPitch;
-						}
-
-						pPortamento->lastPitch = pitch;
-					}
-				}
-
-				// Else, proceed with the Channel Portamento like normal
-				else if (pChannelVariables->portamento.isActive)
-				{
-					TPortamento* pPortamento = &pChannelVariables->portamento;
-
-					pPortamento->targetPitch = pitch;
-
-					if (pPortamento->lastPitch == 0.0)
-						pPortamento->lastPitch = pitch;
-
-					pitch = pPortamento->lastPitch;
-					pitch += GetPortamento(pPortamento, pitch);
-
-					if (pPortamento->targetPitch > pPortamento->lastPitch)
-					{
-						if (pitch > pPortamento->targetPitch)
-							pitch = pPortamento->targetPitch;
-					}
-					else
-					{
-						if (pitch < pPortamento->targetPitch)
-							pitch = pPortamento->targetPitch;
-					}
-
-					pPortamento->lastPitch = pitch;
-				}
-
-				// If the Instrument Vibrato is active, it will be processed in priority, before the Freq is calculated 
-				if (pInstrumentVariables->vibrato.isActive)
-					vibrato = pInstrumentVariables->delayTimer == 0x00 ? GetVibrato(&pInstrumentVariables->vibrato, pitch) : 0.0;
-
-				// Else, If the Channel Vibrato is active, it will be processed before the Freq is calculated instead
-				else if (pChannelVariables->vibrato.isActive)
-					vibrato = GetVibrato(&pChannelVariables->vibrato, pitch);
-
-				// Generate the actual POKEY Freq using all the necessary parameters
-				freq = g_Tuning.GeneratePokeyFreq(pitch + vibrato, i, timbre, pPokey->audctl);
-				freq += offsetFreq;
-			}
-
-			// The Freq should never be allowed to go below 0!
-			if (freq < 0x00)
-				freq = 0x00;
-
-			// Update the AUDF registers once the Freq is ready to be used
-			if (is16BitMode)
-				pPokey->audf16[!_CH2(i)] = freq > 0xFFFF ? 0xFFFF : freq;
-			else
-				pPokey->audf[i] = freq > 0xFF ? 0xFF : freq;
-
-			// Autofilter is processed after everything, and used to derive the Freq used in the modulation channel
-			if (autoFilter)
-			{
-				freq = is16BitMode ? pPokey->audf16[0] : pPokey->audf[i];
-				offsetFreq = pEffect->command == 0x06 ? (char)pEffect->parameter : 0x00;
-				freq += offsetFreq;
-
-				// The Freq should never be allowed to go below 0!
-				if (freq < 0x00)
-					freq = 0x00;
-
-				if (is16BitMode)
-					pPokey->audf16[1] = freq > 0xFFFF ? 0xFFFF : freq;
-				else
-					pPokey->audf[i + 2] = freq > 0xFF ? 0xFF : freq;
-			}
-
-			// This is to ensure the joined registers isn't overwritten
-			if (is16BitMode)
-				i--;
-
-			// Update the Channel Timer for the next frame once everything was processed using it
-			pChannelVariables->frameCount++;
-		}
-
-		// FIXME: Get rid of the current setup using the Plugins and the outdated DirectSound API, because constantly working around it is seriously pissing me off
-		int offset = (loop / 4) * POKEY_CHANNEL_COUNT;
-
-		for (int j = 0; j < POKEY_CHANNEL_COUNT; j++)
-		{
-			g_atarimem[RMTPLAYR_TRACKN_AUDF + offset + j] = pPokey->audf[j];
-			g_atarimem[RMTPLAYR_TRACKN_AUDC + offset + j] = pPokey->audc[j];
-		}
-
-		g_atarimem[RMTPLAYR_V_AUDCTL] = pPokey->audctl;
-		g_atarimem[RMTPLAYR_V_SKCTL] = pPokey->skctl;
-	}
-}
-*/
-
-/*
-void CSong::PlayInstrument(TInstrumentV2* pInstrument, TChannelVariables* pChannelVariables, TInstrumentVariables* pInstrumentVariables)
-{
-	if (pChannelVariables->isNoteActive)
-	{
-		if (pChannelVariables->isNoteTrigger)
-		{
-			pChannelVariables->frameCount = 0x00;
-		}
-
-		if (pInstrument)
-		{
-			TEnvelopeVariables* pEnvelope = &pInstrumentVariables->envelope;
-			TPeriodic* pVibrato = &pInstrumentVariables->vibrato;
-			TPortamento* pPortamento = &pInstrumentVariables->portamento;
-			void* pEnvelopePtr;
-
-			if (pChannelVariables->isNoteTrigger)
-			{
-				pInstrumentVariables->delayTimer = pInstrument->delay;
-				pInstrumentVariables->isEnvelopeLooped = false;
-				pInstrumentVariables->volumeSlide = 0x00;
-				pInstrumentVariables->finetuneOffset = 0x00;
-				pVibrato->speed = pInstrument->vibrato & 0x0F;
-				pVibrato->depth = pInstrument->vibrato >> 4;
-				pVibrato->phase = 0x00;
-				pVibrato->isActive = pVibrato->speed;
-				pPortamento->depth = pPortamento->speed = 0x00;
-				pPortamento->isActive = false;
-			}
-
-			if (pEnvelope->volume.isActive = pEnvelopePtr = GetVolumeEnvelope(pInstrument->index.volume))
-			{
-				BYTE* pIndex = ((TInstrumentEnvelope*)pEnvelopePtr)->envelope;
-				TFlag* pFlag = &((TInstrumentEnvelope*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentEnvelope*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->volume;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-				{
-					pInstrumentVariables->volume = pIndex[pActive->offset];
-					pInstrumentVariables->isEnvelopeLooped |= hasLooped;
-				}
-			}
-
-			if (pEnvelope->timbre.isActive = pEnvelopePtr = GetTimbreEnvelope(pInstrument->index.timbre))
-			{
-				BYTE* pIndex = ((TInstrumentEnvelope*)pEnvelopePtr)->envelope;
-				TFlag* pFlag = &((TInstrumentEnvelope*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentEnvelope*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->timbre;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-					pInstrumentVariables->timbre = pIndex[pActive->offset];
-			}
-
-			if (pEnvelope->audctl.isActive = pEnvelopePtr = GetAudctlEnvelope(pInstrument->index.audctl))
-			{
-				BYTE* pIndex = ((TInstrumentEnvelope*)pEnvelopePtr)->envelope;
-				TFlag* pFlag = &((TInstrumentEnvelope*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentEnvelope*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->audctl;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-					pInstrumentVariables->audctl = pIndex[pActive->offset];
-			}
-
-			if (pEnvelope->trigger.isActive = pEnvelopePtr = GetTriggerEnvelope(pInstrument->index.trigger))
-			{
-				TAutomatic* pIndex = ((TInstrumentTrigger*)pEnvelopePtr)->trigger;
-				TFlag* pFlag = &((TInstrumentTrigger*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentTrigger*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->trigger;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-					pInstrumentVariables->trigger = pIndex[pActive->offset];
-
-				// A very disgusting hack for Portamento
-				if (pChannelVariables->isNoteTrigger)
-				{
-					for (int i = 0; i < pParameter->length; i++)
-					{
-						pPortamento->isActive |= pIndex[i].autoPortamento;
-					}
-				}
-			}
-
-			if (pEnvelope->effect.isActive = pEnvelopePtr = GetEffectEnvelope(pInstrument->index.effect))
-			{
-				TEffect* pIndex = ((TInstrumentEffect*)pEnvelopePtr)->effect;
-				TFlag* pFlag = &((TInstrumentEffect*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentEffect*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->effect;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-					pInstrumentVariables->effect = pIndex[pActive->offset];
-			}
-
-			if (pEnvelope->note.isActive = pEnvelopePtr = GetNoteTable(pInstrument->index.note))
-			{
-				BYTE* pIndex = ((TInstrumentTable*)pEnvelopePtr)->table;
-				TFlag* pFlag = &((TInstrumentTable*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentTable*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->note;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-				{
-					if (!pChannelVariables->isNoteTrigger && pFlag->isAdditive)
-						pInstrumentVariables->note += pIndex[pActive->offset];
-					else
-						pInstrumentVariables->note = pIndex[pActive->offset];
-				}
-			}
-
-			if (pEnvelope->freq.isActive = pEnvelopePtr = GetFreqTable(pInstrument->index.freq))
-			{
-				BYTE* pIndex = ((TInstrumentTable*)pEnvelopePtr)->table;
-				TFlag* pFlag = &((TInstrumentTable*)pEnvelopePtr)->flag;
-				TParameter* pParameter = &((TInstrumentTable*)pEnvelopePtr)->parameter;
-
-				TActive* pActive = &pEnvelope->freq;
-				bool hasLooped = false;
-
-				if (AdvanceEnvelope(pActive, pParameter, pFlag, pChannelVariables->isNoteTrigger, pChannelVariables->isNoteRelease, hasLooped))
-				{
-					if (!pChannelVariables->isNoteTrigger && pFlag->isAdditive)
-						pInstrumentVariables->freq += pIndex[pActive->offset];
-					else
-						pInstrumentVariables->freq = pIndex[pActive->offset];
-				}
-			}
-
-		}
-
-		// These Flags are no longer needed after this point
-		pChannelVariables->isNoteTrigger = pChannelVariables->isNoteRelease = false;
-		pChannelVariables->isNoteReset = false;
-	}
-}
-*/
-
-/*
-bool CSong::AdvanceEnvelope(TActive* pActive, TParameter* pParameter, TFlag* pFlag, bool trigger, bool release, bool& hasLooped)
-{
-	// In order to prevent false Release, the matching Flag must be set as well
-	if (trigger || (release && pFlag->isReleased))
-	{
-		pActive->offset = release ? pParameter->release : 0x00;
-		pActive->timer = pParameter->speed;
-		return true;
-	}
-
-	// If the Timer is 0, the Envelope will advance by 1 step
-	if (--pActive->timer == 0)
-	{
-		// If the End Point is reached, check if the Envelope is Looped
-		if (++pActive->offset > pParameter->length - 1)
-		{
-			// The hasLooped reference is used for detecting the Loop Point when it is encountered
-			if (hasLooped = pFlag->isLooped)
-				pActive->offset = pParameter->loop;
-			else
-				pActive->offset = pParameter->length - 1;
-		}
-
-		pActive->timer = pParameter->speed;
-		return true;
-	}
-
-	return false;
-}
-*/
-
-/*
-double CSong::GetVibrato(TPeriodic* pVibrato, double pitch)
-{
-	if (!pVibrato)
-		return 0;
-	
-	// Create the modulation variables from the vibrato parameters
-	double depth = pVibrato->depth ? pVibrato->depth : 0.5;
-	double phase = pVibrato->phase;
-	double amplitude = log2(1.0 + (depth / 64.0));
-	double velocity = phase / 64.0;
-
-	// Update the Vibrato Phase with the Speed parameter for the next frame
-	pVibrato->phase += pVibrato->speed;
-
-	// Return the finetuned offset from the reference Pitch on the current Vibrato Phase
-	return ((pitch / sqrt(depth)) * amplitude) * sin(velocity * 2.0 * 3.14159265359);
 
-	return 0;
-}
-*/
-
-/*
-double CSong::GetPortamento(TPortamento* pPortamento, double pitch)
-{
-	if (!pPortamento)
-		return 0;
-
-	// Create the modulation variables from the portamento parameters
-	double depth = pPortamento->depth ? pPortamento->depth : 0.5;
-	double speed = pPortamento->speed;
-	double phase = pPortamento->targetPitch > pPortamento->lastPitch ? 1.0 : -0.5;
-	
-	double amplitude = log2(1.0 + (depth / 16.0));
-	double velocity = phase * (speed / 64.0);
-
-	// Return the finetuned offset from the reference Pitch
-	return ((pitch / sqrt(depth)) * amplitude) * sin(velocity * 2.0 * 3.14159265359);
-
-	return 0;
+	g_PokeyStream.CallFromPlay(m_playMode, m_playRow, m_playSongline);
 }
-*/
 
-/*
-void CSong::PlayRow(TSubtune* pSubtune)
+/// <summary>
+/// Play 1 VBI of the RMTE Module, the first frame also plays the Row, the others only play the Instruments.
+/// </summary>
+/// <param name="pFrames">POKEY registers for every Instrument Speed call, silent if nothing is playing</param>
+/// <returns>Number of frames written, set by the Instrument Speed of the Subtune</returns>
+UINT CSong::PlayEngineFrame(TPokeyFrame* pFrames)
 {
-	if (!pSubtune)
-		return;
-
-	// If the playback positions were set prior to this point, the values will be used accordingly
-	if (m_nextSongline != INVALID || m_nextRow != INVALID)
-	{
-		// If a Goto Songline (Bxx) command was used, set the new Songline position if it is valid
-		if (m_nextSongline != INVALID)
-			m_playSongline = m_playMode != MPLAY_PATTERN ? m_nextSongline : m_playSongline;
-
-		// If a End Pattern (Dxx) command was used, set the new Row position if it is valid
-		if (m_nextRow != INVALID)
-			m_playRow = m_nextRow;
+	std::lock_guard<std::mutex> lock(m_engineMutex);
 
-		// Invalidate subsequent movements once they're used
-		m_nextSongline = m_nextRow = INVALID;
-	}
-
-	// Else, continue playback by incrementing the Row and Songline positions like usual
-	else if ((++m_playRow %= pSubtune->patternLength) == 0)
+	if (!m_engine.IsPlaying())
 	{
-		if (m_playMode != MPLAY_PATTERN)
-			++m_playSongline %= pSubtune->songLength;
-	}
-
-	// Check the song boundaries, to prevent invalid movements
-	PlaybackRespectBoundaries(pSubtune);
-
-	// Process all channels
-	for (int i = 0; i < pSubtune->channelCount; i++)
-	{
-		// Get the Pattern found at the Songline position from each Channel Index
-		BYTE pattern = pSubtune->channel[i].songline[m_playSongline];
-
-		// Get the pointer to Row data found within the Pattern
-		TRow* pRow = &pSubtune->channel[i].pattern[pattern].row[m_playRow];
-
-		// Get the pointers to the variables used for most of the playback routines
-		TChannelVariables* pVariables = &m_songVariables->channel[i];
-
-		// Note
-		ProcessNote(pRow->note, pVariables);
-
-		// Instrument
-		ProcessInstrument(pRow->instrument, pVariables);
-
-		// Volume;
-		ProcessVolume(pRow->volume, pVariables);
-
-		// Command(s)
-		for (int k = 0; k < pSubtune->channel[i].effectCount; k++)
-			ProcessEffect(&pRow->effect[k], pVariables);
-	}
-
-	// Set the Speed Timer to the current Play Speed parameter, the last Fxx Command used will take priority
-	m_speedTimer = m_playSpeed;
-}
-*/
-
-/*
-void CSong::ProcessNote(BYTE note, TChannelVariables* pVariables)
-{
-	switch (note)
-	{
-	case NOTE_EMPTY:
-		break;
-
-	case NOTE_OFF:
-		ResetChannelVariables(pVariables);
-		break;
-
-	case NOTE_RELEASE:
-		if (pVariables->isNoteActive)
-			pVariables->isNoteRelease = true;
-		break;
-
-	case NOTE_RETRIGGER:
-		if (pVariables->isNoteActive)
-			pVariables->isNoteTrigger = true;
-		break;
-
-	default:
-		if (note < NOTE_COUNT)
-		{
-			pVariables->note = note;
-			pVariables->isNoteActive = true;
-			pVariables->isNoteTrigger = true;
-			pVariables->isNoteReset = true;
-			pVariables->frameCount = 0x00;
-		}
+		m_engine.PlayInstruments(&pFrames[0]);
+		return 1;
 	}
-}
-*/
 
-/*
-void CSong::ProcessInstrument(BYTE instrument, TChannelVariables* pVariables)
-{
-	switch (instrument)
-	{
-	case INSTRUMENT_EMPTY:
-		if (pVariables->isNoteActive && pVariables->isNoteReset)
-			pVariables->isNoteTrigger = false;
-		break;
+	UINT instrumentSpeed = m_engine.GetInstrumentSpeed();
 
-	default:
-		if (instrument < INSTRUMENT_COUNT)
-			pVariables->instrument = instrument;
-	}
-}
-*/
+	m_snapshots.PlayFrame(&m_engine, &pFrames[0]);
 
-/*
-void CSong::ProcessVolume(BYTE volume, TChannelVariables* pVariables)
-{
-	switch (volume)
-	{
-	case VOLUME_EMPTY:
-		break;
+	for (UINT i = 1; i < instrumentSpeed; i++)
+		m_engine.PlayInstruments(&pFrames[i]);
 
-	default:
-		if (volume < VOLUME_COUNT)
-			pVariables->volume = volume;
-	}
-}
-*/
+	m_playSongline = m_engine.GetSongline();
+	m_playRow = m_engine.GetRow();
 
-/*
-void CSong::ProcessEffect(TEffect* effect, TChannelVariables* pVariables)
-{
-	switch (effect->command)
+	// Cursor following the player
+	if (m_isFollowPlay)
 	{
-	case EFFECT_PORTAMENTO:
-		pVariables->portamento.speed = effect->parameter & 0x0F;
-		pVariables->portamento.depth = effect->parameter >> 4;
-		pVariables->portamento.isActive = pVariables->portamento.speed;
-		break;
-
-	case EFFECT_VIBRATO:
-		if (pVariables->isNoteActive && pVariables->isNoteReset)
-			pVariables->vibrato.phase = 0x00;
-		pVariables->vibrato.speed = effect->parameter & 0x0F;
-		pVariables->vibrato.depth = effect->parameter >> 4;
-		pVariables->vibrato.isActive = pVariables->vibrato.speed;
-		break;
-
-	case EFFECT_COMMAND_BXX:
-		if (m_nextRow == INVALID)
-			m_nextRow = 0;
-		m_nextSongline = effect->parameter;
-		break;
-
-	case EFFECT_COMMAND_DXX:
-		if (m_nextSongline == INVALID)
-			m_nextSongline = m_playSongline + 1;
-		m_nextRow = effect->parameter;
-		break;
-
-	case EFFECT_COMMAND_FXX:
-		m_playSpeed = effect->parameter;
-		break;
+		m_activeRow = m_playRow;
+		m_activeSongline = m_playSongline;
 	}
-}
-*/
-
-/*
-void CSong::PlaybackRespectBoundaries(TSubtune* pSubtune)
-{
-	if (!pSubtune)
-		return;
 
-	// If an Invalid Songline position is detected, reset it to 0
-	if (m_playSongline >= pSubtune->songLength)
-		m_playSongline = 0;
-	
-	// If an Invalid Row position is detected, reset it to 0
-	if (m_playRow >= GetShortestPatternLength(pSubtune, m_playSongline))
-		m_playRow = 0;
+	return instrumentSpeed;
 }
-*/
 
 
 //-- Editor Functions (TODO(?): Move elsewhere later) --//
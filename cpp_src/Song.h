@@ -1,6 +1,8 @@
 #pragma once
 #include "stdafx.h"
 #include <fstream>
+#include <mutex>
+#include <vector>
 
 #include "General.h"
 #include "global.h"
@@ -10,6 +12,9 @@
 #include "Tracks.h"
 #include "ModuleV2.h"
 #include "Memory.h"
+#include "PlaybackClock.h"
+#include "RmteEngine.h"
+#include "SonglineSnapshots.h"
 
 struct TBookmark
 {
@@ -60,122 +65,6 @@ typedef struct
 } tExportDescription;
 
 
-// POKEY registers typically make use of 8-bit values, but there are cases where 2 Channels may also be joined together in 16-bit mode
-// It is effectively possible to use the same data for either 2 contiguous AUDF Bytes, or a single 16-bit Word, depending on the AUDCTL state
-struct TPokeyRegisters
-{
-	union
-	{
-		BYTE audf[4];
-		WORD audf16[2];
-	};
-	BYTE audc[4];
-	BYTE audctl;
-	BYTE skctl;
-};
-
-// POKEY registers buffer Frame, used for every call of Instrument and/or Effect routines
-struct TPokeyFrame
-{
-	TPokeyRegisters pokey[POKEY_SOUNDCHIP_COUNT];
-};
-
-// POKEY registers buffer Heap, used for rendering sound for a set number of Millisecond Chunks
-struct TPokeyBuffer
-{
-	TPokeyFrame frame[256];
-};
-
-/*
-// Active Instrument Envelope Variables
-struct TActive
-{
-	bool isActive;					// Instrument Envelope is Active
-	BYTE offset;					// Instrument Envelope Offset
-	BYTE timer;						// Instrument Envelope Timer
-};
-
-// Periodic Effect Variables, such as Vibrato and Tremolo
-struct TPeriodic
-{
-	bool isActive;
-	BYTE depth;
-	BYTE speed;
-	BYTE phase;
-};
-
-// Portamento Effect Variables
-struct TPortamento
-{
-	bool isActive;
-	BYTE depth;
-	BYTE speed;
-	double lastPitch;
-	double targetPitch;
-};
-
-struct TEnvelopeVariables
-{
-	TActive volume;
-	TActive timbre;
-	TActive audctl;
-	TActive trigger;
-	TActive effect;
-	TActive note;
-	TActive freq;
-};
-
-// Instrument variables used by the RMTE Module playback routines
-struct TInstrumentVariables
-{
-	bool isEnvelopeLooped;			// Instrument Envelope flag for looping, used to trigger Volume Slide if enabled
-	TEnvelopeVariables envelope;	// Instrument Envelope variables to keep track of during playback
-	BYTE volume;					// AUDC, bits 0-3, Volume level could be 0-15 inclusive
-	BYTE timbre;					// AUDC, bits 5-7, unique tones and noises generated by the POKEY Soundchip
-	BYTE audctl;					// AUDCTL, bits from all 4 POKEY Channels combined during playback
-	TAutomatic trigger;				// Trigger bits used for specific functionalities during playback
-	TEffect effect;					// Instrument Effect Command used for specific functionalities during playback
-	BYTE note;						// Instrument Note, which may be used as an offset to the Channel Note
-	BYTE freq;						// Instrument Freq, which may be used as an offset to the Channel Freq
-	BYTE volumeSlide;				// Volume Slide parameter, set using the Axx Command, the Instrument Volume Slide Parameter will take priority if enabled
-	BYTE delayTimer;				// Delay Timer used by the ShiftFreq and Vibrato Commands in the Legacy RMT Instrument format, for compatibility's sake
-	BYTE finetuneOffset;			// Finetune offset, set using the ?xx Command, signed values are expected, thus $01 will add 1, and $FF will subtract 1, etc
-	TPortamento portamento;			// Instrument Portamento, taking priority over Channel Portamento
-	TPeriodic vibrato;				// Instrument Vibrato, taking priority over Channel Vibrato
-};
-
-// Channel variables used by the RMTE Module playback routines
-// Loosely inspired by FamiTracker for most of them
-struct TChannelVariables
-{
-	bool isNoteTrigger;				// Note Trigger, for new Note initialisation, the Command ~~~ will retrigger the last Note played
-	bool isNoteRelease;				// Note Release, the Command === will release the last Note played
-	bool isNoteActive;				// Note Playing, the Command OFF will stop the last Note played, and reset the Channel variables
-	bool isNoteReset;				// Note Reset, implying it is played for the first time when this flag is set
-	bool isVolumeOnlyEnabled;		// AUDC, bit 4, forcing Volume Only output in the Channel when enabled
-	BYTE note;						// Maximum set by NOTE_COUNT, currently set to 120
-	BYTE instrument;				// Maximum set by INSTRUMENT_COUNT, currently set to 64
-	BYTE volume;					// AUDC, bits 0-3, Volume level could be 0-15 inclusive
-	BYTE timbre;					// AUDC, bits 5-7, unique tones and noises generated by the POKEY Soundchip
-	BYTE audctl;					// AUDCTL, bits from all 4 POKEY Channels combined during playback
-	BYTE frameCount;				// Counter used for timing Effect Commands, including the Arpeggio Cycle, and possibly more things
-	BYTE delayOffset;				// Number of frames used to delay a Row during playback
-	TRow* delayedRow;				// Pointer to the delayed Row Index
-	BYTE arpeggioScheme;			// Arpeggio Scheme, set using the 0xy Command, cycling between channelNote, x, y, then repeat
-	TPortamento portamento;			// Channel Portamento, set using Effect Commands such as 3xy
-	TPeriodic vibrato;				// Channel Vibrato, set using Effect Commands such as 4xy
-	TPeriodic tremolo;				// Channel Tremolo, set using Effect Commands such as 7xy
-	BYTE finetuneOffset;			// Finetune offset, set using the ?xx Command, signed values are expected, thus $01 will add 1, and $FF will subtract 1, etc
-};
-
-struct TSongVariables
-{
-	TChannelVariables channel[CHANNEL_COUNT];
-	TInstrumentVariables instrument[CHANNEL_COUNT];
-};
-*/
-
-
 // Pattern Editor Cursor Column Index
 typedef enum patternCursorColumn_t : BYTE
 {
@@ -252,7 +141,7 @@ public:
 	CSong();
 	~CSong();
 
-	void ChangeTimer(int ms);
+	void StartTimer();
 	void KillTimer();
 
 	void ClearSong(int numoftracks);
@@ -262,14 +151,6 @@ public:
 	//void DeleteChannelVariables(int channel);
 	//void InitialiseChannelVariables();
 
-/*
-	void ResetChannelVariables(TChannelVariables* pVariables);
-
-	void ClearSongVariables();
-	void CreateSongVariables();
-	void DeleteSongVariables();
-*/
-
 	void ClearPokeyBuffer();
 	void CreatePokeyBuffer();
 	void DeletePokeyBuffer();
@@ -522,16 +403,20 @@ public:
 	bool ExportAsAsm(std::ofstream& ou, tExportDescription* exportStrippedDesc);
 	bool ExportAsRelocatableAsmForRmtPlayer(std::ofstream& ou, tExportDescription* exportStrippedDesc);
 
-	bool ExportSAP_R(std::ofstream& ou);
+	bool ExportSAP_R(std::ofstream& ou, LPCTSTR filename);
 	bool ExportLZSS(std::ofstream& ou, LPCTSTR filename);
 	bool ExportCompactLZSS(std::ofstream& ou, LPCTSTR filename);
 	bool ExportLZSS_SAP(std::ofstream& ou);
 	bool ExportLZSS_XEX(std::ofstream& ou);
 
-	bool ExportWav(std::ofstream& ou, LPCTSTR filename);
+	bool ExportWav(std::ofstream& ou, LPCTSTR filename, bool isStems = false);
+	bool ExportCycleProfile(std::ofstream& ou, tExportDescription* exportDesc);
+	bool ExportDriverDiff(std::ofstream& ou, tExportDescription* exportDesc);
+	bool ExportEngineValidation(std::ofstream& ou, tExportDescription* exportDesc);
+	bool ExportLzssValidation(std::ofstream& ou);
 
-	void DumpSongToPokeyBuffer(int playmode = MPLAY_START, int songline = 0, int trackline = 0);
-	int BruteforceOptimalLZSS(unsigned char* src, int srclen, unsigned char* dst);
+	bool DumpSongToPokeyBuffer(int playmode = MPLAY_START, int songline = 0, int trackline = 0);
+	int BruteforceOptimalLZSS(int firstFrame, int frameCount, std::vector<unsigned char>& dst, std::vector<int>& restartPoints, int room);
 
 	bool TestBeforeFileSave();
 	//int GetSubsongParts(CString& resultstr);
@@ -649,26 +534,9 @@ public:
 	//BOOL IsSongGo(int songline) { return IsValidSongline(songline) ? m_songgo[songline] >= 0 : 0; };
 
 
-	// Prototype C++ RMTE Module Driver functions
-
-/*
-	void PlayFrame(TSubtune* pSubtune);
-	void PlayContinue(TSubtune* pSubtune);
-	
-	void PlayInstrument(TInstrumentV2* pInstrument, TChannelVariables* pChannelVariables, TInstrumentVariables* pInstrumentVariables);
-	bool AdvanceEnvelope(TActive* pActive, TParameter* pParameter, TFlag* pFlag, bool trigger, bool release, bool& hasLooped);
-	double GetVibrato(TPeriodic* pVibrato, double pitch);
-	double GetPortamento(TPortamento* pPortamento, double pitch);
-
-	void PlayRow(TSubtune* pSubtune);
-
-	void ProcessNote(BYTE note, TChannelVariables* pVariables);
-	void ProcessInstrument(BYTE instrument, TChannelVariables* pVariables);
-	void ProcessVolume(BYTE volume, TChannelVariables* pVariables);
-	void ProcessEffect(TEffect* effect, TChannelVariables* pVariables);
-
-	void PlaybackRespectBoundaries(TSubtune* pSubtune);
-*/
+	// RMTE Module playback, using the native C++ engine
+	UINT PlayEngineFrame(TPokeyFrame* pFrames);
+	CRmteEngine* GetEngine() { return &m_engine; };
 
 	TSubtune* GetSubtune() { return g_Module.GetSubtune(m_activeSubtune); };
 	TChannel* GetChannel() { return g_Module.GetChannel(m_activeSubtune, m_activeChannel); };
@@ -809,7 +677,7 @@ private:
 	int m_songlineclipboard[SONGTRACKS];	// TODO: Delete
 	int m_songgoclipboard;					// TODO: Delete
 
-	UINT m_timerRoutine;
+	CPlaybackClock m_playbackClock;
 
 	CString m_fileName;
 	int m_fileType;
@@ -819,6 +687,8 @@ private:
 	int m_TracksOrderChange_songlineto;	  // TODO: Delete	//the last values used remain
 
 	// RMTE variables
-	//TSongVariables* m_songVariables;
+	CRmteEngine m_engine;					// Plays the RMTE Module, filling the POKEY buffer frame by frame
+	CSonglineSnapshots m_snapshots;			// Engine state at every Songline, for playing from any position without a cold start
+	std::mutex m_engineMutex;				// The engine is started and stopped by the GUI while the playback thread is using it
 	TPokeyBuffer* m_pokeyBuffer;
 };
\ No newline at end of file
@@ -0,0 +1,285 @@
+//
+// SonglineSnapshots.cpp
+// Snapshots of the RMTE engine state at every Songline boundary, so playback may resume from any position with the correct state
+//
+
+#include "stdafx.h"
+
+#include "SonglineSnapshots.h"
+#include "IOHelpers.h"
+
+CSonglineSnapshots::CSonglineSnapshots()
+{
+	m_module = NULL;
+	m_pSubtune = NULL;
+	m_subtune = 0;
+	m_checksum = 0;
+	m_isRecording = false;
+	m_isStatePending = false;
+	Invalidate();
+}
+
+/// <summary>
+/// Throw away every snapshot, they must not be used once the Module is cleared or loaded again.
+/// </summary>
+void CSonglineSnapshots::Invalidate()
+{
+	m_snapshot.clear();
+	m_isScanned = false;
+	m_isRecording = false;
+
+	for (int i = 0; i < SONGLINE_COUNT; i++)
+		m_index[i] = INVALID;
+}
+
+/// <summary>
+/// Start the engine at the given position, from the snapshot of that Songline when there is one, or after a pre-scan finding it.
+/// The beginning of the Subtune and looped Patterns are always started cold, like CRmteEngine::Start would.
+/// </summary>
+/// <param name="pEngine">Engine to start, it must be playing the same Module</param>
+/// <returns>True if the state was restored from a snapshot, false for a cold start</returns>
+bool CSonglineSnapshots::Start(CRmteEngine* pEngine, CModule* pModule, UINT subtune, UINT songline, UINT row, bool isPatternLooped)
+{
+	TSubtune* pSubtune = pModule ? pModule->GetSubtune(subtune) : NULL;
+
+	m_isRecording = false;
+
+	if (!pSubtune)
+	{
+		pEngine->Start(subtune, songline, row, isPatternLooped);
+		return false;
+	}
+
+	// Any change to the Subtune, Instrument or Envelope data may change every state that follows it
+	UINT64 checksum = GetChecksum(pModule, pSubtune);
+
+	if (pModule != m_module || pSubtune != m_pSubtune || subtune != m_subtune || checksum != m_checksum)
+	{
+		Invalidate();
+		m_module = pModule;
+		m_pSubtune = pSubtune;
+		m_subtune = subtune;
+		m_checksum = checksum;
+	}
+
+	// Positions out of bounds are reset to the beginning of the Subtune, the same way the engine does
+	if (songline >= pModule->GetSongLength(pSubtune))
+		songline = 0;
+
+	if (row >= pModule->GetPatternLength(pSubtune))
+		row = 0;
+
+	if (isPatternLooped || (songline == 0 && row == 0))
+	{
+		pEngine->Start(subtune, songline, row, isPatternLooped);
+
+		if (!isPatternLooped)
+		{
+			TRmteEngineState state;
+			pEngine->GetState(&state);
+			Record(0, 0, &state);
+			BeginRecording(pEngine, 0);
+		}
+
+		return false;
+	}
+
+	if (!IsRecorded(songline) && !m_isScanned)
+		Prescan(songline);
+
+	if (Restore(pEngine, songline, row))
+	{
+		BeginRecording(pEngine, songline);
+		return true;
+	}
+
+	pEngine->Start(subtune, songline, row, false);
+	return false;
+}
+
+/// <summary>
+/// Play 1 frame with CRmteEngine::PlayFrame, and record the state of every new Songline that was not recorded yet.
+/// </summary>
+void CSonglineSnapshots::PlayFrame(CRmteEngine* pEngine, TPokeyFrame* pFrame)
+{
+	// The state must be taken before the frame, which then plays the first Row of the Songline
+	if (m_isRecording && (m_isStatePending = pEngine->IsNewSonglineNext()))
+		pEngine->GetState(&m_pendingState);
+
+	pEngine->PlayFrame(pFrame);
+
+	if (!m_isRecording || !pEngine->IsNewSongline())
+		return;
+
+	UINT songline = pEngine->GetSongline();
+
+	// The order of the Songlines never changes, once the song loops there is nothing new to record
+	if (m_isVisited[songline])
+	{
+		m_isScanned = true;
+		m_isRecording = false;
+		return;
+	}
+
+	m_isVisited[songline] = true;
+
+	if (m_isStatePending)
+		Record(songline, pEngine->GetRow(), &m_pendingState);
+}
+
+/// <summary>
+/// Record every new Songline from now on, the engine is about to play the given Songline.
+/// </summary>
+void CSonglineSnapshots::BeginRecording(CRmteEngine* pEngine, UINT songline)
+{
+	memset(m_isVisited, 0, sizeof(m_isVisited));
+
+	// Unless the next frame begins that Songline, which will be counted by PlayFrame, it is already in progress
+	if (!pEngine->IsNewSonglineNext())
+		m_isVisited[songline] = true;
+
+	m_isStatePending = false;
+	m_isRecording = true;
+}
+
+/// <summary>
+/// Keep the state of a Songline, only the first time it is played, which is the one reached when playing from the beginning.
+/// </summary>
+void CSonglineSnapshots::Record(UINT songline, UINT row, const TRmteEngineState* pState)
+{
+	if (songline >= SONGLINE_COUNT || IsRecorded(songline))
+		return;
+
+	TSonglineSnapshot snapshot;
+	snapshot.state = *pState;
+	snapshot.songline = songline;
+	snapshot.row = row;
+
+	m_index[songline] = (int)m_snapshot.size();
+	m_snapshot.push_back(snapshot);
+}
+
+/// <summary>
+/// Restore the snapshot of a Songline, then play the frames before the Row, so the next PlayFrame plays that Row.
+/// This is at most 1 Pattern of frames, no matter how far the Songline is in the song.
+/// </summary>
+/// <returns>False if the Row is not reached from the snapshot, the engine is then stopped</returns>
+bool CSonglineSnapshots::Restore(CRmteEngine* pEngine, UINT songline, UINT row)
+{
+	if (!IsRecorded(songline))
+		return false;
+
+	TSonglineSnapshot* pSnapshot = &m_snapshot[m_index[songline]];
+
+	if (row < pSnapshot->row || !pEngine->SetState(&pSnapshot->state))
+		return false;
+
+	if (row == pSnapshot->row)
+		return true;
+
+	TRmteEngineState state;
+	TPokeyFrame frame;
+
+	// The first frame plays the first Row of the Songline, a Goto Command delayed with Gxx may still go elsewhere
+	pEngine->PlayFrame(&frame);
+
+	if (pEngine->GetSongline() == songline)
+	{
+		// The state is taken before every frame, the one before the Row is played is where playback resumes
+		for (UINT i = 0; i < ROW_COUNT * SONG_SPEED_MAX && pEngine->IsPlaying(); i++)
+		{
+			pEngine->GetState(&state);
+			pEngine->PlayFrame(&frame);
+
+			if (pEngine->IsNewSongline())
+				break;
+
+			if (pEngine->GetRow() == row)
+				return pEngine->SetState(&state);
+		}
+	}
+
+	pEngine->Stop();
+	return false;
+}
+
+/// <summary>
+/// Play the Subtune silently, with an engine of its own, until the Songline is recorded or the song loops.
+/// It continues from the last snapshot recorded, nothing is played twice.
+/// </summary>
+void CSonglineSnapshots::Prescan(UINT songline)
+{
+	CRmteEngine engine(m_module);
+	TPokeyFrame frame;
+
+	if (m_snapshot.empty())
+		Start(&engine, m_module, m_subtune);
+	else if (engine.SetState(&m_snapshot.back().state))
+		BeginRecording(&engine, m_snapshot.back().songline);
+
+	for (UINT i = 0; i < SONGLINE_SNAPSHOT_PRESCAN_FRAMES && m_isRecording && engine.IsPlaying() && !IsRecorded(songline); i++)
+		PlayFrame(&engine, &frame);
+
+	// A Songline that could not be reached is not worth another pre-scan
+	if (!IsRecorded(songline))
+		m_isScanned = true;
+
+	m_isRecording = false;
+}
+
+/// <summary>
+/// Checksum of everything the playback depends on: the Subtune parameters, its Songlines, the Patterns they use,
+/// and every Instrument and Envelope. Only the Rows and Envelope steps in use are included, so it is quick enough for every Start.
+/// </summary>
+UINT64 CSonglineSnapshots::GetChecksum(CModule* pModule, TSubtune* pSubtune)
+{
+	UINT64 hash = FNV1A_OFFSET_BASIS;
+	UINT songLength = pModule->GetSongLength(pSubtune);
+	UINT patternLength = pModule->GetPatternLength(pSubtune);
+	UINT channelCount = pModule->GetChannelCount(pSubtune);
+
+	hash = FNV1a(&pSubtune->parameter, sizeof(TSubtuneParameter), hash);
+
+	for (UINT i = 0; i < channelCount; i++)
+	{
+		TChannel* pChannel = pModule->GetChannel(pSubtune, i);
+		bool isHashed[PATTERN_COUNT] = {};
+
+		hash = FNV1a(&pChannel->parameter, sizeof(TChannelParameter), hash);
+		hash = FNV1a(pChannel->songline, songLength, hash);
+
+		for (UINT j = 0; j < songLength; j++)
+		{
+			BYTE pattern = pChannel->songline[j];
+
+			if (isHashed[pattern])
+				continue;
+
+			isHashed[pattern] = true;
+			hash = FNV1a(pChannel->pattern[pattern].row, patternLength * sizeof(TRow), hash);
+		}
+	}
+
+	for (UINT i = 0; i < INSTRUMENT_COUNT; i++)
+	{
+		if (TInstrumentV2* pInstrument = pModule->GetInstrument(i))
+		{
+			hash = FNV1a(&pInstrument->parameter, sizeof(TInstrumentParameter), hash);
+			hash = FNV1a(pInstrument->envelope, sizeof(pInstrument->envelope), hash);
+		}
+	}
+
+	for (UINT type = 0; type < ET_COUNT; type++)
+	{
+		for (UINT i = 0; i < ENVELOPE_COUNT; i++)
+		{
+			if (TEnvelope* pEnvelope = pModule->GetEnvelope(i, type))
+			{
+				hash = FNV1a(&pEnvelope->parameter, sizeof(TEnvelopeParameter), hash);
+				hash = FNV1a(pEnvelope->rawData, pModule->GetEnvelopeLength(pEnvelope) * sizeof(UINT), hash);
+			}
+		}
+	}
+
+	return hash;
+}
@@ -0,0 +1,59 @@
+//
+// SonglineSnapshots.h header file
+// Snapshots of the RMTE engine state at every Songline boundary, so playback may resume from any position with the correct state
+// A cold start in the middle of a song loses everything the Instruments and Effect Commands were doing up to that point
+//
+
+#pragma once
+
+#include <vector>
+
+#include "RmteEngine.h"
+
+#define SONGLINE_SNAPSHOT_PRESCAN_FRAMES	(50 * 60 * 30)		// 30 minutes of PAL frames, a song that does not reach its Songline by then never will
+
+typedef struct
+{
+	TRmteEngineState state;		// Taken just before the frame playing the first Row of the Songline
+	UINT songline;
+	UINT row;					// First Row played in the Songline, not 0 after a Dxx Command
+} TSonglineSnapshot;
+
+/// <summary>
+/// Records the engine state at every new Songline, while playing from the beginning of a Subtune, or during a pre-scan when none exists yet.
+/// Start then restores the nearest snapshot and only plays the few frames left before the Row asked for, whatever the length of the song is.
+/// The snapshots are thrown away as soon as the Subtune data they depend on is changed.
+/// </summary>
+class CSonglineSnapshots
+{
+public:
+	CSonglineSnapshots();
+
+	void Invalidate();
+
+	bool Start(CRmteEngine* pEngine, CModule* pModule, UINT subtune, UINT songline = 0, UINT row = 0, bool isPatternLooped = false);
+	void PlayFrame(CRmteEngine* pEngine, TPokeyFrame* pFrame);
+
+	bool IsRecorded(UINT songline) { return songline < SONGLINE_COUNT && m_index[songline] != INVALID; };
+	UINT GetCount() { return (UINT)m_snapshot.size(); };
+
+private:
+	CModule* m_module;
+	TSubtune* m_pSubtune;
+	UINT m_subtune;
+	UINT64 m_checksum;				// Subtune, Instrument and Envelope data the snapshots were taken from
+	bool m_isScanned;				// Every reachable Songline was recorded, a missing one is never played from the beginning
+	bool m_isRecording;				// The engine is playing from the beginning of the Subtune, or from a restored snapshot
+	bool m_isStatePending;			// m_pendingState was taken before a frame expected to begin a new Songline
+	TRmteEngineState m_pendingState;
+	bool m_isVisited[SONGLINE_COUNT];	// Songlines played since recording began, playing one twice means the song is looping
+
+	std::vector<TSonglineSnapshot> m_snapshot;
+	int m_index[SONGLINE_COUNT];	// Index in m_snapshot for every Songline, INVALID if it was not recorded
+
+	void BeginRecording(CRmteEngine* pEngine, UINT songline);
+	void Record(UINT songline, UINT row, const TRmteEngineState* pState);
+	bool Restore(CRmteEngine* pEngine, UINT songline, UINT row);
+	void Prescan(UINT songline);
+	UINT64 GetChecksum(CModule* pModule, TSubtune* pSubtune);
+};
@@ -0,0 +1,123 @@
+//
+// WorkerPool.cpp
+// Small pool of persistent threads, running a batch of independent jobs and waiting for all of them
+//
+
+#include "WorkerPool.h"
+
+CWorkerPool::CWorkerPool()
+{
+	m_job = NULL;
+	m_jobCount = 0;
+	m_nextJob = 0;
+	m_pendingJobs = 0;
+	m_batch = 0;
+	m_isStopping = false;
+}
+
+CWorkerPool::~CWorkerPool()
+{
+	Stop();
+}
+
+/// <summary>
+/// Create the worker threads, if they are not running already.
+/// </summary>
+/// <param name="threads">Number of threads, not counting the thread calling Run</param>
+void CWorkerPool::Start(int threads)
+{
+	if (!m_threads.empty())
+		return;
+
+	m_isStopping = false;
+
+	for (int i = 0; i < threads; i++)
+		m_threads.push_back(std::thread(&CWorkerPool::Loop, this));
+}
+
+void CWorkerPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isStopping = true;
+	}
+
+	m_wake.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+
+	m_threads.clear();
+}
+
+/// <summary>
+/// Call job(0) to job(jobs - 1), spread over the worker threads and the calling thread.
+/// Only returns once every job of the batch is finished.
+/// </summary>
+/// <param name="jobs">Number of jobs in the batch</param>
+/// <param name="job">Procedure running 1 job, it must be safe to call from several threads at once</param>
+void CWorkerPool::Run(int jobs, const WORKER_JOB_PROC& job)
+{
+	// Without any worker, or with nothing to share, there is no point in waking anyone up
+	if (m_threads.empty() || jobs <= 1)
+	{
+		for (int i = 0; i < jobs; i++)
+			job(i);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_job = &job;
+	m_jobCount = jobs;
+	m_nextJob = 0;
+	m_pendingJobs = jobs;
+	m_batch++;
+	m_wake.notify_all();
+
+	while (RunNextJob(lock))
+		;
+
+	m_done.wait(lock, [this] { return m_pendingJobs == 0; });
+	m_job = NULL;
+}
+
+/// <summary>
+/// Take the next job of the current batch and run it outside of the lock.
+/// </summary>
+/// <returns>false if every job of the batch was already taken</returns>
+bool CWorkerPool::RunNextJob(std::unique_lock<std::mutex>& lock)
+{
+	if (!m_job || m_nextJob >= m_jobCount)
+		return false;
+
+	int index = m_nextJob++;
+	const WORKER_JOB_PROC* job = m_job;
+
+	lock.unlock();
+	(*job)(index);
+	lock.lock();
+
+	if (--m_pendingJobs == 0)
+		m_done.notify_all();
+
+	return true;
+}
+
+void CWorkerPool::Loop()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	unsigned int batch = m_batch;
+
+	while (true)
+	{
+		m_wake.wait(lock, [this, batch] { return m_isStopping || m_batch != batch; });
+
+		if (m_isStopping)
+			return;
+
+		batch = m_batch;
+
+		while (RunNextJob(lock))
+			;
+	}
+}
@@ -0,0 +1,50 @@
+//
+// WorkerPool.h header file
+// Small pool of persistent threads, running a batch of independent jobs and waiting for all of them
+// This code does not depend on MFC or Windows, so it could also be used for headless rendering
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(int)> WORKER_JOB_PROC;
+
+/// <summary>
+/// The jobs of a batch are handed out one by one, the calling thread takes its share too,
+/// so a batch of N jobs needs at most N - 1 worker threads to run entirely in parallel.
+/// The threads are only created once, and sleep between the batches.
+/// </summary>
+class CWorkerPool
+{
+public:
+	CWorkerPool();
+	~CWorkerPool();
+
+	void Start(int threads);
+	void Stop();
+	void Run(int jobs, const WORKER_JOB_PROC& job);
+
+	int GetThreadCount() { return (int)m_threads.size(); };
+
+private:
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	// Current batch, all of these are protected by m_mutex
+	const WORKER_JOB_PROC* m_job;
+	int m_jobCount;
+	int m_nextJob;
+	int m_pendingJobs;
+	unsigned int m_batch;
+	bool m_isStopping;
+
+	void Loop();
+	bool RunNextJob(std::unique_lock<std::mutex>& lock);
+};
@@ -1,6 +1,5 @@
 // Original code by Raster, 2002-2009
 // Experimental changes and additions by VinsCool, 2021-2023
-// TODO: Replace the plugin interface with a permanent emulation core
 // FIXME: Use a better backend (DirectSound is outdated...)
 
 #include "stdafx.h"
@@ -11,6 +10,10 @@
 #include "global.h"
 #include "ChannelControl.h"
 #include "PokeyStream.h"
+#include "PokeyEmu.h"
+#include "RmteEngine.h"
+
+#include <chrono>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -18,62 +21,48 @@
 static char THIS_FILE[] = __FILE__;
 #endif
 
-typedef enum 
-{
-	ASAP_FORMAT_U8 = 8,       /* unsigned char */
-	ASAP_FORMAT_S16_LE = 16,  /* signed short, little-endian */
-	ASAP_FORMAT_S16_BE = -16  /* signed short, big-endian */
-} ASAP_SampleFormat;
-
 typedef enum
 {
 	SOUND_DRIVER_NONE,
-	SOUND_DRIVER_APOKEYSND,
-	SOUND_DRIVER_SA_POKEY
+	SOUND_DRIVER_NATIVE
 } POKEY_SoundDriver;
 
-typedef int abool;
-
-typedef void (* APokeySound_Initialize_PROC)(abool stereo);
-typedef void (* APokeySound_PutByte_PROC)(int addr, int data);
-typedef int  (* APokeySound_GetRandom_PROC)(int addr, int cycle);
-typedef int  (* APokeySound_Generate_PROC)(int cycles, byte buffer[], ASAP_SampleFormat format);
-typedef void (* APokeySound_About_PROC)(const char **name, const char **author, const char **description);
-
-APokeySound_Initialize_PROC APokeySound_Initialize;
-APokeySound_PutByte_PROC APokeySound_PutByte;
-APokeySound_GetRandom_PROC APokeySound_GetRandom;	// Unused?
-APokeySound_Generate_PROC APokeySound_Generate;
-APokeySound_About_PROC APokeySound_About;
-
-typedef void (* Pokey_Initialise_PROC)(int*, char**);
-typedef void (* Pokey_SoundInit_PROC)(DWORD, WORD, BYTE);
-typedef void (* Pokey_Process_PROC)(BYTE*, const WORD);
-typedef BYTE (* Pokey_GetByte_PROC)(WORD);
-typedef void (* Pokey_PutByte_PROC)(WORD, BYTE);
-typedef void (* Pokey_About_PROC)(char**, char**, char**);
-
-Pokey_Initialise_PROC Pokey_Initialise;
-Pokey_SoundInit_PROC Pokey_SoundInit;
-Pokey_Process_PROC Pokey_Process;
-Pokey_GetByte_PROC Pokey_GetByte;	// Unused?
-Pokey_PutByte_PROC Pokey_PutByte;
-Pokey_About_PROC Pokey_About;
-
-// Needed for proper Machine Region and Stereo detection with POKEY plugins
+// Needed for proper Machine Region and Stereo detection with the POKEY emulation
 int numTracksSetOnDriver = g_tracks4_8;
 int ntscRegionSetOnDriver = g_ntsc;
 
-static LPDIRECTSOUND          g_lpds;
-static LPDIRECTSOUNDBUFFER    g_lpdsbPrimary;
-
 extern CPokeyStream g_PokeyStream;
+extern CSong g_Song;
+
+/// <summary>
+/// Number of channels the POKEY emulation has to play: every channel of the active subtune, up to 4 POKEY,
+/// and never less than the legacy Mono or Stereo setup.
+/// </summary>
+static int GetEmulatedChannelCount()
+{
+	TSubtune* pSubtune = g_Song.GetSubtune();
+	int channels = pSubtune ? (int)g_Module.GetChannelCount(pSubtune) : 0;
+
+	return (channels > g_tracks4_8) ? channels : g_tracks4_8;
+}
 
 CXPokey::CXPokey()
 {
 	m_soundDriverId = SOUND_DRIVER_NONE;
-	m_pokey_dll = NULL;
-	m_SoundBuffer = NULL;
+	m_atari = &g_atari;
+	m_sink = NULL;
+	m_isSinkRunning = false;
+	m_renderSpeed = 0;
+	m_renderedTime = 0;
+	m_renderWallTime = 0;
+	m_renderTime = 0;
+	m_frameRenderTime = 0;
+	m_overrunCount = 0;
+	m_isStems = false;
+	m_chipCount = 1;
+	memset(m_chipSamples, 0, sizeof(m_chipSamples));
+	memset(m_chipRenderTime, 0, sizeof(m_chipRenderTime));
+	m_ring.Create(BUFFER_SIZE / sizeof(int16_t));
 }
 
 CXPokey::~CXPokey()
@@ -83,27 +72,13 @@ CXPokey::~CXPokey()
 
 BOOL CXPokey::DeInitSound()
 {
+	SetSink(NULL);
+	m_directSound.Close();
+	m_workers.Stop();
+
 	m_soundDriverId = SOUND_DRIVER_NONE;
-	if (m_pokey_dll)
-	{
-		FreeLibrary(m_pokey_dll);
-		m_pokey_dll = NULL;
-	}
 	g_aboutpokey = "No Pokey sound emulation.";
 
-	if (m_SoundBuffer)
-	{
-		m_SoundBuffer->Stop();
-		m_SoundBuffer->Release();
-	}
-	m_SoundBuffer = NULL;
-
-	if (g_lpdsbPrimary) g_lpdsbPrimary->Release();
-	g_lpdsbPrimary = NULL;
-
-	if (g_lpds) g_lpds->Release();
-	g_lpds = NULL;
-
 	return 1;
 }
 
@@ -113,289 +88,200 @@ BOOL CXPokey::ReInitSound()
 	return InitSound();
 }
 
-BOOL CXPokey::RenderSound1_50(int instrspeed)
+/// <summary>
+/// Replace the audio output draining the rendered sound.
+/// Real time sinks get their own thread, the others are drained after every rendered frame.
+/// </summary>
+/// <param name="sink">The new audio output, NULL stops the output entirely</param>
+void CXPokey::SetSink(CAudioSink* sink)
 {
-	if (!m_soundDriverId) return 0;
-	if (!m_SoundBuffer) return 0;
-
-	m_SoundBuffer->GetCurrentPosition(&m_PlayCursor, &m_WriteCursor);
-
-	//|||||||||||||||||||||||||||||||||||||||||
-	//           ^|-------delta------->^
-	//      m_WriteCursor           m_LoadPos
+	// Stop the consumer thread first, nothing may read from the ring buffer while it is cleared
+	if (m_isSinkRunning)
+	{
+		m_isSinkRunning = false;
+		m_sinkThread.join();
+	}
 
-	int delta = (m_LoadPos - m_WriteCursor) & (BUFFER_SIZE - 1);
+	m_sink = sink;
+	m_ring.Clear();
 
-	m_LoadSize = CHUNK_SIZE;	//1764  (882 samples * 2 channels)
-	if (delta > LATENCY_SIZE)
+	if (m_sink && m_sink->IsRealTime())
 	{
-		if (delta > (BUFFER_SIZE / 2))
-		{
-			//we missed it, we're more than half a buffer late, so get to it and move on to what we should be right
-			m_LoadPos = (m_WriteCursor + LATENCY_SIZE) & (BUFFER_SIZE - 1);
-		}
-		else
-		{
-			//we ran too far ahead so we slow down a bit (we will render smaller pieces than CHUNK_SIZE)
-			m_LoadSize = CHUNK_SIZE - (((delta - LATENCY_SIZE) / 16) & (BUFFER_SIZE - 1 - 1));	//-1-1 <=Just the numbers!
-			//watched
-			if (m_LoadSize <= 0) return 0; //we are so far ahead that it will not render at all
-		}
+		m_isSinkRunning = true;
+		m_sinkThread = std::thread(&CXPokey::SinkThread, this);
 	}
-	else // delta <=LATENCY_SIZE
-	{
-		//we are closer than the required latency, that's great, but we'd rather speed up so that m_WriteCursor doesn't catch up with us (we'll render bigger chunks than CHUNK_SIZE)
-		m_LoadSize = CHUNK_SIZE + (((LATENCY_SIZE - delta) / 16) & (BUFFER_SIZE - 1 - 1));	//-1-1 <=Just the numbers!
+}
 
-		//watched
-		if (m_LoadSize >= BUFFER_SIZE / 2) return 0; //that would be a bigger piece than the size of a buffer pulse
+/// <summary>
+/// Consumer side of the ring buffer, for real time sinks only.
+/// </summary>
+void CXPokey::SinkThread()
+{
+	while (m_isSinkRunning)
+	{
+		m_sink->Consume(m_ring);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
 	}
+}
 
-	int rendersize = m_LoadSize;
-	int renderpartsize = 0;
-	int renderoffset = 0;
+/// <summary>
+/// Producer side of the ring buffer, hand over one rendered frame from m_PlayBuffer.
+/// Real time sinks get their latency adjusted once per frame, from the underruns they reported.
+/// </summary>
+/// <param name="size">Size of the frame, in bytes</param>
+void CXPokey::SubmitFrame(int size)
+{
+	int count = size / sizeof(int16_t);
 
-	//--- RMT - instrument play ---/
-	for (; instrspeed > 0; instrspeed--)
-	{
-		// One play of RMT routine (instruments)
-		if (g_rmtroutine)
-			Atari_PlayRMT();
+	if (m_ring.Write((int16_t*)m_PlayBuffer, count) < count)
+		m_overrunCount++;
 
-		// Transfer from g_atarimem to POKEY (mono or stereo)
-		MemToPokey();
+	m_renderTime = m_frameRenderTime * 1000;
+	m_frameRenderTime = 0;
 
-		renderpartsize = (rendersize / instrspeed) & 0xfffe;	//just the numbers
+	if (m_sink->IsRealTime())
+	{
+		m_latency.Update(m_sink->GetUnderrunCount());
+		m_sink->SetLatency(m_latency.GetLatency());
+	}
+	else
+		m_sink->Consume(m_ring);
+}
 
-		switch (m_soundDriverId)
-		{
-		case SOUND_DRIVER_APOKEYSND:	// FIXME: Mono POKEY sound generation is broken, currently the reason for this is unclear...
-			{
-				int cycles = (unsigned short)((float)renderpartsize / CHANNELS * CYCLESPERSAMPLE);
-				while (cycles > 0 && renderpartsize > 0)
-				{
-					// The maximum number of cycles that can be generated is CYCLESPERSCREEN
-					int rencyc = (cycles > CYCLESPERSCREEN) ? (int)CYCLESPERSCREEN : cycles;
-					renderpartsize = APokeySound_Generate(rencyc, (unsigned char*)&m_PlayBuffer + renderoffset, ASAP_FORMAT_U8);
-					rendersize -= renderpartsize;
-					renderoffset += renderpartsize;
-					cycles -= rencyc;
-				}
-			}
-			break;
+/// <summary>
+/// Check if 1 more frame should be rendered into the ring buffer.
+/// Real time playback only renders once the sink took almost everything, the sink itself holds
+/// the adaptive latency, so the sound card clock is what sets the playback speed.
+/// </summary>
+bool CXPokey::IsFrameNeeded()
+{
+	if (!m_soundDriverId || !m_sink)
+		return false;
 
-		case SOUND_DRIVER_SA_POKEY:
-			Pokey_Process((unsigned char*)&m_PlayBuffer + renderoffset, (unsigned short)renderpartsize);
-			rendersize -= renderpartsize;
-			renderoffset += renderpartsize;
-			break;
-		}
-	}
+	if (m_sink->IsRealTime())
+		return m_ring.GetAvailable() < LATENCY_MIN * CHANNELS;
 
-	if (!m_SoundBuffer) return 0;	// Should help preventing crashes from reading NULL pointer when data is read faster than it could be processed
+	return (int)(m_ring.GetAvailable() * sizeof(int16_t)) + CHUNK_SIZE + BLOCK_ALIGN <= BUFFER_SIZE;
+}
 
-	m_LoadSize = renderoffset; // Actually generated sample data
+int CXPokey::GetUnderrunCount()
+{
+	return m_sink ? m_sink->GetUnderrunCount() : 0;
+}
 
-	int r = m_SoundBuffer->Lock(m_LoadPos, m_LoadSize, &Data1, &dwSize1, &Data2, &dwSize2, 0);
+BOOL CXPokey::RenderSound1_50(int instrspeed)
+{
+	// We ran too far ahead, the sink did not take the previous frames yet
+	if (!IsFrameNeeded())
+		return 0;
 
-	if (r == DS_OK)
-	{
-		// Render the whole m_LoadSize into the buffer at once
-		m_LoadPos = (m_LoadPos + m_LoadSize) & (BUFFER_SIZE - 1);
+	int framesize = m_frameCycles.Next();	//35468 cycles on PAL, the remainder is carried over to the next frame
+	int rendersize = framesize;
+	int renderpartsize = 0;
+	int renderoffset = 0;
 
-		// Transfer the first bit from the buffer to Data1
-		memcpy(Data1, m_PlayBuffer, dwSize1);
+	//--- RMT - instrument play ---/
+	for (instrspeed = (instrspeed < 1) ? 1 : instrspeed; instrspeed > 0; instrspeed--)
+	{
+		// One play of RMT routine (instruments), the test modes leave only SetPokey running
+		if (g_rmtroutine && g_is6502)
+			m_atari->PlayRMT(g_prove < PROVE_EDIT_AND_JAM_MODES);
 
-		if (Data2)
-		{
-			// If it is divided, now transfer the remaining bits
-			memcpy(Data2, m_PlayBuffer + dwSize1, dwSize2);
-		}
-		m_SoundBuffer->Unlock(Data1, dwSize1, Data2, dwSize2);
+		// Transfer from the emulated memory to POKEY (mono or stereo), at the exact cycle this play happens
+		MemToPokey(renderoffset);
 
-		return 1;
+		renderpartsize = rendersize / instrspeed;	//in cycles
+		renderoffset += renderpartsize;
+		rendersize -= renderpartsize;
 	}
 
-	return 0;
+	// The whole frame is rendered at once, every queued write lands on its own cycle
+	SubmitFrame(RenderPokey(m_PlayBuffer, framesize));
+
+	return 1;
 }
 
 // Initial WAV recorder process
-// NOTE: This does NOT work with the Altirra plugin due to it hijacking the soundbuffer with its own thing...
 void CXPokey::RenderSoundV2(int instrspeed, BYTE* buffer, int& length)
 {
-	int rendersize = CHUNK_SIZE;
+	int framesize = m_frameCycles.Next();
+	int rendersize = framesize;
 	int renderpartsize = 0;
 	int renderoffset = 0;
 
-	for (; instrspeed > 0; instrspeed--)
+	for (instrspeed = (instrspeed < 1) ? 1 : instrspeed; instrspeed > 0; instrspeed--)
 	{
-		Atari_SetPokey();
-		MemToPokey();
-		renderpartsize = (rendersize / instrspeed) & 0xfffe;
-
-		switch (m_soundDriverId)
-		{
-		case SOUND_DRIVER_SA_POKEY:
-			Pokey_Process(buffer + renderoffset, (unsigned short)renderpartsize);
-			rendersize -= renderpartsize;
-			renderoffset += renderpartsize;
-			break;
-		}
+		if (g_is6502)
+			m_atari->SetPokey();
+		MemToPokey(renderoffset);
+		renderpartsize = rendersize / instrspeed;
+		renderoffset += renderpartsize;
+		rendersize -= renderpartsize;
 	}
 
 	// Copy the actually generated sample data to buffer
-	length = renderoffset;
+	length = RenderPokey(buffer, framesize);
 }
 
-void CXPokey::RenderSound_No6502(int instrspeed)
+/// <summary>
+/// Render 1 frame, split into as many parts as the Instrument Speed.
+/// If frames are given, their registers are written to the POKEY memory instead of running RMT_SETPOKEY.
+/// </summary>
+void CXPokey::RenderSound_No6502(int instrspeed, const TPokeyFrame* frames)
 {
-	if (!m_soundDriverId || !m_SoundBuffer)
+	if (!IsFrameNeeded())
 		return;
 
-	m_SoundBuffer->GetCurrentPosition(&m_PlayCursor, &m_WriteCursor);
-
-	int delta = (m_LoadPos - m_WriteCursor) & (BUFFER_SIZE - 1);
-
-	m_LoadSize = CHUNK_SIZE;
-
-	if (delta > LATENCY_SIZE)
-	{
-		if (delta > (BUFFER_SIZE / 2))
-			m_LoadPos = (m_WriteCursor + LATENCY_SIZE) & (BUFFER_SIZE - 1);
-		else
-		{
-			m_LoadSize = CHUNK_SIZE - (((delta - LATENCY_SIZE) / 16) & (BUFFER_SIZE - 1 - 1));
-			if (m_LoadSize <= 0)
-				return;
-		}
-	}
-	else
-	{
-		m_LoadSize = CHUNK_SIZE + (((LATENCY_SIZE - delta) / 16) & (BUFFER_SIZE - 1 - 1));
-		if (m_LoadSize >= BUFFER_SIZE / 2)
-			return;
-	}
-
-	int rendersize = m_LoadSize;
+	int framesize = m_frameCycles.Next();
+	int rendersize = framesize;
 	int renderpartsize = 0;
 	int renderoffset = 0;
 
-	for (; instrspeed > 0; instrspeed--)
+	for (instrspeed = (instrspeed < 1) ? 1 : instrspeed; instrspeed > 0; instrspeed--)
 	{
-		Atari_SetPokey();
-		MemToPokey();
-		renderpartsize = (rendersize / instrspeed) & 0xfffe;
-
-		switch (m_soundDriverId)
-		{
-		case SOUND_DRIVER_SA_POKEY:
-			Pokey_Process(&m_PlayBuffer[renderoffset], renderpartsize);
-			rendersize -= renderpartsize;
-			renderoffset += renderpartsize;
-			break;
-		}
+		if (frames)
+			CRmteEngine::WriteToMemory(frames++, m_atari->GetMemory());
+		else if (g_is6502)
+			m_atari->SetPokey();
+		MemToPokey(renderoffset);
+		renderpartsize = rendersize / instrspeed;
+		renderoffset += renderpartsize;
+		rendersize -= renderpartsize;
 	}
 
-	if (!m_SoundBuffer)
-		return;
-
-	m_LoadSize = renderoffset;
-
-	if (m_SoundBuffer->Lock(m_LoadPos, m_LoadSize, &Data1, &dwSize1, &Data2, &dwSize2, 0) == DS_OK)
-	{
-		m_LoadPos = (m_LoadPos + m_LoadSize) & (BUFFER_SIZE - 1);
-		memcpy(Data1, m_PlayBuffer, dwSize1);
-
-		if (Data2)
-			memcpy(Data2, m_PlayBuffer + dwSize1, dwSize2);
-
-		m_SoundBuffer->Unlock(Data1, dwSize1, Data2, dwSize2);
-	}
+	SubmitFrame(RenderPokey(m_PlayBuffer, framesize));
 }
 
 BOOL CXPokey::InitSound()
 {
-	if (m_soundDriverId || m_pokey_dll) DeInitSound();	// Just in case, everything must be cleared before initialising
+	if (m_soundDriverId) DeInitSound();	// Just in case, everything must be cleared before initialising
 
-	if (DirectSoundCreate(NULL, &g_lpds, NULL) != DS_OK)
-	{
-		MessageBox(g_hwnd, "Error: DirectSoundCreate", "DirectSound Error!", MB_OK | MB_ICONSTOP);
-		return FALSE;
-	}
-
-	// Set cooperative level
-	if (g_lpds->SetCooperativeLevel(AfxGetApp()->GetMainWnd()->m_hWnd, DSSCL_PRIORITY) != DS_OK)
-	{
-		MessageBox(g_hwnd, "Error: SetCooperativeLevel", "DirectSound Error!", MB_OK | MB_ICONSTOP);
-		return FALSE;
-	}
-
-	// Set the emulated Machine Region and if Stereo is used
-	numTracksSetOnDriver = g_tracks4_8;
+	// Set the emulated Machine Region and the number of POKEY used
+	numTracksSetOnDriver = GetEmulatedChannelCount();
 	ntscRegionSetOnDriver = g_ntsc;
+	m_atari->SetNtsc(g_ntsc);
 
 	// Set primary buffer format
 	ZeroMemory(&m_SoundFormat, sizeof(WAVEFORMATEX));
 	m_SoundFormat.wFormatTag = WAVE_FORMAT_PCM;
 	m_SoundFormat.nChannels = CHANNELS;			//2
 	m_SoundFormat.nSamplesPerSec = OUTPUTFREQ;	//44100
-	m_SoundFormat.wBitsPerSample = BITRESOLUTION;	//8 
+	m_SoundFormat.wBitsPerSample = BITRESOLUTION;	//16
 	m_SoundFormat.nBlockAlign = m_SoundFormat.wBitsPerSample / 8 * m_SoundFormat.nChannels;
 	m_SoundFormat.nAvgBytesPerSec = m_SoundFormat.nSamplesPerSec * m_SoundFormat.nBlockAlign;
 	m_SoundFormat.cbSize = 0;
 
-	// Create primary buffer.
-	ZeroMemory(&dsbdesc, sizeof(DSBUFFERDESC));
-	dsbdesc.dwSize = sizeof(DSBUFFERDESC);
-	dsbdesc.dwFlags = DSBCAPS_PRIMARYBUFFER;
-
-	if (g_lpds->CreateSoundBuffer(&dsbdesc, &g_lpdsbPrimary, NULL) != DS_OK)
-	{
-		MessageBox(g_hwnd, "Error: CreatePrimarySoundBuffer", "DirectSound Error!", MB_OK | MB_ICONSTOP);
-		return FALSE;
-	}
-
-	if (g_lpdsbPrimary->SetFormat(&m_SoundFormat) != DS_OK)
-	{
-		MessageBox(g_hwnd, "Error: SetFormat", "DirectSound Error!", MB_OK | MB_ICONSTOP);
+	if (!m_directSound.Open(&m_SoundFormat, BUFFER_SIZE, LATENCY_SIZE))
 		return FALSE;
-	}
 
-	ZeroMemory(&dsbdesc, sizeof(DSBUFFERDESC));
-	dsbdesc.dwSize = sizeof(DSBUFFERDESC);
-	dsbdesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_LOCHARDWARE | DSBCAPS_GLOBALFOCUS | DSBCAPS_STICKYFOCUS;
-	dsbdesc.dwBufferBytes = BUFFER_SIZE;
-	dsbdesc.lpwfxFormat = &m_SoundFormat;
+	// Start from the default latency, and let it adapt from there
+	m_latency.SetLimits(OUTPUTFREQ, LATENCY_MIN, LATENCY_MAX);
+	m_latency.Reset(LATENCY_SIZE / BLOCK_ALIGN);
+	m_overrunCount = 0;
 
-	if (g_nohwsoundbuffer ||
-		g_lpds->CreateSoundBuffer(&dsbdesc, &m_SoundBuffer, NULL) != DS_OK)
-	{
-		dsbdesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_LOCSOFTWARE | DSBCAPS_GLOBALFOCUS | DSBCAPS_STICKYFOCUS;
-		if (g_lpds->CreateSoundBuffer(&dsbdesc, &m_SoundBuffer, NULL) != DS_OK)
-		{
-			MessageBox(g_hwnd, "Error: CreateSoundBuffer", "DirectSound Error!", MB_OK | MB_ICONSTOP);
-			return FALSE;
-		}
-	}
-
-	DSBCAPS bc;
-	bc.dwSize = sizeof(bc);
-	m_SoundBuffer->GetCaps(&bc);
-
-	int r = m_SoundBuffer->Lock(0, BUFFER_SIZE, &Data1, &dwSize1, &Data2, &dwSize2, DSBLOCK_FROMWRITECURSOR);
-	if (r == DS_OK)
-	{
-		memset(Data1, 0x80, dwSize1);
-		if (Data2) memset(Data2, 0x80, dwSize2);
-		m_SoundBuffer->Unlock(Data1, dwSize1, Data2, dwSize2);
-	}
-
-	m_SoundBuffer->Play(0, 0, DSBPLAY_LOOPING);
-	m_SoundBuffer->GetCurrentPosition(&m_PlayCursor, &m_WriteCursorStart);
-	m_LoadPos = (m_WriteCursorStart + LATENCY_SIZE) & (BUFFER_SIZE - 1);  //initial latency (in hundredths of a second)
-
-	// Initialise the POKEY emulation plugin once the sound interface is ready
-	m_soundDriverId = InitPokeyDll();
+	// Initialise the POKEY emulation once the sound interface is ready
+	m_soundDriverId = InitPokeyEmulation();
+	SetSink(&m_directSound);
 
 	return 1;
 }
@@ -404,131 +290,176 @@ BOOL CXPokey::InitSound()
 /// Transfer 9 Pokey registers values into the sound driver.
 /// Mono: D200-D208
 /// Stereo: D200-D208 and D210-D218
+/// Up to 4 POKEY: D220-D228 and D230-D238 for the 3rd and 4th ones
+/// The writes are queued, and only take effect at the given cycle of the next RenderPokey call.
 /// </summary>
-void CXPokey::MemToPokey()
+/// <param name="cycle">Cycle offset from the start of the next RenderPokey call</param>
+void CXPokey::MemToPokey(int cycle)
 {
-	// If the variabes no longer match the last known parameters, the POKEY plugins must be re-initialised first
-	bool resetPokey = false;
-	if (numTracksSetOnDriver != g_tracks4_8 || ntscRegionSetOnDriver != g_ntsc)
+	if (!m_soundDriverId)
+		return;
+
+	// If the variabes no longer match the last known parameters, the POKEY emulation must be re-initialised first
+	if (numTracksSetOnDriver != GetEmulatedChannelCount() || ntscRegionSetOnDriver != g_ntsc)
 	{
-		numTracksSetOnDriver = g_tracks4_8;
+		numTracksSetOnDriver = GetEmulatedChannelCount();
 		ntscRegionSetOnDriver = g_ntsc;
-		resetPokey = true;
-		//ReInitSound();
-		//return;
+		m_atari->SetNtsc(g_ntsc);
+		InitPokeyEmulation();
 	}
 
-	// Check for which POKEY plugin to use, and process whichever is currently active
-	switch (m_soundDriverId)
+	unsigned char* memory = m_atari->GetMemory();
+
+	for (int chip = 0; chip < m_chipCount; chip++)
 	{
-	case SOUND_DRIVER_APOKEYSND:
-		if (resetPokey) 
-			APokeySound_Initialize(g_tracks4_8 == 8);
-		for (int i = 0; i <= 8; i++)	// 0-7 + 8 (AUDCTL)
-		{
-			APokeySound_PutByte(i, (i & 0x01) && !GetChannelOnOff(i / 2) ? 0 : g_atarimem[0xd200 + i]);
-			if (numTracksSetOnDriver == 8)
-				APokeySound_PutByte(i + 16, (i & 0x01) && !GetChannelOnOff(i / 2 + 4) ? 0 : g_atarimem[0xd210 + i]);	// Stereo
-		}
-		break;
+		int base = 0xd200 + chip * 0x10;
 
-	case SOUND_DRIVER_SA_POKEY:
-		if (resetPokey) 
-			Pokey_SoundInit((DWORD)FREQ_17, OUTPUTFREQ, (g_tracks4_8 == 8) + 1);
 		for (int i = 0; i <= 8; i++)	// 0-7 + 8 (AUDCTL)
 		{
-			Pokey_PutByte(i, (i & 0x01) && !GetChannelOnOff(i / 2) ? 0 : g_atarimem[0xd200 + i]);
-			if (numTracksSetOnDriver == 8)
-				Pokey_PutByte(i + 16, (i & 0x01) && !GetChannelOnOff(i / 2 + 4) ? 0 : g_atarimem[0xd210 + i]);		// Stereo
+			// Only the channels known to the tracker can be muted
+			int channel = chip * POKEY_CHANNELS + i / 2;
+			bool isMuted = (i & 0x01) && channel < SONGTRACKS && !GetChannelOnOff(channel);
+			m_pokey[chip].QueueWrite(cycle, i, isMuted ? 0 : memory[base + i]);
 		}
+
 		// 15 (SKCTL)
-		Pokey_PutByte(0x0F, g_atarimem[0xd20F]);
-		if (numTracksSetOnDriver == 8)
-			Pokey_PutByte(0x1F, g_atarimem[0xd21F]);
-		break;
+		m_pokey[chip].QueueWrite(cycle, POKEY_SKCTL, memory[base + POKEY_SKCTL]);
 	}
 }
 
-//TODO: Add a method for letting the user chose which plugin they would like to use instead of the current default/fallback setup
-int CXPokey::InitPokeyDll()
+/// <summary>
+/// Run the POKEY emulation for an exact number of cycles, and write the resulting 16-bit signed stereo samples.
+/// In Mono, the same POKEY output is written to both the left and right channels.
+/// With more POKEY, the 1st and 3rd ones are mixed to the left channel, the 2nd and 4th ones to the right channel.
+/// </summary>
+/// <param name="buffer">Output buffer, in the m_SoundFormat format</param>
+/// <param name="cycles">Number of machine cycles to run</param>
+/// <returns>Number of bytes written to the buffer</returns>
+int CXPokey::RenderPokey(BYTE* buffer, int cycles)
 {
-	// apokeysnd.dll is first loaded, will be used in priority if it is found
-	if (m_pokey_dll = LoadLibrary("apokeysnd.dll"))
-	{
-		CString warningMessage = "";
+	if (!m_soundDriverId)
+		return 0;
 
-		APokeySound_Initialize = (APokeySound_Initialize_PROC)GetProcAddress(m_pokey_dll, "APokeySound_Initialize");
-		if (!APokeySound_Initialize) warningMessage += "APokeySound_Initialize\n";
+	auto renderStart = std::chrono::steady_clock::now();
 
-		APokeySound_PutByte = (APokeySound_PutByte_PROC)GetProcAddress(m_pokey_dll, "APokeySound_PutByte");
-		if (!APokeySound_PutByte) warningMessage += "APokeySound_PutByte\n";
+	// The POKEY do not share anything until they are mixed, so they are all rendered at the same time
+	m_workers.Run(m_chipCount, [this, cycles](int chip) { RenderSoundchip(chip, cycles); });
 
-		APokeySound_GetRandom = (APokeySound_GetRandom_PROC)GetProcAddress(m_pokey_dll, "APokeySound_GetRandom");
-		if (!APokeySound_GetRandom) warningMessage += "APokeySound_GetRandom\n";
+	// Every POKEY runs from the same clock, so they always produce the same number of samples
+	int samples = m_chipSamples[0];
+	int16_t* output = (int16_t*)buffer;
 
-		APokeySound_Generate = (APokeySound_Generate_PROC)GetProcAddress(m_pokey_dll, "APokeySound_Generate");
-		if (!APokeySound_Generate) warningMessage += "APokeySound_Generate\n";
+	if (m_chipCount == 1)
+	{
+		for (int i = 0; i < samples; i++)
+			output[i * CHANNELS + 0] = output[i * CHANNELS + 1] = m_RenderBuffer[0][i];
+	}
+	else
+	{
+		for (int i = 0; i < samples; i++)
+		{
+			int left = 0, right = 0;
 
-		APokeySound_About = (APokeySound_About_PROC)GetProcAddress(m_pokey_dll, "APokeySound_About");
-		if (!APokeySound_About) warningMessage += "APokeySound_About\n";
+			for (int chip = 0; chip < m_chipCount; chip++)
+			{
+				if (chip & 1)
+					right += m_RenderBuffer[chip][i];
+				else
+					left += m_RenderBuffer[chip][i];
+			}
 
-		// Get "About" data from apokeysnd driver, then finalise the inisialisation
-		if (warningMessage.IsEmpty())
-		{
-			const char* name, * author, * description;
-			APokeySound_About(&name, &author, &description);
-			g_aboutpokey.Format("%s\n%s\n%s", name, author, description);
-			APokeySound_Initialize(g_tracks4_8 == 8);	// STEREO enabled
-			return SOUND_DRIVER_APOKEYSND;
+			output[i * CHANNELS + 0] = (int16_t)(left > 32767 ? 32767 : left < -32768 ? -32768 : left);
+			output[i * CHANNELS + 1] = (int16_t)(right > 32767 ? 32767 : right < -32768 ? -32768 : right);
 		}
-
-		// If an error is caught, the plugin will be unloaded with an error message showing the problematic procedures
-		MessageBox(g_hwnd, "Error:\nNo compatible 'apokeysnd.dll',\ntherefore the Pokey sound can't be performed.\nIncompatibility with:" + warningMessage, "Pokey library error", MB_ICONEXCLAMATION);
-		FreeLibrary(m_pokey_dll);
 	}
 
-	// sa_pokey.dll will be loaded next if apokeysnd.dll was not found or had an error, as a fallback
-	if (m_pokey_dll = LoadLibrary("sa_pokey.dll"))
+	// Measure the rendering throughput, this is displayed with the debug infos
+	double renderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+	m_renderWallTime += renderTime;
+	m_frameRenderTime += renderTime;
+	m_renderedTime += (double)samples / OUTPUTFREQ;
+
+	if (m_renderedTime >= 1.0)
 	{
-		CString warningMessage = "";
+		m_renderSpeed = m_renderedTime / m_renderWallTime;
+		m_renderedTime = 0;
+		m_renderWallTime = 0;
+	}
 
-		Pokey_Initialise = (Pokey_Initialise_PROC)GetProcAddress(m_pokey_dll, "Pokey_Initialise");
-		if (!Pokey_Initialise) warningMessage += "Pokey_Initialise\n";
+	return samples * BLOCK_ALIGN;
+}
 
-		Pokey_SoundInit = (Pokey_SoundInit_PROC)GetProcAddress(m_pokey_dll, "Pokey_SoundInit");
-		if (!Pokey_SoundInit) warningMessage += "Pokey_SoundInit\n";
+/// <summary>
+/// Run a single POKEY for an exact number of cycles, into its own render buffer.
+/// This is called from the worker threads, it must only touch what belongs to that POKEY.
+/// </summary>
+/// <param name="chip">POKEY index, 0-3</param>
+/// <param name="cycles">Number of machine cycles to run</param>
+void CXPokey::RenderSoundchip(int chip, int cycles)
+{
+	auto renderStart = std::chrono::steady_clock::now();
 
-		Pokey_Process = (Pokey_Process_PROC)GetProcAddress(m_pokey_dll, "Pokey_Process");
-		if (!Pokey_Process) warningMessage += "Pokey_Process\n";
+	m_pokey[chip].Run(cycles);
+	int samples = m_pokey[chip].GetSamplesAvailable();
+	m_pokey[chip].ReadSamples(m_RenderBuffer[chip], samples);
 
-		Pokey_GetByte = (Pokey_GetByte_PROC)GetProcAddress(m_pokey_dll, "Pokey_GetByte");
-		if (!Pokey_GetByte) warningMessage += "Pokey_GetByte\n";
+	// The stems come from the same run, they are simply read back alongside the mix
+	if (m_isStems)
+	{
+		for (int i = 0; i < POKEY_CHANNELS; i++)
+			m_pokey[chip].ReadStemSamples(i, m_StemBuffer[chip * POKEY_CHANNELS + i], samples);
+	}
 
-		Pokey_PutByte = (Pokey_PutByte_PROC)GetProcAddress(m_pokey_dll, "Pokey_PutByte");
-		if (!Pokey_PutByte) warningMessage += "Pokey_PutByte\n";
+	m_chipSamples[chip] = samples;
+	m_chipRenderTime[chip] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+}
 
-		Pokey_About = (Pokey_About_PROC)GetProcAddress(m_pokey_dll, "Pokey_About");
-		if (!Pokey_About) warningMessage += "Pokey_About\n";
+/// <summary>
+/// Render every channel on its own as well, in the same pass as the mix.
+/// After each RenderSoundV2 call, GetStemBuffer holds 1 mono stem per channel, as many samples as the mix.
+/// </summary>
+/// <param name="isStems">true to render the stems, false to only render the mix</param>
+void CXPokey::SetStems(bool isStems)
+{
+	m_isStems = isStems;
 
-		// Get "About" data from sa_pokey driver, then finalise the inisialisation
-		if (warningMessage.IsEmpty())
-		{
-			char* name, * author, * description;
-			Pokey_About(&name, &author, &description);
-			g_aboutpokey.Format("%s\n%s\n%s", name, author, description);
-			Pokey_Initialise(0, 0);
-
-			// Specify the machine region and if it uses Stereo or Mono, as well as the frequency for the sound output
-			Pokey_SoundInit(FREQ_17, OUTPUTFREQ, (g_tracks4_8 == 8) + 1);
-			return SOUND_DRIVER_SA_POKEY;
-		}
+	for (int i = 0; i < POKEY_CHIP_COUNT; i++)
+		m_pokey[i].SetStems(isStems);
+}
+
+/// <summary>
+/// Get the number of stems rendered with the mix, 4 for each POKEY, or 0 when the stems are disabled.
+/// </summary>
+int CXPokey::GetStemCount()
+{
+	if (!m_isStems)
+		return 0;
+
+	return m_chipCount * POKEY_CHANNELS;
+}
+
+/// <summary>
+/// Reset the built-in POKEY emulation to the current Machine Region and number of channels.
+/// Every 4 channels of the module use 1 more POKEY, up to POKEY_CHIP_COUNT.
+/// </summary>
+/// <returns>The m_soundDriverId value</returns>
+int CXPokey::InitPokeyEmulation()
+{
+	m_chipCount = numTracksSetOnDriver / POKEY_CHANNELS;
+	m_chipCount = (m_chipCount < 1) ? 1 : (m_chipCount > POKEY_CHIP_COUNT) ? POKEY_CHIP_COUNT : m_chipCount;
 
-		// If an error is caught, the plugin will be unloaded with an error message showing the problematic procedures
-		MessageBox(g_hwnd, "Error:\nNo compatible 'sa_pokey.dll',\ntherefore the Pokey sound can't be performed.\nIncompatibility with:" + warningMessage, "Pokey library error", MB_ICONEXCLAMATION);
-		FreeLibrary(m_pokey_dll);
+	for (int i = 0; i < POKEY_CHIP_COUNT; i++)
+	{
+		m_pokey[i].SetClock(FREQ_17, OUTPUTFREQ);
+		m_pokey[i].Reset();
+		m_chipRenderTime[i] = 0;
 	}
 
-	// If no POKEY emulation plugin was found, no sound emulation will be output
-	MessageBox(g_hwnd, "Warning:\nNone of 'apokeysnd.dll' or 'sa_pokey.dll' found,\ntherefore the Pokey sound can't be performed.", "LoadLibrary error", MB_ICONEXCLAMATION);
-	return SOUND_DRIVER_NONE;
+	// The 1st POKEY is always rendered by the player thread itself
+	m_workers.Start(POKEY_CHIP_COUNT - 1);
+
+	m_frameCycles.SetTiming(FREQ_17, FRAMERATE);
+
+	g_aboutpokey = "Built-in POKEY sound emulation\nPolynomial counters, AUDCTL clocks, 16-bit, High Pass Filters and Two-Tone";
+	return SOUND_DRIVER_NATIVE;
 }
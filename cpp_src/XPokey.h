@@ -11,19 +11,35 @@
 #pragma once
 #endif // _MSC_VER > 1000
 
+#include <atomic>
+#include <thread>
+
+#include "PokeyEmu.h"
+#include "AudioRingBuffer.h"
+#include "DirectSoundSink.h"
+#include "PlaybackClock.h"
+#include "WorkerPool.h"
+#include "LatencyController.h"
+
 #define CHANNELS		2
-#define BITRESOLUTION	8
-#define OUTPUTFREQ		44100		//22050		//44100
-#define BUFFER_SIZE		0x8000		//must be a power of 2
+#define BITRESOLUTION	16
+#define OUTPUTFREQ		44100		//44100, 48000 or 96000, the POKEY output is resampled to any rate
+#define BUFFER_SIZE		0x10000		//must be a power of 2
+#define BLOCK_ALIGN		(BITRESOLUTION / 8 * CHANNELS)
 #define FRAMERATE		((g_ntsc) ? 60 : 50)
 #define CHUNK_SIZE		(BITRESOLUTION / 8 * CHANNELS * OUTPUTFREQ / FRAMERATE)
-#define LATENCY			3			//3/50sec
+#define LATENCY			3			//3/50sec, initial value only, the latency then adapts to what the machine can sustain
 #define LATENCY_SIZE	(LATENCY * CHUNK_SIZE)
+#define LATENCY_MIN		(OUTPUTFREQ / 100)				//10ms, in samples
+#define LATENCY_MAX		(BUFFER_SIZE / BLOCK_ALIGN / 4)	//in samples, a quarter of the DirectSound buffer
 #define FREQ_17_NTSC	1789773		//The true clock frequency for the NTSC Atari 8-bit computer is 1.7897725 MHz
 #define FREQ_17_PAL		1773447		//The true clock frequency for the PAL Atari 8-bit computer is 1.7734470 MHz
 #define FREQ_17			(g_ntsc ? FREQ_17_NTSC : FREQ_17_PAL)
 #define CYCLESPERSCREEN	(FREQ_17 / FRAMERATE)
-#define CYCLESPERSAMPLE	(FREQ_17 / 44100)
+#define POKEY_CHIP_COUNT	4			// Up to 4 POKEY soundchips, as many as POKEY_SOUNDCHIP_COUNT in ModuleV2.h, 1 for every 4 channels of the active subtune
+
+class CAtariEmulation;
+struct TPokeyFrame;
 
 class CXPokey
 {
@@ -36,27 +52,64 @@ public:
 	BOOL ReInitSound();
 	BOOL RenderSound1_50(int instrspeed);
 	void RenderSoundV2(int instrspeed, BYTE* buffer, int& length);
-	void RenderSound_No6502(int instrspeed);
-	void MemToPokey();
+	void RenderSound_No6502(int instrspeed, const TPokeyFrame* frames = NULL);
+	void MemToPokey(int cycle = 0);
+	void SetEmulation(CAtariEmulation* atari) { m_atari = atari; };
+	void SetSink(CAudioSink* sink);
+	bool IsFrameNeeded();
 	bool IsSoundDriverLoaded() { return m_soundDriverId; }
 	WAVEFORMATEX* GetSoundFormat() { return &m_SoundFormat; };
+	double GetRenderSpeed() { return m_renderSpeed; };
+	double GetRenderTime() { return m_renderTime; };
+	int GetUnderrunCount();
+	int GetOverrunCount() { return m_overrunCount; };
+	int GetLatency() { return m_latency.GetLatency(); };
+	void SetStems(bool isStems);
+	int GetStemCount();
+	int16_t* GetStemBuffer(int channel) { return m_StemBuffer[channel]; };
+	int GetSoundchipCount() { return m_chipCount; };
+	double GetSoundchipRenderTime(int chip) { return m_chipRenderTime[chip]; };
 
 private:
 	int volatile		m_soundDriverId;
-	HINSTANCE			m_pokey_dll;
-	DWORD				m_LoadPos;
+	CAtariEmulation*	m_atari;			// Emulation context running the driver, g_atari unless another one is set
+	CPokeyEmu			m_pokey[POKEY_CHIP_COUNT];
+	int					m_chipCount;		// POKEY soundchips in use, 1 for every 4 channels
+	CFrameCycles		m_frameCycles;
 	WAVEFORMATEX		m_SoundFormat;
-	DWORD				m_LoadSize;
-	DSBUFFERDESC        dsbdesc;
-	LPDIRECTSOUNDBUFFER m_SoundBuffer;
-	DWORD				dwSize1, dwSize2;
-	LPVOID				Data1, Data2;
-	BYTE				m_PlayBuffer[BUFFER_SIZE];	// Rendered part of the swing CHUNK_SIZE +- something (but it can be much bigger)
-	DWORD				m_PlayCursor;  
-	DWORD				m_WriteCursor;
-	DWORD				m_WriteCursorStart;
-
-	int InitPokeyDll();	// The function will return the m_soundDriverId value
+	BYTE				m_PlayBuffer[BUFFER_SIZE];	// Rendered frame, before it is handed over to the ring buffer
+	int16_t				m_RenderBuffer[POKEY_CHIP_COUNT][BUFFER_SIZE / BLOCK_ALIGN];	// Output of each POKEY, before it is mixed into m_SoundFormat
+	int16_t				m_StemBuffer[POKEY_CHIP_COUNT * POKEY_CHANNELS][BUFFER_SIZE / BLOCK_ALIGN];	// Output of each channel, when the stems are rendered
+	bool				m_isStems;
+
+	// The player thread renders frames into the ring buffer, and the sink drains it on its own schedule
+	CAudioRingBuffer	m_ring;
+	CDirectSoundSink	m_directSound;
+	CAudioSink*			m_sink;
+	std::thread			m_sinkThread;
+	std::atomic<bool>	m_isSinkRunning;
+
+	// Output latency in samples, raised after underruns and slowly lowered while the output is stable
+	CLatencyController	m_latency;
+	int					m_overrunCount;		// Frames that did not fit in the ring buffer, and were partly dropped
+
+	// Rendered seconds per wall-clock second, measured over about 1 second of rendered sound
+	double				m_renderSpeed;
+	double				m_renderedTime;
+	double				m_renderWallTime;
+	double				m_renderTime;		// Time spent rendering the last frame, in milliseconds
+	double				m_frameRenderTime;
+
+	// Every POKEY is rendered on its own worker thread, then they are mixed together
+	CWorkerPool			m_workers;
+	int					m_chipSamples[POKEY_CHIP_COUNT];
+	double				m_chipRenderTime[POKEY_CHIP_COUNT];	// Time spent rendering the last block, in milliseconds
+
+	int InitPokeyEmulation();	// The function will return the m_soundDriverId value
+	int RenderPokey(BYTE* buffer, int cycles);
+	void RenderSoundchip(int chip, int cycles);
+	void SubmitFrame(int size);
+	void SinkThread();
 };
 
 #endif
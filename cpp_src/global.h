@@ -34,7 +34,6 @@ extern int g_baseOctave;
 extern HWND g_hwnd;
 extern HWND g_viewhwnd;
 
-extern HINSTANCE g_c6502_dll;
 extern BOOL volatile g_is6502;
 extern CString g_aboutpokey;
 extern CString g_about6502;
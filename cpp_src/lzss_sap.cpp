@@ -11,7 +11,11 @@
  * C++ port for Raster Music Tracker by VinsCool, 2022
  */
 
+#include <algorithm>
+#include <climits>
+
 #include "lzss_sap.h"
+#include "IOHelpers.h"
 
 CCompressLzss::CCompressLzss()
 {
@@ -22,25 +26,24 @@ CCompressLzss::CCompressLzss()
     fmt_pos_start_zero = 0;
     stat_len = NULL;
     stat_off = NULL;
+    m_isReference = false;
+    m_isCaching = false;
+    memset(m_streamOptimisations, 0, sizeof(m_streamOptimisations));
 }
 
  ///////////////////////////////////////////////////////
  // Bit encoding functions
 void CCompressLzss::init(struct bf* x)
 {
-    x->total = 0;
-    x->len = 0;
+    x->start = (int)x->out->size();
     x->bnum = 0;
     x->bpos = -1;
     x->hpos = -1;
 }
 
+// The bytes are already in the output, only the bit and half-byte holders are closed
 void CCompressLzss::bflush(struct bf* x)
 {
-    if (x->len)
-        memcpy(x->out + x->total, x->buf, x->len);
-    x->total += x->len;
-    x->len = 0;
     x->bnum = 0;
     x->bpos = -1;
     x->hpos = -1;
@@ -51,13 +54,12 @@ void CCompressLzss::add_bit(struct bf* x, int bit)
     if (x->bpos < 0)
     {
         // Adds a new byte holding bits
-        x->bpos = x->len;
+        x->bpos = (int)x->out->size();
         x->bnum = 0;
-        x->len++;
-        x->buf[x->bpos] = 0;
+        x->out->push_back(0);
     }
     if (bit)
-        x->buf[x->bpos] |= 1 << x->bnum;
+        (*x->out)[x->bpos] |= 1 << x->bnum;
     x->bnum++;
     if (x->bnum == 8)
     {
@@ -68,8 +70,7 @@ void CCompressLzss::add_bit(struct bf* x, int bit)
 
 void CCompressLzss::add_byte(struct bf* x, int byte)
 {
-    x->buf[x->len] = byte;
-    x->len++;
+    x->out->push_back(byte);
 }
 
 void CCompressLzss::add_hbyte(struct bf* x, int hbyte)
@@ -77,14 +78,13 @@ void CCompressLzss::add_hbyte(struct bf* x, int hbyte)
     if (x->hpos < 0)
     {
         // Adds a new byte holding half-bytes
-        x->hpos = x->len;
-        x->len++;
-        x->buf[x->hpos] = hbyte & 0x0F;
+        x->hpos = (int)x->out->size();
+        x->out->push_back(hbyte & 0x0F);
     }
     else
     {
         // Fixes last h-byte
-        x->buf[x->hpos] |= hbyte << 4;
+        (*x->out)[x->hpos] |= hbyte << 4;
         x->hpos = -1;
     }
 }
@@ -104,10 +104,10 @@ int CCompressLzss::get_mlen(const uint8_t* a, const uint8_t* b, int max)
     return max;
 }
 
+// Key of the 2 bytes at p, positions sharing it are linked in the same hash chain
 int CCompressLzss::hsh(const uint8_t* p)
 {
-    size_t x = (size_t)p;
-    return 0xFF & (x ^ (x >> 8) ^ (x >> 16) ^ (x >> 24));
+    return p[0] | (p[1] << 8);
 }
 
 void CCompressLzss::lzop_init(struct lzop* lz, const uint8_t* data, int size)
@@ -118,6 +118,32 @@ void CCompressLzss::lzop_init(struct lzop* lz, const uint8_t* data, int size)
     lz->bits = (int*)calloc(sizeof(int), size);
     lz->mlen = (int*)calloc(sizeof(int), size);
     lz->mpos = (int*)calloc(sizeof(int), size);
+    lz->chain = (int*)calloc(sizeof(int), size);
+    lz->chain1 = (int*)calloc(sizeof(int), size);
+    lz->window = (int*)calloc(sizeof(int), max_off);
+
+    // Link every position to the previous one starting with the same 2 bytes, and with the same byte
+    int* head = (int*)malloc(sizeof(int) * 0x10000);
+    int head1[0x100];
+    memset(head, -1, sizeof(int) * 0x10000);
+    memset(head1, -1, sizeof(head1));
+
+    for (int i = 0; i < size; i++)
+    {
+        lz->chain1[i] = head1[data[i]];
+        head1[data[i]] = i;
+
+        if (i < size - 1)
+        {
+            int key = hsh(data + i);
+            lz->chain[i] = head[key];
+            head[key] = i;
+        }
+        else
+            lz->chain[i] = -1;
+    }
+
+    free(head);
 }
 
 void CCompressLzss::lzop_free(struct lzop* lz)
@@ -125,10 +151,66 @@ void CCompressLzss::lzop_free(struct lzop* lz)
     free(lz->bits);
     free(lz->mlen);
     free(lz->mpos);
+    free(lz->chain);
+    free(lz->chain1);
+    free(lz->window);
 }
 
 // Returns maximal match length (and match position) at pos.
-int CCompressLzss::match(const uint8_t* data, int pos, int size, int* mpos)
+// Only the earlier positions starting with the same bytes are compared, from the oldest one in range,
+// so the match found is the same as comparing every position: the longest, and the farthest of them.
+int CCompressLzss::match(const struct lzop* lz, int pos, int size, int* mpos)
+{
+    const uint8_t* data = lz->data;
+    int mxlen = -maximum(-max_mlen, pos - size);
+    int first = maximum(pos - max_off, 0);
+    int mlen = 0;
+
+    if (mxlen >= 2)
+    {
+        // The chain goes backwards, the positions in range are gathered to be compared in order
+        int count = 0;
+        for (int i = lz->chain[pos]; i >= first; i = lz->chain[i])
+            lz->window[count++] = i;
+
+        while (count--)
+        {
+            int i = lz->window[count];
+
+            // A position can only be longer than the best match if it also matches the byte after it
+            if (mlen && data[i + mlen] != data[pos + mlen])
+                continue;
+
+            int ml = get_mlen(data + pos + 2, data + i + 2, mxlen - 2) + 2;
+            if (ml > mlen)
+            {
+                mlen = ml;
+                *mpos = pos - i;
+                if (ml == mxlen)
+                    break;
+            }
+        }
+    }
+
+    // Without 2 bytes in common, the oldest position with the same byte is a match of 1
+    if (!mlen && mxlen >= 1)
+    {
+        int oldest = -1;
+        for (int i = lz->chain1[pos]; i >= first; i = lz->chain1[i])
+            oldest = i;
+
+        if (oldest >= 0)
+        {
+            mlen = 1;
+            *mpos = pos - oldest;
+        }
+    }
+
+    return mlen;
+}
+
+// Returns maximal match length (and match position) at pos, comparing every position of the window, as the original compressor did.
+int CCompressLzss::match_window(const uint8_t* data, int pos, int size, int* mpos)
 {
     int mxlen = -maximum(-max_mlen, pos - size);
     int mlen = 0;
@@ -169,7 +251,7 @@ void CCompressLzss::lzop_backfill(struct lzop* lz, int last_literal)
     {
         // Get best match at this position
         int mp = 0;
-        int ml = match(lz->data, pos, lz->size, &mp);
+        int ml = m_isReference ? match_window(lz->data, pos, lz->size, &mp) : match(lz, pos, lz->size, &mp);
 
         // Init "no-match" case
         int best = lz->bits[pos + 1] + bits_literal;
@@ -348,16 +430,364 @@ void CCompressLzss::Optimise_AUDF(uint8_t* buf)
     }
 }
 
-// Hacked up version of main() by VinsCool, stripping out most options that aren't needed for RMT 
-int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst, int optimisations)
+// Apply the desired optimisations to a row of 9 bytes
+void CCompressLzss::Optimise(uint8_t* buf, int optimisations)
+{
+    switch (optimisations)
+    {
+    case SAPR_OPTIMISATIONS_AUDC:
+        Optimise_AUDC(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_AUDCTL:
+        Optimise_AUDCTL(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_AUDF:
+        Optimise_AUDF(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_AUDC_AUDF:
+        Optimise_AUDC(buf);
+        Optimise_AUDF(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_AUDCTL_AUDC:
+        Optimise_AUDC(buf);
+        Optimise_AUDCTL(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_AUDCTL_AUDF:
+        Optimise_AUDCTL(buf);
+        Optimise_AUDF(buf);
+        break;
+
+    case SAPR_OPTIMISATIONS_ALL:
+        Optimise_AUDC(buf);
+        Optimise_AUDCTL(buf);
+        Optimise_AUDF(buf);
+        break;
+    }
+}
+
+// Compress SAP-R frames held in memory, as a contiguous buffer of 9 bytes rows
+// The compressed data is appended to dst, and its size is returned
+int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, std::vector<unsigned char>& dst, int optimisations)
+{
+    uint8_t* data[9];
+    int rows = srclen / 9;
+
+    for (int i = 0; i < 9; i++)
+        m_streamOptimisations[i] = optimisations;
+
+    // Each buffer holds 1 byte of every row
+    AllocStreams(data, rows);
+
+    // Read all data
+    int sz = 0;
+    int mem = 0;
+
+    // Buffered bytes are loaded from source memory pointer
+    for (sz = 0; sz < rows; sz++)
+    {
+        // SAP-R frames are processed in groups of 9 bytes, in this order: 
+        // AUDF0, AUDC0, AUDF1, AUDC1, AUDF2, AUDC2, AUDF3, AUDC3, AUDCTL
+        uint8_t buf[9];
+        for (int i = 0; i < 9; i++) { buf[i] = src[mem + i]; }
+
+        // Write the processed bytes once the optimisations were applied to them
+        Optimise(buf, optimisations);
+        for (int i = 0; i < 9; i++) { data[i][sz] = buf[i]; }
+
+        // Adjust the offset for the next buffer chunk
+        mem += 9;
+    }
+
+    int total = Compress(data, sz, dst);
+
+    FreeStreams(data);
+
+    return total;
+}
+
+// Compress SAP-R frames straight from a recorded stream, decoded one after the other
+// The compressed data is appended to dst, and its size is returned
+int CCompressLzss::LZSS_SAP(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst, int optimisations)
+{
+    if (optimisations == SAPR_OPTIMISATIONS_PER_STREAM)
+        return CompressPerStream(pStream, firstFrame, frameCount, dst);
+
+    uint8_t* data[9];
+
+    for (int i = 0; i < 9; i++)
+        m_streamOptimisations[i] = optimisations;
+
+    AllocStreams(data, GetRowCount(pStream, frameCount));
+
+    int sz = ReadStreams(pStream, firstFrame, frameCount, optimisations, data);
+    int total = Compress(data, sz, dst);
+
+    FreeStreams(data);
+
+    return total;
+}
+
+// Compress the frames in chunks of chunkFrames, each one a complete LZSS stream appended to dst, so the memory needed stays the same for songs of any length
+// The offset of every chunk in dst is added to restartPoints, a player can start decoding from any of them, and the size of all the chunks is returned
+// Each chunk uses the optimisation pattern given by pickPattern if there is one, else all of them use optimisations
+// pickPattern may also stop the compression, when the chunks already compressed are enough to tell the output is too large for its use
+int CCompressLzss::LZSS_SAP_Chunks(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst, std::vector<int>& restartPoints, int optimisations, TLzssChunkPattern pickPattern, void* pContext, int chunkFrames)
+{
+    int total = 0;
+
+    for (int frame = 0; frame < frameCount; frame += chunkFrames)
+    {
+        int count = min(chunkFrames, frameCount - frame);
+        int chunkOptimisations = pickPattern ? pickPattern(this, pStream, firstFrame + frame, count, pContext) : optimisations;
+
+        if (chunkOptimisations < 0)
+            break;
+
+        restartPoints.push_back((int)dst.size());
+        total += LZSS_SAP(pStream, firstFrame + frame, count, dst, chunkOptimisations);
+
+        // The streams of a chunk are not found again in the next ones, only 1 chunk is kept parsed at once
+        m_parseCache.clear();
+    }
+
+    return total;
+}
+
+// Rows of 9 bytes in frameCount frames, Stereo frames hold 2 rows
+int CCompressLzss::GetRowCount(CPokeyStream* pStream, int frameCount)
+{
+    return maximum(frameCount, 0) * (pStream->GetFrameSize() / 9);
+}
+
+// Allocate the 9 streams for the given number of rows, at least 1 byte is allocated since the first byte of each stream is always read
+void CCompressLzss::AllocStreams(uint8_t** data, int rows)
+{
+    for (int i = 0; i < 9; i++)
+        data[i] = (uint8_t*)calloc(maximum(rows, 1), 1);
+}
+
+void CCompressLzss::FreeStreams(uint8_t** data)
+{
+    for (int i = 0; i < 9; i++)
+        free(data[i]);
+}
+
+// Read the 9 streams from a recorded stream, with the optimisations applied, and return the number of rows read
+// Stereo frames are compressed as 2 rows of 9 bytes, the second POKEY first, like they are laid out in a SAP-R file
+int CCompressLzss::ReadStreams(CPokeyStream* pStream, int firstFrame, int frameCount, int optimisations, uint8_t** data)
+{
+    TStreamCursor cursor;
+    const unsigned char* registers;
+    int rowCount = pStream->GetFrameSize() / 9;
+
+    int sz = 0;
+    pStream->SeekFrame(&cursor, firstFrame);
+
+    for (int frame = 0; frame < frameCount && (registers = pStream->ReadFrame(&cursor)); frame++)
+    {
+        for (int row = 0; row < rowCount; row++, sz++)
+        {
+            uint8_t buf[9];
+            memcpy(buf, registers + row * 9, 9);
+
+            Optimise(buf, optimisations);
+            for (int i = 0; i < 9; i++) { data[i][sz] = buf[i]; }
+        }
+    }
+
+    return sz;
+}
+
+// Keep the optimal parsing of every stream compressed, so compressing the same stream again only needs to encode it
+// Disabling the cache frees everything it holds
+void CCompressLzss::SetParseCache(bool isEnabled)
+{
+    m_isCaching = isEnabled && !m_isReference;
+
+    if (!m_isCaching)
+        m_parseCache.clear();
+}
+
+// Compress as the original compressor did: every position of the window is compared to find the matches,
+// the 9 streams are parsed one after the other, and nothing is cached, the output must be the same either way
+// SAPR_OPTIMISATIONS_PER_STREAM, which the original compressor did not have, still compares the streams through the cache
+void CCompressLzss::SetReference(bool isEnabled)
+{
+    m_isReference = isEnabled;
+
+    if (isEnabled)
+        SetParseCache(false);
+}
+
+// Parse every distinct stream produced by the optimisation patterns, all at once, into the cache
+// Each pattern only changes some of the streams, the others are the same for several patterns and are only parsed once
+void CCompressLzss::ParseOptimisations(CPokeyStream* pStream, int firstFrame, int frameCount)
+{
+    if (!m_isCaching || !InitFormat())
+        return;
+
+    uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9];
+    int sz = ReadOptimisations(pStream, firstFrame, frameCount, data);
+
+    ParseStreams(data, sz);
+    FreeOptimisations(data);
+}
+
+// Compress every stream with the optimisation pattern giving it the fewest bits, each stream being chosen on its own
+// The optimisations only change registers which cannot be heard, so the streams may come from different patterns
+int CCompressLzss::CompressPerStream(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst)
+{
+    bool isCaching = m_isCaching;
+
+    if (!InitFormat())
+        return 0;
+
+    // The streams are parsed to be compared, the one chosen is then encoded from the cache
+    m_isCaching = true;
+
+    uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9];
+    uint8_t* best[9];
+    int sz = ReadOptimisations(pStream, firstFrame, frameCount, data);
+
+    ParseStreams(data, sz);
+
+    for (int i = 0; i < 9; i++)
+    {
+        int bestBits = INT_MAX;
+
+        // If several patterns give the same number of bits, the first one is used
+        for (int opt = 0; opt < SAPR_OPTIMISATIONS_COUNT; opt++)
+        {
+            int bits = GetStreamBits(data[opt][i], sz, i);
+
+            if (bits < bestBits)
+            {
+                bestBits = bits;
+                m_streamOptimisations[i] = opt;
+            }
+        }
+
+        best[i] = data[m_streamOptimisations[i]][i];
+    }
+
+    int total = Compress(best, sz, dst);
+
+    FreeOptimisations(data);
+
+    if (!isCaching)
+        SetParseCache(false);
+
+    return total;
+}
+
+// Read the streams of every optimisation pattern, and return the number of rows read
+int CCompressLzss::ReadOptimisations(CPokeyStream* pStream, int firstFrame, int frameCount, uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9])
+{
+    int sz = 0;
+
+    for (int opt = 0; opt < SAPR_OPTIMISATIONS_COUNT; opt++)
+    {
+        AllocStreams(data[opt], GetRowCount(pStream, frameCount));
+        sz = ReadStreams(pStream, firstFrame, frameCount, opt, data[opt]);
+    }
+
+    return sz;
+}
+
+void CCompressLzss::FreeOptimisations(uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9])
+{
+    for (int opt = 0; opt < SAPR_OPTIMISATIONS_COUNT; opt++)
+        FreeStreams(data[opt]);
+}
+
+// Parse the distinct streams of every optimisation pattern which are not in the cache yet, all at once on the workers
+void CCompressLzss::ParseStreams(uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9], int sz)
+{
+    std::vector<const uint8_t*> streams;
+    std::vector<UINT64> keys;
+
+    for (int opt = 0; opt < SAPR_OPTIMISATIONS_COUNT; opt++)
+    {
+        for (int i = 0; i < 9 && sz; i++)
+        {
+            if (IsStreamSkipped(data[opt][i], sz, i))
+                continue;
+
+            UINT64 key = GetStreamKey(data[opt][i], sz);
+
+            if (m_parseCache.count(key) || std::find(keys.begin(), keys.end(), key) != keys.end())
+                continue;
+
+            streams.push_back(data[opt][i]);
+            keys.push_back(key);
+        }
+    }
+
+    std::vector<struct lzparse> parses(streams.size());
+    StartWorkers();
+    m_workers.Run((int)streams.size(), [&](int j)
+    {
+        struct lzop lz;
+        lzop_init(&lz, streams[j], sz);
+        lzop_backfill(&lz, 0);
+        parses[j].bits.assign(lz.bits, lz.bits + sz);
+        parses[j].mlen.assign(lz.mlen, lz.mlen + sz);
+        parses[j].mpos.assign(lz.mpos, lz.mpos + sz);
+        lzop_free(&lz);
+    });
+
+    for (size_t j = 0; j < keys.size(); j++)
+        m_parseCache[keys[j]] = std::move(parses[j]);
+}
+
+// Streams with a single value are skipped, except for the first one, see Compress
+bool CCompressLzss::IsStreamSkipped(const uint8_t* data, int sz, int stream)
+{
+    if (stream == 0)
+        return false;
+
+    for (int j = 1; j < sz; j++)
+    {
+        if (data[j] != data[0])
+            return false;
+    }
+
+    return true;
+}
+
+// Bits needed to encode a stream parsed in the cache, a skipped stream needs none
+int CCompressLzss::GetStreamBits(const uint8_t* data, int sz, int stream)
+{
+    if (!sz || IsStreamSkipped(data, sz, stream))
+        return 0;
+
+    auto parse = m_parseCache.find(GetStreamKey(data, sz));
+    return (parse != m_parseCache.end()) ? parse->second.bits[0] : INT_MAX;
+}
+
+// Start the threads parsing the streams, once for all the compressions done
+void CCompressLzss::StartWorkers()
+{
+    int workers = (int)std::thread::hardware_concurrency() - 1;
+    m_workers.Start(maximum(min(workers, LZSS_WORKERS_MAX), 0));
+}
+
+// Identify a stream by its size and content, for the cache
+UINT64 CCompressLzss::GetStreamKey(const uint8_t* data, int sz)
+{
+    return FNV1a(data, sz, FNV1a(&sz, sizeof(sz)));
+}
+
+// Set the match and format parameters, LZ16 always
+bool CCompressLzss::InitFormat()
 {
-    struct bf b;
-    uint8_t buf[9], * data[9];
-    int lpos[9];
-    int show_stats = 2; // Full Verbose for debugging purposes
     int bits_mtotal = bits_moff + bits_mlen;
     int bits_set = 0;
-    int force_last_literal = 1;
     int format_version = 0;  // LZSS format version - 0 means last version
 
     int opt = '6';  //LZ16 always, however this may be changed if needed
@@ -418,78 +848,35 @@ int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst,
         // OK
         break;
     default:
-        return 0;
+        return false;
         break;
     }
 
+    return true;
+
+}
+
+// Hacked up version of main() by VinsCool, stripping out most options that aren't needed for RMT 
+// Each of the 9 streams holds sz bytes, the registers of every row, the compressed data is appended to dst
+int CCompressLzss::Compress(uint8_t** data, int sz, std::vector<unsigned char>& dst)
+{
+    struct bf b;
+    int lpos[9];
+    int show_stats = 2; // Full Verbose for debugging purposes
+    int force_last_literal = 1;
+
+    if (!InitFormat())
+        return 0;
+
     // Alloc statistic arrays
     stat_len = (int*)calloc(sizeof(int), max_mlen + 1);
     stat_off = (int*)calloc(sizeof(int), max_off + 1);
 
-    // Max size of each bufer: 128k
     for (int i = 0; i < 9; i++)
-    {
-        data[i] = (uint8_t*)malloc(128 * 1024);
         lpos[i] = -1;
-    }
-
-    // Read all data
-    int sz = 0;
-    int mem = 0;
-
-    // Buffered bytes are loaded from source memory pointer
-    for (sz = 0; mem < srclen && sz < (128 * 1024); sz++)
-    {
-        // SAP-R frames are processed in groups of 9 bytes, in this order: 
-        // AUDF0, AUDC0, AUDF1, AUDC1, AUDF2, AUDC2, AUDF3, AUDC3, AUDCTL
-        for (int i = 0; i < 9; i++) { buf[i] = src[mem + i]; }
-
-        // Apply desired optimisations to the buffered bytes
-        switch (optimisations)
-        {
-        case SAPR_OPTIMISATIONS_AUDC:
-            Optimise_AUDC(buf);
-            break;
-
-        case SAPR_OPTIMISATIONS_AUDCTL:
-            Optimise_AUDCTL(buf);
-            break;
-
-        case SAPR_OPTIMISATIONS_AUDF:
-            Optimise_AUDF(buf);
-            break;
-
-        case SAPR_OPTIMISATIONS_AUDC_AUDF:
-            Optimise_AUDC(buf);
-            Optimise_AUDF(buf);
-            break;
 
-        case SAPR_OPTIMISATIONS_AUDCTL_AUDC:
-            Optimise_AUDC(buf);
-            Optimise_AUDCTL(buf);
-            break;
-
-        case SAPR_OPTIMISATIONS_AUDCTL_AUDF:
-            Optimise_AUDCTL(buf);
-            Optimise_AUDF(buf);
-            break;
-
-        case SAPR_OPTIMISATIONS_ALL:
-            Optimise_AUDC(buf);
-            Optimise_AUDCTL(buf);
-            Optimise_AUDF(buf);
-            break;
-        }
-
-        // Write the processed bytes once the optimisations were applied to them
-        for (int i = 0; i < 9; i++) { data[i][sz] = buf[i]; }
-
-        // Adjust the offset for the next buffer chunk
-        mem += 9;
-    }
-
-    // Set the output to the destination memory pointer 
-    b.out = dst;
+    // Set the output to the destination buffer, it grows with the compressed data
+    b.out = &dst;
 
     // Check for empty streams and warn
     int chn_skip[9];
@@ -536,13 +923,53 @@ int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst,
     bflush(&b);
 
     // Init LZ states
+    // Each stream is parsed on its own, so they are all parsed at the same time, only the encoding below interleaves them
     struct lzop lz[9];
+    StartWorkers();
+    UINT64 keys[9];
+    bool isCached[9];
+
     for (int i = 0; i < 9; i++)
+    {
+        keys[i] = (m_isCaching && !chn_skip[i]) ? GetStreamKey(data[i], sz) : 0;
+        isCached[i] = m_isCaching && !chn_skip[i] && m_parseCache.count(keys[i]);
+    }
+
+    auto parseStream = [&](int i)
     {
         if (!chn_skip[i])
         {
             lzop_init(&lz[i], data[i], sz);
-            lzop_backfill(&lz[i], 0);
+
+            // A stream parsed before is copied as it was, the result is the same
+            if (isCached[i])
+            {
+                const struct lzparse& parse = m_parseCache.find(keys[i])->second;
+                memcpy(lz[i].bits, parse.bits.data(), sizeof(int) * sz);
+                memcpy(lz[i].mlen, parse.mlen.data(), sizeof(int) * sz);
+                memcpy(lz[i].mpos, parse.mpos.data(), sizeof(int) * sz);
+            }
+            else
+                lzop_backfill(&lz[i], 0);
+        }
+    };
+
+    if (m_isReference)
+    {
+        for (int i = 0; i < 9; i++)
+            parseStream(i);
+    }
+    else
+        m_workers.Run(9, parseStream);
+
+    for (int i = 0; i < 9; i++)
+    {
+        if (m_isCaching && !chn_skip[i] && !isCached[i])
+        {
+            struct lzparse& parse = m_parseCache[keys[i]];
+            parse.bits.assign(lz[i].bits, lz[i].bits + sz);
+            parse.mlen.assign(lz[i].mlen, lz[i].mlen + sz);
+            parse.mpos.assign(lz[i].mpos, lz[i].mpos + sz);
         }
     }
 
@@ -577,11 +1004,12 @@ int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst,
         }
     }
     bflush(&b);
+    int total = (int)dst.size() - b.start;
 
     // Show stats
     fprintf(stderr, "LZSS: max offset= %d,\tmax len= %d,\tmatch bits= %d,\t",
         max_off, max_mlen, bits_match - 1);
-    fprintf(stderr, "ratio: %5d / %d = %5.2f%%\n", b.total, 9 * sz, (100.0 * b.total) / (9.0 * sz));
+    fprintf(stderr, "ratio: %5d / %d = %5.2f%%\n", total, 9 * sz, (100.0 * total) / (9.0 * sz));
     if (show_stats)
     {
         for (int i = 0; i < 9; i++)
@@ -590,7 +1018,7 @@ int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst,
             {
                 fprintf(stderr, " Stream #%d: %d bits,\t%5.2f%%,\t%5.2f%% of output\n", i,
                     lz[i].bits[0], (100.0 * lz[i].bits[0]) / (8.0 * sz),
-                    (100.0 * lz[i].bits[0]) / (8.0 * b.total));
+                    (100.0 * lz[i].bits[0]) / (8.0 * total));
             }
         }
     }
@@ -609,13 +1037,12 @@ int CCompressLzss::LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst,
     // Free memory
     for (int i = 0; i < 9; i++)
     {
-        free(data[i]);
         if (!chn_skip[i])
             lzop_free(&lz[i]);
     }
     free(stat_len);
     free(stat_off);
 
-    // Size of compressed data is returned, for use with the destination memory pointer
-    return b.total;
+    // Size of compressed data is returned, it was appended to the destination buffer
+    return total;
 }
@@ -15,12 +15,25 @@
 
 #include "stdafx.h"
 #include "General.h"
+#include "PokeyStream.h"
+#include "WorkerPool.h"
+#include <unordered_map>
+#include <vector>
 
 #define bits_literal (1+8)                      // Number of bits for encoding a literal
 #define bits_match (1 + bits_moff + bits_mlen)  // Bits for encoding a match
 #define max_mlen (min_mlen + (1<<bits_mlen) -1) // Maximum match length
 #define max_off (1<<bits_moff)                  // Maximum offset
 
+#define LZSS_WORKERS_MAX 8                      // Threads parsing the streams along with the caller, 1 stream each at most
+#define LZSS_CHUNK_FRAMES 0x8000                // Frames compressed at once by LZSS_SAP_Chunks, which bounds the memory needed for songs of any length
+
+class CCompressLzss;
+
+// Pick the optimisation pattern of a chunk, called by LZSS_SAP_Chunks before the chunk is compressed, the parsing cache only holds that chunk
+// A negative value stops the compression before that chunk, the chunks already compressed are kept
+typedef int (*TLzssChunkPattern)(CCompressLzss* pLzss, CPokeyStream* pStream, int firstFrame, int frameCount, void* pContext);
+
  // Struct for LZ optimal parsing
 struct lzop
 {
@@ -29,24 +42,42 @@ struct lzop
     int* bits;                                  // Number of bits needed to code from position
     int* mlen;                                  // Best match length at position (0 == no match);
     int* mpos;                                  // Best match offset at position
+    int* chain;                                 // Previous position starting with the same 2 bytes, -1 if none
+    int* chain1;                                // Previous position starting with the same byte, -1 if none
+    int* window;                                // Positions gathered from a chain, to be compared
+};
+
+// Optimal parsing of a stream, kept to compress the same stream again without parsing it
+struct lzparse
+{
+    std::vector<int> bits;
+    std::vector<int> mlen;
+    std::vector<int> mpos;
 };
 
 struct bf
 {
-    int len;
-    uint8_t buf[128 * 1024];
+    std::vector<unsigned char>* out;            // The compressed bytes are appended to it, the bit and half-byte holders are fixed in place
+    int start;                                  // Size of the output before the compression began
     int bnum;
     int bpos;
     int hpos;
-    int total;
-    unsigned char* out;
 };
 
 class CCompressLzss
 {
 public:
     CCompressLzss();
-    int LZSS_SAP(unsigned char* src, int srclen, unsigned char* dst, int optimisations = SAPR_OPTIMISATIONS_AUDC);
+    int LZSS_SAP(unsigned char* src, int srclen, std::vector<unsigned char>& dst, int optimisations = SAPR_OPTIMISATIONS_AUDC);
+    int LZSS_SAP(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst, int optimisations = SAPR_OPTIMISATIONS_AUDC);
+    int LZSS_SAP_Chunks(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst, std::vector<int>& restartPoints, int optimisations = SAPR_OPTIMISATIONS_AUDC, TLzssChunkPattern pickPattern = NULL, void* pContext = NULL, int chunkFrames = LZSS_CHUNK_FRAMES);
+
+    void SetParseCache(bool isEnabled);
+    void SetReference(bool isEnabled);
+    void ParseOptimisations(CPokeyStream* pStream, int firstFrame, int frameCount);
+
+    // Optimisation pattern used by each stream of the last compression, all the same unless SAPR_OPTIMISATIONS_PER_STREAM was used
+    const int* GetStreamOptimisations() { return m_streamOptimisations; };
 
 private:
     int bits_moff;                              // Number of bits used for OFFSET
@@ -57,6 +88,13 @@ private:
     int* stat_len;                              // Statistics
     int* stat_off;
 
+    CWorkerPool m_workers;                      // Parses the 9 streams in parallel, started by the first compression
+
+    bool m_isReference;                         // Compress as the original compressor did, to check the output against it, see SetReference
+    bool m_isCaching;                           // Streams parsed are kept in m_parseCache
+    std::unordered_map<UINT64, struct lzparse> m_parseCache;    // Parsing of every stream, by GetStreamKey
+    int m_streamOptimisations[9];               // Optimisation pattern used by each stream
+
     void init(struct bf* x);
     void bflush(struct bf* x);
     void add_bit(struct bf* x, int bit);
@@ -67,11 +105,27 @@ private:
     int hsh(const uint8_t* p);
     void lzop_init(struct lzop* lz, const uint8_t* data, int size);
     void lzop_free(struct lzop* lz);
-    int match(const uint8_t* data, int pos, int size, int* mpos);
+    int match(const struct lzop* lz, int pos, int size, int* mpos);
+    int match_window(const uint8_t* data, int pos, int size, int* mpos);
     void lzop_backfill(struct lzop* lz, int last_literal);
     int lzop_last_is_match(const struct lzop* lz);
     int lzop_encode(struct bf* b, const struct lzop* lz, int pos, int lpos);
     void Optimise_AUDC(uint8_t* buf);
     void Optimise_AUDCTL(uint8_t* buf);
     void Optimise_AUDF(uint8_t* buf);
-};
\ No newline at end of file
+    void Optimise(uint8_t* buf, int optimisations);
+    bool InitFormat();
+    void StartWorkers();
+    int GetRowCount(CPokeyStream* pStream, int frameCount);
+    void AllocStreams(uint8_t** data, int rows);
+    void FreeStreams(uint8_t** data);
+    int ReadStreams(CPokeyStream* pStream, int firstFrame, int frameCount, int optimisations, uint8_t** data);
+    UINT64 GetStreamKey(const uint8_t* data, int sz);
+    int Compress(uint8_t** data, int sz, std::vector<unsigned char>& dst);
+    int CompressPerStream(CPokeyStream* pStream, int firstFrame, int frameCount, std::vector<unsigned char>& dst);
+    int ReadOptimisations(CPokeyStream* pStream, int firstFrame, int frameCount, uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9]);
+    void FreeOptimisations(uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9]);
+    void ParseStreams(uint8_t* data[SAPR_OPTIMISATIONS_COUNT][9], int sz);
+    bool IsStreamSkipped(const uint8_t* data, int sz, int stream);
+    int GetStreamBits(const uint8_t* data, int sz, int stream);
+};
\ No newline at end of file